@@ -1,6 +1,10 @@
 
 from typing import Optional
 from typing import Tuple
+from typing import Union
+
+import math
+import time
 
 from fastcap2_core import Problem as _Problem
 
@@ -468,6 +472,267 @@ class Problem(_Problem):
   def verbose(self, value: bool):
     super()._set_verbose(value)
 
+  @property
+  def direct_solve(self) -> bool:
+    """If true, :py:meth:`solve` uses a direct, full matrix solver instead of the multipole-accelerated iterative one
+
+    The direct solver is exact up to the panel discretization, but its
+    memory and run time grow with the square and cube of the number
+    of panels. It is useful as an accuracy reference for small problems
+    (see :py:meth:`sweep`).
+
+    The full matrix is kept in an unlinked temporary file in `TMPDIR`
+    (default `/tmp`) and factored tile by tile, so only a few column
+    panels need to be held in memory.
+    """
+    return super()._get_direct_solve()
+
+  @direct_solve.setter
+  def direct_solve(self, value: bool):
+    super()._set_direct_solve(value)
+
+  @property
+  def hmatrix_solve(self) -> bool:
+    """If true, :py:meth:`solve` uses a compressed (H-matrix) direct solver instead of the iterative one
+
+    The panel interaction matrix is stored hierarchically: the
+    interactions of well separated panel clusters are compressed into
+    low-rank blocks, so memory and factorization time grow only a
+    little faster than the number of panels. Once factored, all
+    conductors are solved at once without iterations, which pays off
+    for problems with many conductors.
+
+    The accuracy of the compressed blocks follows :py:attr:`iter_tol`.
+    :py:attr:`direct_solve` takes precedence over this option.
+
+    This property corresponds to option "--hmatrix" of the
+    "fastcap" program.
+    """
+    return super()._get_hmatrix_solve()
+
+  @hmatrix_solve.setter
+  def hmatrix_solve(self, value: bool):
+    super()._set_hmatrix_solve(value)
+
+  @property
+  def compress_near_field(self) -> bool:
+    """If true, :py:meth:`solve` stores the outer near-field interactions in compressed form
+
+    The interactions of a cube with its second shell of neighbor cubes
+    are smooth, so their matrices are stored as low-rank products if that
+    needs less memory. This reduces memory and the time per iteration when
+    the cubes hold many panels (small partitioning depth). The accuracy
+    of the compressed matrices follows :py:attr:`iter_tol`.
+
+    This property corresponds to option "--compress-near" of the
+    "fastcap" program.
+    """
+    return super()._get_compress_near_field()
+
+  @compress_near_field.setter
+  def compress_near_field(self, value: bool):
+    super()._set_compress_near_field(value)
+
+  @property
+  def two_level_precond(self) -> bool:
+    """If true, :py:meth:`solve` adds a coarse-grid correction to the preconditioner
+
+    The standard preconditioner only looks at the neighborhood of each
+    cube. The coarse-grid correction adds a global view: the charge of
+    each conductor within each of the eight top-level octants is solved
+    for directly. This reduces the number of iterations for large,
+    extended conductors like long buses or ground planes. Building the
+    coarse system costs one matrix product per conductor and octant.
+
+    This property corresponds to option "--two-level" of the
+    "fastcap" program.
+    """
+    return super()._get_two_level_precond()
+
+  @two_level_precond.setter
+  def two_level_precond(self, value: bool):
+    super()._set_two_level_precond(value)
+
+  @property
+  def preconditioner(self) -> str:
+    """The preconditioner used by :py:meth:`solve`
+
+    The values are:
+
+    * "ol": the overlapped preconditioner (the default). For each cube,
+      the rows of the cube are taken from the inverse of the near-field
+      matrix of the cube and its nearest neighbors.
+    * "spai": a sparse approximate inverse with the same pattern. For each
+      cube, the columns of the cube are taken instead. This gives about
+      the same number of iterations.
+    * "bd": the block diagonal preconditioner. The near-field matrix of
+      the eight children of each second-lowest level cube is inverted.
+      This is cheaper to set up, but needs more iterations.
+    * "none": no preconditioner.
+
+    This property corresponds to option "--precond" of the
+    "fastcap" program.
+    """
+    return super()._get_preconditioner()
+
+  @preconditioner.setter
+  def preconditioner(self, value: str):
+    super()._set_preconditioner(value)
+
+  @property
+  def iteration_type(self) -> str:
+    """The iterative solver used by :py:meth:`solve`
+
+    The values are "gmres" (generalized minimum residuals, the default)
+    and "gcr" (generalized conjugate residuals).
+
+    This property corresponds to option "--itrtyp" of the
+    "fastcap" program.
+    """
+    return super()._get_iteration_type()
+
+  @iteration_type.setter
+  def iteration_type(self, value: str):
+    super()._set_iteration_type(value)
+
+  @property
+  def downward_pass(self) -> str:
+    """The way the multipole expansions are evaluated
+
+    The values are:
+
+    * "grengd": the full Greengard downward pass with local expansions
+      shifted from parent to child cubes (the default).
+    * "noshft": local expansions are formed per cube, but not shifted.
+    * "nolocl": no local expansions - multipoles are evaluated directly
+      at the panels.
+
+    This property corresponds to option "--dntype" of the
+    "fastcap" program.
+    """
+    return super()._get_downward_pass()
+
+  @downward_pass.setter
+  def downward_pass(self, value: str):
+    super()._set_downward_pass(value)
+
+  @property
+  def neighbor_shells(self) -> int:
+    """The number of cube shells treated as nearest neighbors
+
+    Interactions with neighbor cubes are computed directly, all others
+    through expansions. More shells give more accurate, but slower
+    products. The value is between 1 and 3, the default is 2.
+
+    This property corresponds to option "--nnbrs" of the
+    "fastcap" program.
+    """
+    return super()._get_neighbor_shells()
+
+  @neighbor_shells.setter
+  def neighbor_shells(self, value: int):
+    super()._set_neighbor_shells(value)
+
+  @property
+  def dielectric_points(self) -> int:
+    """The number of potential evaluation points per dielectric panel
+
+    The normal field on dielectric interfaces is computed from a divided
+    difference of the potentials at 2 (the default) or 3 points.
+    With 0, it is evaluated analytically from the normal derivatives of
+    the panel potentials and expansions, so no extra evaluation points
+    are needed.
+
+    This property corresponds to option "--numdpt" of the
+    "fastcap" program.
+    """
+    return super()._get_dielectric_points()
+
+  @dielectric_points.setter
+  def dielectric_points(self, value: int):
+    super()._set_dielectric_points(value)
+
+  @property
+  def adaptive(self) -> bool:
+    """If true (the default), sparsely filled cubes are not expanded
+
+    Cubes with fewer panels than multipole coefficients are treated
+    exactly. If false, expansions are used on all levels.
+
+    This property corresponds to option "--adapt" of the
+    "fastcap" program.
+    """
+    return super()._get_adaptive()
+
+  @adaptive.setter
+  def adaptive(self, value: bool):
+    super()._set_adaptive(value)
+
+  @property
+  def m2l_type(self) -> str:
+    """The way multipole expansions are translated into local expansions
+
+    The values are:
+
+    * "dense": one stored matrix per translation (O(p^4) for order p).
+    * "rotate": the expansion is rotated so that the translation is
+      along the z axis, translated and rotated back (O(p^3), nothing
+      stored per translation).
+    * "auto": "rotate" from expansion order 6 on, "dense" below
+      (the default).
+
+    The results agree within rounding. This property corresponds to
+    option "--m2l" of the "fastcap" program.
+    """
+    return super()._get_m2l_type()
+
+  @m2l_type.setter
+  def m2l_type(self, value: str):
+    super()._set_m2l_type(value)
+
+  @property
+  def autotune(self) -> Optional[float]:
+    """If set, :py:meth:`solve` picks the expansion order and partitioning depth itself
+
+    The value is the target relative error of the capacitance matrix,
+    e.g. 0.01 for 1%. Before the setup, the solver predicts setup time,
+    time per iteration, memory and error for all combinations of order
+    and depth from cube statistics and a short on-machine calibration.
+    It takes the cheapest combination that meets the target. The chosen
+    values can be read from :py:attr:`expansion_order` and 
+    :py:attr:`partitioning_depth` after the solve.
+
+    The error prediction is a rough, empirical estimate. It does not
+    include the iteration error (see :py:attr:`iter_tol`).
+
+    This property corresponds to option "--autotune" of the 
+    "fastcap" program. 'None' (the default) disables this feature.
+    """
+    return super()._get_autotune()
+
+  @autotune.setter
+  def autotune(self, value: Optional[float]):
+    super()._set_autotune(value)
+
+  @property
+  def trace_file(self) -> Optional[str]:
+    """If set, :py:meth:`solve` writes a timeline of the solver phases to this file
+
+    The file is written in the Chrome trace event JSON format and can be 
+    viewed with `chrome://tracing` or https://ui.perfetto.dev.
+    It contains the setup phases (charge list building, partitioning,
+    direct and multipole matrix setup, preconditioner setup) and
+    every pass of the matrix-vector products, tagged with the conductor 
+    column and iteration number.
+
+    Setting this property to None (the default) disables the trace.
+    """
+    return super()._get_trace_file()
+
+  @trace_file.setter
+  def trace_file(self, value: Optional[str]):
+    super()._set_trace_file(value)
+
   def load(self, file: str, 
            link: bool = False, 
            group: Optional[str] = None,
@@ -668,6 +933,120 @@ class Problem(_Problem):
     """
     return super()._solve()
 
+  def sweep(self, 
+            orders: Optional[list[int]] = None, 
+            depths: Optional[list[int]] = None, 
+            tolerances: Optional[list[float]] = None,
+            reference: Union[str, int, list[list[float]]] = "direct") -> list[dict]:
+    """Solves the problem for a grid of expansion orders, partitioning depths and iteration tolerances
+
+    :param orders: The expansion orders to try (default: the current :py:attr:`expansion_order`).
+    :param depths: The partitioning depths to try, -1 for automatic (default: the current :py:attr:`partitioning_depth`).
+    :param tolerances: The iteration tolerances to try (default: the current :py:attr:`iter_tol`).
+    :param reference: The accuracy reference: "direct" for a :py:attr:`direct_solve` run,
+                      an integer for a multipole run with this expansion order and a
+                      tolerance 10 times below the smallest one of the grid, or a 
+                      capacitance matrix as returned by :py:meth:`solve`.
+
+    The panel list is read once and reused for all points. Points which 
+    only differ in the tolerance also reuse the partitioning, direct,
+    preconditioner and multipole matrices, so tolerances are cheap to sweep.
+    A new setup releases the previous one, so the memory held stays at the
+    level of the largest point. The reference is computed last, so its
+    setup (a dense matrix for "direct") is only held after the grid has
+    been solved.
+
+    Returns one dict per grid point with these keys:
+
+    * "order", "depth", "iter_tol": the settings (depth is the one actually used)
+    * "time": wall clock time of the solve in seconds
+    * "setup_time": matrix setup time (zero if the setup was reused)
+    * "iterations": total number of iterations over all conductors
+    * "memory": bytes allocated by this solve, including the setup if a new one was made
+    * "error": Frobenius norm of the difference to the reference capacitance
+      matrix, relative to the norm of the reference
+    * "cap_matrix": the capacitance matrix
+    * "pareto": True if no other point is both faster and more accurate
+
+    The Pareto front ("pareto" is True) gives the settings worth 
+    considering for production runs. The problem's settings are
+    restored after the sweep.
+    """
+
+    saved = (self.expansion_order, self.partitioning_depth, self.iter_tol, self.direct_solve)
+
+    if orders is None:
+      orders = [ saved[0] ]
+    if depths is None:
+      depths = [ saved[1] ]
+    if tolerances is None:
+      tolerances = [ saved[2] ]
+
+    def settings(order, depth, tol, direct):
+      self.expansion_order = order
+      self.partitioning_depth = depth
+      self.iter_tol = tol
+      self.direct_solve = direct
+
+    results = []
+
+    try:
+
+      if isinstance(reference, str) and reference != "direct":
+        raise ValueError("Invalid reference: '" + reference + "' (expected 'direct', an order or a capacitance matrix)")
+
+      for order in orders:
+        for depth in depths:
+          #  tolerances innermost, so these points share one setup
+          for tol in tolerances:
+
+            settings(order, depth, tol, False)
+
+            mem_before = super()._solve_stats()["memory"]
+            start = time.perf_counter()
+            cap_matrix = self.solve()
+            elapsed = time.perf_counter() - start
+            stats = super()._solve_stats()
+
+            results.append({
+              "order": order,
+              "depth": stats["depth"],
+              "iter_tol": tol,
+              "time": elapsed,
+              "setup_time": stats["setup_time"],
+              "iterations": stats["iterations"],
+              "memory": stats["memory"] - (mem_before - stats["released_memory"]),
+              "cap_matrix": cap_matrix
+            })
+
+      #  the reference last, so a large setup does not stay around for the grid
+      if isinstance(reference, str):
+        settings(saved[0], -1, saved[2], True)
+        ref = self.solve()
+      elif isinstance(reference, int):
+        settings(reference, -1, min(tolerances) * 0.1, False)
+        ref = self.solve()
+      else:
+        ref = reference
+
+      ref_norm = math.sqrt(sum([ c * c for row in ref for c in row ]))
+
+      for res in results:
+        diff = 0.0
+        for row, ref_row in zip(res["cap_matrix"], ref):
+          for c, r in zip(row, ref_row):
+            diff += (c - r) * (c - r)
+        res["error"] = math.sqrt(diff) / ref_norm if ref_norm > 0.0 else 0.0
+
+    finally:
+      settings(*saved)
+
+    for r in results:
+      r["pareto"] = not any([ (o["time"] <= r["time"] and o["error"] <= r["error"]) and 
+                              (o["time"] < r["time"] or o["error"] < r["error"]) for o in results ])
+
+    return results
+
   def conductors(self) -> list[str]:
     """Returns the effective list of conductors present in the capacitance matrix
 
@@ -11,6 +11,7 @@
 #include "zbuf2fastcap.h"
 #include "quickif.h"
 #include "matrix.h"
+#include "counters.h"
 
 #include <memory>
 #include <stdexcept>
@@ -645,6 +646,340 @@ problem_set_verbose(PyProblemObject *self, PyObject *args)
   Py_RETURN_NONE;
 }
 
+static PyObject *
+problem_get_direct_solve(PyProblemObject *self)
+{
+  return PyBool_FromLong (self->sys.dirsol);
+}
+
+static PyObject *
+problem_set_direct_solve(PyProblemObject *self, PyObject *args)
+{
+  int b = 0;
+  if (!PyArg_ParseTuple(args, "p", &b)) {
+    return NULL;
+  }
+
+  self->sys.dirsol = b;
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_hmatrix_solve(PyProblemObject *self)
+{
+  return PyBool_FromLong (self->sys.hsolve);
+}
+
+static PyObject *
+problem_set_hmatrix_solve(PyProblemObject *self, PyObject *args)
+{
+  int b = 0;
+  if (!PyArg_ParseTuple(args, "p", &b)) {
+    return NULL;
+  }
+
+  self->sys.hsolve = b;
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_compress_near_field(PyProblemObject *self)
+{
+  return PyBool_FromLong (self->sys.q2pcomp);
+}
+
+static PyObject *
+problem_set_compress_near_field(PyProblemObject *self, PyObject *args)
+{
+  int b = 0;
+  if (!PyArg_ParseTuple(args, "p", &b)) {
+    return NULL;
+  }
+
+  self->sys.q2pcomp = b;
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_two_level_precond(PyProblemObject *self)
+{
+  return PyBool_FromLong (self->sys.twolevel);
+}
+
+static PyObject *
+problem_set_two_level_precond(PyProblemObject *self, PyObject *args)
+{
+  int b = 0;
+  if (!PyArg_ParseTuple(args, "p", &b)) {
+    return NULL;
+  }
+
+  self->sys.twolevel = b;
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_preconditioner(PyProblemObject *self)
+{
+  switch (self->sys.precond) {
+  case NONE:
+    return PyUnicode_FromString("none");
+  case BD:
+    return PyUnicode_FromString("bd");
+  case SPAI:
+    return PyUnicode_FromString("spai");
+  default:
+    return PyUnicode_FromString("ol");
+  }
+}
+
+static PyObject *
+problem_set_preconditioner(PyProblemObject *self, PyObject *args)
+{
+  const char *name = 0;
+  if (!PyArg_ParseTuple(args, "s", &name)) {
+    return NULL;
+  }
+
+  if (!strcmp(name, "none")) {
+    self->sys.precond = NONE;
+  } else if (!strcmp(name, "bd")) {
+    self->sys.precond = BD;
+  } else if (!strcmp(name, "ol")) {
+    self->sys.precond = OL;
+  } else if (!strcmp(name, "spai")) {
+    self->sys.precond = SPAI;
+  } else {
+    PyErr_Format(PyExc_ValueError, "'preconditioner' needs to be 'none', 'bd', 'ol' or 'spai' (but is '%s')", name);
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_iteration_type(PyProblemObject *self)
+{
+  if (self->sys.itrtyp == GCR) {
+    return PyUnicode_FromString("gcr");
+  } else {
+    return PyUnicode_FromString("gmres");
+  }
+}
+
+static PyObject *
+problem_set_iteration_type(PyProblemObject *self, PyObject *args)
+{
+  const char *name = 0;
+  if (!PyArg_ParseTuple(args, "s", &name)) {
+    return NULL;
+  }
+
+  if (!strcmp(name, "gmres")) {
+    self->sys.itrtyp = GMRES;
+  } else if (!strcmp(name, "gcr")) {
+    self->sys.itrtyp = GCR;
+  } else {
+    PyErr_Format(PyExc_ValueError, "'iteration_type' needs to be 'gmres' or 'gcr' (but is '%s')", name);
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_downward_pass(PyProblemObject *self)
+{
+  switch (self->sys.dntype) {
+  case NOLOCL:
+    return PyUnicode_FromString("nolocl");
+  case NOSHFT:
+    return PyUnicode_FromString("noshft");
+  default:
+    return PyUnicode_FromString("grengd");
+  }
+}
+
+static PyObject *
+problem_set_downward_pass(PyProblemObject *self, PyObject *args)
+{
+  const char *name = 0;
+  if (!PyArg_ParseTuple(args, "s", &name)) {
+    return NULL;
+  }
+
+  if (!strcmp(name, "grengd")) {
+    self->sys.dntype = GRENGD;
+  } else if (!strcmp(name, "noshft")) {
+    self->sys.dntype = NOSHFT;
+  } else if (!strcmp(name, "nolocl")) {
+    self->sys.dntype = NOLOCL;
+  } else {
+    PyErr_Format(PyExc_ValueError, "'downward_pass' needs to be 'grengd', 'noshft' or 'nolocl' (but is '%s')", name);
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_neighbor_shells(PyProblemObject *self)
+{
+  return PyLong_FromLong ((long) self->sys.nnbrs);
+}
+
+static PyObject *
+problem_set_neighbor_shells(PyProblemObject *self, PyObject *args)
+{
+  int i = 0;
+  if (!PyArg_ParseTuple(args, "i", &i)) {
+    return NULL;
+  }
+
+  if (i < 1 || i > 3) {
+    PyErr_Format(PyExc_ValueError, "'neighbor_shells' needs to be between 1 and 3 (but is %d)", i);
+    return NULL;
+  }
+
+  self->sys.nnbrs = i;
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_dielectric_points(PyProblemObject *self)
+{
+  return PyLong_FromLong ((long) self->sys.numdpt);
+}
+
+static PyObject *
+problem_set_dielectric_points(PyProblemObject *self, PyObject *args)
+{
+  int i = 0;
+  if (!PyArg_ParseTuple(args, "i", &i)) {
+    return NULL;
+  }
+
+  if (i != 0 && i != 2 && i != 3) {
+    PyErr_Format(PyExc_ValueError, "'dielectric_points' needs to be 0, 2 or 3 (but is %d)", i);
+    return NULL;
+  }
+
+  //  the dummy panels are made when reading the panels
+  if ((i == 0) != (self->sys.numdpt == 0)) {
+    self->sys.reset_read();
+  }
+
+  self->sys.numdpt = i;
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_adaptive(PyProblemObject *self)
+{
+  return PyBool_FromLong (self->sys.adapt);
+}
+
+static PyObject *
+problem_set_adaptive(PyProblemObject *self, PyObject *args)
+{
+  int b = 0;
+  if (!PyArg_ParseTuple(args, "p", &b)) {
+    return NULL;
+  }
+
+  self->sys.adapt = b;
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_m2l_type(PyProblemObject *self)
+{
+  switch (self->sys.m2ltyp) {
+  case M2LDNS:
+    return PyUnicode_FromString("dense");
+  case M2LROT:
+    return PyUnicode_FromString("rotate");
+  default:
+    return PyUnicode_FromString("auto");
+  }
+}
+
+static PyObject *
+problem_set_m2l_type(PyProblemObject *self, PyObject *args)
+{
+  const char *name = 0;
+  if (!PyArg_ParseTuple(args, "s", &name)) {
+    return NULL;
+  }
+
+  if (!strcmp(name, "dense")) {
+    self->sys.m2ltyp = M2LDNS;
+  } else if (!strcmp(name, "rotate")) {
+    self->sys.m2ltyp = M2LROT;
+  } else if (!strcmp(name, "auto")) {
+    self->sys.m2ltyp = M2LAUT;
+  } else {
+    PyErr_Format(PyExc_ValueError, "'m2l_type' needs to be 'dense', 'rotate' or 'auto' (but is '%s')", name);
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_autotune(PyProblemObject *self)
+{
+  if (self->sys.autotune <= 0.0) {
+    Py_RETURN_NONE;
+  } else {
+    return PyFloat_FromDouble (self->sys.autotune);
+  }
+}
+
+static PyObject *
+problem_set_autotune(PyProblemObject *self, PyObject *value)
+{
+  if (value == Py_None) {
+    self->sys.autotune = 0.0;
+  } else {
+    double d = PyFloat_AsDouble(value);
+    if (PyErr_Occurred()) {
+      return NULL;
+    }
+    if (d <= 0.0) {
+      PyErr_SetString(PyExc_ValueError, "autotune target error must be positive");
+      return NULL;
+    }
+    self->sys.autotune = d;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+problem_get_trace_file(PyProblemObject *self)
+{
+  if (!self->sys.trace_file) {
+    Py_RETURN_NONE;
+  } else {
+    return PyUnicode_FromString(self->sys.trace_file);
+  }
+}
+
+static PyObject *
+problem_set_trace_file(PyProblemObject *self, PyObject *value)
+{
+  if (value == Py_None) {
+    self->sys.trace_file = 0;
+  } else {
+    PyObject *trace_file_str = PyObject_Str(value);
+    if (!trace_file_str) {
+      return NULL;
+    }
+    const char *trace_file_utf8str = PyUnicode_AsUTF8(trace_file_str);
+    if (!trace_file_utf8str) {
+      return NULL;
+    }
+    self->sys.trace_file = self->sys.heap.strdup(trace_file_utf8str);
+  }
+  Py_RETURN_NONE;
+}
+
 static bool
 parse_vector(PyObject *arg, Vector3d &v)
 {
@@ -898,6 +1233,22 @@ problem_solve(PyProblemObject *self)
   Py_RETURN_NONE;
 }
 
+static PyObject *
+problem_solve_stats(PyProblemObject *self)
+{
+  double solve_time = counters.dirtime + counters.uptime + counters.downtime + counters.evaltime
+                        + counters.prectime + counters.conjtime + counters.fullsoltime;
+
+  return Py_BuildValue("{s:d,s:d,s:i,s:i,s:n,s:n,s:n}",
+                       "setup_time", counters.setuptime + counters.prsetime,
+                       "solve_time", solve_time,
+                       "iterations", counters.iterations,
+                       "depth", self->sys.depth,
+                       "memory", Py_ssize_t(self->sys.heap.total_memory()),
+                       "q2p_memory", Py_ssize_t(self->sys.heap.memory(AQ2P)),
+                       "released_memory", Py_ssize_t(counters.released));
+}
+
 static PyObject *
 problem_conductors(PyProblemObject *self)
 {
@@ -1048,10 +1399,37 @@ static PyMethodDef problem_methods[] = {
   { "_set_ps_axislength", (PyCFunction) problem_set_ps_axislength, METH_VARARGS, NULL },
   { "_get_verbose", (PyCFunction) problem_get_verbose, METH_NOARGS, NULL },
   { "_set_verbose", (PyCFunction) problem_set_verbose, METH_VARARGS, NULL },
+  { "_get_direct_solve", (PyCFunction) problem_get_direct_solve, METH_NOARGS, NULL },
+  { "_set_direct_solve", (PyCFunction) problem_set_direct_solve, METH_VARARGS, NULL },
+  { "_get_hmatrix_solve", (PyCFunction) problem_get_hmatrix_solve, METH_NOARGS, NULL },
+  { "_set_hmatrix_solve", (PyCFunction) problem_set_hmatrix_solve, METH_VARARGS, NULL },
+  { "_get_compress_near_field", (PyCFunction) problem_get_compress_near_field, METH_NOARGS, NULL },
+  { "_set_compress_near_field", (PyCFunction) problem_set_compress_near_field, METH_VARARGS, NULL },
+  { "_get_two_level_precond", (PyCFunction) problem_get_two_level_precond, METH_NOARGS, NULL },
+  { "_set_two_level_precond", (PyCFunction) problem_set_two_level_precond, METH_VARARGS, NULL },
+  { "_get_preconditioner", (PyCFunction) problem_get_preconditioner, METH_NOARGS, NULL },
+  { "_set_preconditioner", (PyCFunction) problem_set_preconditioner, METH_VARARGS, NULL },
+  { "_get_iteration_type", (PyCFunction) problem_get_iteration_type, METH_NOARGS, NULL },
+  { "_set_iteration_type", (PyCFunction) problem_set_iteration_type, METH_VARARGS, NULL },
+  { "_get_downward_pass", (PyCFunction) problem_get_downward_pass, METH_NOARGS, NULL },
+  { "_set_downward_pass", (PyCFunction) problem_set_downward_pass, METH_VARARGS, NULL },
+  { "_get_neighbor_shells", (PyCFunction) problem_get_neighbor_shells, METH_NOARGS, NULL },
+  { "_set_neighbor_shells", (PyCFunction) problem_set_neighbor_shells, METH_VARARGS, NULL },
+  { "_get_dielectric_points", (PyCFunction) problem_get_dielectric_points, METH_NOARGS, NULL },
+  { "_set_dielectric_points", (PyCFunction) problem_set_dielectric_points, METH_VARARGS, NULL },
+  { "_get_adaptive", (PyCFunction) problem_get_adaptive, METH_NOARGS, NULL },
+  { "_set_adaptive", (PyCFunction) problem_set_adaptive, METH_VARARGS, NULL },
+  { "_get_m2l_type", (PyCFunction) problem_get_m2l_type, METH_NOARGS, NULL },
+  { "_set_m2l_type", (PyCFunction) problem_set_m2l_type, METH_VARARGS, NULL },
+  { "_get_autotune", (PyCFunction) problem_get_autotune, METH_NOARGS, NULL },
+  { "_set_autotune", (PyCFunction) problem_set_autotune, METH_O, NULL },
+  { "_get_trace_file", (PyCFunction) problem_get_trace_file, METH_NOARGS, NULL },
+  { "_set_trace_file", (PyCFunction) problem_set_trace_file, METH_O, NULL },
   { "_load", (PyCFunction) problem_load, METH_VARARGS, NULL },
   { "_load_list", (PyCFunction) problem_load_list, METH_VARARGS, NULL },
   { "_add", (PyCFunction) problem_add, METH_VARARGS, NULL },
   { "_solve", (PyCFunction) problem_solve, METH_NOARGS, NULL },
+  { "_solve_stats", (PyCFunction) problem_solve_stats, METH_NOARGS, NULL },
   { "_conductors", (PyCFunction) problem_conductors, METH_NOARGS, NULL },
   { "_dump_ps", (PyCFunction) problem_dump_ps, METH_VARARGS, NULL },
   { "_extent", (PyCFunction) problem_extent, METH_NOARGS, NULL },
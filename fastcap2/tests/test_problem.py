@@ -2,6 +2,7 @@
 import unittest
 import tempfile
 import os
+import json
 
 import fastcap2 as fc2
 
@@ -11,6 +12,31 @@ def format_cap_matrix(cap_matrix, unit = 1e-12):
 
 class TestProblem(unittest.TestCase):
 
+  # two cb.geo plates 2.5 units apart, see _solve_cb()
+  cb_ref = [ [ 877e-12, -613e-12 ], [ -613e-12, 877e-12 ] ]
+
+  def _solve_cb(self, problem = None, **settings):
+    """Solves the two plate problem with the given settings and returns
+    the capacitance matrix and the solve statistics"""
+
+    if problem is None:
+      problem = fc2.Problem()
+    for k, v in settings.items():
+      setattr(problem, k, v)
+
+    test_data_path = os.path.join(os.path.dirname(__file__), "data")
+
+    problem.load(os.path.join(test_data_path, "cb.geo"))
+    problem.load(os.path.join(test_data_path, "cb.geo"), d = (0, 0, 2.5))
+
+    cap_matrix = problem.solve()
+    return cap_matrix, problem._solve_stats()
+
+  def _assert_cap_close(self, cap_matrix, ref, rel):
+    for row, ref_row in zip(cap_matrix, ref):
+      for c, r in zip(row, ref_row):
+        self.assertLess(abs(c - r), rel * abs(r))
+
   def test_title(self):
 
     problem = fc2.Problem(title="t1")
@@ -266,6 +292,337 @@ class TestProblem(unittest.TestCase):
     problem.verbose = True
     self.assertEqual(problem.verbose, True)
 
+  def test_direct_solve(self):
+
+    problem = fc2.Problem()
+
+    self.assertEqual(problem.direct_solve, False)
+
+    problem.direct_solve = True
+    self.assertEqual(problem.direct_solve, True)
+
+    test_data_path = os.path.join(os.path.dirname(__file__), "data")
+
+    problem.load(os.path.join(test_data_path, "cb.geo"))
+    problem.load(os.path.join(test_data_path, "cb.geo"), d = (0, 0, 2.5))
+
+    cap_matrix = problem.solve()
+
+    # the direct solution is within 1% of the multipole reference values
+    self._assert_cap_close(cap_matrix, self.cb_ref, 0.01)
+
+  def test_hmatrix_solve(self):
+
+    problem = fc2.Problem()
+
+    self.assertEqual(problem.hmatrix_solve, False)
+
+    problem.hmatrix_solve = True
+    self.assertEqual(problem.hmatrix_solve, True)
+
+    cap_matrix, stats = self._solve_cb(problem)
+
+    # no iterations, and the compression error is far below the
+    # discretization error: same result as the dense direct solve
+    self.assertEqual(stats["iterations"], 0)
+
+    direct, _ = self._solve_cb(direct_solve = True)
+    self._assert_cap_close(cap_matrix, direct, 1e-4)
+
+  def test_hmatrix_solve_touching(self):
+
+    # two plates touching along an edge: the sibling clusters at the
+    # contact are compressed too (weak admissibility)
+    test_data_path = os.path.join(os.path.dirname(__file__), "data")
+
+    cap_matrices = []
+    for settings in [ { "hmatrix_solve": True }, { "direct_solve": True } ]:
+      problem = fc2.Problem()
+      for k, v in settings.items():
+        setattr(problem, k, v)
+      problem.load(os.path.join(test_data_path, "cb.geo"))
+      problem.load(os.path.join(test_data_path, "cb.geo"), d = (10, 0, 0.5))
+      cap_matrices.append(problem.solve())
+
+    self._assert_cap_close(cap_matrices[0], cap_matrices[1], 1e-4)
+
+  def test_compress_near_field(self):
+
+    problem = fc2.Problem()
+
+    self.assertEqual(problem.compress_near_field, False)
+
+    problem.compress_near_field = True
+    self.assertEqual(problem.compress_near_field, True)
+
+    # at the default depth the second-shell blocks are too small to
+    # compress - with two levels the cubes are large enough
+    cap_matrix, stats = self._solve_cb(problem, partitioning_depth = 2)
+    dense, dense_stats = self._solve_cb(partitioning_depth = 2)
+
+    self.assertLess(stats["q2p_memory"], 0.9 * dense_stats["q2p_memory"])
+    self._assert_cap_close(cap_matrix, dense, 1e-5)
+
+  def test_two_level_precond(self):
+
+    problem = fc2.Problem()
+
+    self.assertEqual(problem.two_level_precond, False)
+
+    problem.two_level_precond = True
+    self.assertEqual(problem.two_level_precond, True)
+
+    cap_matrix, stats = self._solve_cb(problem)
+    one_level, one_level_stats = self._solve_cb()
+
+    # the coarse-grid correction saves iterations (8 instead of 12)
+    self.assertLess(stats["iterations"], one_level_stats["iterations"])
+    self._assert_cap_close(cap_matrix, one_level, 1e-3)
+
+  def test_preconditioner(self):
+
+    problem = fc2.Problem()
+
+    self.assertEqual(problem.preconditioner, "ol")
+
+    problem.preconditioner = "none"
+    self.assertEqual(problem.preconditioner, "none")
+
+    with self.assertRaises(ValueError):
+      problem.preconditioner = "xyz"
+    self.assertEqual(problem.preconditioner, "none")
+
+    problem.preconditioner = "bd"
+    self.assertEqual(problem.preconditioner, "bd")
+
+    problem.preconditioner = "spai"
+    self.assertEqual(problem.preconditioner, "spai")
+
+    spai, spai_stats = self._solve_cb(problem)
+    ol, ol_stats = self._solve_cb(preconditioner = "ol")
+    bd, bd_stats = self._solve_cb(preconditioner = "bd")
+    none, none_stats = self._solve_cb(preconditioner = "none")
+
+    # SPAI and OL have the same pattern and need about the same number
+    # of iterations, the block diagonal one is in between them and none
+    # (12, 12, 24 and 32 iterations)
+    self.assertLessEqual(spai_stats["iterations"], ol_stats["iterations"] + 2)
+    self.assertLess(ol_stats["iterations"], bd_stats["iterations"])
+    self.assertLess(bd_stats["iterations"], none_stats["iterations"])
+
+    for cap_matrix in (spai, bd, none):
+      self._assert_cap_close(cap_matrix, ol, 1e-3)
+
+  def test_multipole_config(self):
+
+    problem = fc2.Problem()
+
+    self.assertEqual(problem.iteration_type, "gmres")
+    self.assertEqual(problem.downward_pass, "grengd")
+    self.assertEqual(problem.neighbor_shells, 2)
+    self.assertEqual(problem.dielectric_points, 2)
+    self.assertEqual(problem.adaptive, True)
+
+    with self.assertRaises(ValueError):
+      problem.iteration_type = "xyz"
+    with self.assertRaises(ValueError):
+      problem.downward_pass = "xyz"
+    with self.assertRaises(ValueError):
+      problem.neighbor_shells = 0
+    with self.assertRaises(ValueError):
+      problem.dielectric_points = 4
+
+    problem.iteration_type = "gcr"
+    self.assertEqual(problem.iteration_type, "gcr")
+    problem.downward_pass = "nolocl"
+    self.assertEqual(problem.downward_pass, "nolocl")
+    problem.neighbor_shells = 1
+    self.assertEqual(problem.neighbor_shells, 1)
+    problem.dielectric_points = 3
+    self.assertEqual(problem.dielectric_points, 3)
+    problem.adaptive = False
+    self.assertEqual(problem.adaptive, False)
+
+    base, base_stats = self._solve_cb()
+
+    # GCR and GMRES converge to the same solution
+    gcr, _ = self._solve_cb(iteration_type = "gcr")
+    self._assert_cap_close(gcr, base, 1e-3)
+
+    # multipoles evaluated directly instead of through local expansions
+    nolocl, _ = self._solve_cb(downward_pass = "nolocl")
+    self._assert_cap_close(nolocl, base, 1e-3)
+
+    # without adaptive exact cubes, all cubes get expansions
+    _, fixed_stats = self._solve_cb(adaptive = False)
+    self.assertGreater(fixed_stats["memory"], base_stats["memory"])
+
+    # one neighbor shell gives a smaller near field and preconditioner
+    one_shell, one_shell_stats = self._solve_cb(neighbor_shells = 1)
+    self.assertGreater(one_shell_stats["iterations"], base_stats["iterations"])
+    self._assert_cap_close(one_shell, base, 0.01)
+
+  def test_m2l_type(self):
+
+    problem = fc2.Problem()
+    self.assertEqual(problem.m2l_type, "auto")
+
+    with self.assertRaises(ValueError):
+      problem.m2l_type = "xyz"
+
+    test_data_path = os.path.join(os.path.dirname(__file__), "data")
+
+    problem.load(os.path.join(test_data_path, "cb.geo"))
+    problem.load(os.path.join(test_data_path, "cb.geo"), d = (0, 0, 2.5))
+    problem.expansion_order = 8
+
+    problem.m2l_type = "dense"
+    self.assertEqual(problem.m2l_type, "dense")
+    dense = problem.solve()
+
+    problem.m2l_type = "rotate"
+    self.assertEqual(problem.m2l_type, "rotate")
+    rotated = problem.solve()
+
+    for row, ref_row in zip(rotated, dense):
+      for c, r in zip(row, ref_row):
+        self.assertLess(abs(c - r), 1e-6 * abs(r))
+
+  def test_analytic_normal_field(self):
+
+    test_data_path = os.path.join(os.path.dirname(__file__), "data")
+
+    with open(os.path.join(test_data_path, "1x1bus.lst"), "r") as f:
+      data = f.read()
+
+    data = data.replace("%", os.path.join(test_data_path, ""))
+
+    tmp = tempfile.NamedTemporaryFile()
+    tmp.write(str.encode(data))
+    tmp.flush()
+
+    problem = fc2.Problem()
+    problem.load_list(tmp.name)
+
+    divided = problem.solve()
+
+    # no dummy panels: the panels are read again
+    problem.dielectric_points = 0
+    self.assertEqual(problem.dielectric_points, 0)
+    analytic = problem.solve()
+
+    for row, ref_row in zip(analytic, divided):
+      for c, r in zip(row, ref_row):
+        self.assertLess(abs(c - r), 0.01 * abs(r))
+
+  def test_autotune(self):
+
+    test_data_path = os.path.join(os.path.dirname(__file__), "data")
+
+    problem = fc2.Problem()
+
+    self.assertEqual(problem.autotune, None)
+
+    problem.autotune = 0.01
+    self.assertEqual(problem.autotune, 0.01)
+
+    with self.assertRaises(ValueError):
+      problem.autotune = -1.0
+
+    problem.load(os.path.join(test_data_path, "cb.geo"))
+    problem.load(os.path.join(test_data_path, "cb.geo"), d = (0, 0, 2.5))
+
+    cap_matrix = problem.solve()
+
+    self.assertGreaterEqual(problem.expansion_order, 1)
+    self.assertGreaterEqual(problem.partitioning_depth, 2)
+
+    # within the target error of the default solution
+    ref = [ [ 877e-12, -613e-12 ], [ -613e-12, 877e-12 ] ]
+    for row, ref_row in zip(cap_matrix, ref):
+      for c, r in zip(row, ref_row):
+        self.assertLess(abs(c - r), 0.01 * abs(r))
+
+    problem.autotune = None
+    self.assertEqual(problem.autotune, None)
+
+  def test_sweep(self):
+
+    test_data_path = os.path.join(os.path.dirname(__file__), "data")
+
+    problem = fc2.Problem()
+
+    problem.load(os.path.join(test_data_path, "cb.geo"))
+    problem.load(os.path.join(test_data_path, "cb.geo"), d = (0, 0, 2.5))
+
+    problem.expansion_order = 3
+    problem.partitioning_depth = 4
+    problem.iter_tol = 1e-4
+    ref = problem.solve()
+
+    problem.expansion_order = 2
+    problem.partitioning_depth = 5
+    problem.iter_tol = 0.01
+
+    results = problem.sweep(orders = [ 1, 2 ], depths = [ 4 ], tolerances = [ 0.1, 0.01 ], reference = ref)
+
+    # settings are restored
+    self.assertEqual(problem.expansion_order, 2)
+    self.assertEqual(problem.partitioning_depth, 5)
+    self.assertEqual(problem.iter_tol, 0.01)
+
+    self.assertEqual([ (r["order"], r["depth"], r["iter_tol"]) for r in results ], 
+                     [ (1, 4, 0.1), (1, 4, 0.01), (2, 4, 0.1), (2, 4, 0.01) ])
+
+    for r in results:
+      self.assertLess(r["error"], 0.01)
+      self.assertGreater(r["iterations"], 0)
+      self.assertEqual(len(r["cap_matrix"]), 2)
+
+    # a tolerance change reuses the setup
+    self.assertGreater(results[0]["setup_time"], 0.0)
+    self.assertEqual(results[1]["setup_time"], 0.0)
+    self.assertLess(results[1]["memory"], results[0]["memory"])
+
+    self.assertTrue(any([ r["pareto"] for r in results ]))
+
+    # a new setup releases the previous one, so sweeping again does not pile up memory
+    memory = problem._solve_stats()["memory"]
+    problem.sweep(orders = [ 1, 2 ], depths = [ 4 ], tolerances = [ 0.1, 0.01 ], reference = ref)
+    self.assertEqual(problem._solve_stats()["memory"], memory)
+
+  def test_trace_file(self):
+
+    test_data_path = os.path.join(os.path.dirname(__file__), "data")
+
+    problem = fc2.Problem()
+
+    self.assertEqual(problem.trace_file, None)
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+
+      trace_file = os.path.join(tmpdir, "trace.json")
+      problem.trace_file = trace_file
+      self.assertEqual(problem.trace_file, trace_file)
+
+      problem.load(os.path.join(test_data_path, "cb.geo"))
+      problem.load(os.path.join(test_data_path, "cb.geo"), d = (0, 0, 2.5))
+      problem.solve()
+
+      with open(trace_file) as f:
+        trace = json.load(f)
+
+      names = set([ e["name"] for e in trace["traceEvents"] ])
+      for n in [ "build_charge_list", "mulInit", "mulMatDirect", "olmulMatPrecond", 
+                 "mulMatUp", "mulMatDown", "mulMatEval", "computePsi", "mulDirect" ]:
+        self.assertIn(n, names)
+
+      columns = set([ e["args"]["column"] for e in trace["traceEvents"] if e["name"] == "computePsi" ])
+      self.assertEqual(columns, set([ 1, 2 ]))
+
+    problem.trace_file = None
+    self.assertEqual(problem.trace_file, None)
+
   def test_load_plates(self):
 
     test_data_path = os.path.join(os.path.dirname(__file__), "data")
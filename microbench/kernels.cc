@@ -0,0 +1,416 @@
+
+#include <benchmark/benchmark.h>
+
+#include "mulGlobal.h"
+#include "mulStruct.h"
+#include "mulMulti.h"
+#include "mulLocal.h"
+#include "mulSetup.h"
+#include "mulMats.h"
+#include "mulDo.h"
+#include "calcp.h"
+#include "direct.h"
+#include "input.h"
+#include "quickif.h"
+
+#include <memory>
+#include <vector>
+#include <cmath>
+
+namespace {
+
+//  The heap is alloc-only and the matrix builders allocate their result on
+//  every call. To keep long benchmark runs bounded, the system is recreated
+//  (outside of the timed region) once it has accumulated this much memory.
+const size_t max_heap_memory = 64 * 1024 * 1024;
+
+/**
+ *  @brief Provides a system with the multipole scratch arrays for a given order
+ */
+class KernelSystem
+{
+public:
+  KernelSystem(int order, int maxchgs)
+    : m_order(order), m_maxchgs(maxchgs)
+  {
+    reset();
+  }
+
+  ssystem *sys()
+  {
+    return mp_sys.get();
+  }
+
+  void recycle(benchmark::State &state)
+  {
+    if (mp_sys->heap.total_memory() > max_heap_memory) {
+      state.PauseTiming();
+      reset();
+      state.ResumeTiming();
+    }
+  }
+
+private:
+  int m_order, m_maxchgs;
+  std::unique_ptr<ssystem> mp_sys;
+
+  void reset()
+  {
+    mp_sys.reset(new ssystem());
+    mp_sys->order = m_order;
+    mulMultiAlloc(mp_sys.get(), m_maxchgs, m_order, 0);
+  }
+};
+
+/**
+ *  @brief Adds a 1m cube made from n x n uniform quads per face to the system
+ *  and returns the panel list
+ */
+charge *make_cube(ssystem *sys, int n)
+{
+  SurfaceData *data = sys->heap.create<SurfaceData>(AMSC);
+  data->name = sys->heap.strdup("C");
+
+  quadl *last = 0;
+  double h = 1.0 / n;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    for (int side = 0; side < 2; ++side) {
+      for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+
+          double p[4][3];
+          double u[] = { double(i), double(i + 1), double(i + 1), double(i) };
+          double v[] = { double(j), double(j), double(j + 1), double(j + 1) };
+          for (int c = 0; c < 4; ++c) {
+            p[c][axis] = side;
+            p[c][(axis + 1) % 3] = u[c] * h;
+            p[c][(axis + 2) % 3] = v[c] * h;
+          }
+
+          quadl *q = sys->heap.alloc<quadl>(1, AMSC);
+          q->p1 = Vector3d(p[0][0], p[0][1], p[0][2]);
+          q->p2 = Vector3d(p[1][0], p[1][1], p[1][2]);
+          q->p3 = Vector3d(p[2][0], p[2][1], p[2][2]);
+          q->p4 = Vector3d(p[3][0], p[3][1], p[3][2]);
+          if (last) {
+            last->next = q;
+          } else {
+            data->quads = q;
+          }
+          last = q;
+
+        }
+      }
+    }
+  }
+
+  Surface *surf = sys->heap.create<Surface>(AMSC);
+  surf->type = CONDTR;
+  surf->surf_data = data;
+  surf->end_of_chain = TRUE;
+  surf->group_name = sys->heap.strdup("GROUP1");
+  sys->surf_list = surf;
+
+  return build_charge_list(sys);
+}
+
+// ----------------------------------------------------------------------------
+//  calcp in its three regimes
+
+//  distance in units of the panel diagonal: > 6 is the 2nd moment
+//  expansion, 3..6 is the 4th moment expansion and < 3 is exact
+void calcp_at(benchmark::State &state, double dist)
+{
+  ssystem sys;
+  charge *panel = make_cube(&sys, 1);
+
+  double r = dist * panel->max_diag;
+  double x = panel->x + r * panel->Z[0] + 0.1 * r * panel->X[0];
+  double y = panel->y + r * panel->Z[1] + 0.1 * r * panel->X[1];
+  double z = panel->z + r * panel->Z[2] + 0.1 * r * panel->X[2];
+
+  double pfd = 0.0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(calcp(&sys, panel, x, y, z, &pfd));
+    benchmark::DoNotOptimize(pfd);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_calcp_far(benchmark::State &state)
+{
+  calcp_at(state, 10.0);
+}
+BENCHMARK(BM_calcp_far);
+
+void BM_calcp_mid(benchmark::State &state)
+{
+  calcp_at(state, 4.0);
+}
+BENCHMARK(BM_calcp_mid);
+
+void BM_calcp_near(benchmark::State &state)
+{
+  calcp_at(state, 0.5);
+}
+BENCHMARK(BM_calcp_near);
+
+// ----------------------------------------------------------------------------
+//  expansion matrix builders - argument is the expansion order
+
+void BM_evalLegendre(benchmark::State &state)
+{
+  int order = int(state.range(0));
+  std::vector<double> v(costerms(order));
+
+  double cosA = 0.3;
+  for (auto _ : state) {
+    evalLegendre(cosA, v.data(), order);
+    benchmark::DoNotOptimize(v.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * costerms(order));
+}
+BENCHMARK(BM_evalLegendre)->DenseRange(1, MAXORDER);
+
+void BM_mulQ2Multi(benchmark::State &state)
+{
+  const int nchgs = 24;         //  one lowest level cube of a 2x2 per face cube
+  int order = int(state.range(0));
+
+  KernelSystem ks(order, nchgs);
+  ssystem cube_sys;
+  charge *panels = make_cube(&cube_sys, 2);
+
+  std::vector<charge *> chgs;
+  std::vector<int> is_dummy;
+  for (charge *c = panels; c && int(chgs.size()) < nchgs; c = c->next) {
+    chgs.push_back(c);
+    is_dummy.push_back(0);
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(mulQ2Multi(ks.sys(), chgs.data(), is_dummy.data(), int(chgs.size()),
+                                        0.5, 0.5, 0.5, order));
+    ks.recycle(state);
+  }
+
+  state.SetItemsProcessed(state.iterations() * int(chgs.size()) * multerms(order));
+}
+BENCHMARK(BM_mulQ2Multi)->DenseRange(1, MAXORDER);
+
+void BM_mulMulti2Multi(benchmark::State &state)
+{
+  int order = int(state.range(0));
+  KernelSystem ks(order, 0);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(mulMulti2Multi(ks.sys(), 0.25, 0.25, 0.25, 0.5, 0.5, 0.5, order));
+    ks.recycle(state);
+  }
+
+  state.SetItemsProcessed(state.iterations() * multerms(order) * multerms(order));
+}
+BENCHMARK(BM_mulMulti2Multi)->DenseRange(1, MAXORDER);
+
+void BM_mulMulti2Local(benchmark::State &state)
+{
+  int order = int(state.range(0));
+  KernelSystem ks(order, 0);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(mulMulti2Local(ks.sys(), 2.25, 0.25, 1.25, 0.25, 0.25, 0.25, order));
+    ks.recycle(state);
+  }
+
+  state.SetItemsProcessed(state.iterations() * multerms(order) * multerms(order));
+}
+BENCHMARK(BM_mulMulti2Local)->DenseRange(1, MAXORDER);
+
+void BM_mulLocal2Local(benchmark::State &state)
+{
+  int order = int(state.range(0));
+  KernelSystem ks(order, 0);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(mulLocal2Local(ks.sys(), 0.25, 0.25, 0.25, 0.5, 0.5, 0.5, order));
+    ks.recycle(state);
+  }
+
+  state.SetItemsProcessed(state.iterations() * multerms(order) * multerms(order));
+}
+BENCHMARK(BM_mulLocal2Local)->DenseRange(1, MAXORDER);
+
+// ----------------------------------------------------------------------------
+//  dense factorization and solve - argument is the matrix size
+
+//  diagonally dominant and well conditioned
+void fill_matrix(double **mat, int size)
+{
+  for (int i = 0; i < size; ++i) {
+    for (int j = 0; j < size; ++j) {
+      mat[i][j] = (i == j) ? double(size) : 1.0 / (1.0 + std::abs(i - j));
+    }
+  }
+}
+
+void BM_ludecomp(benchmark::State &state)
+{
+  int size = int(state.range(0));
+  ssystem sys;
+  double **mat = sys.heap.mat(size, size);
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    fill_matrix(mat, size);
+    state.ResumeTiming();
+    int *pivots = 0;
+    benchmark::DoNotOptimize(ludecomp(&sys, mat, size, FALSE, &pivots));
+  }
+
+  state.SetItemsProcessed(state.iterations() * size * size);
+}
+BENCHMARK(BM_ludecomp)->RangeMultiplier(2)->Range(32, 512);
+
+void BM_solve(benchmark::State &state)
+{
+  int size = int(state.range(0));
+  ssystem sys;
+  double **mat = sys.heap.mat(size, size);
+  fill_matrix(mat, size);
+  int *pivots = 0;
+  ludecomp(&sys, mat, size, FALSE, &pivots);
+
+  std::vector<double> b(size, 1.0), x(size, 0.0);
+
+  for (auto _ : state) {
+    solve(mat, x.data(), b.data(), size, pivots);
+    benchmark::DoNotOptimize(x.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * size * size);
+}
+BENCHMARK(BM_solve)->RangeMultiplier(2)->Range(32, 512);
+
+//  16 right hand sides at once, items are per right hand side
+void BM_solveMulti(benchmark::State &state)
+{
+  int size = int(state.range(0)), nrhs = 16;
+  ssystem sys;
+  double **mat = sys.heap.mat(size, size);
+  fill_matrix(mat, size);
+  int *pivots = 0;
+  ludecomp(&sys, mat, size, FALSE, &pivots);
+
+  double **x = sys.heap.mat(size, nrhs);
+
+  for (auto _ : state) {
+    for (int i = 0; i < size; ++i) {
+      for (int c = 0; c < nrhs; ++c) {
+        x[i][c] = 1.0;
+      }
+    }
+    solveMulti(mat, x, size, nrhs, pivots);
+    benchmark::DoNotOptimize(x[0]);
+  }
+
+  state.SetItemsProcessed(state.iterations() * size * size * nrhs);
+}
+BENCHMARK(BM_solveMulti)->RangeMultiplier(2)->Range(32, 512);
+
+// ----------------------------------------------------------------------------
+//  P*q passes on a synthetic cube - argument is the expansion order
+
+/**
+ *  @brief A cube problem set up up to the upward pass matrices
+ *
+ *  With "matrices" false, the setup stops before the direct and upward
+ *  pass matrices.
+ */
+class CubeProblem
+{
+public:
+  CubeProblem(int order, int n, bool matrices = true)
+    : panels(0)
+  {
+    sys.order = order;
+    charge *chglist = make_cube(&sys, n);
+
+    mulInit(&sys, chglist);
+
+    int up_size = 0;
+    for (charge *c = chglist; c; c = c->next) {
+      ++up_size;
+    }
+    panels = up_size;
+
+    mulMultiAlloc(&sys, MAX(sys.max_eval_pnt, sys.max_panel), sys.order, sys.depth);
+
+    if (! matrices) {
+      return;
+    }
+
+    blk_matrix *blkmat = 0;
+    int *real_index = 0;
+    mulMatDirect(&sys, &blkmat, &real_index, up_size, up_size);
+    mulMatUp(&sys);
+
+    for (int i = 1; i <= up_size; ++i) {
+      sys.q[i] = 1.0;
+    }
+  }
+
+  ssystem sys;
+  int panels;
+};
+
+void BM_mulDirect(benchmark::State &state)
+{
+  CubeProblem problem(int(state.range(0)), 24);
+
+  for (auto _ : state) {
+    mulDirect(&problem.sys);
+  }
+
+  state.SetItemsProcessed(state.iterations() * problem.panels);
+}
+BENCHMARK(BM_mulDirect)->DenseRange(1, MAXORDER)->Unit(benchmark::kMicrosecond);
+
+//  setup of the near-field (Q2P) blocks - calcp() over the neighbor panels
+void BM_mulMatDirect(benchmark::State &state)
+{
+  int panels = 0;
+
+  //  mulMatDirect() changes the cubes, so every run gets a fresh problem
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<CubeProblem> problem(new CubeProblem(2, int(state.range(0)), false));
+    panels = problem->panels;
+    blk_matrix *blkmat = 0;
+    int *real_index = 0;
+    state.ResumeTiming();
+    mulMatDirect(&problem->sys, &blkmat, &real_index, panels, panels);
+    state.PauseTiming();
+    problem.reset();
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(state.iterations() * panels);
+}
+BENCHMARK(BM_mulMatDirect)->Arg(12)->Arg(24)->Unit(benchmark::kMillisecond);
+
+void BM_mulUp(benchmark::State &state)
+{
+  CubeProblem problem(int(state.range(0)), 24);
+
+  for (auto _ : state) {
+    mulUp(&problem.sys);
+  }
+
+  state.SetItemsProcessed(state.iterations() * problem.panels);
+}
+BENCHMARK(BM_mulUp)->DenseRange(1, MAXORDER)->Unit(benchmark::kMicrosecond);
+
+}
@@ -6,14 +6,18 @@ core_src=[
   "fastcap2/src/fastcap2.cc",
   "fastcap2/src/problem.cc",
   "fastcap2/src/surface.cc",
+  "src/autotune.cc",
   "src/blkDirect.cc",
   "src/calcp.cc",
   "src/capsolve.cc",
+  "src/coarse.cc",
   "src/counters.cc",
   "src/direct.cc",
   "src/electric.cc",
+  "src/estimate.cc",
   "src/fastcap_solve.cc",
   "src/heap.cc",
+  "src/hmatrix.cc",
   "src/input.cc",
   "src/mulDisplay.cc",
   "src/mulDo.cc",
@@ -26,7 +30,9 @@ core_src=[
   "src/psMatDisplay.cc",
   "src/quickif.cc",
   "src/patran.cc",
+  "src/rotation.cc",
   "src/savemat_mod.cc",
+  "src/trace.cc",
   "src/zbuf2fastcap.cc",
   "src/zbufInOut.cc",
   "src/zbufProj.cc",
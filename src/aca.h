@@ -0,0 +1,127 @@
+
+#if !defined(aca_H)
+#define aca_H
+
+#include "mulGlobal.h"
+#include "heap.h"
+
+#include <vector>
+#include <cmath>
+
+/**
+ *  @brief Adaptive cross approximation of a matrix block
+ *
+ *  Approximates the nrows x ncols block given by entry(i, j) by u v^T
+ *  using partial pivoting (Bebendorf): u is nrows x rank, v is ncols x rank.
+ *  Only the rows and columns of the crosses are evaluated. The iteration
+ *  stops when the last cross is below "tol" times the estimated Frobenius
+ *  norm of the approximation and ACACHECK sample rows are represented to
+ *  that accuracy too.
+ *
+ *  Returns the rank, or -1 if more than "maxrank" crosses would be needed.
+ *  u and v are allocated on the heap with the given memory type, but only
+ *  if the approximation succeeds.
+ */
+template <class E>
+int aca(Heap &heap, MemoryType type, int nrows, int ncols, double tol, int maxrank, E entry, double ***u, double ***v)
+{
+  std::vector<std::vector<double> > us, vs;
+  std::vector<bool> row_used(nrows, false);
+  std::vector<double> a(ncols), b(nrows);
+  double norm2 = 0.0;
+  int i = 0;
+
+  auto dot = [] (const std::vector<double> &x, const std::vector<double> &y) {
+    double s = 0.0;
+    for(size_t k = 0; k < x.size(); k++) s += x[k] * y[k];
+    return s;
+  };
+
+  auto residual_row = [&] (int r, std::vector<double> &res) {
+    for(int j = 0; j < ncols; j++) res[j] = entry(r, j);
+    for(size_t l = 0; l < us.size(); l++) {
+      double ulr = us[l][r];
+      const double *vl = vs[l].data();
+      for(int j = 0; j < ncols; j++) res[j] -= ulr * vl[j];
+    }
+  };
+
+  while(true) {
+
+    row_used[i] = true;
+    residual_row(i, a);
+
+    int jmax = 0;
+    for(int j = 1; j < ncols; j++) {
+      if(ABS(a[j]) > ABS(a[jmax])) jmax = j;
+    }
+
+    if(a[jmax] == 0.0) {
+      /* row is represented exactly - try the next unused one */
+      for(i = 0; i < nrows && row_used[i]; i++)
+          ;
+      if(i == nrows) break;
+      continue;
+    }
+
+    if(int(us.size()) == maxrank) return -1;
+
+    /* residual column jmax */
+    for(int r = 0; r < nrows; r++) b[r] = entry(r, jmax);
+    for(size_t l = 0; l < us.size(); l++) {
+      double vlj = vs[l][jmax];
+      const double *ul = us[l].data();
+      for(int r = 0; r < nrows; r++) b[r] -= vlj * ul[r];
+    }
+
+    double pivot = a[jmax];
+    for(int j = 0; j < ncols; j++) a[j] /= pivot;
+
+    double uu = dot(b, b), vv = dot(a, a);
+    for(size_t l = 0; l < us.size(); l++) {
+      norm2 += 2.0 * dot(us[l], b) * dot(vs[l], a);
+    }
+    norm2 += uu * vv;
+
+    us.push_back(b);
+    vs.push_back(a);
+
+    /* next row: largest entry of the new column among the unused rows */
+    int inext = -1;
+    for(int r = 0; r < nrows; r++) {
+      if(!row_used[r] && (inext < 0 || ABS(b[r]) > ABS(b[inext]))) inext = r;
+    }
+    if(inext < 0) break;
+
+    if(sqrt(uu * vv) <= tol * sqrt(ABS(norm2))) {
+      /* the pivots may have missed parts of the block (e.g. for touching
+         clusters) - check some unused rows before stopping and continue
+         from the first one not represented */
+      double limit = tol * sqrt(ABS(norm2) / (double(nrows) * double(ncols)));
+      inext = -1;
+      for(int c = 0; c < ACACHECK && inext < 0; c++) {
+        int r = int((long long)(2 * c + 1) * nrows / (2 * ACACHECK));
+        if(row_used[r]) continue;
+        residual_row(r, a);
+        for(int j = 0; j < ncols && inext < 0; j++) {
+          if(ABS(a[j]) > limit) inext = r;
+        }
+      }
+      if(inext < 0) break;
+    }
+
+    i = inext;
+  }
+
+  int rank = int(us.size());
+  *u = heap.mat(nrows, rank, type);
+  *v = heap.mat(ncols, rank, type);
+  for(int l = 0; l < rank; l++) {
+    for(int r = 0; r < nrows; r++) (*u)[r][l] = us[l][r];
+    for(int j = 0; j < ncols; j++) (*v)[j][l] = vs[l][j];
+  }
+
+  return rank;
+}
+
+#endif
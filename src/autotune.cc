@@ -0,0 +1,587 @@
+
+#include "autotune.h"
+
+#include "mulGlobal.h"
+#include "mulStruct.h"
+#include "mulMulti.h"
+#include "mulLocal.h"
+#include "calcp.h"
+#include "rotation.h"
+
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+//  minimum time a calibration kernel is run for
+const double min_calibration_time = 1e-3;
+
+//  relative capacitance error model: error_scale * error_ratio^(order+1)
+//  times the fraction of panel interactions done by expansions. The
+//  worst case M2L truncation ratio is sqrt(3)/(nnbrs+1), but charge
+//  cancellation makes the capacitance errors decay much faster. These
+//  values are an upper envelope of the errors measured on the examples
+//  (1x1bus, via, 1x1fine) for orders 1 to 4.
+const double error_scale = 0.64;
+const double error_ratio = 0.25;
+
+double now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//  runs "kernel" (which returns the number of elements processed) for
+//  some time and returns the time per element - the best of three runs
+//  is taken to suppress noise
+template <class Kernel>
+double time_per_element(Kernel kernel)
+{
+  double best = 0.0;
+
+  for (int run = 0; run < 3; ++run) {
+    long long n = 0;
+    double start = now(), elapsed = 0.0;
+    do {
+      n += kernel();
+      elapsed = now() - start;
+    } while (elapsed < min_calibration_time);
+    if (run == 0 || elapsed / n < best) {
+      best = elapsed / n;
+    }
+  }
+
+  return best;
+}
+
+struct cube_stat
+{
+  cube_stat() : panels(0), kids(0) { }
+  int panels;                   //  panels in the cube
+  int kids;                     //  number of nonempty kids
+};
+
+typedef std::unordered_map<long long, cube_stat> level_map;
+
+/**
+ *  @brief The panel centers and the root cube as placeq() computes it
+ */
+struct panel_geometry
+{
+  panel_geometry(charge *chglist);
+
+  std::vector<double> x, y, z;
+  double minx, miny, minz, length0;
+};
+
+panel_geometry::panel_geometry(charge *chglist)
+  : minx(0.0), miny(0.0), minz(0.0), length0(0.0)
+{
+  double maxx = 0.0, maxy = 0.0, maxz = 0.0, max_tile = 0.0;
+
+  for (charge *nq = chglist; nq; nq = nq->next) {
+    if (x.empty()) {
+      minx = maxx = nq->x;
+      miny = maxy = nq->y;
+      minz = maxz = nq->z;
+    } else {
+      minx = MIN(minx, nq->x);
+      maxx = MAX(maxx, nq->x);
+      miny = MIN(miny, nq->y);
+      maxy = MAX(maxy, nq->y);
+      minz = MIN(minz, nq->z);
+      maxz = MAX(maxz, nq->z);
+    }
+    x.push_back(nq->x);
+    y.push_back(nq->y);
+    z.push_back(nq->z);
+    max_tile = MAX(max_tile, tilelength(nq));
+  }
+
+  if (maxx - minx < max_tile) {
+    minx -= 0.5 * max_tile;
+    maxx += 0.5 * max_tile;
+  }
+  if (maxy - miny < max_tile) {
+    miny -= 0.5 * max_tile;
+    maxy += 0.5 * max_tile;
+  }
+  if (maxz - minz < max_tile) {
+    minz -= 0.5 * max_tile;
+    maxz += 0.5 * max_tile;
+  }
+
+  length0 = MAX(maxx - minx, MAX(maxy - miny, maxz - minz));
+}
+
+/**
+ *  @brief The nonempty cubes of all levels for one partitioning depth
+ */
+class cube_occupancy
+{
+public:
+  cube_occupancy(const panel_geometry &geo, int depth);
+
+  int depth() const
+  {
+    return int(m_levels.size()) - 1;
+  }
+
+  const level_map &level(int l) const
+  {
+    return m_levels[l];
+  }
+
+  long long side(int l) const
+  {
+    return 1LL << l;
+  }
+
+  const cube_stat *find(int l, long long j, long long k, long long m) const
+  {
+    long long s = side(l);
+    if (j < 0 || k < 0 || m < 0 || j >= s || k >= s || m >= s) {
+      return 0;
+    }
+    level_map::const_iterator c = m_levels[l].find((j * s + k) * s + m);
+    return c == m_levels[l].end() ? 0 : &c->second;
+  }
+
+  void decode(int l, long long key, long long &j, long long &k, long long &m) const
+  {
+    long long s = side(l);
+    m = key % s;
+    k = (key / s) % s;
+    j = key / (s * s);
+  }
+
+  //  number of panels (or nonempty cubes if "cubes" is true) in the box
+  //  [lo, hi) of level l
+  long long sum_box(int l, const long long *lo, const long long *hi, bool cubes) const;
+
+private:
+  std::vector<level_map> m_levels;
+};
+
+cube_occupancy::cube_occupancy(const panel_geometry &geo, int depth)
+  : m_levels(depth + 1)
+{
+  long long s = side(depth);
+  double length = (1.01 * geo.length0) / s;
+
+  for (size_t i = 0; i < geo.x.size(); ++i) {
+    long long j = (long long)((geo.x[i] - geo.minx) / length);
+    long long k = (long long)((geo.y[i] - geo.miny) / length);
+    long long m = (long long)((geo.z[i] - geo.minz) / length);
+    m_levels[depth][(j * s + k) * s + m].panels += 1;
+  }
+
+  for (int l = depth; l > 0; --l) {
+    for (level_map::const_iterator c = m_levels[l].begin(); c != m_levels[l].end(); ++c) {
+      long long j, k, m;
+      decode(l, c->first, j, k, m);
+      long long ps = side(l - 1);
+      cube_stat &parent = m_levels[l - 1][((j / 2) * ps + k / 2) * ps + m / 2];
+      parent.panels += c->second.panels;
+      parent.kids += 1;
+    }
+  }
+}
+
+long long cube_occupancy::sum_box(int l, const long long *lo, const long long *hi, bool cubes) const
+{
+  long long s = side(l);
+  long long blo[3], bhi[3];
+  long long volume = 1;
+  for (int i = 0; i < 3; ++i) {
+    blo[i] = MAX(lo[i], 0LL);
+    bhi[i] = MIN(hi[i], s);
+    if (bhi[i] <= blo[i]) {
+      return 0;
+    }
+    volume *= bhi[i] - blo[i];
+  }
+
+  long long sum = 0;
+
+  if (volume <= 8 * (long long)(m_levels[l].size())) {
+    for (long long j = blo[0]; j < bhi[0]; ++j) {
+      for (long long k = blo[1]; k < bhi[1]; ++k) {
+        for (long long m = blo[2]; m < bhi[2]; ++m) {
+          const cube_stat *c = find(l, j, k, m);
+          if (c) {
+            sum += cubes ? 1 : c->panels;
+          }
+        }
+      }
+    }
+  } else {
+    //  sparse level: cheaper to scan the nonempty cubes
+    for (level_map::const_iterator c = m_levels[l].begin(); c != m_levels[l].end(); ++c) {
+      long long j, k, m;
+      decode(l, c->first, j, k, m);
+      if (j >= blo[0] && j < bhi[0] && k >= blo[1] && k < bhi[1] && m >= blo[2] && m < bhi[2]) {
+        sum += cubes ? 1 : c->second.panels;
+      }
+    }
+  }
+
+  return sum;
+}
+
+tune_estimate estimate(const cube_occupancy &occ, long long panels, int order, int nnbrs, bool adapt, int m2ltyp)
+{
+  tune_estimate e;
+  e.order = order;
+  e.depth = occ.depth();
+  e.panels = panels;
+  e.rotate = m2l_rotated(m2ltyp, order);
+
+  int depth = occ.depth();
+  long long terms = multerms(order);
+
+  for (int l = 0; l <= depth; ++l) {
+    e.cube_cells += occ.side(l) * occ.side(l) * occ.side(l);
+  }
+
+  long long exact_limit = adapt ? terms : -1;
+
+  //  direct part and preconditioner on the lowest level (see getnbrs() and
+  //  olmulMatPrecond())
+  for (level_map::const_iterator c = occ.level(depth).begin(); c != occ.level(depth).end(); ++c) {
+
+    long long j, k, m;
+    occ.decode(depth, c->first, j, k, m);
+    long long idx[3] = { j, k, m };
+
+    //  side length of the exact ancestor
+    long long es = 1;
+    for (int l = depth - 1; l > 0; --l) {
+      const cube_stat *p = occ.find(l, j >> (depth - l), k >> (depth - l), m >> (depth - l));
+      if (! p || p->panels > exact_limit) {
+        break;
+      }
+      es *= 2;
+    }
+
+    long long lo[3], hi[3];
+    for (int i = 0; i < 3; ++i) {
+      lo[i] = MIN(idx[i] - nnbrs, es * (idx[i] / es));
+      hi[i] = MAX(idx[i] + nnbrs + 1, es * (1 + idx[i] / es));
+    }
+    e.q2p += c->second.panels * occ.sum_box(depth, lo, hi, false);
+
+    for (int i = 0; i < 3; ++i) {
+      lo[i] = idx[i] - 1;
+      hi[i] = idx[i] + 2;
+    }
+    long long near = occ.sum_box(depth, lo, hi, false);
+    e.precond += c->second.panels * near;
+    //  LU factors of the near field and a solve for the cube's panels
+    e.precond_setup += near * near * near / 3 + near * near * c->second.panels;
+
+  }
+
+  //  expansions on levels 2 and below (see linkcubes(), getInter() and
+  //  mulMatEval())
+  for (int l = 2; l <= depth; ++l) {
+
+    for (level_map::const_iterator c = occ.level(l).begin(); c != occ.level(l).end(); ++c) {
+
+      long long j, k, m;
+      occ.decode(l, c->first, j, k, m);
+
+      const cube_stat *parent = occ.find(l - 1, j / 2, k / 2, m / 2);
+      if (l > 2 && parent->panels <= exact_limit) {
+        continue;               //  handled by the exact ancestor
+      }
+
+      long long idx[3] = { j, k, m };
+      long long lo[3], hi[3];
+
+      //  kids of the parent's neighbors minus the own neighbors
+      for (int i = 0; i < 3; ++i) {
+        lo[i] = idx[i] / 2 - nnbrs;
+        hi[i] = idx[i] / 2 + nnbrs + 1;
+      }
+      long long candidates = 0;
+      for (long long pj = lo[0]; pj < hi[0]; ++pj) {
+        for (long long pk = lo[1]; pk < hi[1]; ++pk) {
+          for (long long pm = lo[2]; pm < hi[2]; ++pm) {
+            const cube_stat *p = occ.find(l - 1, pj, pk, pm);
+            if (p) {
+              candidates += p->kids;
+            }
+          }
+        }
+      }
+
+      for (int i = 0; i < 3; ++i) {
+        lo[i] = idx[i] - nnbrs;
+        hi[i] = idx[i] + nnbrs + 1;
+      }
+      long long ilist = MAX(candidates - occ.sum_box(l, lo, hi, true), 0LL);
+
+      long long n = c->second.panels;
+
+      if (n <= exact_limit) {
+        //  exact cube: multipoles of the interaction list are evaluated
+        //  directly, charges go into the parent's multipole
+        e.m2p += n * terms * ilist;
+        if (l > 2) {
+          e.q2m += n * terms;
+        }
+      } else {
+        e.m2l += ilist;
+        if (l > 2) {
+          e.m2m += 1;
+          e.l2l += 1;
+        }
+        if (l == depth) {
+          e.q2m += n * terms;
+          e.l2p += n * terms;
+        }
+      }
+
+    }
+
+  }
+
+  double pairs = double(panels) * double(panels);
+  e.far_fraction = pairs > 0.0 ? MAX(0.0, 1.0 - double(e.q2p) / pairs) : 0.0;
+
+  return e;
+}
+
+}
+
+// ----------------------------------------------------------------------------
+
+kernel_costs::kernel_costs()
+  : calcp(0.0), madd(0.0), cube_cell(0.0)
+{
+  for (int i = 0; i <= MAXORDER; ++i) {
+    expansion[i] = 0.0;
+  }
+}
+
+void kernel_costs::calibrate(charge *chglist)
+{
+  ssystem sys;
+
+  //  calcp: a few panels evaluated at the centers of the others
+  std::vector<charge *> sample;
+  for (charge *nq = chglist; nq && sample.size() < 64; nq = nq->next) {
+    sample.push_back(nq);
+  }
+
+  if (! sample.empty()) {
+    double pfd = 0.0, sum = 0.0;
+    calcp = time_per_element([&] () {
+      for (size_t i = 0; i < sample.size(); ++i) {
+        for (size_t j = 0; j < sample.size(); ++j) {
+          sum += ::calcp(&sys, sample[i], sample[j]->x, sample[j]->y, sample[j]->z, &pfd);
+        }
+      }
+      return (long long)(sample.size() * sample.size());
+    });
+  }
+
+  //  dense matrix-vector product, as used by the P*q passes
+  const int size = 128;
+  std::vector<double> mat(size * size, 1e-3), q(size, 1.0), p(size, 0.0);
+  int col = 0;
+
+  madd = time_per_element([&] () {
+    for (int i = 0; i < size; ++i) {
+      const double *row = &mat[i * size];
+      double s = 0.0;
+      for (int j = 0; j < size; ++j) {
+        s += row[j] * q[j];
+      }
+      p[i] += s;
+    }
+    col = (col + 1) % size;
+    q[col] = p[col];
+    return (long long)(size * size);
+  });
+
+  //  cube pointer arrays: allocated like placeq() does and scanned as
+  //  often as mulInit() does
+  const int scans = 10;
+  const int side = 64;
+
+  cube_cell = time_per_element([&] () {
+    ssystem csys;
+    cube ****cubes = csys.heap.alloc<cube***>(side, AMSC);
+    for (int j = 0; j < side; ++j) {
+      cubes[j] = csys.heap.alloc<cube**>(side, AMSC);
+      for (int k = 0; k < side; ++k) {
+        cubes[j][k] = csys.heap.alloc<cube*>(side, AMSC);
+      }
+    }
+    long long nonempty = 0;
+    for (int n = 0; n < scans; ++n) {
+      for (int j = 0; j < side; ++j) {
+        for (int k = 0; k < side; ++k) {
+          for (int l = 0; l < side; ++l) {
+            if (cubes[j][k][l] != NULL) {
+              ++nonempty;
+            }
+          }
+        }
+      }
+    }
+    return (long long) side * side * side + nonempty;
+  });
+
+  //  expansion matrix builds - M2L as the most frequent one
+  for (int order = 1; order <= MAXORDER; ++order) {
+
+    ssystem esys;
+    esys.order = order;
+    mulMultiAlloc(&esys, 0, order, 0);
+
+    long long terms = multerms(order);
+    int shift = 0;
+
+    expansion[order] = time_per_element([&] () {
+      shift = (shift + 1) % 7;
+      mulMulti2Local(&esys, 2.25, 0.25, 1.25, 0.25, 0.25, 0.25 + 1e-3 * shift, order);
+      return terms * terms;
+    });
+
+  }
+}
+
+const kernel_costs &kernel_costs::get(charge *chglist)
+{
+  static kernel_costs costs;
+  static bool calibrated = false;
+
+  if (! calibrated) {
+    costs.calibrate(chglist);
+    calibrated = true;
+  }
+
+  return costs;
+}
+
+// ----------------------------------------------------------------------------
+
+tune_estimate::tune_estimate()
+  : order(0), depth(0), panels(0), cube_cells(0), q2p(0), precond(0), precond_setup(0),
+    q2m(0), l2p(0), m2p(0), m2m(0), m2l(0), l2l(0), rotate(false), far_fraction(0.0)
+{
+  //  .. nothing yet ..
+}
+
+double tune_estimate::setup_time(const kernel_costs &costs) const
+{
+  double terms = multerms(order);
+  //  Q2P is computed twice, for the direct part and for the preconditioner
+  return cube_cells * costs.cube_cell
+         + 2.0 * q2p * costs.calcp
+         + precond_setup * costs.madd
+         + (q2m + l2p + m2p + terms * terms * (m2m + (rotate ? 0 : m2l) + l2l)) * costs.expansion[order];
+}
+
+double tune_estimate::iteration_time(const kernel_costs &costs) const
+{
+  double terms = multerms(order);
+  double m2l_ops = rotate ? double(m2l_rotation::ops(order)) : terms * terms;
+  return (q2p + precond + q2m + l2p + m2p + terms * terms * (m2m + l2l) + m2l_ops * m2l) * costs.madd;
+}
+
+double tune_estimate::memory() const
+{
+  double terms = multerms(order);
+  double m2l_size = rotate ? 3.0 : terms * terms;
+  return sizeof(cube *) * double(cube_cells)
+         + sizeof(double) * (2.0 * q2p + q2m + l2p + m2p + terms * terms * (m2m + l2l) + m2l_size * m2l);
+}
+
+double tune_estimate::error() const
+{
+  return error_scale * far_fraction * pow(error_ratio, order + 1);
+}
+
+tune_estimate estimate_setup(const ssystem *sys, charge *chglist, int order, int depth)
+{
+  panel_geometry geo(chglist);
+  cube_occupancy occ(geo, depth);
+  return estimate(occ, (long long) geo.x.size(), order, sys->nnbrs, sys->adapt, sys->m2ltyp);
+}
+
+double predicted_iterations(const ssystem *sys)
+{
+  //  GMRES with the overlapped preconditioner gains about a third of a
+  //  digit per iteration after a few initial ones (the examples take 2
+  //  to 12 iterations per column for the default tolerance of 0.01)
+  int columns = MAX(1, sys->num_cond - int(sys->kill_num_list.size()) - int(sys->kinp_num_list.size()));
+  return columns * (4.0 + 3.0 * log10(1.0 / MAX(sys->iter_tol, 1e-15)));
+}
+
+void autotune(ssystem *sys, charge *chglist)
+{
+  const kernel_costs &costs = kernel_costs::get(chglist);
+
+  panel_geometry geo(chglist);
+  long long panels = (long long) geo.x.size();
+
+  double iterations = predicted_iterations(sys);
+
+  bool found = false;
+  tune_estimate best, most_accurate;
+  double best_time = 0.0;
+  long long last_cubes = 0;
+
+  for (int depth = 2; depth <= MAXDEP; ++depth) {
+
+    cube_occupancy occ(geo, depth);
+
+    for (int order = 1; order <= MAXORDER; ++order) {
+
+      tune_estimate e = estimate(occ, panels, order, sys->nnbrs, sys->adapt, sys->m2ltyp);
+      double time = e.setup_time(costs) + iterations * e.iteration_time(costs);
+
+      if (most_accurate.order == 0 || e.error() < most_accurate.error()) {
+        most_accurate = e;
+      }
+      if (e.error() <= sys->autotune && (! found || time < best_time)) {
+        found = true;
+        best = e;
+        best_time = time;
+      }
+
+    }
+
+    //  stop once the lowest level cubes hold a single panel on average or
+    //  further levels do not separate the panels any more
+    long long cubes = (long long) occ.level(depth).size();
+    if (cubes * 2 > panels || cubes == last_cubes) {
+      break;
+    }
+    last_cubes = cubes;
+
+  }
+
+  if (! found) {
+    sys->warn("autotune: no expansion order meets the target error %g - using the most accurate one\n", sys->autotune);
+    best = most_accurate;
+  }
+
+  sys->order = best.order;
+  sys->depth = best.depth;
+
+  sys->msg("\nAUTOTUNE (target error %g)\n", sys->autotune);
+  sys->msg("  Calibration: calcp %.3g ns, multiply-add %.3g ns, M2L element %.3g ns (order %d)\n",
+           costs.calcp * 1e9, costs.madd * 1e9, costs.expansion[best.order] * 1e9, best.order);
+  sys->msg("  Selected expansion order: %d\n", best.order);
+  sys->msg("  Selected partitioning depth: %d\n", best.depth);
+  sys->msg("  Predicted setup time: %.3g s\n", best.setup_time(costs));
+  sys->msg("  Predicted iteration time: %.3g s (x %.0f iterations)\n", best.iteration_time(costs), iterations);
+  sys->msg("  Predicted matrix memory: %.3g MB\n", best.memory() * 1e-6);
+  sys->msg("  Estimated error: %.2g\n", best.error());
+}
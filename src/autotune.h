@@ -0,0 +1,94 @@
+
+#if !defined(autotune_H)
+#define autotune_H
+
+#include "mulGlobal.h"
+
+struct ssystem;
+struct charge;
+
+/**
+ *  @brief Per-kernel costs measured with a quick on-machine microbenchmark
+ *
+ *  All costs are in seconds per element. "calibrate" takes a few
+ *  milliseconds; the result of the first calibration is kept for the
+ *  lifetime of the process (see "get").
+ */
+struct kernel_costs
+{
+  kernel_costs();
+
+  double calcp;                 //  per potential coefficient (calcp() call)
+  double madd;                  //  per multiply-add of a dense matrix product
+  double expansion[MAXORDER+1]; //  per expansion matrix element, by order
+  double cube_cell;             //  per cell of the cube pointer arrays
+                                //  (allocation and the scans in mulInit())
+
+  /**
+   *  @brief Measures the costs using some panels of the given list
+   */
+  void calibrate(charge *chglist);
+
+  /**
+   *  @brief Gets the process-wide calibrated costs, calibrating on first use
+   */
+  static const kernel_costs &get(charge *chglist);
+};
+
+/**
+ *  @brief Operation and storage counts predicted for one (order, depth) pair
+ *
+ *  The counts are derived from per-level cube statistics in the same way
+ *  placeq(), setExact(), getnbrs() and getInter() build the cube structure,
+ *  but without allocating it. The interaction lists are estimated without
+ *  the RADINTER merging of parent-level cubes, so M2L counts are an upper
+ *  bound.
+ */
+struct tune_estimate
+{
+  tune_estimate();
+
+  int order, depth;
+  long long panels;             //  number of panels incl. dummies
+  long long cube_cells;         //  cells of the cube pointer arrays, all levels
+  long long q2p;                //  near-field potential coefficients
+  long long precond;            //  preconditioner coefficients
+  long long precond_setup;      //  multiply-adds for the preconditioner inversion
+  long long q2m, l2p, m2p;      //  panel to/from expansion coefficients
+  long long m2m, m2l, l2l;      //  expansion to expansion shifts (multerms^2 each)
+  bool rotate;                  //  M2L by rotation (m2l_rotation::ops() each, nothing stored)
+  double far_fraction;          //  fraction of panel pairs handled by expansions
+
+  double setup_time(const kernel_costs &costs) const;
+  double iteration_time(const kernel_costs &costs) const;
+  double memory() const;
+  double error() const;
+};
+
+/**
+ *  @brief Predicts the counts for the given panel list, order and depth
+ *
+ *  The neighbor shells, adaptive exact cubes and M2L type are taken from sys.
+ */
+tune_estimate estimate_setup(const ssystem *sys, charge *chglist, int order, int depth);
+
+/**
+ *  @brief Predicts the total number of iterations over all solved conductors
+ *
+ *  This is a rough figure based on the iteration tolerance only.
+ */
+double predicted_iterations(const ssystem *sys);
+
+/**
+ *  @brief Picks the expansion order and partitioning depth for sys->autotune
+ *
+ *  Candidates are all orders up to MAXORDER and all depths from 2 down
+ *  to where the lowest level cubes hold a single panel on average.
+ *  The cheapest candidate (setup plus predicted iterations) whose
+ *  estimated error is below sys->autotune wins. If none is accurate
+ *  enough, the most accurate one is taken. The choice is stored in
+ *  sys->order and sys->depth and logged.
+ */
+void autotune(ssystem *sys, charge *chglist);
+
+#endif
@@ -5,695 +5,696 @@
 #include "blkDirect.h"
 #include "resusage.h"
 #include "counters.h"
+#include "parallel.h"
 
 #include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <future>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <cassert>
 
-#define SQRMAT 0                /* for rdMat(), wrMat() */
-#define TRIMAT 1
-#define COLMAT 2
-#define LOWMAT 0                /* for blkMatSolve() */
-#define UPPMAT 1
-#define LO2TR 3                 /* for matXfer() */
-#define UP2TR 4
-#define L11 0                   /*1/4 matrix file names, see getName() */
-#define U11 1
-#define U12 2
-#define L21 3
-#define LTIL 4
-#define UTIL 5
-#define PMODE 0644              /* protection code used with write() */
-
-#define SQDEX(i, j, siz) ((i)*(siz) + (j))
-#define LODEX(i, j, siz) (((i)*((i)+1))/2 + (j))
-#define UPDEX(i, j, siz) (((i)*(2*(siz) - (i) - 1))/2 + (j))
-
-#if defined(UNUSED)
+namespace {
+
 /*
-  index into a square siz x siz matrix stored linearly
+  c[r][*] -= sum_t l[r][t] * u[t][*] for rows r of [from, to) - all
+  matrices are row-major with nb columns, u is nb x nb
 */
-static int sqrdex(int i, int j, int siz)
-/* int i, j, siz: row, column and size */
+void tile_update(double *c, const double *l, const double *u, int from, int to, int nb)
 {
-  return(i*siz + j);
+  const int rblk = 16, tblk = 64;
+
+  for (int r0 = from; r0 < to; r0 += rblk) {
+    int r1 = MIN(r0 + rblk, to);
+    for (int t0 = 0; t0 < nb; t0 += tblk) {
+      int t1 = MIN(t0 + tblk, nb);
+      for (int r = r0; r < r1; r++) {
+        double *cr = c + size_t(r) * nb;
+        const double *lr = l + size_t(r) * nb;
+        for (int t = t0; t < t1; t++) {
+          double a = lr[t];
+          if (a != 0.0) {
+            const double *ut = u + size_t(t) * nb;
+            for (int j = 0; j < nb; j++) {
+              cr[j] -= a * ut[j];
+            }
+          }
+        }
+      }
+    }
+  }
 }
-#endif
 
-#if defined(UNUSED)
 /*
-  index into a lower triangular (w/diagonal) siz x siz matrix stored linearly
+  x -= m x_k for rows [from, to): m is the panel, xk the nb entries
+  multiplied with
 */
-static int lowdex(ssystem *sys, int i, int j, int siz)
-/* int i, j, siz: row, column and size */
+void panel_matvec(double *x, const double *m, const double *xk, int from, int to, int nb)
 {
-  int ret;
-  if(j > i || (ret = i*(i+1)/2 + j) > siz*(1+siz)/2) {
-    sys->error("lowdex: bad indices for lower triangular i=%d  j=%d siz =%d\n",
-               i, j, siz);
+  for (int r = from; r < to; r++) {
+    const double *mr = m + size_t(r) * nb;
+    double s = 0.0;
+    for (int j = 0; j < nb; j++) {
+      s += mr[j] * xk[j];
+    }
+    x[r] -= s;
   }
-  else return(ret);
 }
-#endif
 
-#if defined(UNUSED)
 /*
-  index into an upper triangular (w/diagonal) siz x siz matrix stored linearly
+  x[r][*] -= sum_t m[r][t] * xk[t][*] for rows r of [from, to) and t of
+  [0, nt): x and xk have nrhs columns, m has nb columns
 */
-static int uppdex(ssystem *sys, int i, int j, int siz)
-/* int i, j, siz: row, column and size */
+void panel_update(double *x, const double *m, const double *xk, int from, int to, int nb, int nrhs, int nt)
 {
-  int ret;
-  
-  if(j < i || (ret = i*siz - i*(i-1)/2 + j - i) > siz*(1+siz)/2) {
-    sys->error("uppdex: bad indices for upper triangular i=%d  j=%d siz =%d\n",
-               i, j, siz);
+  for (int r = from; r < to; r++) {
+    const double *mr = m + size_t(r) * nb;
+    double *xr = x + size_t(r) * nrhs;
+    for (int t = 0; t < nt; t++) {
+      double a = mr[t];
+      if (a != 0.0) {
+        const double *xt = xk + size_t(t) * nrhs;
+        for (int c = 0; c < nrhs; c++) {
+          xr[c] -= a * xt[c];
+        }
+      }
+    }
   }
-  else return(ret);
 }
-#endif
 
-#if defined(UNUSED)
 /*
-  for debug only - dumps upper left corner of a matrix
+  applies the row interchanges of step k to the panel
 */
-static void dumpMatCor(ssystem *sys, double **mat, double *vec, int fsize)
-/* int fsize: full matrix size for flat storage */
-/* double **mat, *vec: does first one that's not null */
+void apply_pivots(double *panel, const std::vector<int> &pivots, int k, int nb)
 {
-  int i, j, size = 5;
-
-  if(mat != NULL) {             /* full matrix */
-    sys->msg("\nUPPER LEFT CORNER - full %dx%d matrix\n", fsize, fsize);
-    for(i = 0; i < MIN(size, fsize); i++) {
-      for(j = 0; j < MIN(size, fsize); j++) {
-        sys->msg("%.5e ", mat[i][j]);
+  for (int c = 0; c < nb; c++) {
+    int i = k * nb + c, p = pivots[i];
+    if (p != i) {
+      double *ri = panel + size_t(i) * nb, *rp = panel + size_t(p) * nb;
+      for (int j = 0; j < nb; j++) {
+        double t = ri[j];
+        ri[j] = rp[j];
+        rp[j] = t;
       }
-      sys->msg("\n");
-    }
-
-  }
-  else if(vec != NULL){                 /* flat matrix as in blkDirect.c */
-    sys->msg("\nUPPER LEFT CORNER - flat %dx%d matrix\n", fsize, fsize);
-    for(i = 0; i < MIN(size, fsize); i++) {
-      for(j = 0; j < MIN(size, fsize); j++) {
-        sys->msg("%.5e ", vec[SQDEX(i, j, fsize)]);
-      }
-      sys->msg("\n");
     }
   }
 }
-#endif
 
 /*
-  gets the file name from the flag
+  reads the panels of a blk_matrix in the given order, prefetching the next
+  panel while the current one is being worked on
+  - the buffer returned by next() is valid until the next call of next()
 */
-static char *getName(int file, char *name)
+class panel_stream
 {
-  if(file == L11 || file == L21 || file == LTIL) name[0] = 'L';
-  else name[0] = 'U';
+public:
+  panel_stream(const blk_matrix *mat, const std::vector<int> &order)
+    : mp_mat(mat), m_order(order), m_pos(0)
+  {
+    for (int i = 0; i < 2; i++) {
+      m_buf[i].resize(mat->panel_size());
+    }
+    if (! m_order.empty()) {
+      prefetch(0);
+    }
+  }
 
-  if(file == L11 || file == U11 || file == U12) name[1] = '1';
-  else if(file == L21) name[1] = '2';
-  else name[1] = 'T';
+  ~panel_stream()
+  {
+    if (m_pending.valid()) {
+      m_pending.wait();
+    }
+  }
 
-  if(file == L11 || file == U11 || file == L21) name[2] = '1';
-  else if(file == U12) name[2] = '2';
-  else name[2] = 'I';
+  double *next()
+  {
+    m_pending.get();            /* rethrows read errors */
+    double *cur = m_buf[m_pos % 2].data();
+    if (m_pos + 1 < m_order.size()) {
+      prefetch(m_pos + 1);
+    }
+    ++m_pos;
+    return cur;
+  }
+
+private:
+  const blk_matrix *mp_mat;
+  std::vector<int> m_order;
+  size_t m_pos;
+  std::vector<double> m_buf[2];
+  std::future<void> m_pending;
+
+  void prefetch(size_t pos)
+  {
+    const blk_matrix *mat = mp_mat;
+    double *buf = m_buf[pos % 2].data();
+    int k = m_order[pos];
+    m_pending = std::async(std::launch::async, [mat, buf, k] () { mat->read_panel(k, buf); });
+  }
+};
+
+std::vector<int> ascending(int from, int to)
+{
+  std::vector<int> order;
+  for (int k = from; k < to; k++) {
+    order.push_back(k);
+  }
+  return order;
+}
 
-  name[3] = '\0';
-  return(name);
 }
 
 /*
-  converts a square matrix to its transpose (used to write columnwise)
+  picks the tile size: BLKTILE or what fits into the memory budget
 */
-static void transpose(double *mat, int siz)
+int blkTileSize(ssystem *sys, int size)
 {
-  int i, j;
-  double temp;
-
-  for(i = 0; i < siz; i++) {
-    for(j = 0; j < i; j++) {
-      temp = mat[SQDEX(i, j, siz)];
-      mat[SQDEX(i, j, siz)] = mat[SQDEX(j, i, siz)];
-      mat[SQDEX(j, i, siz)] = temp;
-    }
+  long long tile = BLKTILE;
+  if (sys->mem_limit > 0.0) {
+    double budget = sys->mem_limit * 1024.0 * 1024.0;
+    tile = (long long)(budget / (double(BLKINCORE) * sizeof(double) * MAX(size, 1)));
+    tile = MAX(tile, 16LL);
   }
+  return int(MIN(tile, (long long) MAX(size, 1)));
 }
 
+// ----------------------------------------------------------------------------
 
-/*
-  writes full or triangular matrices 
-*/
-static void wrMat(ssystem *sys, double *mat, int siz, int file, int type)
-/* int siz: siz is #rows and cols */
+blk_matrix::blk_matrix()
+  : factored(false), mp_sys(0), m_fd(-1), m_size(0), m_tile(0), m_panels(0), mp_data(0), m_mapped(false)
 {
-  int ds = sizeof(double), fdis;
-  int realsiz, actsiz;                  /* size in chars */
-  char name[4];                         /* name of file */
+  //  .. nothing yet ..
+}
 
-  /* figure the real size */
-  if(type == TRIMAT) realsiz = ds*siz*(siz+1)/2;
-  else if(type == SQRMAT || type == COLMAT) realsiz = sizeof(double)*siz*siz;
-  else {
-    sys->error("wrMat: bad type flag %d", type);
+blk_matrix::~blk_matrix()
+{
+  if (m_mapped) {
+    munmap((void *) mp_data, size_t(m_panels) * panel_size() * sizeof(double));
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
   }
+}
+
+void blk_matrix::init(ssystem *sys, int size, int tile)
+{
+  mp_sys = sys;
+  m_size = size;
+  m_tile = MAX(tile, 1);
+  m_panels = (size + m_tile - 1) / m_tile;
+  factored = false;
+  pivots.clear();
+
+  const char *dir = getenv("TMPDIR");
+  std::string path = std::string(dir && *dir ? dir : "/tmp") + "/fastcapXXXXXX";
+  std::vector<char> tmpl(path.begin(), path.end());
+  tmpl.push_back(0);
+
+  if ((m_fd = mkstemp(tmpl.data())) < 0) {
+    sys->error("blk_matrix: can't create temporary file '%s'", path.c_str());
+  }
+  unlink(tmpl.data());
+}
 
-  /* figure name of file and create, open to write */
-  if((fdis = creat(getName(file, name), PMODE)) == -1) {
-    sys->error("wrMat: can't creat '%s'", name);
+void blk_matrix::read_panel(int k, double *buf) const
+{
+  size_t n = panel_size() * sizeof(double);
+  off_t offset = off_t(k) * off_t(n);
+  char *d = (char *) buf;
+
+  while (n > 0) {
+    ssize_t r = pread(m_fd, d, n, offset);
+    if (r <= 0) {
+      mp_sys->error("blk_matrix: read error on panel %d", k);
+    }
+    n -= size_t(r);
+    d += r;
+    offset += r;
   }
+}
 
-  sys->info("Writing %s...", name);
+void blk_matrix::write_panel(int k, const double *buf)
+{
+  size_t n = panel_size() * sizeof(double);
+  off_t offset = off_t(k) * off_t(n);
+  const char *d = (const char *) buf;
+
+  while (n > 0) {
+    ssize_t w = pwrite(m_fd, d, n, offset);
+    if (w <= 0) {
+      mp_sys->error("blk_matrix: write error on panel %d", k);
+    }
+    n -= size_t(w);
+    d += w;
+    offset += w;
+  }
+}
 
-  /* write the data and close */
-  if(type == COLMAT) transpose(mat, siz);       /* store columnwise */
-  if((actsiz = write(fdis, (char *)mat, realsiz)) != realsiz) {
-    sys->error("wrMat: buffer write error to '%s,' wrote %d of %d dbls",
-               name, actsiz/ds, realsiz/ds);
+void blk_matrix::make_resident(size_t budget)
+{
+  if (resident()) {
+    return;
   }
-  close(fdis);
 
-  sys->info("done.\n");
+  size_t n = size_t(m_panels) * panel_size();
+
+  if (budget == 0 || n * sizeof(double) <= budget) {
+
+    double *data = mp_sys->heap.alloc<double>(n, AQ2PD);
+    for (int k = 0; k < m_panels; k++) {
+      read_panel(k, data + size_t(k) * panel_size());
+    }
+    mp_data = data;
+
+    /* the file is not needed any longer */
+    if (ftruncate(m_fd, 0) != 0) {
+      mp_sys->warn("blk_matrix: can't truncate temporary file\n");
+    }
+
+  } else {
+
+    void *map = mmap(0, n * sizeof(double), PROT_READ, MAP_SHARED, m_fd, 0);
+    if (map == MAP_FAILED) {
+      mp_sys->error("blk_matrix: can't map temporary file");
+    }
+    mp_data = (const double *) map;
+    m_mapped = true;
+
+  }
 }
 
+// ----------------------------------------------------------------------------
+
 /*
-  reads full or triangular matrices 
+  the entry of the condensed P for charge panel qpan and evaluation panel
+  ppan (no dummies) - DIELEC/BOTH rows are turned into divided differences
+  or, with --numdpt=0, into flux density rows (see calcpn())
+  (see also dumpQ2PDiag() in mulDisplay.c)
 */
-static void rdMat(ssystem *sys, double *mat, int siz, int file, int type)
-/* int siz: siz is #rows and cols */
+double blkQ2Pentry(ssystem *sys, charge *ppan, charge *qpan)
 {
-  int fdis;
-  int realsiz;                  /* size in chars */
-  char name[4];                 /* name of file */
+  double v, pos_fact, neg_fact;
 
-  /* figure the real size */
-  if(type == TRIMAT) realsiz = sizeof(double)*siz*(siz+1)/2;
-  else if(type == SQRMAT) realsiz = sizeof(double)*siz*siz;
-  else {
-    sys->error("rdMat: bad type flag %d", type);
+  if(is_flux_row(sys, ppan)) {
+    /* analytic normal derivative, flux density as compute_electric_fields() */
+    if(qpan == ppan) {
+      return -(2*M_PI*(ppan->surf->inner_perm + ppan->surf->outer_perm)/ppan->area);
+    }
+    return (ppan->surf->outer_perm - ppan->surf->inner_perm)
+        *calcpn(sys, qpan, ppan->x, ppan->y, ppan->z, ppan->Z);
   }
 
-  /* figure name of file and open to read */
-  if((fdis = open(getName(file, name), 0)) == -1) {
-    sys->error("rdMat: can't open '%s'", name);
-  }
+  v = calcp(sys, qpan, ppan->x, ppan->y, ppan->z, NULL);
 
-  sys->info("Reading %s...", name);
+  if(ppan->surf->type == DIELEC || ppan->surf->type == BOTH) {
+    /* add off-panel evaluation contributions to divided diffs */
+    pos_fact = ppan->surf->outer_perm/ppan->pos_dummy->area;
+    neg_fact = ppan->surf->inner_perm/ppan->neg_dummy->area;
 
-  /* read the data and close */
-  if(realsiz != read(fdis, (char *)mat, realsiz)) {
-    sys->error("rdMat: read error to '%s'", name);
+    /* effectively do one columns worth of two row ops, get div dif */
+    v = (pos_fact*calcp(sys, qpan, ppan->pos_dummy->x, ppan->pos_dummy->y,
+                        ppan->pos_dummy->z, NULL)
+         - (pos_fact + neg_fact)*v
+         + neg_fact*calcp(sys, qpan, ppan->neg_dummy->x,
+                          ppan->neg_dummy->y, ppan->neg_dummy->z,
+                          NULL));
   }
-  close(fdis);
 
-  sys->info("done.\n");
+  return v;
 }
 
 /*
-  transfer part of the square matrix to the triangular matrix
+  used only in conjunction with EXPGCR == ON or DIRSOL == ON
+  to dump full P to disc in column panels (see blk_matrix)
+  - dummy panels are condensed out; DIELEC/BOTH rows are turned into
+    divided differences
 */
-static void matXfer(ssystem *sys, double *matsq, double *matri, int siz, int type)
+void blkQ2Pfull(ssystem *sys, cube *directlist, int numchgs, int numchgs_wdummy,
+                blk_matrix **mat, int **real_index, int *is_dummy)
 {
-  int i, j, temp;
+  int i, j, k, c, i_real, j_real, nb, np;
+  cube *pp;
+  charge **chgs, *ppan, *qpan;
+  double *v;
 
-  if(type == UP2TR) {           /* mv upper triangular part */
-    for(i = 0; i < siz; i++) {  /* from row zero up */
-      for(j = i; j < siz; j++) {
-        temp = UPDEX(i, j, siz);
-        matri[temp] = matsq[SQDEX(i, j, siz)];
-      }
-    }
+  pp = directlist;
+  if(pp == NULL || pp->dnext != NULL || pp->upnumeles[0] != numchgs_wdummy) {
+    sys->error("blkQ2Pfull: bad directlist, must run with depth 0");
   }
-  else if(type == LO2TR) {      /* mv lower triangular part, put 1's on diag */
-    for(i = 0; i < siz; i++) {  /* from row zero up */
-      for(j = 0; j <= i; j++) {
-        if(i == j) matri[LODEX(i, j, siz)] = 1.0;
-        else matri[LODEX(i, j, siz)] = matsq[SQDEX(i, j, siz)];
-      }
-    }
+
+  chgs = pp->chgs;
+
+  /* get the real index array - indices of non-dummy panels */
+  *real_index = sys->heap.alloc<int>(numchgs, AMSC);
+  j = 0;
+  for(i = 0; i < numchgs_wdummy; i++) {
+    /* should be that chgs[i]->index = i + 1 */
+    assert(i == chgs[i]->index - 1);
+    if(!chgs[i]->dummy) (*real_index)[j++] = i;
   }
-  else {
-    sys->error("matXfer: bad type %d", type);
+  if(j != numchgs) {
+    sys->error("blkQ2Pfull: panel count and given #panels don't match");
   }
-}  
 
-/*
-  does many rhs, triangular problem to get L21 and U12 for blk factorization
-*/
-static void blkMatsolve(ssystem *sys, double *matsq, double *matri, int siz, int type)
-{
-  int i, j, k;
-
-  if(type == LOWMAT) {
-    /* a row in the result matrix is a linear comb of the previous rows */
-    for(i = 1; i < siz; i++) {  /* loop on rows */
-      sys->info("%d ", i);
-      for(j = 0; j < siz; j++) { /* loop on columns */
-        for(k = 0; k < i; k++) {        /* loop on previous rows */
-          matsq[SQDEX(i, j, siz)]
-              -= (matri[LODEX(i, k, siz)]*matsq[SQDEX(k, j, siz)]);
-          counters.fulldirops++;
-        }
+  *mat = sys->heap.create<blk_matrix>(AMSC);
+  (*mat)->init(sys, numchgs, blkTileSize(sys, numchgs));
+
+  nb = (*mat)->tile();
+  np = (*mat)->padded_size();
+
+  sys->msg("blkQ2Pfull: %d panels of %d x %d tiles...", (*mat)->panels(), np / nb, nb);
+  sys->flush();
+
+  std::vector<double> panel((*mat)->panel_size());
+
+  for(k = 0; k < (*mat)->panels(); k++) {
+
+    for(size_t n = 0; n < panel.size(); n++) panel[n] = 0.0;
+
+    for(i = 0; i < np; i++) {   /* loop on collocation points */
+
+      v = panel.data() + size_t(i) * nb;
+
+      if(i >= numchgs) {        /* padding: identity */
+        if(i >= k * nb && i < (k + 1) * nb) v[i - k * nb] = 1.0;
+        continue;
       }
-    }
-    sys->info("\n");
-  }
-  else if(type == UPPMAT) {
-    /* a column in the result matrix is a linear comb of the prev columns */
-    for(j = 0; j < siz; j++) {  /* loop on columns */
-      sys->info("%d ", j);
-      for(i = 0; i < siz; i++) { /* loop on rows */
-        for(k = 0; k < j; k++) {        /* loop on previous columns */
-          matsq[SQDEX(i, j, siz)]
-              -= (matri[UPDEX(k, j, siz)]*matsq[SQDEX(i, k, siz)]);
-          counters.fulldirops++;
+
+      i_real = (*real_index)[i];
+      ppan = chgs[i_real];
+      assert(!ppan->dummy);
+
+      for(c = 0; c < nb; c++) { /* loop on charge panels */
+
+        j = k * nb + c;
+        if(j >= numchgs) {
+          continue;
         }
-        matsq[SQDEX(i, j, siz)] /= matri[UPDEX(j, j, siz)];
-        counters.fulldirops++;
+
+        /* real_index should eliminate all direct refs to dummy panels */
+        j_real = (*real_index)[j];
+        qpan = chgs[j_real];
+        assert(!qpan->dummy);
+
+        v[c] = blkQ2Pentry(sys, ppan, qpan);
       }
     }
-    sys->info("\n");
-  }
-  else {
-    sys->error("blkMatsolve: bad type %d", type);
+
+    (*mat)->write_panel(k, panel.data());
   }
 
+  sys->msg("done.\n");
+  sys->flush();
 }
 
 /*
-  figures the difference A11-(L21)(U12) - part of block factorization
+  left-looking out-of-core LU factorization with partial pivoting
+  - for each column panel k, the panels j < k are streamed in (with
+    prefetch); each applies its row interchanges and its elimination
+    to panel k, then panel k is factored and written back
+  - the row interchanges of step k are not applied to the panels j < k,
+    so the factors are applied in the same sequence in blkSolve()
 */
-static void subInnerProd(ssystem *sys, double *matsq, double *matri, int siz, int matl, int matu)
-/* int siz, matl, matu: size in doubles; matrices to multiply */
+void blkLUdecomp(ssystem *sys, blk_matrix *mat)
 {
-  int i, j, k, rowlim, rowliml, colimu, fdl, fdu;
-  int froml, fromu, ds = sizeof(double), readl, readu;
-  char name[4];
-  double *matriu, temp;
-
-  /* figure how many doubles will fit in matrix
-  matrisiz = siz*(siz + 1)/2; */
-
-  /* figure max number of square matrix rows that can fit (truncate) */
-  rowlim = (siz+1)/2;   /* total #rows */
-  rowliml = rowlim/2;           /* number of rows in first chunk */
-  colimu = rowlim - rowliml;    /* number of rows in second chunk */
-  matriu = matri + rowliml*siz; /* pointer to second block of rows */
-
-  /* matri always holds rows from matl; matri1 holds columns from matu */
-  /* open the relvant files */
-  if((fdl = open(getName(matl, name), 0)) == -1) {
-    sys->error("subInnerProd: can't open '%s'", name);
-  }
-
-  /* for each matl chunk, read in all chunks of matu and do inner products */
-  for(froml = 0; froml < siz; froml += rowliml) { /* loop on rows in l part */
-    readl = read(fdl, (char *)matri, rowliml*siz*ds);
-    if(readl % (siz*ds) != 0) { /* must read in row size chunks */
-      sys->error("subInnerProd: read error from '%s'",
-                 getName(matl, name));
-    }
-    readl /= (siz*ds);
-    if((fdu = open(getName(matu, name), 0)) == -1) { /* (re)open u part */
-      sys->error("subInnerProd: can't open '%s'", name);
-    }
-    for(fromu = 0; fromu < siz; fromu += colimu) { /* loop on cols in u part */
-      sys->info("%d-%d ", froml, fromu);
-      readu = read(fdu, (char *)matriu, colimu*siz*ds);
-      if(readu % (siz*ds) != 0) {       /* must read in col size chunks */
-        sys->error("subInnerProd: read error from '%s'",
-                   getName(matu, name));
-      }
-      readu /= (siz*ds);
-      /* do the inner product/subtractions possible with these chunks */
-      starttimer;
-      for(i = 0; i < readl; i++) { /* loop on rows */
-        for(j = 0; j < readu; j++) {    /* loop on columns */
-          for(k = 0, temp = 0.0; k < siz; k++) { /* inner product loop */
-            /* matriu indices are flipped since it was stored as columns */
-            temp += matri[SQDEX(i, k, siz)] * matriu[SQDEX(j, k, siz)];
-            counters.fulldirops++;
+  int nb = mat->tile(), np = mat->padded_size(), panels = mat->panels();
+
+  mat->pivots.resize(np);
+  for(int i = 0; i < np; i++) mat->pivots[i] = i;
+
+  sys->msg("\nblkLUdecomp: %d panels...", panels);
+  sys->flush();
+
+  std::vector<double> colbuf(mat->panel_size());
+  double *col = colbuf.data();
+
+  for(int k = 0; k < panels; k++) {
+
+    mat->read_panel(k, col);
+
+    starttimer;
+
+    panel_stream stream(mat, ascending(0, k));
+
+    for(int j = 0; j < k; j++) {
+
+      const double *lpanel = stream.next();
+
+      apply_pivots(col, mat->pivots, j, nb);
+
+      /* U(j,k) = L(j,j)^-1 A(j,k) - unit lower triangular */
+      double *ujk = col + size_t(j) * nb * nb;
+      const double *ljj = lpanel + size_t(j) * nb * nb;
+      for(int r = 1; r < nb; r++) {
+        for(int t = 0; t < r; t++) {
+          double a = ljj[r * nb + t];
+          if(a != 0.0) {
+            for(int c = 0; c < nb; c++) ujk[r * nb + c] -= a * ujk[t * nb + c];
           }
-          /* indices must be offset to get right square matrix entry */
-          matsq[SQDEX(i + froml, j + fromu, siz)] -= temp;
-          counters.fulldirops++;
         }
       }
-      stoptimer;
-      counters.lutime += dtime;
+
+      /* A(i,k) -= L(i,j) U(j,k) for the rows below */
+      parallel_rows((j + 1) * nb, np, (long long) nb * nb, [col, lpanel, ujk, nb] (int from, int to) {
+        tile_update(col, lpanel, ujk, from, to, nb);
+      });
+
+      counters.fulldirops += (long long)(np - j * nb) * nb * nb;
     }
 
-    /* close the u file so it can be reread for next set of l rows */
-    close(fdu);
-  }
-  sys->info("\n");
-  close(fdl);
-}
+    /* factor the panel itself with partial pivoting */
+    for(int c = 0; c < nb; c++) {
 
+      int gr = k * nb + c;
 
-/*
-  used only with DIRSOL == ON to do a direct LU and count the ops
-  - returned matrix has L below the diagonal, U above (GVL1 pg 58)
-  - meant to be used with 2x2 block matrix factorization
-*/
-static void blkLudecomp(ssystem *sys, double *mat, int size)
-{
-  double factor;
-  int i, j, k;
+      int p = gr;
+      double amax = fabs(col[size_t(gr) * nb + c]);
+      for(int r = gr + 1; r < np; r++) {
+        double a = fabs(col[size_t(r) * nb + c]);
+        if(a > amax) {
+          amax = a;
+          p = r;
+        }
+      }
+      if(amax == 0.0) {
+        sys->error("blkLUdecomp: matrix is singular");
+      }
 
-  for(k = 0; k < size-1; k++) { /* loop on rows */
-    if(mat[SQDEX(k, k, size)] == 0.0) {
-      sys->error("blkLudecomp: zero piovt");
-    }
-    sys->info("%d ", k);
-    for(i = k+1; i < size; i++) { /* loop on remaining rows */
-      factor = (mat[SQDEX(i, k, size)] /= mat[SQDEX(k, k, size)]);
-      counters.fulldirops++;
-      for(j = k+1; j < size; j++) { /* loop on remaining columns */
-        mat[SQDEX(i, j, size)] -= (factor*mat[SQDEX(k, j, size)]);
-        counters.fulldirops++;
+      mat->pivots[gr] = p;
+      if(p != gr) {
+        double *rg = col + size_t(gr) * nb, *rp = col + size_t(p) * nb;
+        for(int t = 0; t < nb; t++) {
+          double s = rg[t];
+          rg[t] = rp[t];
+          rp[t] = s;
+        }
       }
+
+      const double *prow = col + size_t(gr) * nb;
+      double pivot = prow[c];
+      parallel_rows(gr + 1, np, nb - c, [col, prow, pivot, c, nb] (int from, int to) {
+        for(int r = from; r < to; r++) {
+          double *row = col + size_t(r) * nb;
+          double f = (row[c] /= pivot);
+          if(f != 0.0) {
+            for(int t = c + 1; t < nb; t++) row[t] -= f * prow[t];
+          }
+        }
+      });
+
+      counters.fulldirops += (long long)(np - gr) * (nb - c);
     }
+
+    stoptimer;
+    counters.lutime += dtime;
+
+    mat->write_panel(k, col);
+
+    sys->info("%d ", k);
   }
+
+  mat->factored = true;
+
   sys->info("\n");
+  sys->msg("done.\n");
+  sys->flush();
 }
 
 /*
-  solves using factored matrix on disc
+  solves using the factored matrix on disc for "nrhs" right hand sides
+  at once - x[i][c] is row i of right hand side c on entry and of the
+  solution on return, so each panel is read once per sweep for all of them
 */
-void blkSolve(ssystem *sys, double *x, double *b, int siz, double *matri, double *matsq)
-/* double *x, *b, *matri, *matsq: solution, rhs */
+void blkSolve(ssystem *sys, double **x, int nrhs, blk_matrix *mat)
 {
-  int i, k;
+  int nb = mat->tile(), np = mat->padded_size(), panels = mat->panels();
+  int n = mat->size();
+
+  assert(mat->factored);
 
   sys->msg("blkSolve: fwd elimination...");
   sys->flush();
 
-  /* forward elimination, solve Ly = b (x becomes y) */
-  for(i = 0; i < siz; i++) x[i] = b[i]; /* copy rhs */
-
-  rdMat(sys, matri, siz/2, L11, TRIMAT);
-  /* a row in the result vector is a linear comb of the previous rows */
-  /* do first (lower triangular only) part */
-  starttimer;
-  for(i = 1; i < siz/2; i++) {  /* loop on rows */
-    for(k = 0; k < i; k++) {    /* loop on previous rows */
-      x[i] -= (matri[LODEX(i, k, siz/2)]*x[k]);
-      counters.fulldirops++;
-    }
+  std::vector<double> xv(size_t(np) * nrhs, 0.0);
+  for(int i = 0; i < n; i++) {
+    for(int c = 0; c < nrhs; c++) xv[size_t(i) * nrhs + c] = x[i][c];
   }
-  stoptimer;
-  counters.fullsoltime += dtime;
+  double *xp = xv.data();
 
-  /* load L21 and LTIL */
-  rdMat(sys, matri, siz/2, LTIL, TRIMAT);
-  rdMat(sys, matsq, siz/2, L21, SQRMAT);
+  {
+    /* forward elimination, solve Ly = Pb in the sequence of the steps */
+    panel_stream stream(mat, ascending(0, panels));
 
-  /* do second (square and lower triangular) part */
-  starttimer;
-  for(; i < siz; i++) {         /* loop on rows of entire matrix */
-    for(k = 0; k < siz/2; k++) { /* loop on first half of rows (L21) */
-      x[i] -= (matsq[SQDEX(i-siz/2, k, siz/2)]*x[k]);
-      counters.fulldirops++;
-    }
-    for(; k < i; k++) { /* loop on 2nd half of rows (LTIL) */
-      x[i] -= (matri[LODEX(i-siz/2, k-siz/2, siz/2)]*x[k]);
-      counters.fulldirops++;
-    }
-  }
-  stoptimer;
-  counters.fullsoltime += dtime;
+    for(int j = 0; j < panels; j++) {
 
-  sys->msg("back substitution...");
-  sys->flush();
+      const double *lpanel = stream.next();
 
-  /* back substitute, solve Ux = y (x converted in place from y to x) */
-  rdMat(sys, matri, siz/2, UTIL, TRIMAT); /* load lower right U factor */
-  starttimer;
-  for(i = siz-1; i >= siz/2; i--) {     /* loop on rows */
-    for(k = siz-1; k > i; k--) {        /* loop on rows (of x) already done */
-      x[i] -= (matri[UPDEX(i-siz/2, k-siz/2, siz/2)]*x[k]);
-      counters.fulldirops++;
-    }
-    x[i] /= matri[UPDEX(i-siz/2, i-siz/2, siz/2)]; /* divide by u_{ii} */
-    counters.fulldirops++;
-  }
-  stoptimer;
-  counters.fullsoltime += dtime;
-
-  /* load U11, U12 to do triangle plus square part of back solve */
-  rdMat(sys, matri, siz/2, U11, TRIMAT);
-  rdMat(sys, matsq, siz/2, U12, SQRMAT); /* U12 is stored columnwise */
-
-  starttimer;
-  for(; i >= 0; i--) {          /* loop on rows */
-    for(k = siz-1; k >= siz/2; k--) { /* loop on rows corresponding to U12 */
-      /* note flipped index because U12 stored as columns */
-      x[i] -= (matsq[SQDEX(k-siz/2, i, siz/2)]*x[k]);
-      counters.fulldirops++;
-    }
-    for(; k > i; k--) {         /* loop on rows corresponding to cols of U11 */
-      x[i] -= (matri[UPDEX(i, k, siz/2)]*x[k]);
-      counters.fulldirops++;
+      starttimer;
+
+      for(int c = 0; c < nb; c++) {
+        int i = j * nb + c, p = mat->pivots[i];
+        if(p != i) {
+          double *xi = xp + size_t(i) * nrhs, *xq = xp + size_t(p) * nrhs;
+          for(int r = 0; r < nrhs; r++) {
+            double t = xi[r];
+            xi[r] = xq[r];
+            xq[r] = t;
+          }
+        }
+      }
+
+      double *xj = xp + size_t(j) * nb * nrhs;
+      const double *ljj = lpanel + size_t(j) * nb * nb;
+      for(int r = 1; r < nb; r++) {
+        panel_update(xj, ljj, xj, r, r + 1, nb, nrhs, r);
+      }
+
+      parallel_rows((j + 1) * nb, np, (long long) nb * nrhs, [xp, lpanel, xj, nb, nrhs] (int from, int to) {
+        panel_update(xp, lpanel, xj, from, to, nb, nrhs, nb);
+      });
+
+      counters.fulldirops += (long long)(np - j * nb) * nb * nrhs;
+
+      stoptimer;
+      counters.fullsoltime += dtime;
     }
-    x[i] /= matri[UPDEX(i, i, siz/2)];
-    counters.fulldirops++;
   }
-  stoptimer;
-  counters.fullsoltime += dtime;
 
-  sys->msg("done.\n\n");
+  sys->msg("back substitution...");
   sys->flush();
-}
 
-/*
-  used only in conjunction with EXPGCR == ON  and DIRSOL == ON
-  to dump full P to disc in four square chunks - N MUST BE EVEN
-  - matrix stored in factored form on exit
-  - used to get around memory restrictions
-  - only 3/8 of the entire matrix is in core at any given time, rest on disc
-    in L11, U11, U12, L21, Ltil and Util
-*/
-void blkQ2Pfull(ssystem *sys, cube *directlist, int numchgs, int numchgs_wdummy,
-                double **triArray, double **sqrArray, int **real_index, int *is_dummy)
-/* double **triArray, **sqrArray: LINEAR arrays: 1 triangular, 1 square mat */
-{
-  int i, j, fromp, fromq, matsize;
-  int k, l, i_real, j_real;
-  cube *pq, *pp;
-  charge **pchgs, **qchgs, *ppan, *qpan;
-  double pos_fact, neg_fact;
-
-  /* allocate room for one 1/4 size square full P matrix, one 1/4 size tri.
-     - linear arrays are used to cut down on memory overhead */
-  /* allocate for read index array too */
-  if(numchgs % 2 == 0) {        /* if numchgs is even */
-    matsize = numchgs*numchgs/4;
-    *sqrArray = sys->heap.alloc<double>(matsize, AMSC);
-    matsize = ((numchgs/2)*(numchgs/2 + 1))/2;
-    *triArray = sys->heap.alloc<double>(matsize, AMSC);
-    *real_index = sys->heap.alloc<int>(numchgs, AMSC);
-  }
-  else {
-    sys->error("blkQ2Pfull: can't handle an odd number of panels");
-  }
-
-  /* load the matrix in the style of Q2P() - no attempt to exploit symmetry */
-  /* calculate interaction between every direct list entry and entire dlist */
-  /* the block implementation MUST have all the charges in 1st dlist entry */
-  pp = pq = directlist;
-  if(pp == NULL || pp->dnext != NULL || pp->upnumeles[0] != numchgs_wdummy) {
-    sys->error("blkQ2Pfull: bad directlist, must run with depth 0");
-  }
+  {
+    /* back substitute, solve Ux = y column panel by column panel */
+    std::vector<int> order = ascending(0, panels);
+    std::vector<int> reversed(order.rbegin(), order.rend());
+    panel_stream stream(mat, reversed);
 
-  pchgs = qchgs = pp->chgs;
+    for(int k = panels - 1; k >= 0; k--) {
 
-  /* get the real index array - indices of non-dummy panels */
-  j = 0;
-  for(i = 0; i < numchgs_wdummy; i++) {
-    /* should be that pchgs[i]->index = i + 1 */
-    /*  note COULD BE STRANGE DUE TO INDEXING FROM 1 */
-    assert(i == pchgs[i]->index - 1);
-    if(!pchgs[i]->dummy) (*real_index)[j++] = i;
-  }
-  if(j != numchgs) {
-    sys->error("blkQ2Pfull: panel count and given #panels don't match");
-  }
+      const double *upanel = stream.next();
 
-  /* dump the four matrix sections */
-  /* - if a charge panel is a dummy panel, skip the interaction calculation */
-  /* - if a potential panel is on a BOTH or DIELEC surf, 
-       include its dummy panels by converting the entry into a divided diff */
-  for(fromp = 0, k = 0; k < 2; k++, fromp += numchgs/2) {
-    for(fromq = 0, l = 0; l < 2; l++, fromq += numchgs/2) {
-
-      for(i = 0; i < numchgs/2; i++) { /* loop on collocation points */
-        i_real = (*real_index)[fromp+i];
-        ppan = pchgs[i_real];
-        assert(!ppan->dummy);
-
-        for(j = 0; j < numchgs/2; j++) { /* loop on charge panels */
-
-          /* real_index should eliminate all direct refs to dummy panels */
-          j_real = (*real_index)[fromq+j];
-          qpan = qchgs[j_real];
-          assert(!qpan->dummy);
-
-          (*sqrArray)[SQDEX(i, j, numchgs/2)] = calcp(sys, qpan, ppan->x, ppan->y,
-                                                      ppan->z, NULL);
-          /* old: qchgs[from+j], pchgs[fromp+i] */
-          /* older: pchgs[fromp+i], qchgs[fromq+j] */
-
-          if(ppan->surf->type == DIELEC || ppan->surf->type == BOTH) {
-            /* add off-panel evaluation contributions to divided diffs */
-            /* see also dumpQ2PDiag() in mulDisplay.c */
-            pos_fact = ppan->surf->outer_perm/ppan->pos_dummy->area;
-            neg_fact = ppan->surf->inner_perm/ppan->neg_dummy->area;
-
-            /* effectively do one columns worth of two row ops, get div dif */
-            (*sqrArray)[SQDEX(i, j, numchgs/2)]
-                = (pos_fact*calcp(sys, qpan, ppan->pos_dummy->x, ppan->pos_dummy->y,
-                                  ppan->pos_dummy->z, NULL)
-                   - (pos_fact + neg_fact)*(*sqrArray)[SQDEX(i, j, numchgs/2)]
-                   + neg_fact*calcp(sys, qpan, ppan->neg_dummy->x,
-                                    ppan->neg_dummy->y, ppan->neg_dummy->z,
-                                    NULL));
-          }
+      starttimer;
+
+      double *xk = xp + size_t(k) * nb * nrhs;
+      const double *ukk = upanel + size_t(k) * nb * nb;
+      for(int r = nb - 1; r >= 0; r--) {
+        double *xr = xk + size_t(r) * nrhs;
+        const double *ur = ukk + size_t(r) * nb;
+        for(int t = r + 1; t < nb; t++) {
+          const double *xt = xk + size_t(t) * nrhs;
+          for(int c = 0; c < nrhs; c++) xr[c] -= ur[t] * xt[c];
         }
+        for(int c = 0; c < nrhs; c++) xr[c] /= ur[r];
       }
-      
-      /* dump the 1/4 matrix to a file */
-      if(k == 0 && l == 0) {
-        wrMat(sys, *sqrArray, numchgs/2, L11, SQRMAT);
-        /* dumpMatCor((double **)NULL, *sqrArray, numchgs/2); */ /* for debug */
-      }
-      else if(k == 0 && l == 1) wrMat(sys, *sqrArray, numchgs/2, U12, SQRMAT);
-      else if(k == 1 && l == 0) wrMat(sys, *sqrArray, numchgs/2, L21, SQRMAT);
-      else wrMat(sys, *sqrArray, numchgs/2, LTIL, SQRMAT);
+
+      parallel_rows(0, k * nb, (long long) nb * nrhs, [xp, upanel, xk, nb, nrhs] (int from, int to) {
+        panel_update(xp, upanel, xk, from, to, nb, nrhs, nb);
+      });
+
+      counters.fulldirops += (long long)(k + 1) * nb * nb * nrhs;
+
+      stoptimer;
+      counters.fullsoltime += dtime;
     }
   }
-  sys->info("Initial dump to disk complete\n\n");
-  sys->msg("Initial dump to disk complete\n\n");
+
+  for(int i = 0; i < n; i++) {
+    for(int c = 0; c < nrhs; c++) x[i][c] = xv[size_t(i) * nrhs + c];
+  }
+
+  sys->msg("done.\n\n");
   sys->flush();
 }
 
 /*
-  does a block factorization into
-  L11  0    U11 U12
-  L21 LTI    0  UTI
-  using four sections of A stored on disk as 
-  A11 = L11, A12 = U12, A21 = L21, A22 = LTI
+  does a matrix vector multiply p += Aq with the (unfactored) matrix
+  - in memory (see blk_matrix::make_resident()), the rows are split over
+    threads and each block of rows runs over all panels
+  - otherwise the panels are streamed from disk
 */
-void blkLUdecomp(ssystem *sys, double *sqrArray, double *triArray, int numchgs)
-/* double *sqrArray, *triArray: previously allocated flattened matrices */
-/* int numchgs: A is numchgsxnumchgs */
+void blkAqprod(ssystem *sys, double *p, double *q, blk_matrix *mat)
 {
-  /* factor the stored matrices to give an overall stored factorization */
-  /* load the A11 part */
-  rdMat(sys, sqrArray, numchgs/2, L11, SQRMAT);
-
-  /* factor it in place */
-  starttimer;
-  blkLudecomp(sys, sqrArray, numchgs/2);
-  stoptimer;
-  counters.lutime += dtime;
-
-  /* write out factors to different files */
-  matXfer(sys, sqrArray, triArray, numchgs/2, UP2TR); /* upper part to triArr */
-  wrMat(sys, triArray, numchgs/2, U11, TRIMAT);
-  matXfer(sys, sqrArray, triArray, numchgs/2, LO2TR); /* lower part to triArr */
-  wrMat(sys, triArray, numchgs/2, L11, TRIMAT);
-
-  sys->info("A11 factorization complete\n\n");
-  sys->msg("\nblkLUdecomp: A11 factored...");
-  sys->flush();
+  int nb = mat->tile(), n = mat->size(), panels = mat->panels();
 
-  /* load A12 and solve in place for U12 and write (L11 in position alrdy) */
-  rdMat(sys, sqrArray, numchgs/2, U12, SQRMAT);
+  assert(! mat->factored);
 
-  starttimer;
-  blkMatsolve(sys, sqrArray, triArray, numchgs/2, LOWMAT);
-  stoptimer;
-  counters.lutime += dtime;
+  if(mat->resident()) {
 
-  wrMat(sys, sqrArray, numchgs/2, U12, COLMAT); /* store as columns */
+    starttimer;
 
-  sys->info("A12 factorization complete\n\n");
-  sys->msg("A12 factored...");
-  sys->flush();
+    /* negated since panel_matvec subtracts */
+    std::vector<double> qv(mat->padded_size(), 0.0);
+    for(int j = 0; j < n; j++) qv[j] = -q[j];
 
-  /* load A21 and U11, solve in place for L21 and write */
-  rdMat(sys, triArray, numchgs/2, U11, TRIMAT);
-  rdMat(sys, sqrArray, numchgs/2, L21, SQRMAT);
+    const double *qvp = qv.data();
+    parallel_rows(0, n, (long long) panels * nb, [p, qvp, mat, panels, nb] (int from, int to) {
+      const int rblk = 256;
+      for(int r0 = from; r0 < to; r0 += rblk) {
+        int r1 = MIN(r0 + rblk, to);
+        for(int k = 0; k < panels; k++) {
+          panel_matvec(p, mat->panel(k), qvp + size_t(k) * nb, r0, r1, nb);
+        }
+      }
+    });
 
-  starttimer;
-  blkMatsolve(sys, sqrArray, triArray, numchgs/2, UPPMAT);
-  stoptimer;
-  counters.lutime += dtime;
+    counters.fullPqops += (long long) n * panels * nb;
+    stoptimer;
+    counters.dirtime += dtime;
+    return;
+  }
 
-  wrMat(sys, sqrArray, numchgs/2, L21, SQRMAT); /* store as rows */
+  std::vector<double> qk(nb);
+  std::vector<double> pv(mat->padded_size(), 0.0);
 
-  sys->info("A21 factorization complete\n\n");
-  sys->msg("A21 factored...");
-  sys->flush();
+  panel_stream stream(mat, ascending(0, panels));
 
-  /* load A22 and subtract off (L21)(U12) product 1/4 matrix at a time */
-  rdMat(sys, sqrArray, numchgs/2, LTIL, SQRMAT);
-  subInnerProd(sys, sqrArray, triArray, numchgs/2, L21, U12); /* timed internally */
+  for(int k = 0; k < panels; k++) {
 
-  /* factor Atilde and write Ltilde, Utilde */
-  starttimer;
-  blkLudecomp(sys, sqrArray, numchgs/2);
-  stoptimer;
-  counters.lutime += dtime;
+    const double *panel = stream.next();
 
-  matXfer(sys, sqrArray, triArray, numchgs/2, UP2TR); /* upper part to triArr */
-  wrMat(sys, triArray, numchgs/2, UTIL, TRIMAT);
-  matXfer(sys, sqrArray, triArray, numchgs/2, LO2TR); /* lower part to triArr */
-  wrMat(sys, triArray, numchgs/2, LTIL, TRIMAT);
+    starttimer;
 
-  sys->info("Block factorization complete\n\n");
-  sys->msg("done.\n");
-  sys->flush();
-}
+    for(int c = 0; c < nb; c++) {
+      int j = k * nb + c;
+      /* negated since panel_matvec subtracts */
+      qk[c] = j < n ? -q[j] : 0.0;
+    }
 
-/*
-  does a matrix vector multiply with the matrix stored on disk in 4 blocks:
-  L11 U12
-  L21 LTI
-*/
-void blkAqprod(ssystem *sys, double *p, double *q, int size, double *sqmat)
-/* int size: A is size by size */
-/* double *p: p = Aq is calculated */
-/* double *sqmat: flat storage space for 1/4 of A */
-{
-  int i, j, k, l, fromp, fromq;
-
-  for(fromp = 0, k = 0; k < 2; k++, fromp += size/2) {
-    for(fromq = 0, l = 0; l < 2; l++, fromq += size/2) {
-      
-      /* read in the correct 1/4 matrix to a file */
-      if(k == 0 && l == 0) rdMat(sys, sqmat, size/2, L11, SQRMAT);
-      else if(k == 0 && l == 1) rdMat(sys, sqmat, size/2, U12, SQRMAT);
-      else if(k == 1 && l == 0) rdMat(sys, sqmat, size/2, L21, SQRMAT);
-      else rdMat(sys, sqmat, size/2, LTIL, SQRMAT);
-
-      /* do the product for this section of the matrix */
-      starttimer;
-      for(i = 0; i < size/2; i++) {
-        for(j = 0; j < size/2; j++) {
-          p[fromp+i] += sqmat[SQDEX(i, j, size/2)]*q[fromq+j];
-          counters.fullPqops++;
-        }
-      }
-      stoptimer;
-      counters.dirtime += dtime;
+    double *pp = pv.data();
+    const double *qkp = qk.data();
+    parallel_rows(0, n, nb, [pp, panel, qkp, nb] (int from, int to) {
+      panel_matvec(pp, panel, qkp, from, to, nb);
+    });
 
-    }
+    counters.fullPqops += (long long) n * nb;
+    stoptimer;
+    counters.dirtime += dtime;
   }
+
+  for(int i = 0; i < n; i++) p[i] += pv[i];
 }
 
 /*
@@ -738,4 +739,3 @@ void blkExpandVector(double *vec, int num_panels, int real_size, int *real_index
     from = j + 1;
   }
 }
-
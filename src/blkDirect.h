@@ -2,15 +2,96 @@
 #if !defined(blkDirect_H)
 #define blkDirect_H
 
+#include <vector>
+
 struct ssystem;
 struct cube;
+struct charge;
+
+/**
+ *  @brief A dense matrix stored out of core in column panels of square tiles
+ *
+ *  The matrix is padded to a multiple of the tile size with identity rows
+ *  and columns. A column panel is "tile" columns wide and holds all rows,
+ *  stored row by row, so it consists of a vertical stack of row-major
+ *  tiles. The panels are kept in an unlinked temporary file (in TMPDIR
+ *  or /tmp) which vanishes when the object is destroyed.
+ *
+ *  After blkLUdecomp(), the panels hold the LU factors with partial
+ *  pivoting, the row interchanges being recorded in "pivots".
+ *
+ *  For repeated products (explicit GCR), make_resident() keeps the
+ *  panels in memory or maps the file, so panel() can be used instead
+ *  of reading the panels again.
+ */
+class blk_matrix
+{
+public:
+  blk_matrix();
+  ~blk_matrix();
+
+  /**
+   *  @brief Creates the file for a size x size matrix with the given tile size
+   */
+  void init(ssystem *sys, int size, int tile);
+
+  int size() const { return m_size; }
+  int tile() const { return m_tile; }
+  int panels() const { return m_panels; }
+
+  //  the padded size (rows of a panel)
+  int padded_size() const { return m_panels * m_tile; }
+
+  //  number of doubles in one panel
+  size_t panel_size() const { return size_t(padded_size()) * size_t(m_tile); }
+
+  void read_panel(int k, double *buf) const;
+  void write_panel(int k, const double *buf);
+
+  /**
+   *  @brief Makes all panels accessible in memory
+   *
+   *  If the matrix fits into "budget" bytes (or if "budget" is 0), it is
+   *  read into memory (type AQ2PD) and the file is truncated. Otherwise
+   *  the file is memory-mapped read-only.
+   */
+  void make_resident(size_t budget);
+
+  //  true if panel() can be used
+  bool resident() const { return mp_data != 0; }
+
+  //  true if the panels are memory-mapped rather than read into memory
+  bool mapped() const { return m_mapped; }
+
+  //  panel k if resident() is true
+  const double *panel(int k) const { return mp_data + size_t(k) * panel_size(); }
+
+  bool factored;
+  std::vector<int> pivots;      //  row interchanged with row i in step i
+
+private:
+  ssystem *mp_sys;
+  int m_fd;
+  int m_size, m_tile, m_panels;
+  const double *mp_data;
+  bool m_mapped;
+
+  blk_matrix(const blk_matrix &);
+  blk_matrix &operator=(const blk_matrix &);
+};
+
+/* panels in core at a time: panel being factored, streamed panel,
+   prefetched panel */
+#define BLKINCORE 3
 
+int blkTileSize(ssystem *sys, int size);
+double blkQ2Pentry(ssystem *sys, charge *ppan, charge *qpan);
 void blkQ2Pfull(ssystem *sys, cube *directlist, int numchgs, int numchgs_wdummy,
-                double **triArray, double **sqrArray, int **real_index, int *is_dummy);
+                blk_matrix **mat, int **real_index, int *is_dummy);
 void blkCompressVector(ssystem *sys, double *vec, int num_panels, int real_size, int *is_dummy);
-void blkAqprod(ssystem *sys, double *p, double *q, int size, double *sqmat);
+void blkAqprod(ssystem *sys, double *p, double *q, blk_matrix *mat);
 void blkExpandVector(double *vec, int num_panels, int real_size, int *real_index);
-void blkLUdecomp(ssystem *sys, double *sqrArray, double *triArray, int numchgs);
-void blkSolve(ssystem *sys, double *x, double *b, int siz, double *matri, double *matsq);
+void blkLUdecomp(ssystem *sys, blk_matrix *mat);
+void blkSolve(ssystem *sys, double **x, int nrhs, blk_matrix *mat);
 
 #endif
@@ -6,6 +6,7 @@
 #include "input.h"
 #include "heap.h"
 
+#include <atomic>
 #include <cmath>
 #include <cstdio>
 
@@ -59,7 +60,10 @@ static double normalize(double vector[3]);
 #define DotP_Product(V1,R,S,T) ((V1[XI])*(R)+(V1[YI])*(S)+(V1[ZI])*(T))
 
 
-static int num2nd=0, num4th=0, numexact=0;
+/* calcp() runs on the worker threads of the near-field setup too (see
+   for_near_fields()), so the counts are atomic - relaxed, they are only
+   read by dumpnums() after the threads are joined */
+static std::atomic<int> num2nd(0), num4th(0), numexact(0);
 static int num2ndsav=0, num4thsav=0, numexactsav=0;
 
 void initcalcp(ssystem *sys, charge *panel_list)
@@ -447,9 +451,9 @@ double calcp(ssystem *sys, charge *panel, double x, double y, double z, double *
       fs += ss5 + ss7 + ss9;
       fdsum = 5.0 * ss5 + 7.0 * ss7 + 9.0 * ss9;
       fd += zr2Inv * fdsum;
-      num4th++;
+      num4th.fetch_add(1, std::memory_order_relaxed);
     }
-    else num2nd++;
+    else num2nd.fetch_add(1, std::memory_order_relaxed);
   }
   else {
     dtol = EQUIV_TOL * panel->min_diag;
@@ -520,7 +524,7 @@ double calcp(ssystem *sys, charge *panel, double x, double y, double z, double *
     if(znabs < dtol) fd = 0.0;
 
     fs -= zn * fd;
-    numexact++;
+    numexact.fetch_add(1, std::memory_order_relaxed);
   }
 
   /* Return values of the source and dipole, normalized by area. */
@@ -543,15 +547,152 @@ double calcp(ssystem *sys, charge *panel, double x, double y, double z, double *
   return (fs);
 }
 
+/*
+Computes the derivative of calcp()'s potential at x, y, z along normal,
+normalized by area as well - this is the flux density coefficient used
+instead of the dummy panel divided differences with --numdpt=0.
+
+With the potential written as fs = sum_i v_i L_i - zn fd (edge i at
+in-plane distance v_i, L_i = -log(arg_i)), the gradient is
+
+    grad fs = sum_i grad(v_i) L_i - zhat fd
+
+as the derivatives of L_i and fd cancel. On the panel itself fd is zero,
+so the principal value is returned there (the jump is the 2 pi q/A term
+of the flux density). Far away the second moment expansion of calcp()
+is differentiated instead.
+*/
+double calcpn(ssystem *sys, charge *panel, double x, double y, double z, const double *normal)
+{
+  double r[4], fe[4], xmxv[4], ymyv[4];
+  double xc, yc, zc, zsq, xn, yn, zn, znabs, xsq, ysq, rsq, diagsq, dtol;
+  double nx, ny, nz, gx, gy, gz;
+  double arg, st, ct, length, s1, c1, s2, c2, s12, c12, fd;
+  double *s;
+  double rInv, r2Inv, r3Inv, r5Inv, ss1, ss3, ss5, fdsum;
+  int okay = TRUE, i, next;
+  double *corner;
+
+  /* Put the evaluation point and the normal into this panel's coordinates. */
+  xc = x - panel->x;
+  yc = y - panel->y;
+  zc = z - panel->z;
+
+  xn = DotP_Product(panel->X, xc, yc, zc);
+  yn = DotP_Product(panel->Y, xc, yc, zc);
+  zn = DotP_Product(panel->Z, xc, yc, zc);
+
+  nx = Dot_Product(panel->X, normal);
+  ny = Dot_Product(panel->Y, normal);
+  nz = Dot_Product(panel->Z, normal);
+
+  zsq = zn * zn;
+  xsq = xn * xn;
+  ysq = yn * yn;
+  rsq = zsq + xsq + ysq;
+  diagsq = panel->max_diag * panel->max_diag;
+
+  if(rsq > (LIMITSECOND * diagsq)) {
+    /* Derivatives of the first and second moment terms. */
+    s = panel->moments;
+    r2Inv = 1.0 / rsq;
+    rInv = sqrt(r2Inv);
+    r3Inv = r2Inv * rInv;
+    r5Inv = r3Inv * r2Inv;
+    ss1 = s[1] * rInv;
+    ss3 = -(s[3] + s[10]) * r3Inv;
+    ss5 = (xsq * s[10] + (xn * yn * s[7]) + ysq * s[3]) * r5Inv;
+    fdsum = (ss1 + ss3 + 5.0 * ss5) * r2Inv;
+    gx = -xn * fdsum + (2.0 * xn * s[10] + yn * s[7]) * r5Inv;
+    gy = -yn * fdsum + (xn * s[7] + 2.0 * yn * s[3]) * r5Inv;
+    gz = -zn * fdsum;
+  }
+  else {
+    dtol = EQUIV_TOL * panel->min_diag;
+    znabs = fabs(zn);
+
+    /* Always move the evaluation point a little bit off the panel. */
+    if(znabs < dtol) {
+      zn = 0.5 * dtol;
+      znabs = 0.5 * dtol;
+    }
+
+    /* Once per corner computations (as in calcp()). */
+    for(okay = TRUE, i=0; i < panel->shape; i++) {
+      corner = panel->corner[i];
+      xmxv[i] = xc = xn - corner[XI];
+      ymyv[i] = yc = yn - corner[YI];
+      zc = zn - corner[ZI];
+      fe[i] = xc * xc + zc * zc;
+      r[i] = sqrt(yc * yc + fe[i]);
+      if(r[i] < (1.005 * znabs)) okay = FALSE;
+    }
+
+    /* Once per edge computations: v_i = xmxv st - ymyv ct. */
+    gx = 0.0; gy = 0.0; fd = 0.0;
+    for(i=0; i < panel->shape; i++) {
+      if(i == (panel->shape - 1)) next = 0;
+      else next = i + 1;
+
+      length = panel->length[i];
+      ct = (panel->corner[next][XI] - panel->corner[i][XI]) / length;
+      st = (panel->corner[next][YI] - panel->corner[i][YI]) / length;
+
+      /* arg == zero if eval on the edge - singular, skipped as in calcp() */
+      arg = (r[i] + r[next] - length)/(r[i] + r[next] + length);
+      if(arg > 0.0) {
+        gx -= st * log(arg);
+        gy += ct * log(arg);
+      }
+
+      if(okay) {
+        s1 = (xmxv[i] * st - ymyv[i] * ct) * r[i];
+        c1 = znabs * (xmxv[i] * ct + ymyv[i] * st);
+        s2 = (xmxv[i] * st - ymyv[i] * ct) * r[next];
+        c2 = znabs * (xmxv[next] * ct + ymyv[next] * st);
+      }
+      else {
+        s1 = (fe[i] * st) - (xmxv[i] * ymyv[i] * ct);
+        c1 = znabs * r[i] * ct;
+        s2 = (fe[next] * st) - (xmxv[next] * ymyv[next] * ct);
+        c2 = znabs * r[next] * ct;
+      }
+
+      s12 = (s1 * c2) - (s2 * c1);
+      c12 = (c1 * c2) + (s1 * s2);
+      fd += atan2(s12, c12);
+    }
+
+    if(fd < 0.0) fd += TWOPI;
+    if(zn < 0.0) fd *= -1.0;
+    if(znabs < dtol) fd = 0.0;
+
+    gz = -fd;
+  }
+
+  return (gx * nx + gy * ny + gz * nz) / panel->area;
+}
+
+/*
+  TRUE if the row of panel is a flux density row built from calcpn() and
+  the normal derivative expansion rows (--numdpt=0, DIELEC or BOTH panel)
+*/
+int is_flux_row(ssystem *sys, charge *panel)
+{
+  if(sys->numdpt != 0 || panel->dummy || panel->surf == NULL) return(FALSE);
+  return(panel->surf->type == DIELEC || panel->surf->type == BOTH);
+}
+
 
 void dumpnums(ssystem *sys, int flag, int size)
 {
   double total;
+  int n2nd = num2nd.load(), n4th = num4th.load(), nexact = numexact.load();
 
   if(flag == ON) {              /* if first call */
-    num2ndsav = num2nd;
-    num4thsav = num4th;
-    numexactsav = numexact;
+    num2ndsav = n2nd;
+    num4thsav = n4th;
+    numexactsav = nexact;
   }
   else {
     total = num2ndsav + num4thsav + numexactsav;
@@ -559,16 +700,16 @@ void dumpnums(ssystem *sys, int flag, int size)
       sys->msg("Potential coefficient counts\n multipole only:\n");
       sys->msg(
               "  2nd order: %d %.3g%%; 4th: %d %.3g%%; Integral: %d %.3g%%\n",
-              num2nd, 100*(num2ndsav/total), num4th, 100*(num4thsav/total),
-              numexact, 100*(numexactsav/total));
+              n2nd, 100*(num2ndsav/total), n4th, 100*(num4thsav/total),
+              nexact, 100*(numexactsav/total));
     }
-    total = num2nd + num4th + numexact;
+    total = n2nd + n4th + nexact;
     if (sys->muldat) {
       sys->msg(" multipole plus adaptive:\n");
       sys->msg(
               "  2nd order: %d %.3g%%; 4th: %d %.3g%%; Integral: %d %.3g%%\n",
-              num2nd, 100*(num2nd/total), num4th, 100*(num4th/total),
-              numexact, 100*(numexact/total));
+              n2nd, 100*(n2nd/total), n4th, 100*(n4th/total),
+              nexact, 100*(nexact/total));
     }
     sys->msg("Percentage of multiplies done by multipole: %.3g%%\n",
             100*(size*size - total)/(size*size));
@@ -592,7 +733,7 @@ Note that S(2)=S(6)=0 due to transfer above
 
 static void ComputeMoments(ssystem *sys, charge *pp)
 {
-  int order=MAXORDER;
+  int order=4;                  /* the S vector below needs moments up to 4th order */
   int i, j, nside,  N, M, N1, M1, M2, MN1, MN2;
   double dx, dy, dxdy, dydx, SI, *xp, *yp, *xpn, *ypn;
   static Heap local_heap;
@@ -10,5 +10,7 @@ double tilelength(charge *nq);
 
 void initcalcp(ssystem *sys, charge *panel_list);
 double calcp(ssystem *sys, charge *panel, double x, double y, double z, double *pfd);
+double calcpn(ssystem *sys, charge *panel, double x, double y, double z, const double *normal);
+int is_flux_row(ssystem *sys, charge *panel);
 
 #endif
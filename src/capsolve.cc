@@ -10,28 +10,43 @@
 #include "quickif.h"
 #include "blkDirect.h"
 #include "direct.h"
+#include "hmatrix.h"
+#include "coarse.h"
 #include "resusage.h"
 #include "counters.h"
+#include "trace.h"
 
 #include <cmath>
 #include <cassert>
 #include <string>
 #include <sstream>
+#include <vector>
 
-static int gmres(ssystem *sys, double *q, double *p, double *r, double *ap, double **bv, double **bh, int size, int real_size, double *sqrmat, int *real_index, int maxiter, double tol, charge *chglist);
-static void computePsi(ssystem *sys, double *q, double *p, int size, int real_size, double *sqrmat, int *real_index, charge *chglist);
-static int gcr(ssystem *sys, double *q, double *p, double *r, double *ap, double **bp, double **bap, int size, int real_size, double *sqrmat, int *real_index, int maxiter, double tol, charge *chglist);
+static int gmres(ssystem *sys, double *q, double *p, double *r, double *ap, double **bv, double **bh, int size, int real_size, blk_matrix *blkmat, int *real_index, int maxiter, double tol, charge *chglist);
+static void computePsi(ssystem *sys, double *q, double *p, int size, int real_size, blk_matrix *blkmat, int *real_index, charge *chglist);
+static void applyP(ssystem *sys, double *q, double *p, int size, int real_size, blk_matrix *blkmat, int *real_index, charge *chglist);
+static void precondition(ssystem *sys, int size);
+static void setup_coarse(ssystem *sys, int size, int real_size, blk_matrix *blkmat, int *real_index, charge *chglist);
+
+/* the coarse space of the two-level preconditioner if enabled */
+static inline const coarse_space *coarse_of(const ssystem *sys)
+{
+  return sys->twolevel ? sys->setup.coarse : 0;
+}
+static int gcr(ssystem *sys, double *q, double *p, double *r, double *ap, double **bp, double **bap, int size, int real_size, blk_matrix *blkmat, int *real_index, int maxiter, double tol, charge *chglist);
+static double **dirsolve(ssystem *sys, charge *chglist, int size, int real_size, blk_matrix *blkmat, h_matrix *hmat);
 
 /* This routine takes the cube data struct and computes capacitances. */
-int capsolve(double ***capmat, ssystem *sys, charge *chglist, int size, int real_size, double *trimat, double *sqrmat, int *real_index)
+int capsolve(double ***capmat, ssystem *sys, charge *chglist, int size, int real_size, blk_matrix *blkmat, h_matrix *hmat, int *real_index)
 /* double ***capmat: pointer to capacitance matrix */
 /* real_size: real_size = total #panels, incl dummies */
+/* h_matrix *hmat: factored H-matrix (solves directly if given) */
 {
   int i, cond, iter, maxiter = MAXITER, ttliter = 0;
-  charge *nq;
+  const panel_table &ptab = sys->ptab;
   double *q, *p, *r, *ap;
-  double **bp = 0, **bap = 0;
-  Surface *surf;
+  double **bp = 0, **bap = 0, **qcols = 0;
+  bool direct = sys->dirsol || hmat != 0;
 
   /* Allocate space for the capacitance matrix. */
   *capmat = sys->heap.mat(sys->num_cond+1, sys->num_cond+1);
@@ -40,7 +55,7 @@ int capsolve(double ***capmat, ssystem *sys, charge *chglist, int size, int real
   q = sys->heap.alloc<double>(size+1, AMSC);
   r = sys->heap.alloc<double>(size+1, AMSC);
 
-  if (! sys->dirsol) {          /* too much to allocate if not used */
+  if (! direct) {               /* too much to allocate if not used */
 
     /* allocate for gcr accumulated basis vectors (moved out of loop 30Apr90) */
     sys->flush();             /* so header will be saved if crash occurs */
@@ -48,6 +63,16 @@ int capsolve(double ***capmat, ssystem *sys, charge *chglist, int size, int real
     bp = sys->heap.alloc<double *>(maxiter+1, AMSC);
     bap = sys->heap.alloc<double *>(maxiter+1, AMSC);
 
+    /* the coarse space only depends on P, so it is kept with the setup */
+    if (sys->twolevel && ! sys->expgcr && ! sys->setup.coarse) {
+      setup_coarse(sys, size, real_size, blkmat, real_index, chglist);
+    }
+
+  } else {
+
+    /* solve for all conductors at once, the loop just picks the columns */
+    qcols = dirsolve(sys, chglist, size, real_size, blkmat, hmat);
+
   }
 
   /* P is the "psuedo-charge" for multipole. Ap is the "psuedo-potential". */
@@ -65,42 +90,34 @@ int capsolve(double ***capmat, ssystem *sys, charge *chglist, int size, int real
     sys->msg("\nStarting on column %d (%s)\n", cond, sys->conductor_name_str(cond));
     sys->flush();
 
+    sys->trace.set_column(cond);
+    TraceSpan column_span(sys->trace, "column");
+
     /* Set up the initial residue vector and charge guess. */
     for(i=1; i <= size; i++) r[i] = q[i] = 0.0;
     i = 0;
-    for(nq = chglist; nq != NULL; nq = nq->next) {
-      if(nq->cond == cond && !nq->dummy 
-         && (nq->surf->type == CONDTR || nq->surf->type == BOTH)) 
-          r[nq->index] = 1.0;
+    for(i = 1; i <= size; i++) {
+      if(ptab.cond[i] == cond && (ptab.type[i] == CONDTR || ptab.type[i] == BOTH))
+          r[i] = 1.0;
     }
 
-    if (sys->dirsol) {
+    if (direct) {
 
-      /* do a direct forward elimination/back solve for the charge vector */
-      if(size > MAXSIZ) {               /* index from 1 here, from 0 in solvers */
-        blkCompressVector(sys, r+1, size, real_size, sys->is_dummy+1);
-        blkSolve(sys, q+1, r+1, real_size, trimat, sqrmat);
-        blkExpandVector(q+1, size, real_size, real_index);
-      }
-      else {
-        starttimer;
-        solve(sys->directlist->directmats[0], q+1, r+1, size);
-        stoptimer;
-        counters.fullsoltime += dtime;
-      }
+      /* index from 1 here, from 0 in the solvers */
+      for(i = 1; i <= size; i++) q[i] = qcols[i-1][cond-1];
       iter = 0;
 
     } else {
 
       /* Do gcr. First allocate space for back vectors. */
       /* allocation moved out of loop 30Apr90 */
-      if (ITRTYP == GMRES) {
-        if((iter = gmres(sys,q,p,r,ap,bp,bap,size,real_size,sqrmat,real_index,maxiter,sys->iter_tol,chglist))
+      if (sys->itrtyp == GMRES) {
+        if((iter = gmres(sys,q,p,r,ap,bp,bap,size,real_size,blkmat,real_index,maxiter,sys->iter_tol,chglist))
            > maxiter) {
           sys->error("NONCONVERGENCE AFTER %d ITERATIONS", maxiter);
         }
       } else {
-        if((iter = gcr(sys,q,p,r,ap,bp,bap,size,real_size,sqrmat,real_index,maxiter,sys->iter_tol,chglist))
+        if((iter = gcr(sys,q,p,r,ap,bp,bap,size,real_size,blkmat,real_index,maxiter,sys->iter_tol,chglist))
            > maxiter) {
           sys->error("NONCONVERGENCE AFTER %d ITERATIONS", maxiter);
         }
@@ -132,9 +149,9 @@ int capsolve(double ***capmat, ssystem *sys, charge *chglist, int size, int real
     /* NOT IMPLEMENTED: fancy stuff for infinitessimally thin conductors */
     /* (once again, permittivity data is poorly organized, lots of pointing) */
     for(i=1; i <= sys->num_cond; i++) (*capmat)[i][cond] = 0.0;
-    for(nq = chglist; nq != NULL; nq = nq->next) {
-      if(nq->dummy || (surf = nq->surf)->type != CONDTR) continue;
-      (*capmat)[nq->cond][cond] += surf->outer_perm * q[nq->index];
+    for(i = 1; i <= size; i++) {
+      if(ptab.type[i] != CONDTR) continue;
+      (*capmat)[ptab.cond[i]][cond] += ptab.outer_perm[i] * q[i];
     }
 
     if (sys->rawdat) {
@@ -153,18 +170,71 @@ int capsolve(double ***capmat, ssystem *sys, charge *chglist, int size, int real
     }
 
   }
+  sys->trace.set_column(-1);
   sys->flush();
   return(ttliter);
 }
 
 
+/*
+  direct forward elimination/back solve for the charge vectors of all
+  conductors (DIRSOL == ON or with the H-matrix)
+  - returns a size x num_cond matrix, column cond-1 holding the charges
+    of conductor cond (rows index from 0)
+*/
+static double **dirsolve(ssystem *sys, charge *chglist, int size, int real_size, blk_matrix *blkmat, h_matrix *hmat)
+{
+  int i, j, cond;
+  const panel_table &ptab = sys->ptab;
+  double **x;
+
+  TraceSpan span(sys->trace, "solve");
+
+  x = sys->heap.mat(size, sys->num_cond);
+
+  for(cond = 1; cond <= sys->num_cond; cond++) {
+    if (sys->kill_num_list.find(cond) != sys->kill_num_list.end() || sys->kinp_num_list.find(cond) != sys->kinp_num_list.end()) {
+      continue;
+    }
+    for(i = 1; i <= size; i++) {
+      if(ptab.cond[i] == cond && (ptab.type[i] == CONDTR || ptab.type[i] == BOTH))
+          x[i-1][cond-1] = 1.0;
+    }
+  }
+
+  if(hmat) {
+    hmat->solve(x, sys->num_cond);
+  }
+  else if(size > MAXSIZ) {
+    /* the block solver works on the condensed system - pick the rows of
+       the real panels, so the solution ends up in the right rows and the
+       dummy rows stay zero */
+    double **rows = sys->heap.alloc<double *>(MAX(real_size, 1), AMSC);
+    for(i = j = 0; i < size; i++) {
+      if(!sys->is_dummy[i+1]) rows[j++] = x[i];
+    }
+    if(j != real_size) {
+      sys->error("dirsolve: number of real panels not right, %d", j);
+    }
+    blkSolve(sys, rows, sys->num_cond, blkmat);
+  }
+  else {
+    starttimer;
+    solveMulti(sys->directlist->directlu, x, size, sys->num_cond, sys->directlist->directpiv);
+    stoptimer;
+    counters.fullsoltime += dtime;
+  }
+
+  return x;
+}
+
 /* 
 Preconditioned(possibly) Generalized Conjugate Residuals.
 */
-static int gcr(ssystem *sys, double *q, double *p, double *r, double *ap, double **bp, double **bap, int size, int real_size, double *sqrmat, int *real_index, int maxiter, double tol, charge *chglist)
+static int gcr(ssystem *sys, double *q, double *p, double *r, double *ap, double **bp, double **bap, int size, int real_size, blk_matrix *blkmat, int *real_index, int maxiter, double tol, charge *chglist)
 {
   int iter, i, j;
-  double norm, beta, alpha, maxnorm;
+  double norm, beta, alpha, maxnorm = 0.0;
 
   /* NOTE ON EFFICIENCY: all the loops of length "size" could have */
   /*   if(sys->is_dummy[i]) continue; as their first line to save some ops */
@@ -172,6 +242,8 @@ static int gcr(ssystem *sys, double *q, double *p, double *r, double *ap, double
 
   for(iter = 0; iter < maxiter; iter++) {
 
+    sys->trace.set_iteration(iter+1);
+
     /* allocate the back vectors if they haven't been already (22OCT90) */
     if(bp[iter] == NULL) {
       bp[iter] = sys->heap.alloc<double>(size+1, AMSC);
@@ -182,7 +254,7 @@ static int gcr(ssystem *sys, double *q, double *p, double *r, double *ap, double
       bp[iter][i] = p[i] = r[i];
     }
 
-    computePsi(sys, p, ap, size, real_size, sqrmat, real_index, chglist);
+    computePsi(sys, p, ap, size, real_size, blkmat, real_index, chglist);
     
     starttimer;
     for(i=1; i <= size; i++) {
@@ -227,14 +299,16 @@ static int gcr(ssystem *sys, double *q, double *p, double *r, double *ap, double
     counters.conjtime += dtime;
     if(maxnorm < tol) break;
   }
+
+  sys->trace.set_iteration(-1);
   
-  if (PRECOND != NONE) {
+  if ((sys->precond != NONE || coarse_of(sys)) && ! sys->expgcr) {
     /* Undo the preconditioning to get the real q. */
     for(i=1; i <= size; i++) {
       p[i] = q[i];
       ap[i] = 0.0;
     }
-    mulPrecond(sys, PRECOND);
+    precondition(sys, size);
     for(i=1; i <= size; i++) {
       q[i] = p[i];
     }
@@ -250,7 +324,7 @@ static int gcr(ssystem *sys, double *q, double *p, double *r, double *ap, double
 /* 
   Preconditioned(possibly) Generalized Minimum Residual. 
   */
-static int gmres(ssystem *sys, double *q, double *p, double *r, double *ap, double **bv, double **bh, int size, int real_size, double *sqrmat, int *real_index, int maxiter, double tol, charge *chglist)
+static int gmres(ssystem *sys, double *q, double *p, double *r, double *ap, double **bv, double **bh, int size, int real_size, blk_matrix *blkmat, int *real_index, int maxiter, double tol, charge *chglist)
 {
   int iter, i, j;
   double rnorm, norm;
@@ -289,6 +363,8 @@ static int gmres(ssystem *sys, double *q, double *p, double *r, double *ap, doub
   
   for(iter = 1; (iter <= maxiter) && (rnorm > tol); iter++) {
     
+    sys->trace.set_iteration(iter);
+
     starttimer;
     /* allocate the back vectors if they haven't been already */
     if(bv[iter] == NULL) {
@@ -303,7 +379,7 @@ static int gmres(ssystem *sys, double *q, double *p, double *r, double *ap, doub
     counters.conjtime += dtime;
 
     /* Form Av{iter}. */
-    computePsi(sys, p, ap, size, real_size, sqrmat, real_index, chglist);
+    computePsi(sys, p, ap, size, real_size, blkmat, real_index, chglist);
 
     starttimer;
     
@@ -362,6 +438,8 @@ static int gmres(ssystem *sys, double *q, double *p, double *r, double *ap, doub
   /* Decrement from the last increment. */
   iter--;
 
+  sys->trace.set_iteration(-1);
+
   starttimer;
   
   /* Compute solution, note, bh is bh[col][row]. */
@@ -382,19 +460,16 @@ static int gmres(ssystem *sys, double *q, double *p, double *r, double *ap, doub
   stoptimer;
   counters.conjtime += dtime;
   
-  if (PRECOND != NONE) {
+  if ((sys->precond != NONE || coarse_of(sys)) && ! sys->expgcr) {
     /* Undo the preconditioning to get the real q. */
-    starttimer;
     for(i=1; i <= size; i++) {
       p[i] = q[i];
       ap[i] = 0.0;
     }
-    mulPrecond(sys, PRECOND);
+    precondition(sys, size);
     for(i=1; i <= size; i++) {
       q[i] = p[i];
     }
-    stoptimer;
-    counters.prectime += dtime;
   }
 
   if(rnorm > tol) {
@@ -410,65 +485,142 @@ charge and potential have already been set up and that the potential
 vector has been zeroed.  ARBITRARY VECTORS CAN NOT BE USED.
 */
 
-static void computePsi(ssystem *sys, double *q, double *p, int size, int real_size, double *sqrmat, int *real_index, charge *chglist)
+static void computePsi(ssystem *sys, double *q, double *p, int size, int real_size, blk_matrix *blkmat, int *real_index, charge *chglist)
 {
   int i;
 
   assert(p == sys->p);
   assert(q == sys->q);
 
+  TraceSpan psi_span(sys->trace, "computePsi");
+
   for(i=1; i <= size; i++) p[i] = 0;
 
-  if (PRECOND != NONE) {
-    starttimer;
-    mulPrecond(sys, PRECOND);
-    stoptimer;
-    counters.prectime += dtime;
+  if ((sys->precond != NONE || coarse_of(sys)) && ! sys->expgcr) {
+    precondition(sys, size);
+  }
+
+  applyP(sys, q, p, size, real_size, blkmat, real_index, chglist);
+}
+
+/*
+  builds the coarse space of the two-level preconditioner - one product
+  with P per aggregate
+*/
+static void setup_coarse(ssystem *sys, int size, int real_size, blk_matrix *blkmat, int *real_index, charge *chglist)
+{
+  TraceSpan span(sys->trace, "coarse_space", "setup");
+  starttimer;
+
+  coarse_space *coarse = sys->heap.create<coarse_space>(AMSC);
+  coarse->init(sys, size, [sys, size, real_size, blkmat, real_index, chglist] (const double *q, double *p) {
+    for(int i = 1; i <= size; i++) {
+      sys->q[i] = q[i];
+      sys->p[i] = 0.0;
+    }
+    applyP(sys, sys->q, sys->p, size, real_size, blkmat, real_index, chglist);
+    for(int i = 1; i <= size; i++) p[i] = sys->p[i];
+  });
+  sys->setup.coarse = coarse;
+
+  stoptimer;
+  counters.prsetime += dtime;
+
+  sys->msg("\nCoarse space: %d aggregates\n", coarse->size());
+}
+
+/*
+  applies the (local and coarse) preconditioner to sys->q in place
+  - sys->p must be zero and is zero again on return
+*/
+static void precondition(ssystem *sys, int size)
+{
+  TraceSpan span(sys->trace, "mulPrecond");
+  starttimer;
+
+  const coarse_space *coarse = coarse_of(sys);
+  std::vector<double> y;
+  if (coarse) {
+    coarse->project(sys->q, y);
   }
 
+  if (sys->precond != NONE) {
+    mulPrecond(sys, sys->precond);
+  }
+
+  if (coarse) {
+    coarse->prolong(sys->q, y);
+  }
+
+  stoptimer;
+  counters.prectime += dtime;
+}
+
+/*
+  the potential p = P q without preconditioning - same requirements
+  as computePsi()
+*/
+static void applyP(ssystem *sys, double *q, double *p, int size, int real_size, blk_matrix *blkmat, int *real_index, charge *chglist)
+{
   if (sys->expgcr) {
 
+    TraceSpan span(sys->trace, "blkAqprod");
+
     blkCompressVector(sys, q+1, size, real_size, sys->is_dummy+1);
-    blkAqprod(sys, p+1, q+1, real_size, sqrmat);        /* offset since index from 1 */
+    blkAqprod(sys, p+1, q+1, blkmat);        /* offset since index from 1 */
     blkExpandVector(p+1, size, real_size, real_index); /* ap changed to p, r chged to q */
     blkExpandVector(q+1, size, real_size, real_index); /*    7 Oct 91 */
 
   } else {
 
-    starttimer;
-    mulDirect(sys);
-    stoptimer;
-    counters.dirtime += dtime;
+    {
+      TraceSpan span(sys->trace, "mulDirect");
+      starttimer;
+      mulDirect(sys);
+      stoptimer;
+      counters.dirtime += dtime;
+    }
 
-    starttimer;
-    mulUp(sys);
-    stoptimer;
-    counters.uptime += dtime;
+    {
+      TraceSpan span(sys->trace, "mulUp");
+      starttimer;
+      mulUp(sys);
+      stoptimer;
+      counters.uptime += dtime;
+    }
 
     if (sys->dupvec) {
       dumpLevOneUpVecs(sys);
     }
 
-    if (DNTYPE == NOSHFT) {
-      mulDown(sys);             /* do downward pass without local exp shifts */
-    }
+    {
+      TraceSpan span(sys->trace, "mulDown");
+      starttimer;
 
-    if (DNTYPE == GRENGD) {
-      mulDown(sys);             /* do hierarchical local shift dwnwd pass */
+      if (sys->dntype == NOSHFT) {
+        mulDown(sys);           /* do downward pass without local exp shifts */
+      }
+
+      if (sys->dntype == GRENGD) {
+        mulDown(sys);           /* do hierarchical local shift dwnwd pass */
+      }
+
+      stoptimer;
+      counters.downtime += dtime;
     }
 
-    stoptimer;
-    counters.downtime += dtime;
+    {
+      TraceSpan span(sys->trace, "mulEval");
+      starttimer;
 
-    starttimer;
+      if (MULTI == ON) {
+        mulEval(sys);           /* evaluate either locals or multis or both */
+      }
 
-    if (MULTI == ON) {
-      mulEval(sys);             /* evaluate either locals or multis or both */
+      stoptimer;
+      counters.evaltime += dtime;
     }
 
-    stoptimer;
-    counters.evaltime += dtime;
-
     if (sys->dmpchg == DMPCHG_LAST) {
       sys->msg("\nPanel potentials divided by areas\n");
       dumpChgDen(sys, p, chglist);
@@ -476,7 +628,10 @@ static void computePsi(ssystem *sys, double *q, double *p, int size, int real_si
     }
 
     /* convert the voltage vec entries on dielectric i/f's into eps1E1-eps2E2 */
-    compute_electric_fields(sys, chglist);
+    {
+      TraceSpan span(sys->trace, "compute_electric_fields");
+      compute_electric_fields(sys);
+    }
 
     if (OPCNT == ON) {
       printops(sys);
@@ -4,7 +4,9 @@
 
 struct ssystem;
 struct charge;
+class blk_matrix;
+class h_matrix;
 
-int capsolve(double ***capmat, ssystem *sys, charge *chglist, int size, int real_size, double *trimat, double *sqrmat, int *real_index);
+int capsolve(double ***capmat, ssystem *sys, charge *chglist, int size, int real_size, blk_matrix *blkmat, h_matrix *hmat, int *real_index);
 
 #endif
@@ -0,0 +1,137 @@
+
+#include "mulGlobal.h"
+#include "mulStruct.h"
+#include "coarse.h"
+#include "direct.h"
+
+#include <map>
+
+namespace {
+
+/*
+  adds the conductor panels in the lowest level cubes below nc to the
+  aggregates of this cube (one per conductor)
+*/
+void add_panels(ssystem *sys, cube *nc, std::map<int, int> &by_cond, int &size,
+                std::vector<int> &aggregate, std::vector<double> &weight)
+{
+  if (nc->level == sys->depth) {
+    for (int i = 0; i < nc->upnumeles[0]; i++) {
+      charge *pq = nc->chgs[i];
+      if (pq->dummy || (pq->surf->type != CONDTR && pq->surf->type != BOTH)) {
+        continue;
+      }
+      auto a = by_cond.find(pq->cond);
+      if (a == by_cond.end()) {
+        a = by_cond.insert(std::make_pair(pq->cond, size++)).first;
+      }
+      aggregate[pq->index] = a->second;
+      weight[pq->index] = pq->area;
+    }
+  } else {
+    for (int i = 0; i < nc->numkids; i++) {
+      if (nc->kids[i]) {
+        add_panels(sys, nc->kids[i], by_cond, size, aggregate, weight);
+      }
+    }
+  }
+}
+
+}
+
+coarse_space::coarse_space()
+  : m_size(0), mp_pr(0), mp_lu(0), mp_pivots(0)
+{
+  //  .. nothing yet ..
+}
+
+/*
+  collects the cubes on the given level (or the lowest level cubes if
+  the hierarchy is not that deep)
+*/
+void coarse_space::collect(ssystem *sys, cube *nc, int level, std::vector<cube *> &cubes)
+{
+  if (nc->level == level || nc->level == sys->depth) {
+    cubes.push_back(nc);
+  } else {
+    for (int i = 0; i < nc->numkids; i++) {
+      if (nc->kids[i]) {
+        collect(sys, nc->kids[i], level, cubes);
+      }
+    }
+  }
+}
+
+void coarse_space::init(ssystem *sys, int size, const std::function<void (const double *q, double *p)> &apply_p)
+{
+  m_size = 0;
+  m_aggregate.assign(size + 1, -1);
+  m_weight.assign(size + 1, 0.0);
+
+  std::vector<cube *> cubes;
+  collect(sys, sys->cubes[0][0][0][0], CGLEVEL, cubes);
+
+  for (auto c = cubes.begin(); c != cubes.end(); ++c) {
+    std::map<int, int> by_cond;
+    add_panels(sys, *c, by_cond, m_size, m_aggregate, m_weight);
+  }
+
+  if (m_size == 0) {
+    return;
+  }
+
+  //  Ac[I][J] = sum of w_i (P R^T e_J)_i over the panels i of aggregate I
+  double **ac = sys->heap.mat(m_size, m_size, AMSC);
+  mp_pr = sys->heap.mat(m_size, size + 1, AMSC);
+  std::vector<double> q(size + 1);
+
+  for (int j = 0; j < m_size; j++) {
+    for (int i = 1; i <= size; i++) {
+      q[i] = (m_aggregate[i] == j ? m_weight[i] : 0.0);
+    }
+    double *p = mp_pr[j];
+    apply_p(q.data(), p);
+    for (int i = 1; i <= size; i++) {
+      if (m_aggregate[i] >= 0) {
+        ac[m_aggregate[i]][j] += m_weight[i] * p[i];
+      }
+    }
+  }
+
+  mp_lu = ludecomp(sys, ac, m_size, FALSE, &mp_pivots);
+}
+
+void coarse_space::project(double *b, std::vector<double> &y) const
+{
+  y.assign(m_size, 0.0);
+  if (m_size == 0) {
+    return;
+  }
+
+  std::vector<double> c(m_size, 0.0);
+  size_t n = m_aggregate.size();
+  for (size_t i = 1; i < n; i++) {
+    if (m_aggregate[i] >= 0) {
+      c[m_aggregate[i]] += m_weight[i] * b[i];
+    }
+  }
+
+  solve(mp_lu, y.data(), c.data(), m_size, mp_pivots);
+
+  for (int j = 0; j < m_size; j++) {
+    const double *pr = mp_pr[j];
+    double yj = y[j];
+    for (size_t i = 1; i < n; i++) {
+      b[i] -= yj * pr[i];
+    }
+  }
+}
+
+void coarse_space::prolong(double *x, const std::vector<double> &y) const
+{
+  for (size_t i = 1; i < m_aggregate.size(); i++) {
+    if (m_aggregate[i] >= 0) {
+      x[i] += m_weight[i] * y[m_aggregate[i]];
+    }
+  }
+}
@@ -0,0 +1,71 @@
+
+#if !defined(coarse_H)
+#define coarse_H
+
+#include <vector>
+#include <functional>
+
+struct ssystem;
+struct cube;
+
+/**
+ *  @brief The coarse space of the two-level preconditioner
+ *
+ *  The conductor panels are grouped into aggregates: one per conductor
+ *  and cube on level CGLEVEL of the cube hierarchy. A coarse vector
+ *  puts a uniform charge density on each aggregate, i.e. the prolongation
+ *  R^T weights each panel by its area. The coarse matrix is the Galerkin
+ *  product Ac = R P R^T, computed with one product with P per aggregate.
+ *
+ *  The local (OL or BD) preconditioner M is combined with the coarse
+ *  correction multiplicatively:
+ *
+ *    M2 b = R^T y + M (b - P R^T y),   y = Ac^-1 R b
+ *
+ *  The coarse part takes care of the global, smooth part of the charge
+ *  distribution which the local preconditioner cannot see. P R^T is
+ *  kept from the setup, so no extra product with P is needed.
+ */
+class coarse_space
+{
+public:
+  coarse_space();
+
+  /**
+   *  @brief Builds the aggregates and the coarse matrix
+   *
+   *  "size" is the length of the charge vectors (index from 1).
+   *  "apply_p" computes p = P q for such vectors.
+   */
+  void init(ssystem *sys, int size, const std::function<void (const double *q, double *p)> &apply_p);
+
+  /**
+   *  @brief First half of the preconditioner: y = Ac^-1 R b, b -= P R^T y
+   *
+   *  b indexes from 1.
+   */
+  void project(double *b, std::vector<double> &y) const;
+
+  /**
+   *  @brief Second half of the preconditioner: x += R^T y
+   */
+  void prolong(double *x, const std::vector<double> &y) const;
+
+  //  number of aggregates
+  int size() const { return m_size; }
+
+private:
+  int m_size;
+  std::vector<int> m_aggregate;         //  aggregate per charge index, -1 for none
+  std::vector<double> m_weight;         //  prolongation weight per charge index
+  double **mp_pr;                       //  P R^T, one row per aggregate
+  double **mp_lu;                       //  LU factors of Ac
+  int *mp_pivots;
+
+  void collect(ssystem *sys, cube *nc, int level, std::vector<cube *> &cubes);
+
+  coarse_space(const coarse_space &);
+  coarse_space &operator=(const coarse_space &);
+};
+
+#endif
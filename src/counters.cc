@@ -18,4 +18,17 @@ Counters::Counters()
   lutime = 0.0;
   fullsoltime = 0.0;
   fullPqops = 0;
+  setuptime = 0.0;
+  iterations = 0;
+  released = 0;
+  dirops = 0;
+  dirbytes = 0;
+  precops = 0;
+  precbytes = 0;
+  upops = 0;
+  upbytes = 0;
+  downops = 0;
+  downbytes = 0;
+  evalops = 0;
+  evalbytes = 0;
 }
@@ -2,6 +2,8 @@
 #if !defined(counters_H)
 #define counters_H
 
+#include <cstddef>
+
 struct Counters
 {
   Counters();
@@ -14,10 +16,26 @@ struct Counters
   double uptime;              //  time in mulUp(), upward pass
   double downtime;            //  time in mulDown(), downward pass
   double evaltime;            //  time in mulEval(), evaluation pass
-  int fulldirops;             //  total direct operations - DIRSOL=ON only
+  long long fulldirops;       //  total direct operations - DIRSOL=ON only
   double lutime;              //  factorization time DIRSOL=ON only
   double fullsoltime;         //  time for solves, DIRSOL=ON only
-  int fullPqops;              //  total P*q ops using P on disk - EXPGCR=ON
+  long long fullPqops;        //  total P*q ops using P on disk - EXPGCR=ON
+  double setuptime;           //  total setup time (allocation, direct, multipole)
+  int iterations;             //  total iterations over all conductor columns
+  size_t released;            //  heap bytes of the previous setup given back
+
+  //  multiply-adds and bytes of matrix and vector data touched per pass,
+  //  accumulated from the matrix shapes once per matrix and call
+  long long dirops;           //  mulDirect(), direct part of P*q
+  long long dirbytes;
+  long long precops;          //  mulPrecond(), preconditioner application
+  long long precbytes;
+  long long upops;            //  mulUp(), upward pass
+  long long upbytes;
+  long long downops;          //  mulDown(), downward pass
+  long long downbytes;
+  long long evalops;          //  mulEval(), evaluation pass
+  long long evalbytes;
 };
 
 extern Counters counters;
@@ -4,11 +4,27 @@
 #include "direct.h"
 #include "calcp.h"
 #include "counters.h"
+#include "parallel.h"
+#include "aca.h"
+
+/* column panel width of the blocked LU factorization */
+#define LUBLOCK 64
+
+/*
+  the coefficient of charge panel qpan at evaluation panel ppan: the
+  potential or, for flux density rows (flux = is_flux_row()), its
+  derivative along ppan's normal
+*/
+static inline double coeff(ssystem *sys, charge *qpan, charge *ppan, int flux)
+{
+  if(flux) return calcpn(sys, qpan, ppan->x, ppan->y, ppan->z, ppan->Z);
+  return calcp(sys, qpan, ppan->x, ppan->y, ppan->z, NULL);
+}
 
 double **Q2PDiag(ssystem *sys, charge **chgs, int numchgs, int *is_dummy, int calc)
 {
   double **mat;
-  int i, j;
+  int i, j, flux;
 
   /* Allocate storage for the potential coefficients. */
   mat = sys->heap.mat(numchgs, numchgs, AQ2PD);
@@ -19,19 +35,18 @@ double **Q2PDiag(ssystem *sys, charge **chgs, int numchgs, int *is_dummy, int ca
        - exclude dielec i/f panels when they would lead to evals at their
          centers (only if using two-point flux-den-diff evaluations) */
     for(i=0; i < numchgs; i++) { 
-      if (NUMDPT == 2) {
+      if (sys->numdpt == 2) {
         if(chgs[i]->dummy);     /* don't check surface of a dummy */
         else if(chgs[i]->surf->type == DIELEC || chgs[i]->surf->type == BOTH)
             continue;
       }
+      flux = is_flux_row(sys, chgs[i]);
       for(j=0; j < numchgs; j++) { /* need to have charge on them */
         if (SKIPQD == ON) {
           if(chgs[j]->pos_dummy == chgs[i] || chgs[j]->neg_dummy == chgs[i])
               continue;
         }
-        if(!is_dummy[j]) mat[i][j] = calcp(sys,
-                                           chgs[j], chgs[i]->x, chgs[i]->y,
-                                           chgs[i]->z, NULL);
+        if(!is_dummy[j]) mat[i][j] = coeff(sys, chgs[j], chgs[i], flux);
       }
     }
   }
@@ -46,7 +61,7 @@ double **Q2PDiag(ssystem *sys, charge **chgs, int numchgs, int *is_dummy, int ca
 double **Q2P(ssystem *sys, charge **qchgs, int numqchgs, int *is_dummy, charge **pchgs, int numpchgs, int calc)
 {
   double **mat;
-  int i, j;
+  int i, j, flux;
 
   /* Allocate storage for the potential coefficients. P rows by Q cols. */
   mat = sys->heap.mat(numpchgs, numqchgs, AQ2P);
@@ -55,16 +70,15 @@ double **Q2P(ssystem *sys, charge **qchgs, int numqchgs, int *is_dummy, charge *
       /* exclude:
          - dummy panels in the charge list
          - dielectric i/f panels in the eval list (if doing 2-point E's)*/
-      if (NUMDPT == 2) {
+      if (sys->numdpt == 2) {
         if(pchgs[i]->dummy);    /* don't check the surface of a dummy */
         else if(pchgs[i]->surf->type == DIELEC || pchgs[i]->surf->type == BOTH)
             continue;
       }
+      flux = is_flux_row(sys, pchgs[i]);
       for(j=0; j < numqchgs; j++) { /* only dummy panels in the charge list */
         if(!is_dummy[j])          /* (not the eval list) are excluded */
-            mat[i][j] = calcp(sys,
-                              qchgs[j], pchgs[i]->x, pchgs[i]->y,
-                              pchgs[i]->z, NULL); /* old: pchgs[i],qchgs[j] */
+            mat[i][j] = coeff(sys, qchgs[j], pchgs[i], flux);
       }
     }
   }
@@ -76,6 +90,29 @@ double **Q2P(ssystem *sys, charge **qchgs, int numqchgs, int *is_dummy, charge *
   return(mat);
 }
 
+/*
+  low-rank form of the Q2P() block (calc == TRUE) as u v^T, u being
+  numpchgs x rank and v numqchgs x rank - the entries are found by
+  adaptive cross approximation to the relative tolerance tol
+  - returns the rank or -1 if the compressed block would not be
+    smaller than the dense one (u, v not allocated then)
+*/
+int Q2Plowrank(ssystem *sys, charge **qchgs, int numqchgs, int *is_dummy, charge **pchgs, int numpchgs, double tol, double ***u, double ***v)
+{
+  auto entry = [sys, qchgs, is_dummy, pchgs] (int i, int j) {
+    /* same exclusions as Q2P() */
+    if (sys->numdpt == 2 && !pchgs[i]->dummy
+        && (pchgs[i]->surf->type == DIELEC || pchgs[i]->surf->type == BOTH)) {
+      return 0.0;
+    }
+    if(is_dummy[j]) return 0.0;
+    return coeff(sys, qchgs[j], pchgs[i], is_flux_row(sys, pchgs[i]));
+  };
+
+  int maxrank = (numpchgs * numqchgs) / (numpchgs + numqchgs + 1);
+  return aca(sys->heap, AQ2P, numpchgs, numqchgs, tol, maxrank, entry, u, v);
+}
+
 /*
   used only in conjunction with DMPMAT == ON  and DIRSOL == ON
   to make 1st directlist mat = full P mat
@@ -113,14 +150,54 @@ double **Q2Pfull(ssystem *sys, cube *directlist, int numchgs)
   return(mat);
 }
 
+/*
+  c[i][j] -= sum_t a[i][t]*b[t][j] for rows i in [from, to), t in [t0, t1)
+  and columns j in [j0, j1)
+  - four rows at a time, so each row of b is loaded once for four rows
+  - the inner loop runs over contiguous columns and vectorizes
+*/
+static void lu_update(double **c, double **a, double **b, int from, int to,
+                      int t0, int t1, int j0, int j1)
+{
+  const int jblk = 256;         /* columns of b kept in cache */
+  int i, t, j, jb, je;
+
+  for(jb = j0; jb < j1; jb += jblk) {
+    je = MIN(jb + jblk, j1);
+    for(i = from; i + 4 <= to; i += 4) {
+      double *c0 = c[i], *c1 = c[i+1], *c2 = c[i+2], *c3 = c[i+3];
+      for(t = t0; t < t1; t++) {
+        double a0 = a[i][t], a1 = a[i+1][t], a2 = a[i+2][t], a3 = a[i+3][t];
+        const double *bt = b[t];
+        for(j = jb; j < je; j++) {
+          double bv = bt[j];
+          c0[j] -= a0*bv;
+          c1[j] -= a1*bv;
+          c2[j] -= a2*bv;
+          c3[j] -= a3*bv;
+        }
+      }
+    }
+    for(; i < to; i++) {
+      double *ci = c[i];
+      for(t = t0; t < t1; t++) {
+        double ai = a[i][t];
+        const double *bt = b[t];
+        for(j = jb; j < je; j++) ci[j] -= ai*bt[j];
+      }
+    }
+  }
+}
+
 /*
   - returned matrix has L below the diagonal, U above (GVL1 pg 58)
   - if allocate == TRUE ends up storing P and LU (could be a lot)
+  - see lu_factor() for the algorithm
 */
-double **ludecomp(ssystem *sys, double **matin, int size, int allocate)
+double **ludecomp(ssystem *sys, double **matin, int size, int allocate, int **pivots)
 {
-  double factor, **mat;
-  int i, j, k;
+  double **mat;
+  int i, j;
 
   if(allocate == TRUE) {
     /* allocate for LU matrix and copy A */
@@ -131,48 +208,179 @@ double **ludecomp(ssystem *sys, double **matin, int size, int allocate)
   }
   else mat = matin;
 
-  for(k = 0; k < size-1; k++) { /* loop on rows */
-    if(mat[k][k] == 0.0) {
-      sys->error("ludecomp: zero piovt");
+  *pivots = sys->heap.alloc<int>(MAX(size, 1), AMSC);
+
+  if(!lu_factor(mat, size, *pivots, TRUE)) {
+    sys->error("ludecomp: singular matrix");
+  }
+
+  /* total multiply-adds of the elimination: sum over the steps k of
+     (size-k-1) rows times (size-k) entries each */
+  counters.fulldirops += (long long)(size-1)*size*(size+1)/3;
+
+  return(mat);
+}
+
+/*
+  in-place LU factorization of mat, the core of ludecomp() without
+  allocation, counting or error reporting
+  - blocked right-looking version with partial pivoting (GVL3 3.4.8): the
+    row interchanges are done by swapping the row pointers, step k
+    swapping rows k and pivots[k]
+  - par == TRUE spreads the trailing updates over threads (use FALSE
+    when called from a parallel section already)
+  - returns FALSE if mat is singular
+*/
+int lu_factor(double **mat, int size, int *pivots, int par)
+{
+  double best, *swap;
+  int i, j, k, p, k0, k1;
+
+  for(k0 = 0; k0 < size; k0 += LUBLOCK) {
+    k1 = MIN(k0 + LUBLOCK, size);
+
+    /* factor the column panel [k0, k1) */
+    for(k = k0; k < k1; k++) {
+      p = k;
+      best = ABS(mat[k][k]);
+      for(i = k+1; i < size; i++) {
+        if(ABS(mat[i][k]) > best) {
+          best = ABS(mat[i][k]);
+          p = i;
+        }
+      }
+      if(best == 0.0) return FALSE;
+      pivots[k] = p;
+      if(p != k) {
+        swap = mat[k];
+        mat[k] = mat[p];
+        mat[p] = swap;
+      }
+      for(i = k+1; i < size; i++) { /* loop on remaining rows */
+        double factor = (mat[i][k] /= mat[k][k]);
+        for(j = k+1; j < k1; j++) mat[i][j] -= factor*mat[k][j];
+      }
     }
-    for(i = k+1; i < size; i++) { /* loop on remaining rows */
-      factor = (mat[i][k] /= mat[k][k]);
-      counters.fulldirops++;
-      for(j = k+1; j < size; j++) { /* loop on remaining columns */
-        mat[i][j] -= (factor*mat[k][j]);
-        counters.fulldirops++;
+
+    if(k1 < size) {
+      /* U12 = L11^-1 A12, row by row */
+      for(k = k0+1; k < k1; k++) {
+        lu_update(mat, mat, mat, k, k+1, k0, k, k1, size);
       }
+      /* A22 -= L21 U12 */
+      if(par) {
+        parallel_rows(k1, size, (long long)(k1-k0)*(size-k1), [mat, k0, k1, size] (int from, int to) {
+          lu_update(mat, mat, mat, from, to, k0, k1, k1, size);
+        });
+      }
+      else lu_update(mat, mat, mat, k1, size, k0, k1, k1, size);
     }
   }
-  return(mat);
+
+  return TRUE;
 }
 
 /*
   For direct solution of Pq = psi, used if DIRSOL == ON or if preconditioning.
+  - mat and pivots as returned by ludecomp()
 */
-void solve(double **mat, double *x, double *b, int size)
+void solve(double **mat, double *x, double *b, int size, const int *pivots)
 {
   int i, j;
+  double swap;
 
   /* copy rhs */
   if(x != b) for(i = 0; i < size; i++) x[i] = b[i];
 
+  /* row interchanges */
+  for(i = 0; i < size; i++) {
+    if(pivots[i] != i) {
+      swap = x[i];
+      x[i] = x[pivots[i]];
+      x[pivots[i]] = swap;
+    }
+  }
+
   /* forward elimination */
-  for(i = 0; i < size; i++) {   /* loop on pivot row */
-    for(j = i+1; j < size; j++) { /* loop on elimnation row */
-      x[j] -= mat[j][i]*x[i];
-      counters.fulldirops++;
+  for(i = 1; i < size; i++) {   /* loop on elimination row */
+    const double *li = mat[i];
+    double s = x[i];
+    for(j = 0; j < i; j++) s -= li[j]*x[j];
+    x[i] = s;
+  }
+
+  /* back substitution */
+  for(i = size-1; i > -1; i--) {        /* loop on rows */
+    const double *ui = mat[i];
+    double s = x[i];
+    for(j = i+1; j < size; j++) s -= ui[j]*x[j];
+    x[i] = s/ui[i];
+  }
+
+  /* size(size-1)/2 ops each way plus size divisions */
+  counters.fulldirops += (long long) size * size;
+}
+
+/*
+  solve() for "nrhs" right hand sides at once - x[i][c] is row i of
+  right hand side c on entry and of the solution on return
+*/
+void solveMulti(double **mat, double **x, int size, int nrhs, const int *pivots)
+{
+  lu_solve(mat, x, size, nrhs, pivots, TRUE);
+  counters.fulldirops += (long long) size * size * nrhs;
+}
+
+/*
+  the core of solveMulti() for the factors from lu_factor()
+  - blocked by LUBLOCK rows so the factors are read once for all columns
+  - par as for lu_factor()
+*/
+void lu_solve(double **mat, double **x, int size, int nrhs, const int *pivots, int par)
+{
+  int i, c, k0, k1;
+  double swap;
+
+  /* row interchanges */
+  for(i = 0; i < size; i++) {
+    if(pivots[i] != i) {
+      double *xi = x[i], *xp = x[pivots[i]];
+      for(c = 0; c < nrhs; c++) {
+        swap = xi[c];
+        xi[c] = xp[c];
+        xp[c] = swap;
+      }
+    }
+  }
+
+  /* forward elimination */
+  for(k0 = 0; k0 < size; k0 += LUBLOCK) {
+    k1 = MIN(k0 + LUBLOCK, size);
+    for(i = k0+1; i < k1; i++) {
+      lu_update(x, mat, x, i, i+1, k0, i, 0, nrhs);
     }
+    if(par) {
+      parallel_rows(k1, size, (long long)(k1-k0)*nrhs, [mat, x, k0, k1, nrhs] (int from, int to) {
+        lu_update(x, mat, x, from, to, k0, k1, 0, nrhs);
+      });
+    }
+    else lu_update(x, mat, x, k1, size, k0, k1, 0, nrhs);
   }
 
   /* back substitution */
-  for(i--; i > -1; i--) {               /* loop on rows */
-    for(j = i+1; j < size; j++) { /* loop on columns */
-      x[i] -= mat[i][j]*x[j];
-      counters.fulldirops++;
+  for(k1 = size; k1 > 0; k1 = k0) {
+    k0 = MAX(k1 - LUBLOCK, 0);
+    for(i = k1-1; i >= k0; i--) {
+      lu_update(x, mat, x, i, i+1, i+1, k1, 0, nrhs);
+      double d = 1.0/mat[i][i];
+      for(c = 0; c < nrhs; c++) x[i][c] *= d;
+    }
+    if(par) {
+      parallel_rows(0, k0, (long long)(k1-k0)*nrhs, [mat, x, k0, k1, nrhs] (int from, int to) {
+        lu_update(x, mat, x, from, to, k0, k1, 0, nrhs);
+      });
     }
-    x[i] /= mat[i][i];
-    counters.fulldirops++;
+    else lu_update(x, mat, x, 0, k0, k0, k1, 0, nrhs);
   }
 }
 
@@ -10,11 +10,15 @@ struct charge;
 int compressMat(ssystem *sys, double **mat, int size, int *is_dummy, int comp_rows);
 void expandMat(double **mat, int size, int comp_size, int *is_dummy, int exp_rows);
 void invert(double **mat, int size, int *reorder);
-void solve(double **mat, double *x, double *b, int size);
-double **ludecomp(ssystem *sys, double **matin, int size, int allocate);
+void solve(double **mat, double *x, double *b, int size, const int *pivots);
+void solveMulti(double **mat, double **x, int size, int nrhs, const int *pivots);
+double **ludecomp(ssystem *sys, double **matin, int size, int allocate, int **pivots);
+int lu_factor(double **mat, int size, int *pivots, int par);
+void lu_solve(double **mat, double **x, int size, int nrhs, const int *pivots, int par);
 
 double **Q2PDiag(ssystem *sys, charge **chgs, int numchgs, int *is_dummy, int calc);
 double **Q2P(ssystem *sys, charge **qchgs, int numqchgs, int *is_dummy, charge **pchgs, int numpchgs, int calc);
+int Q2Plowrank(ssystem *sys, charge **qchgs, int numqchgs, int *is_dummy, charge **pchgs, int numpchgs, double tol, double ***u, double ***v);
 double **Q2Pfull(ssystem *sys, cube *directlist, int numchgs);
 
 #endif
@@ -7,16 +7,18 @@
   converts the voltage vector entries corresponding to panels on dielectric
      interfaces into electric field boundary condition checks: 
      eps_outer*E_outer - eps_inner*E_inner
-  this routine might be improved by fixing the way dummy, permittivity and h
-     information is stored (more arrays and less pointer chasing)
+  the dielectric panels, their dummies, permittivities and divided
+     difference steps h are taken from the panel table (sys->ptab)
+  with --numdpt=0 the entries of dielectric panels hold the normal
+     derivative of the potential already and are scaled in place
   also - infinitesimally thin conductors on a dielectric i/f (surface type 
      BOTH) are not supported
 */
-void compute_electric_fields(ssystem *sys, charge *chglist)
+void compute_electric_fields(ssystem *sys)
 {
-  charge *cp, *dummy;
+  const panel_table &t = sys->ptab;
+  int i, k, pd, nd;
   double flux_density, *panel_voltages, *panel_charges;
-  Surface *surf;
 
   /* for each dielectric panel, do two divided differences to get the */
   /*    gradient of the potential in the normal and anti-normal directions */
@@ -25,70 +27,81 @@ void compute_electric_fields(ssystem *sys, charge *chglist)
   /* - the zeros can be skipped in the iterative loop calculations */
   panel_voltages = sys->p;
   panel_charges = sys->q;
-  for(cp = chglist; cp != NULL; cp = cp->next) {
-    if(cp->dummy) continue;
 
-    if((surf = cp->surf)->type == DIELEC) {
-      dummy = cp->pos_dummy;
-      /* area field is divided difference step h for dummy panels */
-      if (NUMDPT == 3) {
-        flux_density = surf->outer_perm *
-         (panel_voltages[dummy->index] - panel_voltages[cp->index])/dummy->area;
-      } else {
-        /* figure the electric field without the panel (cancellation error?)
-           - positive dummy taken as positive side (E arrow head on that side)
-           - this is a Gaussian equation (stat-coulombs, stat-volts) */
-        /* (\epsilon_{1R} - \epsilon_{2R})E_{across panel} */
-        flux_density = (surf->outer_perm - surf->inner_perm)
-            *((panel_voltages[cp->pos_dummy->index]
-               - panel_voltages[cp->neg_dummy->index])/(cp->pos_dummy->area
-                                                        + cp->neg_dummy->area));
-        /* - (\epsilon_{1R} +\epsilon_{2R}) 2\pi q/A */
-        flux_density -= ((surf->inner_perm + surf->outer_perm)
-                         *2*M_PI*panel_charges[cp->index]/cp->area);
-      }
+  if (sys->numdpt == 0) {
+    /* the panel's entry already is the normal derivative (no dummies,
+       see calcpn()) - same flux density as the two point case */
+    for(i = 0; i < t.num_dielec; i++) {
+      k = t.dielec[i];
+      panel_voltages[k]
+          = (t.outer_perm[k] - t.inner_perm[k])*panel_voltages[k]
+            - ((t.inner_perm[k] + t.outer_perm[k])
+               *2*M_PI*panel_charges[k]/t.area[k]);
+    }
+    return;
+  }
 
-      if (sys->dmpele && NUMDPT == 3) {
-        sys->msg(
-                "Electric flux density evaluation at (%g %g %g), panel %d\n",
-                cp->x, cp->y, cp->z, cp->index);
-        sys->msg("  pos_dummy at (%g %g %g), potential = %g\n",
-                dummy->x, dummy->y, dummy->z, panel_voltages[dummy->index]);
-        sys->msg("  normal deriv on + side = %g(%g - %g)/%g = %g\n",
-                surf->outer_perm,
-                panel_voltages[dummy->index], panel_voltages[cp->index],
-                dummy->area, flux_density);
-      }
+  for(i = 0; i < t.num_dielec; i++) {
+    k = t.dielec[i];
+    pd = t.pos_dummy[k];
+    nd = t.neg_dummy[k];
 
-      panel_voltages[dummy->index] = 0.0;
+    /* area field is divided difference step h for dummy panels */
+    if (sys->numdpt == 3) {
+      flux_density = t.outer_perm[k] *
+       (panel_voltages[pd] - panel_voltages[k])/t.area[pd];
+    } else {
+      /* figure the electric field without the panel (cancellation error?)
+         - positive dummy taken as positive side (E arrow head on that side)
+         - this is a Gaussian equation (stat-coulombs, stat-volts) */
+      /* (\epsilon_{1R} - \epsilon_{2R})E_{across panel} */
+      flux_density = (t.outer_perm[k] - t.inner_perm[k])
+          *((panel_voltages[pd] - panel_voltages[nd])/(t.area[pd] + t.area[nd]));
+      /* - (\epsilon_{1R} +\epsilon_{2R}) 2\pi q/A */
+      flux_density -= ((t.inner_perm[k] + t.outer_perm[k])
+                       *2*M_PI*panel_charges[k]/t.area[k]);
+    }
 
-      dummy = cp->neg_dummy;
+    if (sys->dmpele && sys->numdpt == 3) {
+      const charge *cp = t.panel[k], *dummy = t.panel[pd];
+      sys->msg(
+              "Electric flux density evaluation at (%g %g %g), panel %d\n",
+              cp->x, cp->y, cp->z, k);
+      sys->msg("  pos_dummy at (%g %g %g), potential = %g\n",
+              dummy->x, dummy->y, dummy->z, panel_voltages[pd]);
+      sys->msg("  normal deriv on + side = %g(%g - %g)/%g = %g\n",
+              t.outer_perm[k],
+              panel_voltages[pd], panel_voltages[k],
+              t.area[pd], flux_density);
+    }
 
-      if (sys->dmpele && NUMDPT == 3) {
-        sys->msg("  neg_dummy at (%g %g %g), potential = %g\n",
-                dummy->x, dummy->y, dummy->z, panel_voltages[dummy->index]);
-        sys->msg("  normal deriv on - side = %g(%g - %g)/%g = %g\n",
-                surf->inner_perm,
-                panel_voltages[cp->index], panel_voltages[dummy->index],
-                dummy->area, surf->inner_perm *
-         (panel_voltages[cp->index] - panel_voltages[dummy->index])/dummy->area);
-      }
+    panel_voltages[pd] = 0.0;
 
-      /* area field is divided difference step h for dummy panels */
-      if (NUMDPT == 3) {
-        flux_density -= (surf->inner_perm *
-         (panel_voltages[cp->index] - panel_voltages[dummy->index])/dummy->area);
-      }
-      panel_voltages[dummy->index] = 0.0;
+    if (sys->dmpele && sys->numdpt == 3) {
+      const charge *dummy = t.panel[nd];
+      sys->msg("  neg_dummy at (%g %g %g), potential = %g\n",
+              dummy->x, dummy->y, dummy->z, panel_voltages[nd]);
+      sys->msg("  normal deriv on - side = %g(%g - %g)/%g = %g\n",
+              t.inner_perm[k],
+              panel_voltages[k], panel_voltages[nd],
+              t.area[nd], t.inner_perm[k] *
+       (panel_voltages[k] - panel_voltages[nd])/t.area[nd]);
+    }
+
+    /* area field is divided difference step h for dummy panels */
+    if (sys->numdpt == 3) {
+      flux_density -= (t.inner_perm[k] *
+       (panel_voltages[k] - panel_voltages[nd])/t.area[nd]);
+    }
+    panel_voltages[nd] = 0.0;
 
-      /* store the normal flux density difference */
-      panel_voltages[cp->index] = flux_density;
+    /* store the normal flux density difference */
+    panel_voltages[k] = flux_density;
 
-      if (sys->dmpele && NUMDPT == 3) {
-        sys->msg(
-                "  flux density difference (pos side - neg side) = %g\n",
-                flux_density);
-      }
+    if (sys->dmpele && sys->numdpt == 3) {
+      sys->msg(
+              "  flux density difference (pos side - neg side) = %g\n",
+              flux_density);
     }
   }
 }
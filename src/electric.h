@@ -3,8 +3,7 @@
 #define electric_H
 
 struct ssystem;
-struct charge;
 
-void compute_electric_fields(ssystem *sys, charge *chglist);
+void compute_electric_fields(ssystem *sys);
 
 #endif
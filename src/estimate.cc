@@ -0,0 +1,370 @@
+
+#include "estimate.h"
+#include "autotune.h"
+
+#include "mulGlobal.h"
+#include "mulStruct.h"
+#include "mulMulti.h"
+#include "blkDirect.h"
+#include "expansion.h"
+#include "rotation.h"
+
+#include <cmath>
+
+namespace {
+
+const char *memory_type_names[NumTypes] = {
+  "Q2M ", "Q2L ", "Q2P ", "L2L ", "M2M ", "M2L ", "M2P ", "L2P ", "Q2PD", "misc"
+};
+
+/* This near picks up all 27 neighboring cubes (as in olmulMatPrecond()). */
+bool is_near(const cube *nbr, const cube *nc)
+{
+  return ABS(nbr->j - nc->j) <= 1 && ABS(nbr->k - nc->k) <= 1 && ABS(nbr->l - nc->l) <= 1;
+}
+
+//  bytes requested by Heap::mat(n, m)
+size_t mat_bytes(long long n, long long m)
+{
+  return size_t(n) * sizeof(double *) + size_t(n) * size_t(m) * sizeof(double);
+}
+
+//  bytes of the cube's pointer/size vectors for "n" matrices
+size_t vects_bytes(long long n)
+{
+  return size_t(n) * (sizeof(double *) + sizeof(int) + sizeof(double **));
+}
+
+void add_mat(resource_estimate &est, MemoryType type, long long n, long long m)
+{
+  est.matrices[type] += 1;
+  est.memory[type] += mat_bytes(n, m);
+}
+
+/* see mulMatDirect() - the second-shell blocks compressed with
+   --compress-near are counted dense, which bounds their low-rank form */
+void estimate_direct(ssystem *sys, int up_size, resource_estimate &est)
+{
+  bool precond = ! sys->dirsol && ! sys->expgcr && (sys->precond == OL || sys->precond == SPAI);
+
+  for (cube *nc = sys->directlist; nc != NULL; nc = nc->dnext) {
+
+    long long n = nc->upnumeles[0];
+    long long nummats = nc->numnbrs + 1;
+
+    //  directq, nbr_is_dummy, directnumeles, directmats, directrank,
+    //  directu, directv, precondmats
+    est.memory[AMSC] += size_t(nummats) * (sizeof(double *) + sizeof(int *) + 2 * sizeof(int) + 4 * sizeof(double **));
+
+    if (sys->dirsol || sys->expgcr) {
+      if (nc == sys->directlist) {
+        //  blkQ2Pfull(): the panels in core and the index
+        long long tile = blkTileSize(sys, up_size);
+        long long padded = (up_size + tile - 1) / tile * tile;
+        est.memory[AMSC] += size_t(up_size) * sizeof(int);
+        est.scratch += BLKINCORE * size_t(padded * tile) * sizeof(double);
+        est.calcp += (long long) up_size * up_size;
+        //  blk_matrix::make_resident() keeps P in memory if it fits
+        size_t full = size_t(padded * padded) * sizeof(double);
+        if (sys->expgcr && (sys->mem_limit <= 0.0 || full <= size_t(sys->mem_limit * 1024.0 * 1024.0))) {
+          est.matrices[AQ2PD] += 1;
+          est.memory[AQ2PD] += full;
+        }
+      } else {
+        add_mat(est, AQ2PD, n, n);
+        est.calcp += n * n;
+      }
+    } else {
+      //  direct part and preconditioner diagonal blocks
+      add_mat(est, AQ2PD, n, n);
+      if (precond) {
+        add_mat(est, AQ2PD, n, n);
+      }
+      est.calcp += n * n;
+      est.product_ops += n * n;
+    }
+
+    for (int i = 0; i < nc->numnbrs; i++) {
+      long long m = nc->nbrs[i]->upnumeles[0];
+      add_mat(est, AQ2P, n, m);
+      //  preconditioner blocks for the 27 nearest cubes only
+      if (precond && is_near(nc->nbrs[i], nc)) {
+        add_mat(est, AQ2P, n, m);
+      }
+      est.calcp += n * m;
+      if (! sys->dirsol && ! sys->expgcr) {
+        est.product_ops += n * m;
+      }
+    }
+
+  }
+
+  if (sys->dirsol) {
+    est.factor_ops += (long long) up_size * up_size * up_size / 3;
+  }
+}
+
+/* see olmulMatPrecond() and spaimulMatPrecond() */
+void estimate_precond(ssystem *sys, resource_estimate &est)
+{
+  long long maxsize = 0;
+
+  for (cube *nc = sys->directlist; nc != NULL; nc = nc->dnext) {
+
+    long long n = nc->upnumeles[0];
+    long long size = n;
+    est.product_ops += n * n;
+
+    for (int i = 0; i < nc->numnbrs; i++) {
+      cube *nnbr = nc->nbrs[i];
+      if (is_near(nnbr, nc)) {
+        size += nnbr->upnumeles[0];
+        est.product_ops += n * nnbr->upnumeles[0];
+      }
+    }
+
+    maxsize = MAX(maxsize, size);
+    //  LU factorization and a solve for the cube's panels
+    est.factor_ops += size * size * size / 3 + size * size * n;
+
+  }
+
+  est.scratch += mat_bytes(maxsize, maxsize);
+}
+
+/* see mulMatUp() */
+void estimate_up(ssystem *sys, resource_estimate &est)
+{
+  long long terms = multerms(sys->order);
+
+  for (cube *nc = sys->multilist[sys->depth]; nc != NULL; nc = nc->mnext) {
+    long long n = nc->upnumeles[0];
+    est.memory[AMSC] += size_t(terms) * sizeof(double) + sizeof(double **);
+    add_mat(est, AQ2M, terms, n);
+    est.expansion += terms * n;
+    est.product_ops += terms * n;
+  }
+
+  for (int depth = sys->depth - 1; depth > 1; depth--) {
+
+    bool have_m2m[8] = { false, false, false, false, false, false, false, false };
+
+    for (cube *nc = sys->multilist[depth]; nc != NULL; nc = nc->mnext) {
+
+      est.memory[AMSC] += size_t(terms) * sizeof(double) + vects_bytes(nc->upnumvects);
+
+      for (int j = 0; j < nc->numkids; j++) {
+        cube *kid = nc->kids[j];
+        if (kid == NULL) {
+          continue;
+        }
+        if (kid->mul_exact == FALSE) {
+          if (! have_m2m[j]) {
+            have_m2m[j] = true;
+            add_mat(est, AM2M, terms, terms);
+            est.expansion += terms * terms;
+          }
+          est.product_ops += terms * terms;
+        } else {
+          long long n = kid->upnumeles[0];
+          add_mat(est, AQ2M, terms, n);
+          est.expansion += terms * n;
+          est.product_ops += terms * n;
+        }
+      }
+
+    }
+
+  }
+}
+
+/* see mulMatDown() */
+void estimate_down(ssystem *sys, resource_estimate &est)
+{
+  long long terms = multerms(sys->order);
+  bool rotate = m2l_rotated(sys->m2ltyp, sys->order);
+
+  if (rotate) {
+    est.memory[AM2L] += m2l_rotation::stored(sys->order) * sizeof(double);
+  }
+
+  for (int depth = 2; depth <= sys->depth; depth++) {
+    for (cube *nc = sys->locallist[depth]; nc != NULL; nc = nc->lnext) {
+
+      bool shift = (depth > 2 && sys->dntype != NOSHFT);
+      est.memory[AMSC] += vects_bytes(nc->interSize + (shift ? 1 : 0))
+                          + size_t(nc->interSize + (shift ? 1 : 0)) * sizeof(double *);
+
+      if (shift) {
+        add_mat(est, AL2L, terms, terms);
+        est.expansion += terms * terms;
+        est.product_ops += terms * terms;
+      }
+
+      for (int j = 0; j < nc->interSize; j++) {
+        cube *ni = nc->interList[j];
+        if (ni->mul_exact == TRUE) {
+          long long n = ni->upnumeles[0];
+          add_mat(est, AQ2L, terms, n);
+          est.expansion += terms * n;
+          est.product_ops += terms * n;
+        } else if (rotate) {
+          //  only the translation vector is kept
+          est.memory[AM2L] += 3 * sizeof(double);
+          est.product_ops += m2l_rotation::ops(sys->order);
+        } else {
+          add_mat(est, AM2L, terms, terms);
+          est.expansion += terms * terms;
+          est.product_ops += terms * terms;
+        }
+      }
+
+    }
+  }
+}
+
+/* see mulMatEval() */
+void estimate_eval(ssystem *sys, resource_estimate &est)
+{
+  long long terms = multerms(sys->order);
+
+  for (cube *nc = sys->directlist; nc != NULL; nc = nc->dnext) {
+
+    long long n = nc->upnumeles[0];
+    long long ttlvects = 0;
+
+    for (cube *na = nc; na->level > 1; na = na->parent) {
+
+      if (na->loc_exact == FALSE && sys->dntype != NOLOCL) {
+        ++ttlvects;
+        add_mat(est, AL2P, n, terms);
+        est.expansion += n * terms;
+        est.product_ops += n * terms;
+        if (sys->dntype == GRENGD) {
+          break;
+        }
+      } else {
+        ttlvects += na->interSize;
+        for (int i = 0; i < na->interSize; i++) {
+          cube *nexti = na->interList[i];
+          if (nexti->mul_exact == TRUE) {
+            long long m = nexti->upnumeles[0];
+            add_mat(est, AQ2P, n, m);
+            est.calcp += n * m;
+            est.product_ops += n * m;
+          } else {
+            add_mat(est, AM2P, n, terms);
+            est.expansion += n * terms;
+            est.product_ops += n * terms;
+          }
+        }
+      }
+
+    }
+
+    est.memory[AMSC] += vects_bytes(ttlvects);
+
+  }
+}
+
+}
+
+// ----------------------------------------------------------------------------
+
+resource_estimate::resource_estimate()
+  : allocated(0), scratch(0), calcp(0), expansion(0), factor_ops(0), product_ops(0), iterations(0.0)
+{
+  for (int i = 0; i < NumTypes; ++i) {
+    matrices[i] = 0;
+    memory[i] = 0;
+  }
+}
+
+size_t resource_estimate::matrix_memory() const
+{
+  size_t n = 0;
+  for (int i = 0; i < NumTypes; ++i) {
+    n += memory[i];
+  }
+  return n;
+}
+
+size_t resource_estimate::peak_memory() const
+{
+  return allocated + matrix_memory() + scratch;
+}
+
+void estimate_resources(ssystem *sys, int up_size, int eval_size, resource_estimate &est)
+{
+  est = resource_estimate();
+  est.allocated = sys->heap.total_memory();
+
+  //  mulMultiAlloc() scratch vectors
+  int order = sys->order;
+  long long maxchgs = MAX(sys->max_eval_pnt, sys->max_panel);
+  est.scratch += size_t(costerms(2 * order) + 2 * (2 * order + 1)) * sizeof(double)
+                 + mat_bytes(NBATCH, maxchgs) + mat_bytes(order + 1, order + 1) + mat_bytes(2 * order + 1, 2 * order + 1);
+
+  estimate_direct(sys, up_size, est);
+
+  if (! sys->dirsol) {
+    if ((sys->precond == OL || sys->precond == SPAI) && ! sys->expgcr) {
+      estimate_precond(sys, est);
+    }
+    if (sys->depth >= 2) {
+      estimate_up(sys, est);
+      if (sys->dntype != NOLOCL) {
+        estimate_down(sys, est);
+      }
+      estimate_eval(sys, est);
+    }
+  }
+
+  int columns = MAX(1, sys->num_cond - int(sys->kill_num_list.size()) - int(sys->kinp_num_list.size()));
+
+  //  capsolve(): capacitance matrix, q and r vectors
+  est.scratch += mat_bytes(sys->num_cond + 1, sys->num_cond + 1) + 2 * size_t(eval_size + 1) * sizeof(double);
+
+  if (sys->dirsol) {
+    //  one forward/backward substitution per conductor
+    est.iterations = columns;
+    est.product_ops = (long long) up_size * up_size;
+  } else {
+    est.iterations = predicted_iterations(sys);
+    if (sys->expgcr) {
+      est.product_ops = (long long) eval_size * eval_size;
+    }
+    //  back vector pointers and the back vectors kept for the longest column
+    long long per_column = (long long) ceil(est.iterations / columns);
+    est.scratch += 2 * size_t(eval_size + 1) * sizeof(double *)
+                   + size_t(per_column) * size_t(2 * eval_size + 3) * sizeof(double);
+  }
+}
+
+void dump_resource_estimate(ssystem *sys, charge *chglist, const resource_estimate &est)
+{
+  const kernel_costs &costs = kernel_costs::get(chglist);
+
+  double setup_time = est.calcp * costs.calcp + est.factor_ops * costs.madd + est.expansion * costs.expansion[sys->order];
+  double solve_time = est.iterations * est.product_ops * costs.madd;
+
+  sys->msg("\nRESOURCE ESTIMATE (order %d, depth %d)\n", sys->order, sys->depth);
+  sys->msg("  Matrix memory by type:\n");
+  for (int i = 0; i < NumTypes; ++i) {
+    if (i == AMSC) {
+      sys->msg("    %s        vectors     %12.1f kilobytes\n", memory_type_names[i], est.memory[i] / 1024.0);
+    } else {
+      sys->msg("    %s %12lld matrices %12.1f kilobytes\n", memory_type_names[i], est.matrices[i], est.memory[i] / 1024.0);
+    }
+  }
+  sys->msg("  Total matrix memory: %.1f kilobytes\n", est.matrix_memory() / 1024.0);
+  sys->msg("  Cubes and panels (allocated): %.1f kilobytes\n", est.allocated / 1024.0);
+  sys->msg("  Solver scratch memory: %.1f kilobytes\n", est.scratch / 1024.0);
+  sys->msg("  Predicted peak memory: %.1f kilobytes\n", est.peak_memory() / 1024.0);
+  sys->msg("  Potential coefficients: %lld\n", est.calcp);
+  sys->msg("  Expansion matrix elements: %lld\n", est.expansion);
+  sys->msg("  Multiply-adds per P*q product: %lld\n", est.product_ops);
+  sys->msg("  Predicted setup time: %.3g s\n", setup_time);
+  sys->msg("  Predicted solve time: %.3g s (x %.0f iterations)\n", solve_time, est.iterations);
+  sys->msg("  Predicted total time: %.3g s\n", setup_time + solve_time);
+}
@@ -0,0 +1,57 @@
+
+#if !defined(estimate_H)
+#define estimate_H
+
+#include "heap.h"
+
+struct ssystem;
+struct charge;
+
+/**
+ *  @brief Matrix storage and operation counts of a solve, predicted after mulInit()
+ *
+ *  The counts are taken from the cube, neighbor and interaction lists
+ *  built by mulInit() by walking them the same way mulMatDirect(),
+ *  olmulMatPrecond(), mulMatUp(), mulMatDown() and mulMatEval() do,
+ *  but without allocating or computing any matrix. Byte counts are
+ *  exactly what these functions request from the heap, except for the
+ *  second-shell blocks compressed with --compress-near, which are
+ *  counted dense as an upper bound of their low-rank factors.
+ */
+struct resource_estimate
+{
+  resource_estimate();
+
+  long long matrices[NumTypes];   //  number of matrices by memory type
+  size_t memory[NumTypes];        //  bytes by memory type
+  size_t allocated;               //  bytes allocated before the estimate (cubes, panels)
+  size_t scratch;                 //  bytes of the multipole, preconditioner and
+                                  //  iteration scratch vectors
+  long long calcp;                //  potential coefficients computed
+  long long expansion;            //  expansion matrix elements computed
+  long long factor_ops;           //  multiply-adds for preconditioner or LU setup
+  long long product_ops;          //  multiply-adds of one P*q product incl.
+                                  //  preconditioner
+  double iterations;              //  predicted number of iterations (all columns)
+
+  size_t matrix_memory() const;
+  size_t peak_memory() const;
+};
+
+/**
+ *  @brief Computes the estimate for the system after mulInit()
+ *
+ *  "up_size" and "eval_size" are the numbers of real panels and of all
+ *  panels including the dummies.
+ */
+void estimate_resources(ssystem *sys, int up_size, int eval_size, resource_estimate &est);
+
+/**
+ *  @brief Prints the estimate together with the predicted run time
+ *
+ *  The run time prediction uses the kernel costs calibrated on the
+ *  given panel list (see kernel_costs in autotune.h).
+ */
+void dump_resource_estimate(ssystem *sys, charge *chglist, const resource_estimate &est);
+
+#endif
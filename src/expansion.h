@@ -0,0 +1,369 @@
+
+#if !defined(expansion_H)
+#define expansion_H
+
+#include "mulGlobal.h"
+#include "mulStruct.h"
+
+#include <cmath>
+
+/**
+ *  @brief Expansion order known at compile time
+ *
+ *  The expansion matrix builders are templates over the order type.
+ *  With this type, all loop bounds over n, m, j and k as well as the
+ *  CINDEX/SINDEX offsets are compile-time constants, so the compiler
+ *  can unroll the coefficient loops and keep the per-panel loops free
+ *  of index arithmetic.
+ */
+template <int N>
+struct fixed_order
+{
+  typedef fixed_order<2 * N> twice_type;
+
+  constexpr int operator()() const { return N; }
+  constexpr twice_type twice() const { return twice_type(); }
+};
+
+/**
+ *  @brief Expansion order known at run time only
+ *
+ *  This is the fallback for orders beyond MAXORDER (and order 0).
+ */
+struct any_order
+{
+  typedef any_order twice_type;
+
+  explicit any_order(int n) : n(n) { }
+
+  int operator()() const { return n; }
+  twice_type twice() const { return any_order(2 * n); }
+
+  int n;
+};
+
+/**
+ *  @brief Calls K::run with the order type matching "order"
+ *
+ *  K::run is instantiated with fixed_order<1> .. fixed_order<N> and with
+ *  any_order for everything else. The order object is passed as the
+ *  first argument, followed by "args".
+ */
+template <class K, int N = MAXORDER>
+struct order_dispatch
+{
+  template <class... A>
+  static auto call(int order, A... args) -> decltype(K::run(any_order(order), args...))
+  {
+    if (order == N) {
+      return K::run(fixed_order<N>(), args...);
+    } else {
+      return order_dispatch<K, N - 1>::call(order, args...);
+    }
+  }
+};
+
+template <class K>
+struct order_dispatch<K, 0>
+{
+  template <class... A>
+  static auto call(int order, A... args) -> decltype(K::run(any_order(order), args...))
+  {
+    return K::run(any_order(order), args...);
+  }
+};
+
+/**
+ *  @brief A table of x! for x = 0 .. MAXFACT
+ */
+#define MAXFACT 170
+const double *factorials();
+
+/**
+ *  @brief i = sqrt(-1) to the power of the even exponent e
+ */
+constexpr double ipower(int e)
+{
+  return (e / 2) % 2 == 0 ? 1.0 : -1.0;
+}
+
+/**
+ *  @brief Legendre function evaluations Pn^m(cosA) for n, m <= order
+ *
+ *  vector entries correspond to (n,m) = (0,0) (1,0) (1,1) (2,0) (2,1)...
+ *  (see CINDEX). This is evalLegendre() for a given order type.
+ */
+template <class O>
+inline void legendre(double cosA, double *vector, O order)
+{
+  double sinMA;                 /* becomes sin^m(alpha) in higher order P's */
+  double fact;                  /* factorial factor */
+
+  sinMA = -sqrt(1-cosA*cosA);
+
+  /* do evaluations of first four functions separately w/o recursions */
+  vector[CINDEX(0, 0)] = 1.0;   /* P0^0 */
+  if(order() > 0) {
+    vector[CINDEX(1, 0)] = cosA;        /* P1^0 */
+    vector[CINDEX(1, 1)] = sinMA;       /* P1^1 = -sin(alpha) */
+  }
+  if(order() > 1) vector[CINDEX(2, 1)] = 3*sinMA*cosA; /* P2^1 = -3sin()cos() */
+
+  /* generate remaining evaluations by recursion on lower triangular array */
+  fact = 1.0;
+  for(int m = 0; m < order()+1; m++) {
+    if(m != 0 && m != 1) {      /* set up first two evaluations in row */
+      fact *= (2*m - 1); /* (2(m-1)-1)!! -> (2m-1)!! */
+      /* use recursion on m */
+      if(vector[CINDEX(1, 1)] == 0.0) {
+        vector[CINDEX(m, m)] = 0.0;
+        if(m != order()) vector[CINDEX(m+1, m)] = 0.0;  /* if not last row */
+      }
+      else {
+        cosA = vector[CINDEX(1,0)]/vector[CINDEX(1,1)]; /* cosA= -cot(theta) */
+        sinMA *= vector[CINDEX(1,1)]; /*(-sin(alpha))^(m-1)->(-sin(alpha))^m*/
+        vector[CINDEX(m, m)] = fact * sinMA;
+        if(m != order()) {              /* do if not on last row */
+          vector[CINDEX(m+1, m)] = vector[CINDEX(1, 0)]*(2*m+1)
+              *vector[CINDEX(m, m)];
+        }
+      }
+    }
+    for(int x = 2; x < order()-m+1; x++) { /* generate row of evals recursively */
+      vector[CINDEX(x+m, m)] = 
+          ((2*(x+m)-1)*vector[CINDEX(1, 0)]*vector[CINDEX(x+m-1, m)]
+           - (x + 2*m - 1)*vector[CINDEX(x+m-2, m)])/x;
+    }
+  }
+}
+
+/**
+ *  @brief Number of per-charge scratch rows used by harmonics()
+ */
+#define NBATCH 14
+
+/**
+ *  @brief Builds a charge-to-expansion or expansion-to-charge matrix in one pass
+ *
+ *  For each charge j at spherical coordinates (r, theta, beta) relative to
+ *  (x, y, z) and each (n, m) up to the order, this computes
+ *
+ *    v = coef[CINDEX(n, m)] * Pn^m(cos(theta)) * R(n)
+ *
+ *  with R(n) = r^n, or 1/r^(n+1) if "inverse" is true. v * cos(m*beta) goes
+ *  to term CINDEX(n, m), v * sin(m*beta) to term SINDEX(n, m) (m > 0 only).
+ *  The matrix is terms x numchgs, or numchgs x terms if "transposed" is true.
+ *
+ *  All loops run over the charges, so they vectorize: the Legendre
+ *  functions use the recursions in n and m of legendre(), cos(m*beta) and
+ *  sin(m*beta) use the Chebyshev recursion
+ *
+ *    cos(m*beta) = 2 cos(beta) cos((m-1)*beta) - cos((m-2)*beta)
+ *
+ *  (sine alike), so only one sqrt per charge is needed beyond the
+ *  coordinate transformation. "batch" needs NBATCH rows of numchgs entries.
+ */
+template <class O, bool inverse, bool transposed>
+void harmonics(O order, charge **chgs, int numchgs, double x, double y, double z,
+               const double *coef, double **batch, double **mat)
+{
+  const int cterms = costerms(order());
+  double *ct = batch[0], *st = batch[1], *cb = batch[2], *sb = batch[3], *rad = batch[4];
+  double *pmm = batch[5], *cm = batch[6], *cmp = batch[7], *sm = batch[8], *smp = batch[9];
+  double *rm = batch[10], *p1 = batch[11], *p2 = batch[12], *rn = batch[13];
+
+  /* spherical coordinates: cos(theta), -sin(theta), cos(beta), sin(beta), r */
+  for(int j = 0; j < numchgs; j++) {
+    double dx = chgs[j]->x - x, dy = chgs[j]->y - y, dz = chgs[j]->z - z;
+    double rxy2 = dx*dx + dy*dy;
+    double r = sqrt(rxy2 + dz*dz);
+    double c = (r == 0.0 ? 1.0 : dz/r);
+    ct[j] = c;
+    st[j] = -sqrt(1.0 - c*c);
+    if(rxy2 == 0.0) {
+      cb[j] = 1.0;
+      sb[j] = 0.0;
+    }
+    else {
+      double rxy = sqrt(rxy2);
+      cb[j] = dx/rxy;
+      sb[j] = dy/rxy;
+    }
+    rad[j] = (inverse ? 1.0/r : r);
+    pmm[j] = 1.0;               /* P0^0 */
+    cm[j] = 1.0;                /* cos(0*beta) */
+    cmp[j] = cb[j];             /* cos(-1*beta) */
+    sm[j] = 0.0;                /* sin(0*beta) */
+    smp[j] = -sb[j];            /* sin(-1*beta) */
+    rm[j] = (inverse ? rad[j] : 1.0);  /* R(0) */
+  }
+
+  for(int m = 0; m <= order(); m++) {
+
+    if(m > 0) {
+      /* Pm^m = -(2m-1) sin(theta) Pm-1^m-1, m*beta trig and R(m) */
+      for(int j = 0; j < numchgs; j++) {
+        pmm[j] *= (2*m-1)*st[j];
+        double c = 2.0*cb[j]*cm[j] - cmp[j];
+        double s = 2.0*cb[j]*sm[j] - smp[j];
+        cmp[j] = cm[j];
+        smp[j] = sm[j];
+        cm[j] = c;
+        sm[j] = s;
+        rm[j] *= rad[j];
+      }
+    }
+
+    for(int n = m; n <= order(); n++) {
+
+      double cf = coef[CINDEX(n, m)];
+      int ci = CINDEX(n, m), si = SINDEX(n, m, cterms);
+      double *crow = (transposed ? 0 : mat[ci]);
+      double *srow = (transposed || m == 0 ? 0 : mat[si]);
+
+      if(n == m) {
+        for(int j = 0; j < numchgs; j++) {
+          p1[j] = pmm[j];
+          p2[j] = 0.0;
+          rn[j] = rm[j];
+        }
+      }
+      else {
+        /* Pn^m = ((2n-1) cos(theta) Pn-1^m - (n+m-1) Pn-2^m) / (n-m) */
+        double a = double(2*n-1)/(n-m), b = double(n+m-1)/(n-m);
+        for(int j = 0; j < numchgs; j++) {
+          double p = a*ct[j]*p1[j] - b*p2[j];
+          p2[j] = p1[j];
+          p1[j] = p;
+          rn[j] *= rad[j];
+        }
+      }
+
+      if(transposed) {
+        for(int j = 0; j < numchgs; j++) {
+          double v = cf*p1[j]*rn[j];
+          mat[j][ci] = v*cm[j];
+          if(m > 0) mat[j][si] = v*sm[j];
+        }
+      }
+      else if(m == 0) {
+        for(int j = 0; j < numchgs; j++) crow[j] = cf*p1[j]*rn[j];
+      }
+      else {
+        for(int j = 0; j < numchgs; j++) {
+          double v = cf*p1[j]*rn[j];
+          crow[j] = v*cm[j];
+          srow[j] = v*sm[j];
+        }
+      }
+
+    }
+  }
+}
+
+/**
+ *  @brief Scratch doubles needed by normal_harmonics() for the given order
+ */
+inline int normal_scratch(int order)
+{
+  return costerms(order + 1) + 3 * (order + 2);
+}
+
+/**
+ *  @brief Builds the normal derivative of one row of harmonics(.., transposed = true)
+ *
+ *  "row" receives the derivative along "normal" of the row harmonics()
+ *  computes for the charge: for each (n, m) coef[CINDEX(n, m)] times the
+ *  derivative of the real and imaginary part of
+ *
+ *    U(n, m) = Pn^m(cos(theta)) R(n) exp(i m beta)
+ *
+ *  With d+ = d/dx + i d/dy and d- = d/dx - i d/dy the derivative is
+ *  nz d/dz + (nx - i ny)/2 d+ + (nx + i ny)/2 d- where for R(n) = r^n
+ *
+ *    d/dz U(n, m) = (n+m) U(n-1, m)
+ *    d+ U(n, m)   = U(n-1, m+1)
+ *    d- U(n, m)   = -(n+m) (n+m-1) U(n-1, m-1)
+ *
+ *  and for R(n) = 1/r^(n+1) ("inverse")
+ *
+ *    d/dz U(n, m) = -(n-m+1) U(n+1, m)
+ *    d+ U(n, m)   = U(n+1, m+1)
+ *    d- U(n, m)   = -(n-m+2) (n-m+1) U(n+1, m-1)
+ *
+ *  For m = 0, d- U is the complex conjugate of d+ U. "scratch" needs
+ *  normal_scratch(order) entries.
+ */
+template <class O, bool inverse>
+void normal_harmonics(O order, const charge *chg, double x, double y, double z, const double *normal,
+                      const double *coef, double *scratch, double *row)
+{
+  const int p = order() + 1;
+  const int cterms = costerms(order());
+  double *leg = scratch, *rk = leg + costerms(p), *cl = rk + p + 1, *sl = cl + p + 1;
+
+  double dx = chg->x - x, dy = chg->y - y, dz = chg->z - z;
+  double rxy2 = dx*dx + dy*dy;
+  double r = sqrt(rxy2 + dz*dz);
+  double cb = 1.0, sb = 0.0;
+  if(rxy2 > 0.0) {
+    double rxy = sqrt(rxy2);
+    cb = dx/rxy;
+    sb = dy/rxy;
+  }
+
+  legendre(r == 0.0 ? 1.0 : dz/r, leg, any_order(p));
+  rk[0] = (inverse ? 1.0/r : 1.0);
+  cl[0] = 1.0;
+  sl[0] = 0.0;
+  for(int k = 1; k <= p; k++) {
+    rk[k] = rk[k-1] * (inverse ? 1.0/r : r);
+    cl[k] = cl[k-1]*cb - sl[k-1]*sb;
+    sl[k] = sl[k-1]*cb + cl[k-1]*sb;
+  }
+
+  /* U(k, l) as (re, im) - zero for l > k */
+  auto u = [leg, rk, cl, sl] (int k, int l, double &re, double &im) {
+    if(k < 0 || l > k) {
+      re = im = 0.0;
+    }
+    else {
+      double v = leg[CINDEX(k, l)] * rk[k];
+      re = v*cl[l];
+      im = v*sl[l];
+    }
+  };
+
+  const double nx = normal[0], ny = normal[1], nz = normal[2];
+
+  for(int n = 0; n <= order(); n++) {
+    const int k = (inverse ? n + 1 : n - 1);
+    for(int m = 0; m <= n; m++) {
+
+      double az, bz, ap, bp, am, bm;
+      u(k, m, az, bz);
+      u(k, m + 1, ap, bp);
+      if(m > 0) {
+        u(k, m - 1, am, bm);
+        double f = (inverse ? -(n-m+2)*(n-m+1) : -(n+m)*(n+m-1));
+        am *= f;
+        bm *= f;
+      }
+      else {
+        am = ap;
+        bm = -bp;
+      }
+      double f = (inverse ? -(n-m+1) : n+m);
+
+      /* nz dz + (nx - i ny)/2 d+ + (nx + i ny)/2 d- */
+      double re = nz*f*az + 0.5*(nx*ap + ny*bp) + 0.5*(nx*am - ny*bm);
+      double im = nz*f*bz + 0.5*(nx*bp - ny*ap) + 0.5*(nx*bm + ny*am);
+
+      row[CINDEX(n, m)] = coef[CINDEX(n, m)]*re;
+      if(m > 0) row[SINDEX(n, m, cterms)] = coef[CINDEX(n, m)]*im;
+
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,634 @@
+
+#include "mulGlobal.h"
+#include "mulStruct.h"
+#include "fastcap_solve.h"
+#include "quickif.h"
+#include "counters.h"
+#include "disrect.h"
+#include "distri.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+  fastcap_bench: scaling benchmark for the solver
+
+  Generates scaled versions of the cubegen, pipedgen, pltcapgen and busgen
+  geometries (and a tetrahedron discretized with disTri) in memory, solves
+  them for a sweep of panel counts and writes setup time, P*q time per
+  iteration, iteration count, memory and capacitance error to a JSON file.
+
+  The capacitance error of each run is taken relative to the finest run of
+  the same geometry (or to a separate reference run given by -r).
+*/
+
+const double DEFEFR = 0.1;             /* edge-cell-width/inner-cell-width */
+const int DEFPMIN = 1000;              /* default smallest panel count */
+const int DEFPMAX = 1000000;           /* default largest panel count */
+const int DEFPPD = 1;                  /* default sweep points per decade */
+
+//  generator: writes quickif lines for ncells to fp, returns number of panels
+typedef int (*generator_func)(FILE *fp, int ncells);
+
+/*
+  writes the six faces of the parallelepiped spanned by a, b and c at p0
+  - the normals are not aligned here, initcalcp() does that
+*/
+static int wrPiped(FILE *fp, int cond, int ncells, const double *p0, const double *a, const double *b, const double *c)
+{
+  const double *e[3] = { a, b, c };
+  int npanels = 0;
+
+  for (int f = 0; f < 3; ++f) {
+
+    const double *u = e[(f + 1) % 3];
+    const double *v = e[(f + 2) % 3];
+
+    for (int side = 0; side < 2; ++side) {
+
+      double o[3];
+      for (int i = 0; i < 3; ++i) {
+        o[i] = p0[i] + (side ? e[f][i] : 0.0);
+      }
+
+      npanels += disRect(fp, cond, DEFEFR, ncells, false,
+                         o[0], o[1], o[2],
+                         o[0] + u[0], o[1] + u[1], o[2] + u[2],
+                         o[0] + u[0] + v[0], o[1] + u[1] + v[1], o[2] + u[2] + v[2],
+                         o[0] + v[0], o[1] + v[1], o[2] + v[2]);
+
+    }
+
+  }
+
+  return npanels;
+}
+
+/*
+  a 1m cube (cubegen defaults)
+*/
+static int gen_cube(FILE *fp, int ncells)
+{
+  static const double p0[] = { 0.0, 0.0, 0.0 };
+  static const double a[] = { 1.0, 0.0, 0.0 };
+  static const double b[] = { 0.0, 1.0, 0.0 };
+  static const double c[] = { 0.0, 0.0, 1.0 };
+  return wrPiped(fp, 1, ncells, p0, a, b, c);
+}
+
+/*
+  a skewed parallelepiped (pipedgen style)
+*/
+static int gen_piped(FILE *fp, int ncells)
+{
+  static const double p0[] = { 0.0, 0.0, 0.0 };
+  static const double a[] = { 2.0, 0.0, 0.0 };
+  static const double b[] = { 0.5, 1.0, 0.0 };
+  static const double c[] = { 0.2, 0.3, 1.0 };
+  return wrPiped(fp, 1, ncells, p0, a, b, c);
+}
+
+/*
+  two 1mX1m parallel plates with 0.1m separation (pltcapgen style)
+*/
+static int gen_pltcap(FILE *fp, int ncells)
+{
+  const double width = 1.0, sep = 0.1;
+  int npanels = 0;
+
+  for (int i = 0; i < 2; ++i) {
+    npanels += disRect(fp, i + 1, DEFEFR, ncells, false,
+                       0.0, 0.0, sep * i,
+                       0.0, width, sep * i,
+                       width, width, sep * i,
+                       width, 0.0, sep * i);
+  }
+
+  return npanels;
+}
+
+/*
+  a 2X2 bus crossing (busgen style): two bars along x below two bars
+  along y, 1m square cross section, 2m pitch, 1m vertical separation
+*/
+static int gen_bus(FILE *fp, int ncells)
+{
+  const int nwires = 2;
+  const double w = 1.0, pitch = 2.0, len = nwires * pitch + w;
+  int npanels = 0, cond = 1;
+
+  for (int i = 0; i < nwires; ++i, ++cond) {
+    double p0[] = { 0.0, w + i * pitch, 0.0 };
+    double a[] = { len, 0.0, 0.0 };
+    double b[] = { 0.0, w, 0.0 };
+    double c[] = { 0.0, 0.0, w };
+    npanels += wrPiped(fp, cond, ncells, p0, a, b, c);
+  }
+
+  for (int i = 0; i < nwires; ++i, ++cond) {
+    double p0[] = { w + i * pitch, 0.0, 2.0 * w };
+    double a[] = { w, 0.0, 0.0 };
+    double b[] = { 0.0, len, 0.0 };
+    double c[] = { 0.0, 0.0, w };
+    npanels += wrPiped(fp, cond, ncells, p0, a, b, c);
+  }
+
+  return npanels;
+}
+
+/*
+  a regular tetrahedron with 1m edges: each face is split into ncells^2
+  triangles which are discretized by disTri()
+*/
+static int gen_tetra(FILE *fp, int ncells)
+{
+  const double h = sqrt(3.0) / 2.0;
+  const double p[4][3] = {
+    { 0.0, 0.0, 0.0 },
+    { 1.0, 0.0, 0.0 },
+    { 0.5, h, 0.0 },
+    { 0.5, h / 3.0, sqrt(2.0 / 3.0) }
+  };
+  static const int faces[4][3] = { { 0, 2, 1 }, { 0, 1, 3 }, { 1, 2, 3 }, { 2, 0, 3 } };
+
+  int npanels = 0;
+
+  for (int f = 0; f < 4; ++f) {
+
+    const double *o = p[faces[f][0]];
+    double u[3], v[3];
+    for (int i = 0; i < 3; ++i) {
+      u[i] = (p[faces[f][1]][i] - o[i]) / ncells;
+      v[i] = (p[faces[f][2]][i] - o[i]) / ncells;
+    }
+
+    //  (j,k) is the lower left corner of the sub-triangle in (u,v) steps
+    for (int j = 0; j < ncells; ++j) {
+      for (int k = 0; j + k < ncells; ++k) {
+
+        double q[4][3];
+        for (int i = 0; i < 3; ++i) {
+          q[0][i] = o[i] + j * u[i] + k * v[i];
+          q[1][i] = q[0][i] + u[i];
+          q[2][i] = q[0][i] + v[i];
+          q[3][i] = q[0][i] + u[i] + v[i];
+        }
+
+        npanels += disTri(fp, 1, DEFEFR, 3, false,
+                          q[0][0], q[0][1], q[0][2],
+                          q[1][0], q[1][1], q[1][2],
+                          q[2][0], q[2][1], q[2][2]);
+        if (j + k + 1 < ncells) {
+          npanels += disTri(fp, 1, DEFEFR, 3, false,
+                            q[1][0], q[1][1], q[1][2],
+                            q[3][0], q[3][1], q[3][2],
+                            q[2][0], q[2][1], q[2][2]);
+        }
+
+      }
+    }
+
+  }
+
+  return npanels;
+}
+
+struct Geometry
+{
+  const char *name;
+  generator_func gen;
+  int min_cells;
+};
+
+static const Geometry geometries[] = {
+  { "cube", &gen_cube, 3 },
+  { "piped", &gen_piped, 3 },
+  { "pltcap", &gen_pltcap, 3 },
+  { "bus", &gen_bus, 3 },
+  { "tetra", &gen_tetra, 1 }
+};
+
+static const int num_geometries = int(sizeof(geometries) / sizeof(geometries[0]));
+
+/*
+  result of one benchmark run
+*/
+struct Run
+{
+  const char *geometry;
+  int target;                   /* requested panel count */
+  int ncells;                   /* discretization parameter used */
+  int panels;                   /* panels generated */
+  int conductors;
+  int order, depth;
+  int iterations;
+  double setup_time;            /* direct + multipole + preconditioner setup */
+  double solve_time;            /* iterative solve, all columns */
+  double pq_time;               /* P*q (incl. preconditioner) per iteration */
+  double wall_time;             /* total fastcap_solve() time */
+  size_t memory;                /* heap bytes allocated */
+  std::vector<double> capmat;   /* conductors^2, row major, in farads */
+  double error;                 /* rel. Frobenius norm error vs. reference */
+};
+
+/*
+  writes the geometry into a temporary file and returns the panel count
+*/
+static FILE *generate(const Geometry &geo, int ncells, int *npanels)
+{
+  FILE *fp = tmpfile();
+  if (!fp) {
+    throw std::runtime_error("fastcap_bench: cannot create temporary file");
+  }
+  *npanels = geo.gen(fp, ncells);
+  rewind(fp);
+  return fp;
+}
+
+/*
+  finds the discretization parameter giving about "target" panels
+  - panel counts grow with the square of ncells for all geometries
+*/
+static int find_ncells(const Geometry &geo, int target)
+{
+  int ncells = std::max(geo.min_cells, 4);
+
+  for (int pass = 0; pass < 3; ++pass) {
+
+    int npanels = 0;
+    FILE *fp = generate(geo, ncells, &npanels);
+    fclose(fp);
+
+    int next = std::max(geo.min_cells, int(floor(ncells * sqrt(double(target) / npanels) + 0.5)));
+    if (next == ncells) {
+      break;
+    }
+    ncells = next;
+
+  }
+
+  return ncells;
+}
+
+/*
+  reads the quickif lines written by the generators into one surface per
+  conductor (one group each) - the conductors are named "1", "2", ...
+*/
+static int load_surfaces(ssystem *sys, FILE *fp)
+{
+  std::vector<SurfaceData *> data;
+  std::vector<quadl *> last_quad;
+  std::vector<tri *> last_tri;
+
+  char line[BUFSIZ], tag[BUFSIZ];
+  int cond = 0;
+  double c[12];
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+
+    int n = 0;
+    if (line[0] == 'Q') {
+      n = sscanf(line, "%s %d %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+                 tag, &cond, c, c + 1, c + 2, c + 3, c + 4, c + 5, c + 6, c + 7, c + 8, c + 9, c + 10, c + 11);
+      if (n != 14) {
+        sys->error("fastcap_bench: bad quad line:\n%s", line);
+      }
+    } else if (line[0] == 'T') {
+      n = sscanf(line, "%s %d %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+                 tag, &cond, c, c + 1, c + 2, c + 3, c + 4, c + 5, c + 6, c + 7, c + 8);
+      if (n != 11) {
+        sys->error("fastcap_bench: bad tri line:\n%s", line);
+      }
+    } else {
+      continue;
+    }
+
+    if (cond < 1) {
+      sys->error("fastcap_bench: bad conductor number %d", cond);
+    }
+
+    while (int(data.size()) < cond) {
+      SurfaceData *sd = sys->heap.create<SurfaceData>(AMSC);
+      char name[BUFSIZ];
+      sprintf(name, "%d", int(data.size()) + 1);
+      sd->name = sys->heap.strdup(name);
+      data.push_back(sd);
+      last_quad.push_back(0);
+      last_tri.push_back(0);
+    }
+
+    int i = cond - 1;
+
+    if (line[0] == 'Q') {
+      quadl *q = sys->heap.alloc<quadl>(1, AMSC);
+      q->cond = cond;
+      q->p1 = Vector3d(c[0], c[1], c[2]);
+      q->p2 = Vector3d(c[3], c[4], c[5]);
+      q->p3 = Vector3d(c[6], c[7], c[8]);
+      q->p4 = Vector3d(c[9], c[10], c[11]);
+      if (last_quad[i]) {
+        last_quad[i]->next = q;
+      } else {
+        data[i]->quads = q;
+      }
+      last_quad[i] = q;
+    } else {
+      tri *t = sys->heap.alloc<tri>(1, AMSC);
+      t->cond = cond;
+      t->p1 = Vector3d(c[0], c[1], c[2]);
+      t->p2 = Vector3d(c[3], c[4], c[5]);
+      t->p3 = Vector3d(c[6], c[7], c[8]);
+      if (last_tri[i]) {
+        last_tri[i]->next = t;
+      } else {
+        data[i]->tris = t;
+      }
+      last_tri[i] = t;
+    }
+
+  }
+
+  Surface *eol = 0;
+
+  for (size_t i = 0; i < data.size(); ++i) {
+
+    Surface *surf = sys->heap.create<Surface>(AMSC);
+    if (eol) {
+      eol->next = surf;
+    } else {
+      sys->surf_list = surf;
+    }
+    eol = surf;
+
+    char group_name[BUFSIZ];
+    sprintf(group_name, "GROUP%d", ++sys->group_cnt);
+
+    surf->type = CONDTR;
+    surf->surf_data = data[i];
+    surf->end_of_chain = TRUE;
+    surf->group_name = sys->heap.strdup(group_name);
+
+  }
+
+  return int(data.size());
+}
+
+static void run_one(const Geometry &geo, int target, int ncells, int order, Run &run)
+{
+  ssystem sys;
+  sys.log = NULL;
+  if (order > 0) {
+    sys.order = order;
+  }
+
+  int npanels = 0;
+  FILE *fp = generate(geo, ncells, &npanels);
+  try {
+    load_surfaces(&sys, fp);
+  } catch (...) {
+    fclose(fp);
+    throw;
+  }
+  fclose(fp);
+
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  double **capmat = fastcap_solve(&sys);
+  double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  int size = capmatrix_size(&sys);
+
+  run.geometry = geo.name;
+  run.target = target;
+  run.ncells = ncells;
+  run.panels = npanels;
+  run.conductors = size;
+  run.order = sys.order;
+  run.depth = sys.depth;
+  run.iterations = counters.iterations;
+  run.setup_time = counters.setuptime;
+  run.solve_time = counters.dirtime + counters.uptime + counters.downtime + counters.evaltime
+                     + counters.prectime + counters.conjtime;
+  run.pq_time = counters.iterations > 0 ?
+                  (counters.dirtime + counters.uptime + counters.downtime + counters.evaltime + counters.prectime)
+                    / counters.iterations : 0.0;
+  run.wall_time = wall_time;
+  run.memory = sys.heap.total_memory();
+  run.error = 0.0;
+
+  //  NOTE: the cap matrix is 1 based
+  double mult = FPIEPS * sys.perm_factor;
+  run.capmat.clear();
+  for (int i = 1; i <= size; ++i) {
+    for (int j = 1; j <= size; ++j) {
+      run.capmat.push_back(mult * capmat[i][j]);
+    }
+  }
+}
+
+static double cap_error(const std::vector<double> &c, const std::vector<double> &ref)
+{
+  if (c.size() != ref.size()) {
+    return -1.0;
+  }
+
+  double nd = 0.0, nr = 0.0;
+  for (size_t i = 0; i < c.size(); ++i) {
+    nd += (c[i] - ref[i]) * (c[i] - ref[i]);
+    nr += ref[i] * ref[i];
+  }
+
+  return nr > 0.0 ? sqrt(nd / nr) : 0.0;
+}
+
+static void write_run(FILE *fp, const Run &run, bool is_ref)
+{
+  fprintf(fp, "{\"geometry\":\"%s\",\"target_panels\":%d,\"ncells\":%d,\"panels\":%d,\"conductors\":%d,"
+              "\"order\":%d,\"depth\":%d,\"iterations\":%d,"
+              "\"setup_time\":%.6g,\"solve_time\":%.6g,\"pq_time_per_iteration\":%.6g,\"wall_time\":%.6g,"
+              "\"memory_bytes\":%lld,\"reference\":%s,\"cap_error\":%.6g,\"capacitance\":[",
+          run.geometry, run.target, run.ncells, run.panels, run.conductors,
+          run.order, run.depth, run.iterations,
+          run.setup_time, run.solve_time, run.pq_time, run.wall_time,
+          (long long) run.memory, is_ref ? "true" : "false", run.error);
+  for (size_t i = 0; i < run.capmat.size(); ++i) {
+    fprintf(fp, "%s%.8g", i > 0 ? "," : "", run.capmat[i]);
+  }
+  fprintf(fp, "]}");
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [-g<geometry>] [-pmin<panels>] [-pmax<panels>] [-ppd<points>]\n"
+          "          [-r<panels>] [-o<order>] [-j<json file>] [--smoke]\n", prog);
+  fprintf(stderr, "DEFAULT VALUES:\n");
+  fprintf(stderr, "  panel count sweep = %d to %d, %d point(s) per decade\n", DEFPMIN, DEFPMAX, DEFPPD);
+  fprintf(stderr, "  reference = finest run of the sweep\n");
+  fprintf(stderr, "  JSON output = stdout\n");
+  fprintf(stderr, "OPTIONS:\n");
+  fprintf(stderr, "  -g       = geometry (may be given multiple times, default: all):\n");
+  fprintf(stderr, "            ");
+  for (int i = 0; i < num_geometries; ++i) {
+    fprintf(stderr, " %s", geometries[i].name);
+  }
+  fprintf(stderr, "\n");
+  fprintf(stderr, "  -pmin    = smallest panel count of the sweep\n");
+  fprintf(stderr, "  -pmax    = largest panel count of the sweep\n");
+  fprintf(stderr, "  -ppd     = number of sweep points per decade\n");
+  fprintf(stderr, "  -r       = panel count of a separate reference run\n");
+  fprintf(stderr, "  -o       = expansion order\n");
+  fprintf(stderr, "  -j       = write JSON results to this file\n");
+  fprintf(stderr, "  --smoke  = quick run of all geometries with small panel counts\n");
+}
+
+int main(int argc, char *argv[])
+{
+  std::vector<const Geometry *> geos;
+  int pmin = DEFPMIN, pmax = DEFPMAX, ppd = DEFPPD, ref_panels = 0, order = 0;
+  const char *json_file = 0;
+  bool cmderr = false;
+  char *chk = 0;
+
+  for (int i = 1; i < argc && !cmderr; i++) {
+    const char *a = argv[i];
+    if (a[0] != '-') {
+      fprintf(stderr, "%s: illegal argument -- %s\n", argv[0], a);
+      cmderr = true;
+    } else if (!strcmp(a + 1, "-smoke")) {
+      pmin = 200;
+      pmax = 1000;
+      ppd = 1;
+    } else if (!strncmp(a + 1, "pmin", 4)) {
+      pmin = int(strtod(a + 5, &chk));
+      cmderr = (chk == a + 5 || pmin < 1);
+    } else if (!strncmp(a + 1, "pmax", 4)) {
+      pmax = int(strtod(a + 5, &chk));
+      cmderr = (chk == a + 5 || pmax < 1);
+    } else if (!strncmp(a + 1, "ppd", 3)) {
+      ppd = int(strtol(a + 4, &chk, 10));
+      cmderr = (chk == a + 4 || ppd < 1);
+    } else if (a[1] == 'g') {
+      int g = 0;
+      for ( ; g < num_geometries && strcmp(geometries[g].name, a + 2); ++g)
+        ;
+      if (g == num_geometries) {
+        fprintf(stderr, "%s: unknown geometry `%s'\n", argv[0], a + 2);
+        cmderr = true;
+      } else {
+        geos.push_back(&geometries[g]);
+      }
+    } else if (a[1] == 'r') {
+      ref_panels = int(strtod(a + 2, &chk));
+      cmderr = (chk == a + 2 || ref_panels < 1);
+    } else if (a[1] == 'o') {
+      order = int(strtol(a + 2, &chk, 10));
+      cmderr = (chk == a + 2 || order < 0 || order > MAXORDER);
+    } else if (a[1] == 'j') {
+      json_file = a + 2;
+    } else {
+      fprintf(stderr, "%s: illegal option -- %s\n", argv[0], a + 1);
+      cmderr = true;
+    }
+  }
+
+  if (cmderr || pmin > pmax) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (geos.empty()) {
+    for (int g = 0; g < num_geometries; ++g) {
+      geos.push_back(&geometries[g]);
+    }
+  }
+
+  //  logarithmic sweep of panel counts
+  std::vector<int> targets;
+  for (double p = pmin; p < pmax * (1.0 + 1e-6); p *= pow(10.0, 1.0 / ppd)) {
+    targets.push_back(int(floor(p + 0.5)));
+  }
+  if (targets.back() != pmax) {
+    targets.push_back(pmax);
+  }
+
+  try {
+
+    FILE *out = stdout;
+    if (json_file && *json_file) {
+      out = fopen(json_file, "w");
+      if (!out) {
+        throw std::runtime_error(std::string("fastcap_bench: cannot open '") + json_file + "' for writing");
+      }
+    }
+
+    fprintf(out, "{\"benchmark\":\"fastcap_bench\",\"runs\":[");
+    const char *sep = "\n";
+
+    for (std::vector<const Geometry *>::const_iterator g = geos.begin(); g != geos.end(); ++g) {
+
+      std::vector<Run> runs;
+      int last_ncells = -1;
+
+      for (std::vector<int>::const_iterator t = targets.begin(); t != targets.end(); ++t) {
+
+        int ncells = find_ncells(**g, *t);
+        if (ncells == last_ncells) {
+          continue;
+        }
+        last_ncells = ncells;
+
+        runs.push_back(Run());
+        run_one(**g, *t, ncells, order, runs.back());
+
+        fprintf(stderr, "%-8s %8d panels: %4d iterations, setup %.3gs, P*q %.3gs/iteration, %.3g MB\n",
+                (*g)->name, runs.back().panels, runs.back().iterations,
+                runs.back().setup_time, runs.back().pq_time, runs.back().memory / 1048576.0);
+
+      }
+
+      Run ref;
+      bool separate_ref = (ref_panels > 0);
+      if (separate_ref) {
+        run_one(**g, ref_panels, find_ncells(**g, ref_panels), order, ref);
+      } else {
+        ref = runs.back();
+      }
+
+      for (std::vector<Run>::iterator r = runs.begin(); r != runs.end(); ++r) {
+        r->error = cap_error(r->capmat, ref.capmat);
+        fprintf(out, "%s", sep);
+        write_run(out, *r, !separate_ref && r + 1 == runs.end());
+        sep = ",\n";
+      }
+
+      if (separate_ref) {
+        fprintf(out, "%s", sep);
+        write_run(out, ref, true);
+      }
+
+    }
+
+    fprintf(out, "\n]}\n");
+
+    if (out != stdout) {
+      if (fclose(out) != 0) {
+        throw std::runtime_error(std::string("fastcap_bench: error writing '") + json_file + "'");
+      }
+    }
+
+    return 0;
+
+  } catch (std::exception &ex) {
+    fputs("ERROR: ", stderr);
+    fputs(ex.what(), stderr);
+    fputs("\n", stderr);
+    return -1;
+  }
+}
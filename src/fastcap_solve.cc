@@ -7,6 +7,7 @@
 #include "zbuf2fastcap.h"
 #include "mulMulti.h"
 #include "mulMats.h"
+#include "mulDo.h"
 #include "mulSetup.h"
 #include "mulDisplay.h"
 #include "calcp.h"
@@ -14,6 +15,10 @@
 #include "psMatDisplay.h"
 #include "resusage.h"
 #include "counters.h"
+#include "trace.h"
+#include "autotune.h"
+#include "estimate.h"
+#include "hmatrix.h"
 
 #include <cstdlib>
 #include <cstring>
@@ -136,13 +141,60 @@ double **symmetrize_and_clean(ssystem *sys, double **capmat)
   return sym_mat;
 }
 
-double **fastcap_solve(ssystem *sys)
+/*
+  prints operation count, data traffic and achieved rates for one kind of
+  P*q pass - a multiply-add counts as two floating point operations
+*/
+static void dump_pass_rate(ssystem *sys, const char *name, long long ops, long long bytes, double time)
 {
-  int ttliter;
-  charge *chglist, *nq;
-  double **capmat, dirtimesav, mulsetup, initalltime, ttlsetup, ttlsolve;
+  sys->msg("    %-16s %10.4g GFlop %10.4g MB %6.3g flop/byte", 
+           name, 2e-9 * ops, 1e-6 * bytes, bytes > 0 ? 2.0 * ops / bytes : 0.0);
+  if (time > 0.0) {
+    sys->msg(" %8.3g GFLOP/s %8.3g GB/s\n", 2e-9 * ops / time, 1e-9 * bytes / time);
+  } else {
+    sys->msg("\n");
+  }
+}
+
+/*
+  moves the near-field (Q2P, Q2PD) matrices into a memory-mapped file if the
+  predicted peak memory exceeds the budget given by sys->mem_limit
+*/
+static void apply_memory_limit(ssystem *sys, int up_size, int eval_size)
+{
+  resource_estimate est;
+  estimate_resources(sys, up_size, eval_size, est);
 
-  double *trimat = 0, *sqrmat = 0;
+  double limit = sys->mem_limit * 1024.0 * 1024.0;
+  if (est.peak_memory() <= limit) {
+    return;
+  }
+
+  if (! sys->heap.map_to_file(AQ2P) || ! sys->heap.map_to_file(AQ2PD)) {
+    sys->error("Cannot create the memory-mapped file for the near-field matrices");
+  }
+
+  size_t near_field = est.memory[AQ2P] + est.memory[AQ2PD];
+  sys->msg("\nPredicted peak memory of %.1f MB exceeds the limit of %.1f MB:\n"
+           "  near-field matrices (%.1f MB) are kept in a memory-mapped file\n",
+           est.peak_memory() / (1024.0 * 1024.0), sys->mem_limit, near_field / (1024.0 * 1024.0));
+
+  if (est.peak_memory() - near_field > limit) {
+    sys->warn("Memory limit of %.1f MB is exceeded even without the near-field matrices (%.1f MB)\n",
+              sys->mem_limit, (est.peak_memory() - near_field) / (1024.0 * 1024.0));
+  }
+}
+
+/*
+  sets up the cubes and the direct, preconditioner and multipole matrices
+  for the given panel list and records the result in sys->setup
+*/
+static void setup_solver(ssystem *sys, charge *chglist)
+{
+  double dirtimesav, mulsetup = 0.0, initalltime;
+
+  blk_matrix *blkmat = 0;
+  h_matrix *hmat = 0;
   int *real_index = 0;
   int num_dielec_panels = 0;            /* number of dielectric interface panels */
   int num_both_panels = 0;              /* number of thin-cond-on-dielec-i/f panels */
@@ -157,17 +209,11 @@ double **fastcap_solve(ssystem *sys)
   char dump_filename[BUFSIZ];
   strcpy(dump_filename, "psmat.ps");
 
-  /* get the list of all panels in the problem */
-  /* - many command line parameters having to do with the postscript
-       file dumping interface are passed back via globals (see mulGlobal.c) */
-  chglist = build_charge_list(sys);
-  if (!chglist) {
-    throw std::runtime_error("No surfaces present - cannot compute capacitance matrix");
-  }
+  /* the H-matrix replaces the multipole and near-field matrices */
+  bool hsolve = sys->hsolve && ! sys->dirsol && ! sys->expgcr;
 
-  if (sys->dissrf && sys->log) {
-    dumpSurfDat(sys);
-  }
+  sys->setup.valid = false;
+  sys->setup.req_depth = sys->depth;
 
   if (sys->log) {
     time(&clock);
@@ -183,9 +229,17 @@ double **fastcap_solve(ssystem *sys)
     dumpConfig(sys, sys->argv[0]);
   }
 
-  starttimer;
-  mulInit(sys, chglist);  /* Set up cubes, charges. */
-  stoptimer;
+  if (sys->autotune > 0.0 && ! sys->dirsol && ! sys->expgcr && ! hsolve) {
+    TraceSpan span(sys->trace, "autotune", "setup");
+    autotune(sys, chglist);   /* pick order and depth */
+  }
+
+  {
+    TraceSpan span(sys->trace, "mulInit", "setup");
+    starttimer;
+    mulInit(sys, chglist);  /* Set up cubes, charges. */
+    stoptimer;
+  }
   initalltime = dtime;
 
   sys->msg("\nINPUT SUMMARY\n");
@@ -199,13 +253,12 @@ double **fastcap_solve(ssystem *sys)
   /* Figure out number of panels and conductors. */
   eval_size = up_size = num_dummy_panels = num_dielec_panels = 0;
   num_both_panels = num_cond_panels = 0;
-  for(nq = chglist; nq != NULL; nq = nq->next) {
-    if(nq->dummy) num_dummy_panels++;
-    else if(nq->surf->type == CONDTR) {
-      num_cond_panels++;
-    }
-    else if(nq->surf->type == DIELEC) num_dielec_panels++;
-    else if(nq->surf->type == BOTH) num_both_panels++;
+  for(int i = 1; i <= sys->ptab.size; i++) {
+    int type = sys->ptab.type[i];
+    if(type < 0) num_dummy_panels++;
+    else if(type == CONDTR) num_cond_panels++;
+    else if(type == DIELEC) num_dielec_panels++;
+    else if(type == BOTH) num_both_panels++;
   }
   up_size = num_cond_panels + num_both_panels + num_dielec_panels;
   eval_size = up_size + num_dummy_panels;
@@ -246,33 +299,72 @@ double **fastcap_solve(ssystem *sys)
 
   sys->flush();
 
-  starttimer;
-  mulMultiAlloc(sys, MAX(sys->max_eval_pnt, sys->max_panel), sys->order, sys->depth);
-  stoptimer;
+  if (sys->estimate) {
+    if (hsolve) {
+      sys->warn("Resource estimate is for the multipole solver - the H-matrix solver is not modelled\n");
+    }
+    resource_estimate est;
+    estimate_resources(sys, up_size, eval_size, est);
+    dump_resource_estimate(sys, chglist, est);
+    return;                     /* dry run - no matrices are built */
+  }
+
+  if (sys->mem_limit > 0.0 && ! sys->dirsol && ! sys->expgcr && ! hsolve) {
+    apply_memory_limit(sys, up_size, eval_size);
+  }
+
+  {
+    TraceSpan span(sys->trace, "mulMultiAlloc", "setup");
+    starttimer;
+    mulMultiAlloc(sys, MAX(sys->max_eval_pnt, sys->max_panel), sys->order, sys->depth);
+    stoptimer;
+  }
   initalltime += dtime;         /* save initial allocation time */
 
   if (sys->dumpps == DUMPPS_ON || sys->dumpps == DUMPPS_ALL) {
     dump_ps_mat(sys, dump_filename, 0, 0, eval_size, eval_size, sys->argv, sys->argc, OPEN);
   }
 
-  mulMatDirect(sys, &trimat, &sqrmat, &real_index, up_size, eval_size);                /* Compute the direct part matrices. */
+  if (hsolve) {
+    TraceSpan span(sys->trace, "h_matrix", "setup");
+    starttimer;
+    hmat = sys->heap.create<h_matrix>(AMSC);
+    hmat->init(sys, ACATOL * sys->iter_tol);
+    stoptimer;
+    counters.dirtime += dtime;
+  } else {
+    TraceSpan span(sys->trace, "mulMatDirect", "setup");
+    mulMatDirect(sys, &blkmat, &real_index, up_size, eval_size);                /* Compute the direct part matrices. */
+  }
 
-  if (! sys->dirsol) {           /* with DIRSOL just want to skip to solve */
+  if (! sys->dirsol && ! hsolve) {           /* with DIRSOL just want to skip to solve */
 
-    if (PRECOND == BD) {
+    /* with EXPGCR, there is only one cube holding the full P, so the
+       preconditioner would be a direct solve - none is used */
+    if (sys->precond == BD && ! sys->expgcr) {
+      TraceSpan span(sys->trace, "bdmulMatPrecond", "setup");
       starttimer;
       bdmulMatPrecond(sys);
       stoptimer;
       counters.prsetime = dtime;                /* preconditioner set up time */
     }
 
-    if (PRECOND == OL) {
+    if (sys->precond == OL && ! sys->expgcr) {
+      TraceSpan span(sys->trace, "olmulMatPrecond", "setup");
       starttimer;
       olmulMatPrecond(sys);
       stoptimer;
       counters.prsetime = dtime;                /* preconditioner set up time */
     }
 
+    if (sys->precond == SPAI && ! sys->expgcr) {
+      TraceSpan span(sys->trace, "spaimulMatPrecond", "setup");
+      starttimer;
+      spaimulMatPrecond(sys);
+      stoptimer;
+      counters.prsetime = dtime;                /* preconditioner set up time */
+    }
+
     if (sys->dmprec) {
       dump_preconditioner(sys, chglist, 1);    /* dump prec. and P to matlab file */
     }
@@ -291,21 +383,29 @@ double **fastcap_solve(ssystem *sys)
   dirtimesav = counters.dirtime;    /* save direct matrix setup time */
   counters.dirtime = 0.0;           /* make way for direct solve time */
 
-  if (! sys->dirsol) {
+  if (! sys->dirsol && ! hsolve) {
 
     if (sys->dumpps == DUMPPS_ON) {
       dump_ps_mat(sys, dump_filename, 0, 0, eval_size, eval_size, sys->argv, sys->argc, CLOSE);
     }
 
     starttimer;
-    mulMatUp(sys);             /* Compute the upward pass matrices. */
 
-    if (DNTYPE == NOSHFT) {
-      mulMatDown(sys);         /* find matrices for no L2L shift dwnwd pass */
+    {
+      TraceSpan span(sys->trace, "mulMatUp", "setup");
+      mulMatUp(sys);           /* Compute the upward pass matrices. */
     }
 
-    if (DNTYPE == GRENGD) {
-      mulMatDown(sys);         /* find matrices for full Greengard dnwd pass*/
+    {
+      TraceSpan span(sys->trace, "mulMatDown", "setup");
+
+      if (sys->dntype == NOSHFT) {
+        mulMatDown(sys);       /* find matrices for no L2L shift dwnwd pass */
+      }
+
+      if (sys->dntype == GRENGD) {
+        mulMatDown(sys);       /* find matrices for full Greengard dnwd pass*/
+      }
     }
 
     if (sys->ckdlst) {
@@ -314,7 +414,12 @@ double **fastcap_solve(ssystem *sys)
       //  Not available anywhere: chkEvalLstD(sys, DIRECT);
     }
 
-    mulMatEval(sys);           /* set up matrices for evaluation pass */
+    {
+      TraceSpan span(sys->trace, "mulMatEval", "setup");
+      mulMatEval(sys);         /* set up matrices for evaluation pass */
+    }
+
+    mulPassTables(sys);        /* flat product lists for the passes */
 
     stoptimer;
     mulsetup = dtime;           /* save multipole matrix setup time */
@@ -335,18 +440,114 @@ double **fastcap_solve(ssystem *sys)
 
   }
 
+  sys->setup.valid = true;
+  sys->setup.panels = chglist;
+  sys->setup.order = sys->order;
+  sys->setup.depth = sys->depth;
+  sys->setup.dirsol = sys->dirsol;
+  sys->setup.expgcr = sys->expgcr;
+  sys->setup.hsolve = sys->hsolve;
+  sys->setup.q2pcomp = sys->q2pcomp;
+  sys->setup.precond = sys->precond;
+  sys->setup.dntype = sys->dntype;
+  sys->setup.nnbrs = sys->nnbrs;
+  sys->setup.numdpt = sys->numdpt;
+  sys->setup.adapt = sys->adapt;
+  sys->setup.m2ltyp = sys->m2ltyp;
+  sys->setup.autotune = sys->autotune;
+  sys->setup.iter_tol = sys->iter_tol;
+  sys->setup.blkmat = blkmat;
+  sys->setup.hmat = hmat;
+  sys->setup.coarse = 0;
+  sys->setup.real_index = real_index;
+  sys->setup.up_size = up_size;
+  sys->setup.eval_size = eval_size;
+  sys->setup.inittime = initalltime;
+  sys->setup.dirtime = dirtimesav;
+  sys->setup.multime = mulsetup;
+}
+
+double **fastcap_solve(ssystem *sys)
+{
+  int ttliter;
+  charge *chglist;
+  double **capmat, ttlsetup, ttlsolve;
+  double dirtimesav = 0.0, mulsetup = 0.0, initalltime = 0.0;
+
+  blk_matrix *blkmat = 0;
+  h_matrix *hmat = 0;
+  int *real_index = 0;
+  int up_size = 0;                      /* number of real panels */
+  int eval_size = 0;                    /* real panels plus dummies */
+
+  /* get the list of all panels in the problem */
+  /* - many command line parameters having to do with the postscript
+       file dumping interface are passed back via globals (see mulGlobal.c) */
+  counters = Counters();         /* report figures for this solve only */
+
+  if (sys->trace_file) {
+    sys->trace.start();
+  }
+
+  {
+    TraceSpan span(sys->trace, "build_charge_list", "setup");
+    chglist = build_charge_list(sys);
+  }
+  if (!chglist) {
+    throw std::runtime_error("No surfaces present - cannot compute capacitance matrix");
+  }
+
+  if (sys->dissrf && sys->log) {
+    dumpSurfDat(sys);
+  }
+
+  if (sys->setup.matches(sys, chglist)) {
+    //  the cube structure was built for the actual depth, not the requested one
+    sys->depth = sys->setup.depth;
+    sys->msg("\nReusing the setup of the previous solve (order %d, depth %d)\n", sys->order, sys->depth);
+  } else {
+    //  the previous setup was made for the same panels, hence everything
+    //  allocated since then belongs to that setup and can be given back
+    if (sys->setup.mark_panels == chglist) {
+      size_t before = sys->heap.total_memory();
+      sys->heap.release(sys->setup.heap_mark);
+      counters.released = before - sys->heap.total_memory();
+    }
+    sys->setup.heap_mark = sys->heap.mark();
+    sys->setup.mark_panels = chglist;
+    setup_solver(sys, chglist);
+    if (sys->estimate) {
+      return 0;
+    }
+    initalltime = sys->setup.inittime;
+    dirtimesav = sys->setup.dirtime;
+    mulsetup = sys->setup.multime;
+  }
+
+  blkmat = sys->setup.blkmat;
+  hmat = sys->setup.hmat;
+  real_index = sys->setup.real_index;
+  up_size = sys->setup.up_size;
+  eval_size = sys->setup.eval_size;
+
   sys->msg("\nITERATION DATA");
-  ttliter = capsolve(&capmat, sys, chglist, eval_size, up_size, trimat, sqrmat, real_index);
+  {
+    TraceSpan span(sys->trace, "capsolve");
+    ttliter = capsolve(&capmat, sys, chglist, eval_size, up_size, blkmat, hmat, real_index);
+  }
 
   capmat = symmetrize_and_clean(sys, capmat);
 
+  ttlsetup = initalltime + dirtimesav + mulsetup + counters.prsetime;
+  counters.setuptime = ttlsetup;
+  counters.iterations = ttliter;
+
   if (sys->mksdat && sys->log) {
     mksCapDump(sys, capmat);
   }
 
   if (sys->timdat && sys->log) {
 
-    ttlsetup = initalltime + dirtimesav + mulsetup;
     counters.multime = counters.uptime + counters.downtime + counters.evaltime;
     ttlsolve = counters.dirtime + counters.multime + counters.prectime + counters.conjtime;
 
@@ -356,6 +557,7 @@ double **fastcap_solve(ssystem *sys)
     sys->msg("  Total setup time: %g\n", ttlsetup);
     sys->msg("    Direct matrix setup time: %g\n", dirtimesav);
     sys->msg("    Multipole matrix setup time: %g\n", mulsetup);
+    sys->msg("    Preconditioner setup time: %g\n", counters.prsetime);
     sys->msg("    Initial misc. allocation time: %g\n", initalltime);
     sys->msg("  Total iterative P*q = psi solve time: %g\n", ttlsolve);
     sys->msg("    P*q product time, direct part: %g\n", counters.dirtime);
@@ -366,17 +568,30 @@ double **fastcap_solve(ssystem *sys)
     sys->msg("    Preconditioner solution time: %g\n", counters.prectime);
     sys->msg("    Iterative loop overhead time: %g\n", counters.conjtime);
 
-    if(sys->dirsol) {            /* if solution is done by Gaussian elim. */
+    if(hmat) {                   /* if solution is done by the H-matrix */
+      sys->msg("\nTotal H-matrix LU factor time: %g\n", counters.lutime);
+      sys->msg("Total H-matrix solve time: %g\n", counters.fullsoltime);
+      sys->msg("Total H-matrix solve operations: %lld\n", counters.fulldirops);
+    }
+    else if(sys->dirsol) {       /* if solution is done by Gaussian elim. */
       sys->msg("\nTotal direct, full matrix LU factor time: %g\n", counters.lutime);
       sys->msg("Total direct, full matrix solve time: %g\n", counters.fullsoltime);
-      sys->msg("Total direct operations: %d\n", counters.fulldirops);
+      sys->msg("Total direct operations: %lld\n", counters.fulldirops);
     }
     else if (sys->expgcr) {      /* if solution done iteratively w/o multis */
-      sys->msg("\nTotal A*q operations: %d (%d/iter)\n",
-              counters.fullPqops, counters.fullPqops/ttliter);
+      sys->msg("\nTotal A*q operations: %lld (%lld/iter)\n",
+              counters.fullPqops, counters.fullPqops/(ttliter > 0 ? ttliter : 1));
+    }
+    else {
+      sys->msg("\nP*q pass operations (totals over all iterations):\n");
+      dump_pass_rate(sys, "Direct part:", counters.dirops, counters.dirbytes, counters.dirtime);
+      dump_pass_rate(sys, "Preconditioner:", counters.precops, counters.precbytes, counters.prectime);
+      dump_pass_rate(sys, "Upward pass:", counters.upops, counters.upbytes, counters.uptime);
+      dump_pass_rate(sys, "Downward pass:", counters.downops, counters.downbytes, counters.downtime);
+      dump_pass_rate(sys, "Evaluation pass:", counters.evalops, counters.evalbytes, counters.evaltime);
     }
 
-    sys->msg("Total memory allocated: %d kilobytes ", int(sys->heap.total_memory()/1024));
+    sys->msg("Total memory allocated: %d kilobytes\n", int(sys->heap.total_memory()/1024));
 
     sys->msg("  Q2M  matrix memory allocated: %7.d kilobytes\n",
             int(sys->heap.memory(AQ2M)/1024));
@@ -398,8 +613,19 @@ double **fastcap_solve(ssystem *sys)
             int(sys->heap.memory(AQ2PD)/1024));
     sys->msg("  Miscellaneous mem. allocated: %7.d kilobytes\n",
             int(sys->heap.memory(AMSC)/1024));
+    if (sys->heap.mapped_memory() > 0) {
+      sys->msg("  Memory-mapped to file (incl.): %6.d kilobytes\n",
+              int(sys->heap.mapped_memory()/1024));
+    }
 
   }
 
+  if (sys->trace.enabled()) {
+    sys->trace.stop();
+    if (! sys->trace.write(sys->trace_file)) {
+      sys->error("Cannot write trace file '%s'", sys->trace_file);
+    }
+  }
+
   return capmat;
 }
@@ -1,8 +1,120 @@
 #include "heap.h"
 
 #include <vector>
+#include <string>
 #include <cstdlib>
 #include <cstring>
+#include <new>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ *  @brief A bump allocator working on an unlinked, memory-mapped temporary file
+ *
+ *  The file grows in chunks which are mapped one by one. Fresh file pages
+ *  read as zero, so the memory does not need to be cleared.
+ */
+struct MappedArena
+{
+  //  chunks are at least this large (a multiple of the page size)
+  static const size_t min_chunk = 64 * 1024 * 1024;
+
+  MappedArena() : fd(-1), file_size(0), ptr(0), avail(0), used(0) { }
+
+  ~MappedArena()
+  {
+    for (auto c = chunks.begin(); c != chunks.end(); ++c) {
+      munmap(c->first, c->second);
+    }
+    chunks.clear();
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  bool open(const char *dir)
+  {
+    if (fd >= 0) {
+      return true;
+    }
+
+    if (! dir) {
+      dir = getenv("TMPDIR");
+    }
+    std::string path = std::string(dir && *dir ? dir : "/tmp") + "/fastcapXXXXXX";
+
+    std::vector<char> tmpl(path.begin(), path.end());
+    tmpl.push_back(0);
+    fd = mkstemp(tmpl.data());
+    if (fd < 0) {
+      return false;
+    }
+    unlink(tmpl.data());
+    return true;
+  }
+
+  void *alloc(size_t n)
+  {
+    //  keep doubles aligned
+    n = (n + 15) & ~size_t(15);
+
+    if (n > avail) {
+
+      size_t page = size_t(sysconf(_SC_PAGESIZE));
+      size_t size = ((n > min_chunk ? n : min_chunk) + page - 1) / page * page;
+
+      if (ftruncate(fd, off_t(file_size + size)) != 0) {
+        return 0;
+      }
+      void *m = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, off_t(file_size));
+      if (m == MAP_FAILED) {
+        return 0;
+      }
+      madvise(m, size, MADV_SEQUENTIAL);
+
+      chunks.push_back(std::make_pair(m, size));
+      file_size += size;
+      ptr = (char *) m;
+      avail = size;
+
+    }
+
+    void *d = ptr;
+    ptr += n;
+    avail -= n;
+    used += n;
+    return d;
+  }
+
+  //  gives back everything allocated after the given state
+  void rewind(size_t nchunks, size_t size, char *p, size_t a, size_t u)
+  {
+    while (chunks.size() > nchunks) {
+      munmap(chunks.back().first, chunks.back().second);
+      chunks.pop_back();
+    }
+    //  truncating drops the old pages, so regrown ones read as zero again
+    if (file_size > size && ftruncate(fd, off_t(size)) == 0) {
+      file_size = size;
+    }
+    ptr = p;
+    avail = a;
+    used = u;
+
+    //  the rest of the current chunk is used again and has to read as zero
+    if (ptr) {
+      memset(ptr, 0, avail);
+    }
+  }
+
+  int fd;
+  size_t file_size;
+  char *ptr;
+  size_t avail;
+  size_t used;
+  std::vector<std::pair<void *, size_t> > chunks;
+};
 
 struct HeapPrivate
 {
@@ -22,6 +134,7 @@ struct HeapPrivate
 
   std::vector<char *> ptrs;
   std::vector<Heap::DestructorBase *> destructors;
+  MappedArena arena;
 };
 
 Heap::Heap()
@@ -29,6 +142,7 @@ Heap::Heap()
 {
   for (unsigned int i = 0; i < NumTypes; ++i) {
     m_memory[i] = 0;
+    m_mapped[i] = false;
   }
 }
 
@@ -44,6 +158,16 @@ Heap::malloc(size_t n, MemoryType type)
   if (! mp_data) {
     mp_data = new HeapPrivate();
   }
+
+  if (type >= 0 && type < NumTypes && m_mapped[type]) {
+    void *d = mp_data->arena.alloc(n);
+    if (! d) {
+      throw std::bad_alloc();
+    }
+    m_memory[type] += n;
+    return d;
+  }
+
   char *d = (char *)::malloc(n);
   mp_data->ptrs.push_back (d);
   if (type >= 0 && type < NumTypes) {
@@ -77,12 +201,35 @@ char *Heap::strdup(const char *str, MemoryType type)
 double **Heap::mat(int n, int m, MemoryType type)
 {
   double **d = this->alloc<double *>(n, type);
+  double *rows = this->alloc<double>(size_t(n) * size_t(m), type);
   for (int i = 0; i < n; ++i) {
-    d[i] = this->alloc<double>(m, type);
+    d[i] = rows + size_t(i) * size_t(m);
   }
   return d;
 }
 
+bool
+Heap::map_to_file(MemoryType type, const char *dir)
+{
+  if (type < 0 || type >= NumTypes) {
+    return false;
+  }
+  if (! mp_data) {
+    mp_data = new HeapPrivate();
+  }
+  if (! mp_data->arena.open(dir)) {
+    return false;
+  }
+  m_mapped[type] = true;
+  return true;
+}
+
+size_t
+Heap::mapped_memory() const
+{
+  return mp_data ? mp_data->arena.used : 0;
+}
+
 size_t
 Heap::memory(MemoryType type) const
 {
@@ -102,3 +249,59 @@ Heap::total_memory() const
   }
   return n;
 }
+
+Heap::Mark::Mark()
+  : ptrs(0), destructors(0), chunks(0), file_size(0), avail(0), used(0), ptr(0)
+{
+  for (unsigned int i = 0; i < NumTypes; ++i) {
+    memory[i] = 0;
+    mapped[i] = false;
+  }
+}
+
+Heap::Mark
+Heap::mark() const
+{
+  Mark m;
+  if (mp_data) {
+    m.ptrs = mp_data->ptrs.size();
+    m.destructors = mp_data->destructors.size();
+    m.chunks = mp_data->arena.chunks.size();
+    m.file_size = mp_data->arena.file_size;
+    m.avail = mp_data->arena.avail;
+    m.used = mp_data->arena.used;
+    m.ptr = mp_data->arena.ptr;
+  }
+  for (unsigned int i = 0; i < NumTypes; ++i) {
+    m.memory[i] = m_memory[i];
+    m.mapped[i] = m_mapped[i];
+  }
+  return m;
+}
+
+void
+Heap::release(const Mark &m)
+{
+  if (! mp_data) {
+    return;
+  }
+
+  //  destroy the objects in reverse order of creation
+  while (mp_data->destructors.size() > m.destructors) {
+    mp_data->destructors.back()->destroy();
+    delete mp_data->destructors.back();
+    mp_data->destructors.pop_back();
+  }
+
+  while (mp_data->ptrs.size() > m.ptrs) {
+    ::free(mp_data->ptrs.back());
+    mp_data->ptrs.pop_back();
+  }
+
+  mp_data->arena.rewind(m.chunks, m.file_size, m.ptr, m.avail, m.used);
+
+  for (unsigned int i = 0; i < NumTypes; ++i) {
+    m_memory[i] = m.memory[i];
+    m_mapped[i] = m.mapped[i];
+  }
+}
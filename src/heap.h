@@ -27,12 +27,28 @@ struct HeapPrivate;
  *  @brief A class providing an allocation heap
  *
  *  The heap is a alloc-only structure that is cleaned as a whole
- *  upon destruction.
+ *  upon destruction. Everything allocated after a mark can be
+ *  released in one step though (see mark() and release()).
  *  The heap offers allocation functionality as well as
  *  memory tracking.
  */
 class Heap
 {
+public:
+  /**
+   *  @brief The state of the heap as recorded by mark()
+   */
+  struct Mark
+  {
+    Mark();
+
+    size_t ptrs, destructors;
+    size_t chunks, file_size, avail, used;
+    char *ptr;
+    size_t memory [NumTypes];
+    bool mapped [NumTypes];
+  };
+
 private:
   class DestructorBase
   {
@@ -81,16 +97,51 @@ public:
   void *malloc(size_t n, MemoryType type = AMSC);
 
   char *strdup(const char *str, MemoryType type = AMSC);
+
+  //  n row pointers into one contiguous, row-major block of n x m doubles
   double **mat(int n, int m, MemoryType = AMSC);
 
   size_t memory(MemoryType type) const;
   size_t total_memory() const;
 
+  /**
+   *  @brief Places all further allocations of the given type in a memory-mapped file
+   *
+   *  The allocations are laid out in the file in the order they are made
+   *  and the mapping is advised for sequential access. This way the
+   *  data can be streamed from disk when it does not fit into memory.
+   *  The file is created in "dir" (TMPDIR or /tmp if 0) and removed
+   *  right away, so it vanishes with the heap.
+   *  Returns false if the file could not be created.
+   */
+  bool map_to_file(MemoryType type, const char *dir = 0);
+
+  /**
+   *  @brief Gets the number of bytes allocated in the memory-mapped file
+   */
+  size_t mapped_memory() const;
+
+  /**
+   *  @brief Records the current state of the heap for release()
+   */
+  Mark mark() const;
+
+  /**
+   *  @brief Frees everything allocated after the given mark
+   *
+   *  Objects made with create() are destroyed, memory-mapped allocations
+   *  are given back to the file and the memory figures and the
+   *  memory-mapped types are the ones of the mark again. Marks taken
+   *  after this one become invalid.
+   */
+  void release(const Mark &m);
+
 private:
   friend struct HeapPrivate;
 
   HeapPrivate *mp_data;
   size_t m_memory [NumTypes];
+  bool m_mapped [NumTypes];
 
   void register_destructor(DestructorBase *);
 
@@ -0,0 +1,420 @@
+
+#include "mulGlobal.h"
+#include "mulStruct.h"
+#include "hmatrix.h"
+#include "blkDirect.h"
+#include "direct.h"
+#include "resusage.h"
+#include "counters.h"
+#include "parallel.h"
+#include "aca.h"
+
+#include <cmath>
+#include <algorithm>
+#include <cassert>
+
+/*
+  a node of the cluster tree - rows and columns [offset, offset+size) in
+  cluster order
+*/
+struct h_node
+{
+  int offset, size;
+  h_node *kids[2];              /* both 0 for leaves */
+
+  /* leaves: LU factors of the diagonal block */
+  double **lu;
+  int *pivots;
+
+  /* inner nodes: A12 = u12 v12^T, A21 = u21 v21^T (ranks r12, r21),
+     w1 = A11^-1 u12, w2 = A22^-1 u21, k = v21^T w1 and the LU factors
+     of g = I - v12^T w2 k */
+  int r12, r21;
+  double **u12, **v12, **u21, **v21;
+  double **w1, **w2, **k, **g;
+  int *gpivots;
+};
+
+namespace {
+
+/*
+  a temporary n x m matrix with row pointers
+*/
+struct scratch
+{
+  scratch(int n, int m)
+    : data(size_t(n) * size_t(m), 0.0), rows(n)
+  {
+    for (int i = 0; i < n; i++) {
+      rows[i] = data.data() + size_t(i) * size_t(m);
+    }
+  }
+
+  double **mat() { return rows.data(); }
+
+  std::vector<double> data;
+  std::vector<double *> rows;
+};
+
+/*
+  t = a^T x - a is n x r, x is n x m and t is r x m
+*/
+void tmul(double **t, double **a, double **x, int n, int r, int m)
+{
+  for (int l = 0; l < r; l++) {
+    for (int c = 0; c < m; c++) {
+      t[l][c] = 0.0;
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    const double *xi = x[i];
+    for (int l = 0; l < r; l++) {
+      double ail = a[i][l];
+      double *tl = t[l];
+      for (int c = 0; c < m; c++) {
+        tl[c] += ail * xi[c];
+      }
+    }
+  }
+}
+
+/*
+  x += f a t - a is n x r, t is r x m and x is n x m
+*/
+void mul_add(double **x, double **a, double **t, int n, int r, int m, double f)
+{
+  parallel_rows(0, n, (long long) r * m, [x, a, t, r, m, f] (int from, int to) {
+    for (int i = from; i < to; i++) {
+      double *xi = x[i];
+      for (int l = 0; l < r; l++) {
+        double ail = f * a[i][l];
+        const double *tl = t[l];
+        for (int c = 0; c < m; c++) {
+          xi[c] += ail * tl[c];
+        }
+      }
+    }
+  });
+}
+
+/*
+  number of real panels in the lowest level cubes below nc
+*/
+int count_panels(ssystem *sys, cube *nc)
+{
+  int n = 0;
+  if (nc->level == sys->depth) {
+    for (int i = 0; i < nc->upnumeles[0]; i++) {
+      if (! nc->chgs[i]->dummy) {
+        ++n;
+      }
+    }
+  } else {
+    for (int i = 0; i < nc->numkids; i++) {
+      if (nc->kids[i]) {
+        n += count_panels(sys, nc->kids[i]);
+      }
+    }
+  }
+  return n;
+}
+
+/*
+  collects the real panels in the lowest level cubes below nc
+*/
+void collect_panels(ssystem *sys, cube *nc, std::vector<charge *> &panels)
+{
+  if (nc->level == sys->depth) {
+    for (int i = 0; i < nc->upnumeles[0]; i++) {
+      if (! nc->chgs[i]->dummy) {
+        panels.push_back(nc->chgs[i]);
+      }
+    }
+  } else {
+    for (int i = 0; i < nc->numkids; i++) {
+      if (nc->kids[i]) {
+        collect_panels(sys, nc->kids[i], panels);
+      }
+    }
+  }
+}
+
+}
+
+// ----------------------------------------------------------------------------
+
+h_matrix::h_matrix()
+  : mp_sys(0), mp_root(0), m_tol(0.0), m_stored(0), m_max_rank(0)
+{
+  //  .. nothing yet ..
+}
+
+void h_matrix::init(ssystem *sys, double tol)
+{
+  mp_sys = sys;
+  m_tol = tol;
+  m_stored = 0;
+  m_max_rank = 0;
+  m_panels.clear();
+
+  std::vector<cube *> top(1, sys->cubes[0][0][0][0]);
+  mp_root = build(top);
+  if (! mp_root) {
+    sys->error("h_matrix: no panels");
+  }
+  assert(mp_root->size == size());
+
+  sys->msg("hmatrix: %d panels...", size());
+  sys->flush();
+
+  starttimer;
+  factor(mp_root);
+  stoptimer;
+  counters.lutime += dtime;
+
+  sys->msg("done (%.1f%% of dense storage, max. rank %d).\n",
+           100.0 * double(m_stored) / (double(size()) * double(size())), m_max_rank);
+  sys->flush();
+}
+
+/*
+  builds the cluster tree for a list of sibling cubes
+*/
+h_node *h_matrix::build(const std::vector<cube *> &cubes)
+{
+  int n = 0;
+  for (auto c = cubes.begin(); c != cubes.end(); ++c) {
+    n += count_panels(mp_sys, *c);
+  }
+
+  if (n == 0) {
+    return 0;
+  }
+
+  if (n <= HLEAFSIZE || (cubes.size() == 1 && cubes.front()->level == mp_sys->depth)) {
+    std::vector<charge *> panels;
+    for (auto c = cubes.begin(); c != cubes.end(); ++c) {
+      collect_panels(mp_sys, *c, panels);
+    }
+    return build(panels);
+  }
+
+  if (cubes.size() == 1) {
+    std::vector<cube *> kids;
+    cube *nc = cubes.front();
+    for (int i = 0; i < nc->numkids; i++) {
+      if (nc->kids[i]) {
+        kids.push_back(nc->kids[i]);
+      }
+    }
+    return build(kids);
+  }
+
+  //  the kids are ordered by octant, so halving the list splits the cube
+  std::vector<cube *> first(cubes.begin(), cubes.begin() + cubes.size() / 2);
+  std::vector<cube *> second(cubes.begin() + cubes.size() / 2, cubes.end());
+
+  h_node *k0 = build(first);
+  h_node *k1 = build(second);
+  if (! k0 || ! k1) {
+    return k0 ? k0 : k1;
+  }
+
+  h_node *node = mp_sys->heap.alloc<h_node>(1, AMSC);
+  node->offset = k0->offset;
+  node->size = k0->size + k1->size;
+  node->kids[0] = k0;
+  node->kids[1] = k1;
+  return node;
+}
+
+/*
+  builds the cluster tree for a list of panels - clusters larger than
+  HLEAFSIZE are bisected along their longest extent
+*/
+h_node *h_matrix::build(std::vector<charge *> &panels)
+{
+  if (panels.empty()) {
+    return 0;
+  }
+
+  if (int(panels.size()) <= HLEAFSIZE) {
+    h_node *node = mp_sys->heap.alloc<h_node>(1, AMSC);
+    node->offset = size();
+    node->size = int(panels.size());
+    m_panels.insert(m_panels.end(), panels.begin(), panels.end());
+    return node;
+  }
+
+  double lo[3] = { panels.front()->x, panels.front()->y, panels.front()->z };
+  double hi[3] = { lo[0], lo[1], lo[2] };
+  for (auto p = panels.begin(); p != panels.end(); ++p) {
+    double c[3] = { (*p)->x, (*p)->y, (*p)->z };
+    for (int d = 0; d < 3; d++) {
+      lo[d] = MIN(lo[d], c[d]);
+      hi[d] = MAX(hi[d], c[d]);
+    }
+  }
+
+  int axis = 0;
+  for (int d = 1; d < 3; d++) {
+    if (hi[d] - lo[d] > hi[axis] - lo[axis]) {
+      axis = d;
+    }
+  }
+  double charge::*coord = (axis == 0 ? &charge::x : (axis == 1 ? &charge::y : &charge::z));
+
+  size_t half = panels.size() / 2;
+  std::nth_element(panels.begin(), panels.begin() + half, panels.end(),
+                   [coord] (const charge *a, const charge *b) { return a->*coord < b->*coord; });
+
+  std::vector<charge *> first(panels.begin(), panels.begin() + half);
+  std::vector<charge *> second(panels.begin() + half, panels.end());
+
+  h_node *node = mp_sys->heap.alloc<h_node>(1, AMSC);
+  node->kids[0] = build(first);
+  node->kids[1] = build(second);
+  node->offset = node->kids[0]->offset;
+  node->size = int(panels.size());
+  return node;
+}
+
+double h_matrix::entry(int i, int j) const
+{
+  return blkQ2Pentry(mp_sys, m_panels[i], m_panels[j]);
+}
+
+/*
+  compresses the block with rows [row0, row0+nrows) and columns
+  [col0, col0+ncols) into u v^T and returns the rank
+*/
+int h_matrix::low_rank(int row0, int nrows, int col0, int ncols, double ***u, double ***v)
+{
+  int rank = aca(mp_sys->heap, AQ2P, nrows, ncols, m_tol, nrows + ncols,
+                 [this, row0, col0] (int i, int j) { return entry(row0 + i, col0 + j); },
+                 u, v);
+
+  m_stored += (long long) rank * (nrows + ncols);
+  m_max_rank = MAX(m_max_rank, rank);
+  return rank;
+}
+
+/*
+  factors the node bottom-up (see class documentation)
+*/
+void h_matrix::factor(h_node *node)
+{
+  if(! node->kids[0]) {
+
+    int n = node->size;
+    node->lu = mp_sys->heap.mat(n, n, AQ2PD);
+    for(int i = 0; i < n; i++) {
+      for(int j = 0; j < n; j++) node->lu[i][j] = entry(node->offset + i, node->offset + j);
+    }
+    ludecomp(mp_sys, node->lu, n, FALSE, &node->pivots);
+    m_stored += (long long) n * n;
+
+  } else {
+
+    h_node *k0 = node->kids[0], *k1 = node->kids[1];
+    int n1 = k0->size, n2 = k1->size;
+
+    factor(k0);
+    factor(k1);
+
+    node->r12 = low_rank(k0->offset, n1, k1->offset, n2, &node->u12, &node->v12);
+    node->r21 = low_rank(k1->offset, n2, k0->offset, n1, &node->u21, &node->v21);
+
+    int r12 = node->r12, r21 = node->r21;
+
+    node->w1 = mp_sys->heap.mat(n1, r12, AQ2P);
+    for(int i = 0; i < n1; i++) {
+      for(int l = 0; l < r12; l++) node->w1[i][l] = node->u12[i][l];
+    }
+    solve(k0, node->w1, r12);
+
+    node->w2 = mp_sys->heap.mat(n2, r21, AQ2P);
+    for(int i = 0; i < n2; i++) {
+      for(int l = 0; l < r21; l++) node->w2[i][l] = node->u21[i][l];
+    }
+    solve(k1, node->w2, r21);
+
+    node->k = mp_sys->heap.mat(r21, r12, AMSC);
+    tmul(node->k, node->v21, node->w1, n1, r21, r12);
+
+    scratch t(r12, r21);
+    tmul(t.mat(), node->v12, node->w2, n2, r12, r21);
+
+    node->g = mp_sys->heap.mat(r12, r12, AMSC);
+    for(int l = 0; l < r12; l++) node->g[l][l] = 1.0;
+    mul_add(node->g, t.mat(), node->k, r12, r21, r12, -1.0);
+    if(r12 > 0) {
+      ludecomp(mp_sys, node->g, r12, FALSE, &node->gpivots);
+    }
+
+    m_stored += (long long)(n1 + r21) * r12 + (long long) n2 * r21 + (long long) r12 * r12;
+
+  }
+}
+
+/*
+  solves A x = b in place for the node's block, x being size x nrhs:
+    y1 = A11^-1 b1
+    z  = A22^-1 (b2 - u21 v21^T y1)
+    x2 = z + w2 k g^-1 v12^T z     (the Schur complement, by Woodbury)
+    x1 = y1 - w1 v12^T x2
+*/
+void h_matrix::solve(const h_node *node, double **x, int nrhs) const
+{
+  if(! node->kids[0]) {
+    solveMulti(node->lu, x, node->size, nrhs, node->pivots);
+    return;
+  }
+
+  const h_node *k0 = node->kids[0], *k1 = node->kids[1];
+  int n1 = k0->size, n2 = k1->size, r12 = node->r12, r21 = node->r21;
+  double **x1 = x, **x2 = x + n1;
+
+  solve(k0, x1, nrhs);
+
+  scratch t21(r21, nrhs);
+  tmul(t21.mat(), node->v21, x1, n1, r21, nrhs);
+  mul_add(x2, node->u21, t21.mat(), n2, r21, nrhs, -1.0);
+
+  solve(k1, x2, nrhs);
+
+  scratch s(r12, nrhs);
+  if(r12 > 0) {
+    tmul(s.mat(), node->v12, x2, n2, r12, nrhs);
+    solveMulti(node->g, s.mat(), r12, nrhs, node->gpivots);
+    scratch ks(r21, nrhs);
+    mul_add(ks.mat(), node->k, s.mat(), r21, r12, nrhs, 1.0);
+    mul_add(x2, node->w2, ks.mat(), n2, r21, nrhs, 1.0);
+
+    tmul(s.mat(), node->v12, x2, n2, r12, nrhs);
+    mul_add(x1, node->w1, s.mat(), n1, r12, nrhs, -1.0);
+  }
+}
+
+void h_matrix::solve(double **x, int nrhs) const
+{
+  int n = size();
+
+  starttimer;
+
+  scratch y(n, nrhs);
+  for(int i = 0; i < n; i++) {
+    for(int c = 0; c < nrhs; c++) y.rows[i][c] = x[m_panels[i]->index - 1][c];
+  }
+
+  solve(mp_root, y.mat(), nrhs);
+
+  for(int i = 0; i < n; i++) {
+    for(int c = 0; c < nrhs; c++) x[m_panels[i]->index - 1][c] = y.rows[i][c];
+  }
+
+  counters.fulldirops += (long long)(2 * m_stored) * nrhs;
+
+  stoptimer;
+  counters.fullsoltime += dtime;
+}
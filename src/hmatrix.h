@@ -0,0 +1,85 @@
+
+#if !defined(hmatrix_H)
+#define hmatrix_H
+
+#include <vector>
+
+struct ssystem;
+struct charge;
+struct cube;
+struct h_node;
+
+/**
+ *  @brief A hierarchically compressed and factored P for direct solves
+ *
+ *  The panels (without dummies) are ordered along a binary cluster tree
+ *  derived from the cube hierarchy of mulInit(): the non-empty kids of a
+ *  cube are split in halves, clusters with at most HLEAFSIZE panels become
+ *  leaves. In this ordering, P is stored as a HODLR matrix: the diagonal
+ *  blocks of the leaves are dense, the off-diagonal blocks on each level
+ *  are low-rank products U V^T found by adaptive cross approximation (ACA)
+ *  of the condensed P entries (see blkQ2Pentry()).
+ *
+ *  As usual for HODLR, the admissibility is weak: every off-diagonal block
+ *  is compressed, also between siblings which touch, e.g. at the contact
+ *  of two conductors. Such blocks have higher ranks, but ACA only accepts
+ *  a block after checking ACACHECK sample rows against the tolerance.
+ *  Keeping touching blocks dense (standard admissibility) would make
+ *  nearly all blocks dense, since the halves of a cluster always touch.
+ *
+ *  The factorization is recursive: for a node with blocks A11, A12 = U12 V12^T,
+ *  A21 = U21 V21^T and A22, the kids are factored, then A11^-1 U12 and
+ *  A22^-1 U21 and a small capacitance matrix for the Schur complement
+ *  (Sherman-Morrison-Woodbury) are stored. A solve then costs
+ *  O(n r log n) for rank r, for any number of right hand sides at once.
+ */
+class h_matrix
+{
+public:
+  h_matrix();
+
+  /**
+   *  @brief Builds and factors the matrix for the cubes set up by mulInit()
+   *
+   *  "tol" is the relative accuracy of the low-rank blocks.
+   */
+  void init(ssystem *sys, double tol);
+
+  /**
+   *  @brief Solves P x = b for "nrhs" right hand sides at once
+   *
+   *  x[i][c] is the entry of right hand side c for the panel with
+   *  index i+1 on entry and the charge on return. Dummy panel rows are
+   *  not touched.
+   */
+  void solve(double **x, int nrhs) const;
+
+  //  number of real panels
+  int size() const { return int(m_panels.size()); }
+
+  //  number of doubles stored (dense and low-rank blocks)
+  long long stored() const { return m_stored; }
+
+  //  largest rank of an off-diagonal block
+  int max_rank() const { return m_max_rank; }
+
+private:
+  ssystem *mp_sys;
+  h_node *mp_root;
+  std::vector<charge *> m_panels;       //  panels in cluster order
+  double m_tol;
+  long long m_stored;
+  int m_max_rank;
+
+  h_node *build(const std::vector<cube *> &cubes);
+  h_node *build(std::vector<charge *> &panels);
+  void factor(h_node *node);
+  void solve(const h_node *node, double **x, int nrhs) const;
+  int low_rank(int row0, int nrows, int col0, int ncols, double ***u, double ***v);
+  double entry(int i, int j) const;
+
+  h_matrix(const h_matrix &);
+  h_matrix &operator=(const h_matrix &);
+};
+
+#endif
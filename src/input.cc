@@ -473,8 +473,7 @@ static charge *read_panels(ssystem *sys)
   char surf_name[BUFSIZ];
   int patran_file_read = FALSE;
 
-  sys->num_cond = 0;
-  sys->cond_names = NULL;
+  sys->clear_conductors();
 
   stdin_read = FALSE;
   for(cur_surf = sys->surf_list; cur_surf != NULL; cur_surf = cur_surf->next) {
@@ -573,7 +572,7 @@ static charge *read_panels(ssystem *sys)
     
     /* align the normals and add dummy structs if dielec i/f */
     initcalcp(sys, cur_surf->panels);/* get normals, edges, perpendiculars */
-    if(cur_surf->type == DIELEC || cur_surf->type == BOTH) {
+    if((cur_surf->type == DIELEC || cur_surf->type == BOTH) && sys->numdpt != 0) {
       add_dummy_panels(sys, cur_surf->panels); /* add dummy panels for field calc */
     }
 
@@ -697,6 +696,100 @@ static void parse_command_line(ssystem *sys, const char **input_file, const char
       }
       else if(!strcmp(&(argv[i][1]), "rd")) sys->rd_ = true;
       else if(!strcmp(&(argv[i][1]), "rk")) sys->rk_ = true;
+      else if(!strcmp(&(argv[i][1]), "-timing")) sys->timdat = true;
+      else if(!strncmp(&(argv[i][1]), "-trace=", 7) && argv[i][8]) {
+        sys->trace_file = &(argv[i][8]);
+      }
+      else if(!strncmp(&(argv[i][1]), "-autotune=", 10)) {
+        if(sscanf(&(argv[i][11]), "%lf", &sys->autotune) != 1 || sys->autotune <= 0.0) {
+          sys->info("%s: bad autotune target error '%s'\n",
+                  argv[0], &argv[i][11]);
+          cmderr = TRUE;
+          break;
+        }
+      }
+      else if(!strcmp(&(argv[i][1]), "-estimate")) sys->estimate = true;
+      else if(!strcmp(&(argv[i][1]), "-hmatrix")) sys->hsolve = true;
+      else if(!strcmp(&(argv[i][1]), "-compress-near")) sys->q2pcomp = true;
+      else if(!strcmp(&(argv[i][1]), "-two-level")) sys->twolevel = true;
+      else if(!strncmp(&(argv[i][1]), "-precond=", 9)) {
+        if(!strcmp(&(argv[i][10]), "none")) sys->precond = NONE;
+        else if(!strcmp(&(argv[i][10]), "bd")) sys->precond = BD;
+        else if(!strcmp(&(argv[i][10]), "ol")) sys->precond = OL;
+        else if(!strcmp(&(argv[i][10]), "spai")) sys->precond = SPAI;
+        else {
+          sys->info("%s: bad preconditioner '%s' (use none, bd, ol or spai)\n",
+                  argv[0], &argv[i][10]);
+          cmderr = TRUE;
+          break;
+        }
+      }
+      else if(!strncmp(&(argv[i][1]), "-itrtyp=", 8)) {
+        if(!strcmp(&(argv[i][9]), "gmres")) sys->itrtyp = GMRES;
+        else if(!strcmp(&(argv[i][9]), "gcr")) sys->itrtyp = GCR;
+        else {
+          sys->info("%s: bad iteration type '%s' (use gmres or gcr)\n",
+                  argv[0], &argv[i][9]);
+          cmderr = TRUE;
+          break;
+        }
+      }
+      else if(!strncmp(&(argv[i][1]), "-dntype=", 8)) {
+        if(!strcmp(&(argv[i][9]), "grengd")) sys->dntype = GRENGD;
+        else if(!strcmp(&(argv[i][9]), "noshft")) sys->dntype = NOSHFT;
+        else if(!strcmp(&(argv[i][9]), "nolocl")) sys->dntype = NOLOCL;
+        else {
+          sys->info("%s: bad downward pass type '%s' (use grengd, noshft or nolocl)\n",
+                  argv[0], &argv[i][9]);
+          cmderr = TRUE;
+          break;
+        }
+      }
+      else if(!strncmp(&(argv[i][1]), "-nnbrs=", 7)) {
+        if(sscanf(&(argv[i][8]), "%d", &sys->nnbrs) != 1 || sys->nnbrs < 1 || sys->nnbrs > 3) {
+          sys->info("%s: bad neighbor distance '%s' (use 1 to 3)\n",
+                  argv[0], &argv[i][8]);
+          cmderr = TRUE;
+          break;
+        }
+      }
+      else if(!strncmp(&(argv[i][1]), "-numdpt=", 8)) {
+        if(sscanf(&(argv[i][9]), "%d", &sys->numdpt) != 1 || (sys->numdpt != 0 && sys->numdpt != 2 && sys->numdpt != 3)) {
+          sys->info("%s: bad number of dielectric points '%s' (use 0, 2 or 3)\n",
+                  argv[0], &argv[i][9]);
+          cmderr = TRUE;
+          break;
+        }
+      }
+      else if(!strncmp(&(argv[i][1]), "-adapt=", 7)) {
+        if(!strcmp(&(argv[i][8]), "on")) sys->adapt = true;
+        else if(!strcmp(&(argv[i][8]), "off")) sys->adapt = false;
+        else {
+          sys->info("%s: bad adaptive mode '%s' (use on or off)\n",
+                  argv[0], &argv[i][8]);
+          cmderr = TRUE;
+          break;
+        }
+      }
+      else if(!strncmp(&(argv[i][1]), "-m2l=", 5)) {
+        if(!strcmp(&(argv[i][6]), "dense")) sys->m2ltyp = M2LDNS;
+        else if(!strcmp(&(argv[i][6]), "rotate")) sys->m2ltyp = M2LROT;
+        else if(!strcmp(&(argv[i][6]), "auto")) sys->m2ltyp = M2LAUT;
+        else {
+          sys->info("%s: bad M2L type '%s' (use dense, rotate or auto)\n",
+                  argv[0], &argv[i][6]);
+          cmderr = TRUE;
+          break;
+        }
+      }
+      else if(!strncmp(&(argv[i][1]), "-mem-limit=", 11)) {
+        if(sscanf(&(argv[i][12]), "%lf", &sys->mem_limit) != 1 || sys->mem_limit <= 0.0) {
+          sys->info("%s: bad memory limit '%s'\n",
+                  argv[0], &argv[i][12]);
+          cmderr = TRUE;
+          break;
+        }
+      }
       else if(argv[i][1] == 'r') {
         if(sscanf(&(argv[i][2]), "%lf", &sys->rotation) != 1) {
           sys->info("%s: bad image rotation angle '%s'\n",
@@ -784,7 +877,7 @@ static void parse_command_line(ssystem *sys, const char **input_file, const char
   if (cmderr == TRUE) {
     if (sys->capvew) {
       sys->info(
-              "Usage: '%s [-o<expansion order>] [-d<partitioning depth>] [<input file>]\n                [-p<permittivity factor>] [-rs<cond list>] [-ri<cond list>]\n                [-] [-l<list file>] [-t<iter tol>] [-a<azimuth>] [-e<elevation>]\n                [-r<rotation>] [-h<distance>] [-s<scale>] [-w<linewidth>]\n                [-u<upaxis>] [-q<cond list>] [-rc<cond list>] [-x<axeslength>]\n                [-b<.figfile>] [-m] [-rk] [-rd] [-dc] [-c] [-v] [-n] [-f] [-g]\n", argv[0]);
+              "Usage: '%s [-o<expansion order>] [-d<partitioning depth>] [<input file>]\n                [-p<permittivity factor>] [-rs<cond list>] [-ri<cond list>]\n                [-] [-l<list file>] [-t<iter tol>] [-a<azimuth>] [-e<elevation>]\n                [-r<rotation>] [-h<distance>] [-s<scale>] [-w<linewidth>]\n                [-u<upaxis>] [-q<cond list>] [-rc<cond list>] [-x<axeslength>]\n                [-b<.figfile>] [-m] [-rk] [-rd] [-dc] [-c] [-v] [-n] [-f] [-g]\n                [--timing] [--trace=<trace file>]\n                [--autotune=<target error>] [--estimate]\n                [--mem-limit=<megabytes>] [--hmatrix]\n                [--compress-near] [--two-level]\n                [--precond=none|bd|ol|spai] [--itrtyp=gmres|gcr]\n                [--dntype=grengd|noshft|nolocl] [--nnbrs=<n>]\n                [--numdpt=0|2|3] [--adapt=on|off]\n                [--m2l=dense|rotate|auto]\n", argv[0]);
       sys->info("DEFAULT VALUES:\n");
       sys->info("  expansion order = %d\n", DEFORD);
       sys->info("  partitioning depth = set automatically\n");
@@ -823,9 +916,24 @@ static void parse_command_line(ssystem *sys, const char **input_file, const char
       sys->info("  -n  = number faces with input order numbers\n");
       sys->info("  -f  = do not fill in faces (don't rmv hidden lines)\n");
       sys->info("  -g  = dump depth graph and quit\n");
+      sys->info("  --timing = print time, memory and per-pass operation synopsis\n");
+      sys->info("  --trace = write Chrome/Perfetto trace JSON of the solver phases\n");
+      sys->info("  --autotune = pick expansion order and depth for the given relative error\n");
+      sys->info("  --estimate = print predicted memory and run time after setting up the cubes and quit\n");
+      sys->info("  --mem-limit = keep near-field matrices in a memory-mapped file above this budget\n");
+      sys->info("  --hmatrix = solve with a compressed (H-matrix) direct solver instead of iterating\n");
+      sys->info("  --compress-near = store the second-shell near-field blocks in low-rank form\n");
+      sys->info("  --two-level = add a coarse-grid correction per conductor and region to the preconditioner\n");
+      sys->info("  --precond = preconditioner: none, bd (block diagonal), ol (overlapped, default) or spai (sparse approximate inverse)\n");
+      sys->info("  --itrtyp = iterative solver: gmres (default) or gcr\n");
+      sys->info("  --dntype = downward pass: grengd (full, default), noshft (no local shifts) or nolocl (no locals)\n");
+      sys->info("  --nnbrs = number of cube shells treated as near neighbors (1 to 3, default 2)\n");
+      sys->info("  --numdpt = potential evaluation points per dielectric panel (2, default, or 3) or 0 for analytic normal fields without dummy panels\n");
+      sys->info("  --adapt = on (default) to evaluate sparsely filled cubes directly, off to use expansions everywhere\n");
+      sys->info("  --m2l = multipole to local translations: dense (matrices), rotate (rotation to the z axis) or auto (default, rotate from order %d on)\n", ROTORD);
     } else {
       sys->info(
-            "Usage: '%s [-o<expansion order>] [-d<partitioning depth>] [<input file>]\n                [-p<permittivity factor>] [-rs<cond list>] [-ri<cond list>]\n                [-] [-l<list file>] [-t<iter tol>]\n", argv[0]);
+            "Usage: '%s [-o<expansion order>] [-d<partitioning depth>] [<input file>]\n                [-p<permittivity factor>] [-rs<cond list>] [-ri<cond list>]\n                [-] [-l<list file>] [-t<iter tol>]\n                [--timing] [--trace=<trace file>]\n                [--autotune=<target error>] [--estimate]\n                [--mem-limit=<megabytes>] [--hmatrix]\n                [--compress-near] [--two-level]\n                [--precond=none|bd|ol|spai] [--itrtyp=gmres|gcr]\n                [--dntype=grengd|noshft|nolocl] [--nnbrs=<n>]\n                [--numdpt=0|2|3] [--adapt=on|off]\n                [--m2l=dense|rotate|auto]\n", argv[0]);
       sys->info("DEFAULT VALUES:\n");
       sys->info("  expansion order = %d\n", DEFORD);
       sys->info("  partitioning depth = set automatically\n");
@@ -835,6 +943,21 @@ static void parse_command_line(ssystem *sys, const char **input_file, const char
       sys->info("  -   = force conductor surface file read from stdin\n");
       sys->info("  -rs = remove conductors from solve list\n");
       sys->info("  -ri = remove conductors from input\n");
+      sys->info("  --timing = print time, memory and per-pass operation synopsis\n");
+      sys->info("  --trace = write Chrome/Perfetto trace JSON of the solver phases\n");
+      sys->info("  --autotune = pick expansion order and depth for the given relative error\n");
+      sys->info("  --estimate = print predicted memory and run time after setting up the cubes and quit\n");
+      sys->info("  --mem-limit = keep near-field matrices in a memory-mapped file above this budget\n");
+      sys->info("  --hmatrix = solve with a compressed (H-matrix) direct solver instead of iterating\n");
+      sys->info("  --compress-near = store the second-shell near-field blocks in low-rank form\n");
+      sys->info("  --two-level = add a coarse-grid correction per conductor and region to the preconditioner\n");
+      sys->info("  --precond = preconditioner: none, bd (block diagonal), ol (overlapped, default) or spai (sparse approximate inverse)\n");
+      sys->info("  --itrtyp = iterative solver: gmres (default) or gcr\n");
+      sys->info("  --dntype = downward pass: grengd (full, default), noshft (no local shifts) or nolocl (no locals)\n");
+      sys->info("  --nnbrs = number of cube shells treated as near neighbors (1 to 3, default 2)\n");
+      sys->info("  --numdpt = potential evaluation points per dielectric panel (2, default, or 3) or 0 for analytic normal fields without dummy panels\n");
+      sys->info("  --adapt = on (default) to evaluate sparsely filled cubes directly, off to use expansions everywhere\n");
+      sys->info("  --m2l = multipole to local translations: dense (matrices), rotate (rotation to the z axis) or auto (default, rotate from order %d on)\n", ROTORD);
     }
     sys->info("  <cond list> = [<name>],[<name>],...,[<name>]\n");
     dumpConfig(sys, argv[0]);
@@ -995,6 +1118,8 @@ static void remove_names(ssystem *sys, const std::set<int> &num_list)
       }
     }
   }
+
+  sys->update_conductor_index();
 }
         
 /*
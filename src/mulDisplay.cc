@@ -72,6 +72,10 @@ void disdirectcube(ssystem *sys, cube *pc)
 int i;
   for(i=0; i < pc->directnumvects; i++) {
     sys->msg("matrix %d\n", i);
+    if(pc->directrank[i] >= 0) {
+      sys->msg("compressed, rank %d\n", pc->directrank[i]);
+      continue;
+    }
     dismat(sys, pc->directmats[i], pc->directnumeles[0], pc->directnumeles[i]);
     if(i==0) {
       sys->msg("lu factored matrix\n");
@@ -795,11 +799,11 @@ void dumpConfig(ssystem *sys, const char *name)
   sys->msg(" MULTIPOLE CONFIGURATION\n");
 
   sys->msg("   DNTYPE");
-  if(DNTYPE == NOLOCL) 
+  if(sys->dntype == NOLOCL) 
       sys->msg(" == NOLOCL (no locals in dwnwd pass)\n");
-  else if(DNTYPE == NOSHFT) 
+  else if(sys->dntype == NOSHFT) 
       sys->msg(" == NOSHFT (no local2local shift dwnwd pass)\n");
-  else if(DNTYPE == GRENGD) 
+  else if(sys->dntype == GRENGD) 
       sys->msg(" == GRENGD (full Greengard dwnwd pass)\n");
   sys->msg("   MULTI");
   if(MULTI == ON) sys->msg(" == ON (include multipole part of P*q)\n");
@@ -809,11 +813,18 @@ void dumpConfig(ssystem *sys, const char *name)
       sys->msg(" == ON (allow parent level interaction list entries)\n");
   else 
    sys->msg(" == OFF (use only cube level interaction list entries)\n");
-  sys->msg("   NNBRS == %d (max distance to a nrst neighbor)\n", NNBRS);
+  sys->msg("   NNBRS == %d (max distance to a nrst neighbor)\n", sys->nnbrs);
   sys->msg("   ADAPT");
-  if(ADAPT == ON) 
+  if(sys->adapt) 
       sys->msg(" == ON (adaptive - no expansions in exact cubes)\n");
   else sys->msg(" == OFF (not adaptive - expansions in all cubes)\n");
+  sys->msg("   M2LTYP");
+  if(sys->m2ltyp == M2LDNS) 
+      sys->msg(" == M2LDNS (dense multi to local matrices)\n");
+  else if(sys->m2ltyp == M2LROT) 
+      sys->msg(" == M2LROT (multi to local by rotation to z axis)\n");
+  else 
+      sys->msg(" == M2LAUT (rotation to z axis from order %d on)\n", ROTORD);
   sys->msg("   OPCNT");
   if(OPCNT == ON) 
       sys->msg(" == ON (count P*q ops - exit after mat build)\n");
@@ -825,33 +836,39 @@ void dumpConfig(ssystem *sys, const char *name)
           MAXDEP, MAXDEP);
 
   sys->msg("   NUMDPT");
-  sys->msg(
+  if(sys->numdpt == 0)
+      sys->msg(" == 0 (evaluate the normal field on dielectric panels analytically)\n");
+  else sys->msg(
           " == %d (do %d potential evaluations for each dielectric panel)\n",
-          NUMDPT, NUMDPT);
+          sys->numdpt, sys->numdpt);
 
   sys->msg(" LINEAR SYSTEM SOLUTION CONFIGURATION\n");
 
   sys->msg("   ITRTYP");
-  if(ITRTYP == GCR)
+  if(sys->itrtyp == GCR)
       sys->msg(" == GCR (generalized conjugate residuals)\n");
-  else if(ITRTYP == GMRES)
+  else if(sys->itrtyp == GMRES)
       sys->msg(" == GMRES (generalized minimum residuals)\n");
-  else sys->msg(" == %d (not implemented - use GCR)\n", ITRTYP);
+  else sys->msg(" == %d (not implemented - use GCR)\n", sys->itrtyp);
 
   sys->msg("   PRECOND");
-  if(PRECOND == BD) {
+  if(sys->precond == BD) {
     sys->msg(
             " == BD (use block diagonal preconditioner)\n");
   }
-  else if(PRECOND == OL) {
+  else if(sys->precond == OL) {
     sys->msg(
             " == OL (use overlap preconditioner)\n");
   }
-  else if(PRECOND == NONE) {
+  else if(sys->precond == SPAI) {
+    sys->msg(
+            " == SPAI (use sparse approximate inverse preconditioner)\n");
+  }
+  else if(sys->precond == NONE) {
     sys->msg(
             " == NONE (no preconditioner)\n");
   }
-  else sys->msg(" == %d (not implemented - use BD, OL or NONE)\n", PRECOND);
+  else sys->msg(" == %d (not implemented - use BD, OL, SPAI or NONE)\n", sys->precond);
 
   sys->msg("   DIRSOL");
   if (sys->dirsol)
@@ -1167,7 +1184,7 @@ void dump_preconditioner(ssystem *sys, charge *chglist, int type)
     sys->error("dump_preconditioner: can't open `prec.mat'");
   }
 
-  if(type == 1 || type == 3) {
+  if((type == 1 || type == 3) && sys->precond != NONE) {
     sys->msg("\nDumping preconditioner to `prec.mat' as `Ctil'\n");
     /* dump the preconditioner one column at a time */
     /* - savemat arg "type" can be used to make rowwise dumps
@@ -1180,7 +1197,7 @@ void dump_preconditioner(ssystem *sys, charge *chglist, int type)
         else sys->q[i] = 0.0;
       }
       /* figure the column of C in p (xfered to q after calculation) */
-      mulPrecond(sys, PRECOND);
+      mulPrecond(sys, sys->precond);
       /* dump the preconditioner column */
       if(j == 1) savemat_mod(fp, 1000, "Ctil", num_panels, num_panels, 0,
                              &(sys->q[1]), (double *)NULL, 0, num_panels);
@@ -1285,6 +1302,16 @@ void dumpQ2PDiag(ssystem *sys, cube *nextc)
         temp_mat[i][j] = rmat[i][j];
       }
     }
+    else if(sys->numdpt == 0) {
+      /* the row holds the normal derivatives already (see calcpn()) */
+      pos_fact = nextc->chgs[i]->surf->outer_perm - nextc->chgs[i]->surf->inner_perm;
+      for(j = 0; j < nextc->upnumeles[0]; j++) {
+        temp_mat[i][j] = pos_fact*rmat[i][j];
+      }
+      temp_mat[i][i] = -(2*M_PI*(nextc->chgs[i]->surf->inner_perm
+                                 + nextc->chgs[i]->surf->outer_perm)
+                         /nextc->chgs[i]->area);
+    }
     else {
 
       pos_fact 
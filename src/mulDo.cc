@@ -2,17 +2,48 @@
 #include "mulGlobal.h"
 #include "direct.h"
 #include "mulDo.h"
+#include "counters.h"
+#include "parallel.h"
+#include "rotation.h"
+#include "mulMulti.h"
 
-static int directops = 0, upops = 0, downops = 0, evalops = 0;
+#include <vector>
+#include <algorithm>
+
+/*
+  accounts for a rows x cols matrix-vector product: the multiply-adds and 
+  the bytes moved for the matrix, the source vector and the result vector
+  (read and written) - done once per matrix, not in the inner loops
+*/
+static inline void count_matvec(long long *ops, long long *bytes, int rows, int cols)
+{
+  *ops += (long long) rows * cols;
+  *bytes += ((long long) rows * cols + cols + 2 * rows) * (long long) sizeof(double);
+}
+
+/*
+  accounts for the product with a compressed rows x cols matrix of rank r
+  (see count_matvec())
+*/
+static inline void count_lowrank(long long *ops, long long *bytes, int rows, int cols, int r)
+{
+  *ops += (long long) r * (rows + cols);
+  *bytes += ((long long) r * (rows + cols) + cols + 2 * rows) * (long long) sizeof(double);
+}
 
 /* 
 Compute the direct piece. 
+- sys->numdpt is the template argument numdpt, so the dielectric row test
+  is resolved at compile time (and drops out for 3 points and for 0, where
+  the dielectric rows hold the normal derivatives)
 */
-void mulDirect(ssystem *sys)
+template <int numdpt>
+static void mul_direct(ssystem *sys)
 {
-int i, j, k, dsize, *is_dummy, *is_dielec;
-double *p, *q, *qn, **mat;
+int i, j, k, l, dsize, rows, rank, *is_dummy, *is_dielec;
+double *p, *q, *qn, **mat, **u, **v, s;
 cube *nextc;
+std::vector<double> t;          /* v^T q for compressed matrices */
 
 /* Assumes the potential vector has been zero'd!!!! */
   for(nextc=sys->directlist; nextc != NULL; nextc = nextc->dnext) {
@@ -23,70 +54,130 @@ cube *nextc;
     is_dielec = nextc->is_dielec;
   /* Inside Cube piece. */
     mat = nextc->directmats[0];
-    for(j = dsize - 1; j >= 0; j--) {
-      if(NUMDPT == 2 && is_dielec[j]) continue;
+    for(rows = 0, j = dsize - 1; j >= 0; j--) {
+      if(numdpt == 2 && is_dielec[j]) continue;
+      rows++;
       for(k = dsize - 1; k >= 0; k--) {
         if(!is_dummy[k]) p[j] += mat[j][k] * q[k];
-        directops++;
       }
     }
+    count_matvec(&counters.dirops, &counters.dirbytes, rows, dsize);
   /* Through all nearest nbrs. */
     for(i=nextc->directnumvects - 1; i > 0; i--) {
-      mat = nextc->directmats[i];
       qn = nextc->directq[i];
+      if((rank = nextc->directrank[i]) >= 0) {
+        /* compressed second-shell matrix: u (v^T q), dummy entries of q
+           have zero columns in v */
+        u = nextc->directu[i];
+        v = nextc->directv[i];
+        t.assign(rank, 0.0);
+        for(k = nextc->directnumeles[i] - 1; k >= 0; k--) {
+          for(l = 0; l < rank; l++) t[l] += v[k][l] * qn[k];
+        }
+        for(j = dsize - 1; j >= 0; j--) {
+          if(numdpt == 2 && is_dielec[j]) continue;
+          for(s = 0.0, l = 0; l < rank; l++) s += u[j][l] * t[l];
+          p[j] += s;
+        }
+        count_lowrank(&counters.dirops, &counters.dirbytes,
+                      rows, nextc->directnumeles[i], rank);
+        continue;
+      }
+      mat = nextc->directmats[i];
       is_dummy = nextc->nbr_is_dummy[i];
       for(j = dsize - 1; j >= 0; j--) {
-        if(NUMDPT == 2 && is_dielec[j]) continue;
+        if(numdpt == 2 && is_dielec[j]) continue;
         for(k = nextc->directnumeles[i] - 1; k >= 0; k--) {
           if(!is_dummy[k]) p[j] += mat[j][k] * qn[k];
-          directops++;
         }
       }
+      count_matvec(&counters.dirops, &counters.dirbytes, 
+                   rows, nextc->directnumeles[i]);
     }
   }
 }
 
+void mulDirect(ssystem *sys)
+{
+  if(sys->numdpt == 2) mul_direct<2>(sys);
+  else mul_direct<3>(sys);
+}
+
 /*
-Block diagonal or Overlapped Preconditioner.
+  product of the overlapped (OL) or sparse approximate inverse (SPAI)
+  preconditioner with the charges of cube nc, added to nc's potentials
 */
-void mulPrecond(ssystem *sys, int type)
+static void precond_cube(cube *nc)
 {
   int i, j, k, dsize, *is_dummy;
   double *p, *q, *qn, **mat;
+
+  dsize = nc->directnumeles[0];  /* Equals number of charges. */
+  q = nc->directq[0];
+  p = nc->eval;
+  is_dummy = nc->nbr_is_dummy[0];
+  /* Inside Cube piece. */
+  mat = nc->precondmats[0];
+  for(j = dsize - 1; j >= 0; j--) {
+    for(k = dsize - 1; k >= 0; k--) {
+      if(!is_dummy[k]) p[j] += mat[j][k] * q[k];
+    }
+  }
+  /* Through all nearest nbrs. */
+  for(i=nc->directnumvects - 1; i > 0; i--) {
+    mat = nc->precondmats[i];
+    is_dummy = nc->nbr_is_dummy[i];
+    if(mat != NULL) {
+      qn = nc->directq[i];
+      for(j = dsize - 1; j >= 0; j--) {
+        for(k = nc->directnumeles[i] - 1; k >= 0; k--) {
+          if(!is_dummy[k]) p[j] += mat[j][k] * qn[k];
+        }
+      }
+    }
+  }
+}
+
+/*
+Block diagonal, Overlapped or sparse approximate inverse Preconditioner.
+*/
+void mulPrecond(ssystem *sys, int type)
+{
+  int i, j, dsize;
+  double *p, *q;
   cube *nc;
 
   if(type == BD) {
     for(nc=sys->precondlist; nc != NULL; nc = nc->pnext) {
-      solve(nc->precond, nc->prevectq, nc->prevectq, nc->presize);
+      solve(nc->precond, nc->prevectq, nc->prevectq, nc->presize, nc->prepivots);
+      count_matvec(&counters.precops, &counters.precbytes, 
+                   nc->presize, nc->presize);
     }
   }
   else {
     /* Assumes the potential vector has been zero'd!!!! */
+    /* The cubes only write their own potentials - the product is a 
+       sparse matrix-vector product done in parallel over the cubes. */
+    std::vector<cube *> cubes;
+    long long work = 0;
     for(nc=sys->directlist; nc != NULL; nc = nc->dnext) {
-      dsize = nc->directnumeles[0];  /* Equals number of charges. */
-      q = nc->directq[0];   
-      p = nc->eval;
-      is_dummy = nc->nbr_is_dummy[0];
-      /* Inside Cube piece. */
-      mat = nc->precondmats[0];
-      for(j = dsize - 1; j >= 0; j--) {
-        for(k = dsize - 1; k >= 0; k--) {
-          if(!is_dummy[k]) p[j] += mat[j][k] * q[k];
-        }
-      }
-      /* Through all nearest nbrs. */
+      dsize = nc->directnumeles[0];
+      count_matvec(&counters.precops, &counters.precbytes, dsize, dsize);
+      work += (long long) dsize * dsize;
       for(i=nc->directnumvects - 1; i > 0; i--) {
-        mat = nc->precondmats[i];
-        is_dummy = nc->nbr_is_dummy[i];
-        if(mat != NULL) {
-          qn = nc->directq[i];
-          for(j = dsize - 1; j >= 0; j--) {
-            for(k = nc->directnumeles[i] - 1; k >= 0; k--) {
-              if(!is_dummy[k]) p[j] += mat[j][k] * qn[k];
-            }
-          }
+        if(nc->precondmats[i] != NULL) {
+          count_matvec(&counters.precops, &counters.precbytes, 
+                       dsize, nc->directnumeles[i]);
+          work += (long long) dsize * nc->directnumeles[i];
         }
       }
+      cubes.push_back(nc);
+    }
+    if(!cubes.empty()) {
+      parallel_rows(0, int(cubes.size()), work / (long long) cubes.size(),
+                    [&cubes] (int from, int to) {
+        for(int c = from; c < to; c++) precond_cube(cubes[c]);
+      });
     }
     /* Copy ps back to qs and zero ps. */
     for(nc=sys->directlist; nc != NULL; nc = nc->dnext) {
@@ -102,69 +193,87 @@ void mulPrecond(ssystem *sys, int type)
 }
   
 
-/* 
-Loop through upward pass. 
+/*
+  performs the products of a pass table in order (see mulPassTables())
+  - numdpt as for mul_direct(), only the evaluation pass has skip vectors
+  - consecutive entries with the same matrix (the shared M2M matrices of
+    a level) are done as one matrix-matrix product: each matrix element
+    is loaded once for all the vector pairs of the batch
 */
-void mulUp(ssystem *sys)
+template <int numdpt>
+static void run_pass(ssystem *sys, const pass_table &t, long long *ops, long long *bytes)
 {
-int i, j, k, l;
-int msize;
-double *multi, *rhs, **mat;
-cube *nextc;
-
-  if(sys->depth < 2) return;    /* ret if upward pass not possible/worth it */
+  int i, j, k, b, e, rows;
+  double *dst, *src, **mat, m;
+  const int *skip;
 
-/* Through all the depths, starting from the bottom and not doing top. */
-  for(i = sys->depth; i > 0; i--) {  
-  /* Through all the cubes at depth. */
-    for(nextc=sys->multilist[i]; nextc != NULL; nextc = nextc->mnext) {
-      msize = nextc->multisize;
-      multi = nextc->multi;
-      for(j=0; j < msize; j++) multi[j] = 0;
-    /* Through all the nonempty children of cube. */
-      for(j=nextc->upnumvects - 1; j >= 0; j--) {
-        mat = nextc->upmats[j];
-        rhs = nextc->upvects[j];
-        for(k = nextc->upnumeles[j] - 1; k >= 0; k--) {
-          for(l = msize - 1; l >= 0; l--) {
-            multi[l] += mat[l][k] * rhs[k];
-            upops++;
-          }
+  for(i = 0; i < t.num_ops; i = e) {
+    const pass_op &op = t.ops[i];
+    dst = op.dst;
+    src = op.src;
+    mat = op.mat;
+    e = i + 1;
+    if(src == NULL) {           /* zeroes a level's expansion block */
+      for(j = 0; j < op.rows; j++) dst[j] = 0;
+      continue;
+    }
+    if(mat == NULL) {           /* M2L by rotation */
+      sys->mm.rot->apply(src, dst, op.xyz[0], op.xyz[1], op.xyz[2]);
+      *ops += sys->mm.rot->ops();
+      *bytes += 3 * (long long) op.rows * (long long) sizeof(double);
+      continue;
+    }
+    skip = op.skip;
+    if(skip == NULL) {
+      while(e < t.num_ops && t.ops[e].mat == mat && t.ops[e].skip == NULL
+            && t.ops[e].rows == op.rows && t.ops[e].cols == op.cols) {
+        e++;
+      }
+    }
+    if(e - i > 1) {
+      for(j = op.rows - 1; j >= 0; j--) {
+        for(k = op.cols - 1; k >= 0; k--) {
+          m = mat[j][k];
+          for(b = i; b < e; b++) t.ops[b].dst[j] += m * t.ops[b].src[k];
         }
       }
+      *ops += (long long) (e - i) * op.rows * op.cols;
+      *bytes += ((long long) op.rows * op.cols 
+                 + (long long) (e - i) * (op.cols + 2 * op.rows)) * (long long) sizeof(double);
+      continue;
     }
+    for(rows = 0, j = op.rows - 1; j >= 0; j--) {
+      if(numdpt == 2 && skip != NULL && skip[j]) continue;
+      rows++;
+      for(k = op.cols - 1; k >= 0; k--) {
+        dst[j] += mat[j][k] * src[k];
+      }
+    }
+    count_matvec(ops, bytes, rows, op.cols);
   }
 }
 
+/* 
+Loop through upward pass. 
+*/
+void mulUp(ssystem *sys)
+{
+  if(sys->depth < 2) return;    /* ret if upward pass not possible/worth it */
+
+  run_pass<3>(sys, sys->uppass, &counters.upops, &counters.upbytes);
+}
 
 /*
   evaluation pass - use after mulDown or alone. 
 */
 void mulEval(ssystem *sys)
 {
-  int i, j, k, size, *is_dielec;
-  cube *nc;
-  double *eval, **mat, *vec;
-
   if(sys->depth < 2) return;    /* ret if upward pass not possible/worth it */
 
-  for(nc = sys->directlist; nc != NULL; nc = nc->dnext) {
-    size = nc->upnumeles[0];    /* number of eval pnts (chgs) in cube */
-    eval = nc->eval;            /* vector of evaluation pnt potentials */
-    is_dielec = nc->is_dielec;  /* vector of DIELEC/BOTH panel flags */
-
-    /* do the evaluations */
-    for(i = nc->evalnumvects - 1; i >= 0; i--) {
-      mat = nc->evalmats[i];
-      vec = nc->evalvects[i];
-      for(j = size - 1; j >= 0; j--) {
-        if(NUMDPT == 2 && is_dielec[j]) continue;
-        for(k = nc->evalnumeles[i] - 1; k >= 0; k--) {
-          eval[j] += mat[j][k] * vec[k];
-          evalops++;
-        }
-      }
-    }
+  if(sys->numdpt == 2) {
+    run_pass<2>(sys, sys->evalpass, &counters.evalops, &counters.evalbytes);
+  } else {
+    run_pass<3>(sys, sys->evalpass, &counters.evalops, &counters.evalbytes);
   }
 }
 
@@ -173,38 +282,136 @@ Loop through downward pass.
 */
 void mulDown(ssystem *sys)
 {
+  if(sys->depth < 2) return;    /* ret if upward pass not possible/worth it */
+
+  run_pass<3>(sys, sys->downpass, &counters.downops, &counters.downbytes);
+}
+
+/*
+  appends the products of one cube (last vector first, as the cube loops
+  did) to a pass table
+*/
+static void add_ops(std::vector<pass_op> &ops, double *dst, int rows, const int *skip,
+                    int num, double **srcs, int *cols, double ***mats, double **xyz)
+{
+  pass_op op;
+
+  for(int i = num - 1; i >= 0; i--) {
+    op.dst = dst;
+    op.src = srcs[i];
+    op.mat = mats[i];
+    op.xyz = xyz != NULL ? xyz[i] : NULL;
+    op.skip = skip;
+    op.rows = rows;
+    op.cols = cols[i];
+    ops.push_back(op);
+  }
+}
+
+/*
+  appends the zeroing of a level's (cubes x terms) expansion block
+*/
+static void add_clear(std::vector<pass_op> &ops, double *block, int size)
+{
+  pass_op op = pass_op();
+
+  if(block == NULL) return;
+  op.dst = block;
+  op.rows = size;
+  ops.push_back(op);
+}
+
+/*
+  orders the products of one level so the ones sharing a matrix (the 8
+  M2M matrices of a level) are adjacent, in order of first appearance
+*/
+static void group_by_matrix(std::vector<pass_op> &ops, size_t from)
+{
+  std::vector<double **> mats;
+  std::vector<std::pair<size_t, size_t> > keys;
+  std::vector<pass_op> sorted;
+
+  for(size_t i = from; i < ops.size(); i++) {
+    size_t g = std::find(mats.begin(), mats.end(), ops[i].mat) - mats.begin();
+    if(g == mats.size()) mats.push_back(ops[i].mat);
+    keys.push_back(std::make_pair(g, i));
+  }
+  std::sort(keys.begin(), keys.end());
+
+  for(size_t i = 0; i < keys.size(); i++) sorted.push_back(ops[keys[i].second]);
+  std::copy(sorted.begin(), sorted.end(), ops.begin() + from);
+}
+
+static void set_table(ssystem *sys, pass_table *t, const std::vector<pass_op> &ops)
+{
+  t->num_ops = int(ops.size());
+  t->ops = sys->heap.alloc<pass_op>(MAX(t->num_ops, 1), AMSC);
+  std::copy(ops.begin(), ops.end(), t->ops);
+}
+
+/*
+  collects the products of the upward, downward and evaluation passes from
+  the cube lists into flat arrays (sys->uppass, downpass and evalpass), so
+  the passes only touch the few fields they need
+  - call after mulMatUp(), mulMatDown() and mulMatEval()
+  - the expansions of a level are zeroed as one block (see linkcubes()), 
+    the M2M products of a level are grouped by matrix (see run_pass())
+  - M2L translations by rotation (downmats entry NULL) become entries
+    with mat == NULL
+*/
+void mulPassTables(ssystem *sys)
+{
+  int depth, numterms = multerms(sys->order);
   cube *nc;
-  int depth, i, j, k, lsize;
-  double **mat, *rhs, *local;
+  std::vector<pass_op> ops;
+  size_t from;
 
-  if(sys->depth < 2) return;    /* ret if upward pass not possible/worth it */
+  sys->uppass = pass_table();
+  sys->downpass = pass_table();
+  sys->evalpass = pass_table();
 
-  for(depth=2; depth <= sys->depth; depth++) {
-    for(nc=sys->locallist[depth]; nc != NULL; nc = nc->lnext) {
-      lsize = nc->localsize;
-      local = nc->local;
-      for(j=0; j < lsize; j++) local[j] = 0;
-  /* Through all the locals for the cube. */
-      for(i=nc->downnumvects - 1; i >= 0; i--) {
-        mat = nc->downmats[i];
-        rhs = nc->downvects[i];
-        for(j = lsize - 1; j >= 0; j--) {
-          for(k = nc->downnumeles[i] - 1; k >= 0; k--) {
-            local[j] += mat[j][k] * rhs[k];
-            downops++;
-          }
-        }
+  if(sys->depth < 2) return;
+
+  /* bottom up, the M2M's of a level use the shared matrices of mulMatUp() */
+  for(depth = sys->depth; depth > 1; depth--) {
+    add_clear(ops, sys->multiblock[depth], sys->multicount[depth] * numterms);
+    from = ops.size();
+    for(nc = sys->multilist[depth]; nc != NULL; nc = nc->mnext) {
+      add_ops(ops, nc->multi, nc->multisize, NULL,
+              nc->upnumvects, nc->upvects, nc->upnumeles, nc->upmats, NULL);
+    }
+    if(depth < sys->depth) group_by_matrix(ops, from);
+  }
+  set_table(sys, &sys->uppass, ops);
+
+  ops.clear();
+  if(sys->dntype != NOLOCL) {
+    for(depth = 2; depth <= sys->depth; depth++) {
+      add_clear(ops, sys->localblock[depth], sys->localcount[depth] * numterms);
+      for(nc = sys->locallist[depth]; nc != NULL; nc = nc->lnext) {
+        add_ops(ops, nc->local, nc->localsize, NULL,
+                nc->downnumvects, nc->downvects, nc->downnumeles, nc->downmats,
+                nc->downxyz);
       }
     }
   }
+  set_table(sys, &sys->downpass, ops);
+
+  ops.clear();
+  for(nc = sys->directlist; nc != NULL; nc = nc->dnext) {
+    add_ops(ops, nc->eval, nc->upnumeles[0], nc->is_dielec,
+            nc->evalnumvects, nc->evalvects, nc->evalnumeles, nc->evalmats, NULL);
+  }
+  set_table(sys, &sys->evalpass, ops);
 }
 
 
 void printops(ssystem *sys)
 {
-  sys->msg("Number of Direct Multi-Adds = %d\n", directops);
-  sys->msg("Number of Upward Pass Multi-Adds = %d\n", upops);
-  sys->msg("Number of Downward Pass Multi-Adds = %d\n", downops);
-  sys->msg("Number of Evaluation Pass Multi-Adds = %d\n", evalops);
-  sys->msg("Total Number of Multi-Adds = %d\n", directops+upops+downops+evalops);
+  sys->msg("Number of Direct Multi-Adds = %lld\n", counters.dirops);
+  sys->msg("Number of Upward Pass Multi-Adds = %lld\n", counters.upops);
+  sys->msg("Number of Downward Pass Multi-Adds = %lld\n", counters.downops);
+  sys->msg("Number of Evaluation Pass Multi-Adds = %lld\n", counters.evalops);
+  sys->msg("Total Number of Multi-Adds = %lld\n", 
+           counters.dirops + counters.upops + counters.downops + counters.evalops);
 }
@@ -10,5 +10,6 @@ void mulDirect(ssystem *sys);
 void mulUp(ssystem *sys);
 void mulDown(ssystem *sys);
 void mulEval(ssystem *sys);
+void mulPassTables(ssystem *sys);
 
 #endif
@@ -87,6 +87,11 @@ misc. global macros
 #define NOSHFT 1                /* multis to locals w/o local2local shifts */
 #define GRENGD 3                /* full Greengard downward pass/eval */
 
+/* types of multipole to local translations (values of M2LTYP below) */
+#define M2LDNS 0                /* dense M2L matrices */
+#define M2LROT 1                /* rotation to the z axis (see rotation.h) */
+#define M2LAUT 2                /* M2LROT from order ROTORD on, else M2LDNS */
+
 /* types of iterative methods (values of ITRTYP below) */
 #define GCR 0                   /* GCR with single (not block) vector iters */
 #define GMRES 1                 /* GMRES with vector iterates */
@@ -103,27 +108,30 @@ misc. global macros
 
 /* types of preconditioners. */
 #define NONE 0
-#define BD 1                    /* Block diagonal (not set up for dielecs). */
+#define BD 1                    /* Block diagonal, see --precond=bd. */
 #define OL 2                    /* OverLap */
+#define SPAI 3                  /* Sparse approx. inverse (OL pattern) */
 
 /* Discretization Configuration */
 #define WRMETH COLLOC           /* weighted res meth type (COLLOC only now) */
 #define ELTYPE CONST            /* finite element type (CONST only now) */
 /* Multipole Configuration */
-#define DNTYPE GRENGD           /* type of downward/eval pass - see above */
+#define DNTYPE GRENGD           /* default, see --dntype (type of dwnwd pass) */
 #define MULTI ON                /* ON=> add in multipole contribution to P*q */
 #define RADINTER ON             /* ON=> Parent level multis in interlist. */
-#define NNBRS 2                 /* Distance to consider a nearest nbr. */
-#define ADAPT ON                /* ON=> use adaptive algorithm */
+#define NNBRS 2                 /* default, see --nnbrs (nearest nbr dist.) */
+#define ADAPT ON                /* default, see --adapt (ON=> adaptive) */
 #define OPCNT OFF               /* Counts the Matrix-Vector multiply ops. */
 #define DEFORD 2                /* default expansion order */
-#define MAXORDER 6              /* Maximum expansion order (sets ary sizes) */
+#define MAXORDER 16             /* Maximum expansion order (sets ary sizes) */
+#define M2LTYP M2LAUT           /* default, see --m2l (type of M2L xforms) */
+#define ROTORD 6                /* lowest order with M2LROT if M2LAUT */
 #define MAXDEP 20               /* maximum partitioning depth */
-#define NUMDPT 2                /* num pnts for ea dielec panel (2 or 3) */
+#define NUMDPT 2                /* default, see --numdpt (2 or 3 dielec pnts, 0 analytic) */
 #define SKIPQD OFF              /* ON => skip dielec panel chg in E eval */
 /* Linear System Solution Configuration */
-#define ITRTYP GMRES            /* type of iterative method */
-#define PRECOND OL              /* NONE=> no preconditioner OL=> use prec. */
+#define ITRTYP GMRES            /* default, see --itrtyp (GCR or GMRES) */
+#define PRECOND OL              /* default, see --precond (NONE, OL or SPAI) */
 #define ABSTOL 0.01             /* iterations until ||res||inf < ABSTOL */
 #define MAXITER size            /* max num iterations ('size' => # panels) */
 #define EXRTSH 0.9              /* exact/ttl>EXRTSH for lev => make last lev */
@@ -132,4 +140,16 @@ misc. global macros
 /* blkDirect.c related flags - used only when DIRSOL == ON || EXPGCR == ON */
 #define MAXSIZ 0                /* any more tiles than this uses matrix on disk
                                    for DIRSOL == ON or EXPGCR == ON */
+#define BLKTILE 256             /* tile size of the out-of-core dense matrix */
+
+/* aca.h related flags - low-rank blocks (hsolve and q2pcomp) */
+#define ACATOL 1e-2             /* low-rank block tolerance relative to the
+                                   iteration tolerance */
+#define ACACHECK 8              /* rows sampled before accepting a low-rank block */
+
+/* coarse.c related flags - used only for the two-level preconditioner */
+#define CGLEVEL 1               /* cube level of the coarse aggregates */
+
+/* hmatrix.c related flags - used only for the H-matrix solver (hsolve) */
+#define HLEAFSIZE 64            /* clusters up to this many panels are dense */
 #endif
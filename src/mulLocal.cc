@@ -4,6 +4,8 @@
 #include "mulLocal.h"
 #include "mulStruct.h"
 #include "mulDisplay.h"
+#include "expansion.h"
+#include "calcp.h"
 #include <cmath>
 
 /*
@@ -67,10 +69,12 @@ void evalSqrtFac(ssystem * /*sys*/, double **arrayout, double **arrayin, int ord
 }
 
 
+namespace {
+
 /*
   initializes cos[(m+-k)beta] and sin[(m+-k)beta] lookup tables (M2L and L2L)
 */
-static void evalSinCos(ssystem *sys, double beta, int order)
+inline void evalSinCos(ssystem *sys, double beta, int order)
 {
   int i;
   double temp = beta;
@@ -84,383 +88,333 @@ static void evalSinCos(ssystem *sys, double beta, int order)
 /*
   looks up sin[(m+-k)beta]
 */
-static double sinB(ssystem *sys, int sum)
+inline double sinB(const double *sinmkB, int sum)
 {
-  if(sum < 0) return(-sys->mm.sinmkB[abs(sum)]);
-  else return(sys->mm.sinmkB[sum]);
+  if(sum < 0) return(-sinmkB[-sum]);
+  else return(sinmkB[sum]);
 }
 
 /*
   looks up cos[(m+-k)beta]
 */
-static double cosB(ssystem *sys, int sum)
+inline double cosB(const double *cosmkB, int sum)
 {
-  return(sys->mm.cosmkB[abs(sum)]);
+  return(cosmkB[abs(sum)]);
 }
 
-/* 
-  Used for all but no local downward pass. 
+/*
+  builds the M2L matrix for a given order type (see mulMulti2Local())
 */
-double **mulMulti2Local(ssystem *sys, double x, double y, double z, double xp, double yp, double zp, int order)
-/* double x, y, z, xp, yp, zp: multipole and local cube centers */
+struct m2l_kernel
 {
-  int j, k, n, m;
-  int terms = multerms(order);  /* the number of non-zero moments */
-  int ct = costerms(order);     /* the number of non-zero cos (bar) moments */
-  double **mat;                 /* the transformation matrix */
-  double rho, cosA, beta;       /* spher. position of multi rel to local */
-  double rhoJ, rhoN;            /* rho^j and (-1)^n*rho^(n+1) in main loop */
-  double rhoFac;                /* = rhoJ*rhoN intermediate storage */
-  double temp1, temp2, temp3;
-
-  /* allocate the multi to local transformation matrix */
-  mat = sys->heap.mat(terms, terms, AM2L);
-
-  /* find relative spherical coordinates */
-  xyz2sphere(x, y, z, xp, yp, zp, &rho, &cosA, &beta);
-
-  /* generate legendre function evaluations */
-  evalLegendre(cosA, sys->mm.tleg, 2*order); /* multi->loc needs 2x legendres */
-
-  /* generate sin[(m+-k)beta] and cos[(m+-k)beta] look up arrays */
-  /*  other lookup arrays generated in mulMultiAlloc() */
-  evalSinCos(sys, beta, order);
-
-  /* generate multi to local transformation matrix; uses NB12 pg30 */
-  /*  rhoFac factor divides could be reduced to once per loop */
-  for(j = 0, rhoJ = 1.0; j <= order; rhoJ *= rho, j++) {
-    for(k = 0; k <= j; k++) {   /* loop on Nj^k's, local exp moments */
-      for(n = 0, rhoN = rho; n <= order; rhoN *= (-rho), n++) {
-        for(m = 0; m <= n; m++) { /* loop on On^m's, multipole moments */
-
-          /* generate a bar(N)j^k and dblbar(N)j^k entry */
+  template <class O>
+  static double **run(O order, ssystem *sys, double x, double y, double z, double xp, double yp, double zp)
+  {
+    const int terms = multerms(order()); /* the number of non-zero moments */
+    const int ct = costerms(order()); /* the number of non-zero cos (bar) moments */
+    double **mat;               /* the transformation matrix */
+    double rho, cosA, beta;     /* spher. position of multi rel to local */
+    double rhoJ, rhoN;          /* rho^j and (-1)^n*rho^(n+1) in main loop */
+    double rhoFac;              /* = rhoJ*rhoN intermediate storage */
+    double temp1, temp2, temp3;
+    const double *tleg = sys->mm.tleg, *sinmkB = sys->mm.sinmkB, *cosmkB = sys->mm.cosmkB;
+    double **facFrA = sys->mm.facFrA;
+
+    /* allocate the multi to local transformation matrix */
+    mat = sys->heap.mat(terms, terms, AM2L);
+
+    /* find relative spherical coordinates */
+    xyz2sphere(x, y, z, xp, yp, zp, &rho, &cosA, &beta);
+
+    /* generate legendre function evaluations */
+    legendre(cosA, sys->mm.tleg, order.twice()); /* multi->loc needs 2x legendres */
+
+    /* generate sin[(m+-k)beta] and cos[(m+-k)beta] look up arrays */
+    /*  other lookup arrays generated in mulMultiAlloc() */
+    evalSinCos(sys, beta, order());
+
+    /* generate multi to local transformation matrix; uses NB12 pg30 */
+    /*  rhoFac factor divides could be reduced to once per loop */
+    rhoJ = 1.0;
+    for(int j = 0; j <= order(); rhoJ *= rho, j++) {
+      for(int k = 0; k <= j; k++) { /* loop on Nj^k's, local exp moments */
+        double *crow = mat[CINDEX(j, k)];
+        double *srow = mat[SINDEX(j, k, ct)];
+        rhoN = rho;
+        for(int n = 0; n <= order(); rhoN *= (-rho), n++) {
           rhoFac = rhoJ*rhoN;   /* divisor to give (-1)^n/rho^(j+n+1) factor */
-          if(k == 0) {          /* use abbreviated formulae in this case */
+          for(int m = 0; m <= n; m++) { /* loop on On^m's, multipole moments */
 
-            /* generate only bar(N)j^0 entry (dblbar(N)j^0 = 0 always) */
-            if(m != 0) {
-              temp1 = sys->mm.tleg[CINDEX(j+n, m)]*sys->mm.facFrA[j+n-m][n+m];
-              mat[CINDEX(j, 0)][CINDEX(n, m)] += temp1*cosB(sys, m)/rhoFac;
-              mat[CINDEX(j, 0)][SINDEX(n, m, ct)] += temp1*sinB(sys, m)/rhoFac;
-            }
-            else mat[CINDEX(j, 0)][CINDEX(n, 0)] 
-                += sys->mm.tleg[CINDEX(j+n, 0)]*sys->mm.facFrA[j+n][n]/rhoFac;
-          }
-          else {
-            temp1 = sys->mm.tleg[CINDEX(j+n, abs(m-k))]
-                *sys->mm.facFrA[j+n-abs(m-k)][n+m]*iPwr(sys, abs(k-m)-k-m);
-            temp2 = sys->mm.tleg[CINDEX(j+n, m+k)]*sys->mm.facFrA[j+n-m-k][n+m];
-            temp3 = sys->mm.tleg[CINDEX(j+n, k)]*sys->mm.facFrA[j+n-k][n]*2;
-
-            /* generate bar(N)j^k entry */
-            if(m != 0) {
-              mat[CINDEX(j, k)][CINDEX(n, m)] 
-                  += (temp1*cosB(sys,m-k)+temp2*cosB(sys,m+k))/rhoFac;
-              mat[CINDEX(j, k)][SINDEX(n, m, ct)] 
-                  += (temp1*sinB(sys,m-k)+temp2*sinB(sys,m+k))/rhoFac;
+            /* generate a bar(N)j^k and dblbar(N)j^k entry */
+            if(k == 0) {        /* use abbreviated formulae in this case */
+
+              /* generate only bar(N)j^0 entry (dblbar(N)j^0 = 0 always) */
+              if(m != 0) {
+                temp1 = tleg[CINDEX(j+n, m)]*facFrA[j+n-m][n+m];
+                crow[CINDEX(n, m)] += temp1*cosB(cosmkB, m)/rhoFac;
+                crow[SINDEX(n, m, ct)] += temp1*sinB(sinmkB, m)/rhoFac;
+              }
+              else crow[CINDEX(n, 0)] += tleg[CINDEX(j+n, 0)]*facFrA[j+n][n]/rhoFac;
             }
-            else mat[CINDEX(j, k)][CINDEX(n, 0)] += temp3*cosB(sys,k)/rhoFac;
-
-            /* generate dblbar(N)j^k entry */
-            if(m != 0) {
-              mat[SINDEX(j, k, ct)][CINDEX(n, m)] 
-                  += (-temp1*sinB(sys,m-k)+temp2*sinB(sys,m+k))/rhoFac;
-              mat[SINDEX(j, k, ct)][SINDEX(n, m, ct)] 
-                  += (temp1*cosB(sys,m-k)-temp2*cosB(sys,m+k))/rhoFac;
+            else {
+              temp1 = tleg[CINDEX(j+n, abs(m-k))]
+                  *facFrA[j+n-abs(m-k)][n+m]*ipower(abs(k-m)-k-m);
+              temp2 = tleg[CINDEX(j+n, m+k)]*facFrA[j+n-m-k][n+m];
+              temp3 = tleg[CINDEX(j+n, k)]*facFrA[j+n-k][n]*2;
+
+              /* generate bar(N)j^k entry */
+              if(m != 0) {
+                crow[CINDEX(n, m)] 
+                    += (temp1*cosB(cosmkB,m-k)+temp2*cosB(cosmkB,m+k))/rhoFac;
+                crow[SINDEX(n, m, ct)] 
+                    += (temp1*sinB(sinmkB,m-k)+temp2*sinB(sinmkB,m+k))/rhoFac;
+              }
+              else crow[CINDEX(n, 0)] += temp3*cosB(cosmkB,k)/rhoFac;
+
+              /* generate dblbar(N)j^k entry */
+              if(m != 0) {
+                srow[CINDEX(n, m)] 
+                    += (-temp1*sinB(sinmkB,m-k)+temp2*sinB(sinmkB,m+k))/rhoFac;
+                srow[SINDEX(n, m, ct)] 
+                    += (temp1*cosB(cosmkB,m-k)-temp2*cosB(cosmkB,m+k))/rhoFac;
+              }
+              else srow[CINDEX(n, 0)] += temp3*sinB(sinmkB,k)/rhoFac;
             }
-            else mat[SINDEX(j, k, ct)][CINDEX(n, 0)] += temp3*sinB(sys,k)/rhoFac;
           }
         }
       }
     }
-  }
 
-  if (sys->dism2l) {
-    dispM2L(sys, mat, x, y, z, xp, yp, zp, order);
-  }
+    if (sys->dism2l) {
+      dispM2L(sys, mat, x, y, z, xp, yp, zp, order());
+    }
 
-  return(mat);
-}
+    return(mat);
+  }
+};
 
-/* 
-  Used only for true (Greengard) downward pass - similar to Multi2Local
+/*
+  builds the L2L matrix for a given order type (see mulLocal2Local())
 */
-double **mulLocal2Local(ssystem *sys, double x, double y, double z, double xc, double yc, double zc, int order)
-/* double x, y, z, xc, yc, zc: parent and child cube centers */
+struct l2l_kernel
 {
-  int j, k, n, m;
-  int terms = multerms(order);  /* the number of non-zero moments */
-  int ct = costerms(order);     /* the number of non-zero cos (bar) moments */
-  double **mat;                 /* the transformation matrix */
-  double rho, cosA, beta;       /* spher. position of multi rel to local */
-  double rhoJ, rhoN;            /* rho^j and (-1)^n*rho^(n+1) in main loop */
-  double rhoFac;                /* = rhoJ*rhoN intermediate storage */
-  double temp1, temp2, temp3;
-
-  /* allocate the local to local transformation matrix */
-  mat = sys->heap.mat(terms, terms, AL2L);
-
-  /* find relative spherical coordinates */
-  xyz2sphere(x, y, z, xc, yc, zc, &rho, &cosA, &beta);
-
-  /* generate legendre function evaluations */
-  evalLegendre(cosA, sys->mm.tleg, 2*order); /* local->local needs 2x legendres */
-
-  /* generate sin[(m+-k)beta] and cos[(m+-k)beta] look up arrays */
-  /*  other lookup arrays generated in mulMultiAlloc() */
-  evalSinCos(sys, beta, order);
-
-  /* generate local to local transformation matrix; uses NB12 pg36Y */
-  /*  rhoFac factor divides could be reduced to once per loop */
-  for(j = 0, rhoJ = 1.0; j <= order; rhoJ *= (-rho), j++) {
-    for(k = 0; k <= j; k++) {   /* loop on Nj^k's, local exp moments */
-      for(n = j, rhoN = rhoJ; n <= order; rhoN *= (-rho), n++) {
-        for(m = 0; m <= n; m++) { /* loop on On^m's, old local moments */
-
-          /* generate a bar(N)j^k and dblbar(N)j^k entry */
-          rhoFac = rhoN/rhoJ;   /* divide to give (-rho)^(n-j) factor */
-          if(k == 0 && n-j >= m) {  /* use abbreviated formulae in this case */
-
-            /* generate only bar(N)j^0 entry (dblbar(N)j^0 = 0 always) */
-            if(m != 0) {
-              temp1 = sys->mm.tleg[CINDEX(n-j, m)]*sys->mm.facFrA[0][n-j+m]*rhoFac;
-              mat[CINDEX(j, 0)][CINDEX(n, m)] += temp1*cosB(sys,m);
-              mat[CINDEX(j, 0)][SINDEX(n, m, ct)] += temp1*sinB(sys,m);
-            }
-            else mat[CINDEX(j, 0)][CINDEX(n, 0)] += sys->mm.tleg[CINDEX(n-j, 0)]
-                    *sys->mm.facFrA[0][n-j]*rhoFac;
-          }
-          else {
-            if(n-j >= abs(m-k)) temp1 = sys->mm.tleg[CINDEX(n-j, abs(m-k))]
-                *sys->mm.facFrA[0][n-j+abs(m-k)]*iPwr(sys, m-k-abs(m-k))*rhoFac;
-            if(n-j >= m+k) temp2 = sys->mm.tleg[CINDEX(n-j, m+k)]
-                *sys->mm.facFrA[0][n-j+m+k]*iPwr(sys, 2*k)*rhoFac;
-            if(n-j >= k) temp3 = 2*sys->mm.tleg[CINDEX(n-j, k)]
-                *sys->mm.facFrA[0][n-j+k]*iPwr(sys, 2*k)*rhoFac;
-
-            /* generate bar(N)j^k entry */
-            if(m != 0) {
-              if(n-j >= abs(m-k)) {
-                mat[CINDEX(j, k)][CINDEX(n, m)] += temp1*cosB(sys,m-k);
-                mat[CINDEX(j, k)][SINDEX(n, m, ct)] += temp1*sinB(sys,m-k);
-              }
-              if(n-j >= m+k) {
-                mat[CINDEX(j, k)][CINDEX(n, m)] += temp2*cosB(sys,m+k);
-                mat[CINDEX(j, k)][SINDEX(n, m, ct)] += temp2*sinB(sys,m+k);
+  template <class O>
+  static double **run(O order, ssystem *sys, double x, double y, double z, double xc, double yc, double zc)
+  {
+    const int terms = multerms(order()); /* the number of non-zero moments */
+    const int ct = costerms(order()); /* the number of non-zero cos (bar) moments */
+    double **mat;               /* the transformation matrix */
+    double rho, cosA, beta;     /* spher. position of multi rel to local */
+    double rhoJ, rhoN;          /* rho^j and (-1)^n*rho^(n+1) in main loop */
+    double rhoFac;              /* = rhoJ*rhoN intermediate storage */
+    double temp1 = 0.0, temp2 = 0.0, temp3 = 0.0;
+    const double *tleg = sys->mm.tleg, *sinmkB = sys->mm.sinmkB, *cosmkB = sys->mm.cosmkB;
+    const double *facFrA0 = sys->mm.facFrA[0];
+
+    /* allocate the local to local transformation matrix */
+    mat = sys->heap.mat(terms, terms, AL2L);
+
+    /* find relative spherical coordinates */
+    xyz2sphere(x, y, z, xc, yc, zc, &rho, &cosA, &beta);
+
+    /* generate legendre function evaluations */
+    legendre(cosA, sys->mm.tleg, order.twice()); /* local->local needs 2x legendres */
+
+    /* generate sin[(m+-k)beta] and cos[(m+-k)beta] look up arrays */
+    /*  other lookup arrays generated in mulMultiAlloc() */
+    evalSinCos(sys, beta, order());
+
+    /* generate local to local transformation matrix; uses NB12 pg36Y */
+    /*  rhoFac factor divides could be reduced to once per loop */
+    rhoJ = 1.0;
+    for(int j = 0; j <= order(); rhoJ *= (-rho), j++) {
+      for(int k = 0; k <= j; k++) { /* loop on Nj^k's, local exp moments */
+        double *crow = mat[CINDEX(j, k)];
+        double *srow = mat[SINDEX(j, k, ct)];
+        rhoN = rhoJ;
+        for(int n = j; n <= order(); rhoN *= (-rho), n++) {
+          for(int m = 0; m <= n; m++) { /* loop on On^m's, old local moments */
+
+            /* generate a bar(N)j^k and dblbar(N)j^k entry */
+            rhoFac = rhoN/rhoJ; /* divide to give (-rho)^(n-j) factor */
+            if(k == 0 && n-j >= m) {  /* use abbreviated formulae in this case */
+
+              /* generate only bar(N)j^0 entry (dblbar(N)j^0 = 0 always) */
+              if(m != 0) {
+                temp1 = tleg[CINDEX(n-j, m)]*facFrA0[n-j+m]*rhoFac;
+                crow[CINDEX(n, m)] += temp1*cosB(cosmkB,m);
+                crow[SINDEX(n, m, ct)] += temp1*sinB(sinmkB,m);
               }
+              else crow[CINDEX(n, 0)] += tleg[CINDEX(n-j, 0)]*facFrA0[n-j]*rhoFac;
             }
-            else if(n-j >= k) mat[CINDEX(j, k)][CINDEX(n, 0)] += temp3*cosB(sys,k);
-
-            /* generate dblbar(N)j^k entry */
-            if(m != 0) {
-              if(n-j >= abs(m-k)) {
-                mat[SINDEX(j, k, ct)][CINDEX(n, m)] += (-temp1*sinB(sys,m-k));
-                mat[SINDEX(j, k, ct)][SINDEX(n, m, ct)] += temp1*cosB(sys,m-k);
+            else {
+              if(n-j >= abs(m-k)) temp1 = tleg[CINDEX(n-j, abs(m-k))]
+                  *facFrA0[n-j+abs(m-k)]*ipower(m-k-abs(m-k))*rhoFac;
+              if(n-j >= m+k) temp2 = tleg[CINDEX(n-j, m+k)]
+                  *facFrA0[n-j+m+k]*ipower(2*k)*rhoFac;
+              if(n-j >= k) temp3 = 2*tleg[CINDEX(n-j, k)]
+                  *facFrA0[n-j+k]*ipower(2*k)*rhoFac;
+
+              /* generate bar(N)j^k entry */
+              if(m != 0) {
+                if(n-j >= abs(m-k)) {
+                  crow[CINDEX(n, m)] += temp1*cosB(cosmkB,m-k);
+                  crow[SINDEX(n, m, ct)] += temp1*sinB(sinmkB,m-k);
+                }
+                if(n-j >= m+k) {
+                  crow[CINDEX(n, m)] += temp2*cosB(cosmkB,m+k);
+                  crow[SINDEX(n, m, ct)] += temp2*sinB(sinmkB,m+k);
+                }
               }
-              if(n-j >= m+k) {
-                mat[SINDEX(j, k, ct)][CINDEX(n, m)] += (-temp2*sinB(sys,m+k));
-                mat[SINDEX(j, k, ct)][SINDEX(n, m, ct)] += temp2*cosB(sys,m+k);
+              else if(n-j >= k) crow[CINDEX(n, 0)] += temp3*cosB(cosmkB,k);
+
+              /* generate dblbar(N)j^k entry */
+              if(m != 0) {
+                if(n-j >= abs(m-k)) {
+                  srow[CINDEX(n, m)] += (-temp1*sinB(sinmkB,m-k));
+                  srow[SINDEX(n, m, ct)] += temp1*cosB(cosmkB,m-k);
+                }
+                if(n-j >= m+k) {
+                  srow[CINDEX(n, m)] += temp2*sinB(sinmkB,m+k);
+                  srow[SINDEX(n, m, ct)] += (-temp2*cosB(cosmkB,m+k));
+                }
               }
+              else if(n-j >= k) srow[CINDEX(n, 0)] += temp3*sinB(sinmkB,k);
             }
-            else if(n-j >= k) 
-                mat[SINDEX(j, k, ct)][CINDEX(n, 0)] += temp3*sinB(sys,k);
           }
         }
       }
     }
-  }
 
-  if (sys->disl2l) {
-    dispL2L(sys, mat, x, y, z, xc, yc, zc, order);
-  }
+    if (sys->disl2l) {
+      dispL2L(sys, mat, x, y, z, xc, yc, zc, order());
+    }
 
-  return(mat);
-}
+    return(mat);
+  }
+};
 
 /*
-  sets up xformation for distant cube charges to local expansion
-  form almost identical to mulQ2Multi - follows NB12 pg 32 w/m,n replacing k,j
-  OPTIMIZATIONS INVOLVING is_dummy HAVE NOT BEEN COMPLETELY IMPLEMENTED
+  builds the Q2L matrix for a given order type (see mulQ2Local())
 */
-double **mulQ2Local(ssystem *sys, charge **chgs, int numchgs, int *is_dummy, double x, double y, double z, int order)
+struct q2l_kernel
 {
-  int i, j, n, m;
-  int cterms = costerms(order), terms = multerms(order);
-  double **mat, temp;
-  double cosA;                  /* cosine of elevation coordinate */
-
-  /* Allocate the matrix. */
-  mat = sys->heap.mat(terms, numchgs, AQ2L);
-
-  /* get Legendre function evaluations, one set for each charge */
-  /*  also get charge coordinates, set up for subsequent evals */
-  for(j = 0; j < numchgs; j++) { /* for each charge */
-
-    /* get cosA for eval; save rho, beta in rho^n and cos/sin(m*beta) arrays */
-    xyz2sphere(chgs[j]->x, chgs[j]->y, chgs[j]->z,
-               x, y, z, &(sys->mm.Rho[j]), &cosA, &(sys->mm.Beta[j]));
-    sys->mm.Rhon[j] = sys->mm.Rho[j]; /* init powers of rho_i's */
-    sys->mm.Betam[j] = sys->mm.Beta[j];         /* init multiples of beta */
-    evalLegendre(cosA, sys->mm.tleg, order);    /* write moments to temporary array */
-    /* write a column of the matrix with each set of legendre evaluations */
-    for(i = 0; i < cterms; i++) mat[i][j] = sys->mm.tleg[i]; /* copy for cos terms */
-  }
-
-  if (sys->dalq2l) {
-    sys->msg(
-            "\nQ2L MATRIX BUILD:\n    AFTER LEGENDRE FUNCTION EVALUATON\n");
-    dumpMat(sys, mat, terms, numchgs);
-  }
-
-  /* add the rho^n+1 factors to the cos matrix entries. */
-  for(n = 0; n <= order; n++) { /* loop on rows of matrix */
-    for(m = 0; m <= n; m++) {
-      for(j = 0; j < numchgs; j++) 
-          mat[CINDEX(n, m)][j] /= sys->mm.Rhon[j]; /* divide by factor */
+  template <class O>
+  static double **run(O order, ssystem *sys, charge **chgs, int numchgs, int *is_dummy, double x, double y, double z)
+  {
+    const int terms = multerms(order());
+    double **mat;
+    const double *f = factorials();
+    double *coef = sys->mm.tleg;
+
+    /* Allocate the matrix. */
+    mat = sys->heap.mat(terms, numchgs, AQ2L);
+
+    /* bar(N)n^0 = n! Pn^0(cosA)/rho^n+1, Nn^m = 2 (n-m)! Pn^m(cosA)/rho^n+1 (cos, sin)(m*beta) */
+    for(int n = 0; n <= order(); n++) {
+      for(int m = 0; m <= n; m++) coef[CINDEX(n, m)] = (m == 0 ? f[n] : 2.0*f[n-m]);
     }
-    for(j = 0; j < numchgs; j++) sys->mm.Rhon[j] *= sys->mm.Rho[j];     /* rho^n -> rho^n+1 */
-  }
-
-  if (sys->dalq2l) {
-    sys->msg("    AFTER ADDITION OF (1/RHO)^N+1 FACTORS\n");
-    dumpMat(sys, mat, terms, numchgs);
-  }
+    harmonics<O, true, false>(order, chgs, numchgs, x, y, z, coef, sys->mm.batch, mat);
 
-  /* copy result to lower (sine) part of matrix */
-  for(n = 1; n <= order; n++) { /* loop on rows of matrix */
-    for(m = 1; m <= n; m++) {
-      for(j = 0; j < numchgs; j++) { /* copy a row */
-        mat[SINDEX(n, m, cterms)][j] = mat[CINDEX(n, m)][j];
-      }
+    if (sys->dalq2l) {
+      sys->msg("\nQ2L MATRIX BUILD:\n    AFTER SINGLE PASS EVALUATION\n");
+      dumpMat(sys, mat, terms, numchgs);
     }
-  }
 
-  if (sys->dalq2l) {
-    sys->msg("    AFTER COPYING SINE (LOWER) HALF\n");
-    dumpMat(sys, mat, terms, numchgs);
-  }
-
-  /* add factors of cos(m*beta) and sin(m*beta) to matrix entries */
-  for(m = 0; m <= order; m++) { /* lp on m in Mn^m */
-    for(n = m; n <= order; n++) { /* loop over rows with same m */
-      for(j = 0; j < numchgs; j++) { /* add factors to a row */
-        if(m == 0)  mat[CINDEX(n, m)][j] *= fact(sys, n); /* j! part of bar(N)j^0 */
-        else {                  /* for Nj^k, k != 0 */
-          temp = 2.0*fact(sys, n-m);            /* find the factorial for moment */
-          mat[CINDEX(n, m)][j] *= (temp*cos(sys->mm.Betam[j]));   /* note mul by 2 */
-          mat[SINDEX(n, m, cterms)][j] *= (temp*sin(sys->mm.Betam[j]));
+    /* THIS IS NOT VERY GOOD: zero out columns corresponding to dummy panels */
+    for(int j = 0; j < numchgs; j++) {
+      if(is_dummy[j]) {
+        for(int i = 0; i < terms; i++) {
+          mat[i][j] = 0.0;
         }
       }
     }
-    if(m > 0) {
-      for(j = 0; j < numchgs; j++) sys->mm.Betam[j] += sys->mm.Beta[j];/* (m-1)*beta->m*beta */
-    }
-  }
 
-  /* THIS IS NOT VERY GOOD: zero out columns corresponding to dummy panels */
-  for(j = 0; j < numchgs; j++) {
-    if(is_dummy[j]) {
-      for(i = 0; i < terms; i++) {
-        mat[i][j] = 0.0;
-      }
+    if (sys->disq2l) {
+       dispQ2L(sys, mat, chgs, numchgs, x, y, z, order());
     }
-  }
 
-  if (sys->disq2l) {
-     dispQ2L(sys, mat, chgs, numchgs, x, y, z, order);
+    return(mat);
   }
-
-  return(mat);
-}
+};
 
 /*
-  builds local expansion evaluation matrix; not used for fake dwnwd pass
-  follows NB10 equation marked circle(2A) except roles of j,k and n,m switched
-  very similar to mulMulti2P()
+  builds the L2P matrix for a given order type (see mulLocal2P())
 */
-double **mulLocal2P(ssystem *sys, double x, double y, double z, charge **chgs, int numchgs, int order)
+struct l2p_kernel
 {
-  double **mat;
-  double cosTh;                 /* cosine of elevation coordinate */
-  int i, j, k, m, n, kold;
-  int cterms = costerms(order), terms = multerms(order);
-
-  mat = sys->heap.mat(numchgs, terms, AL2P);
-
-  /* get Legendre function evaluations, one set for each charge */
-  /*   also get charge coordinates to set up rest of matrix */
-  for(i = 0; i < numchgs; i++) { /* for each charge, do a legendre eval set */
-    xyz2sphere(chgs[i]->x, chgs[i]->y, chgs[i]->z,
-               x, y, z, &(sys->mm.Ir[i]), &cosTh, &(sys->mm.phi[i]));
-    sys->mm.Irn[i] = 1.0; /* initialize r^n vec. */
-    sys->mm.Mphi[i] = sys->mm.phi[i];           /* initialize m*phi vector */
-    evalLegendre(cosTh, mat[i], order); /* wr moms to 1st (cos) half of row */
-  }
-
-  if (sys->dall2p) {
-    sys->msg(
-            "\nL2P MATRIX BUILD:\n    AFTER LEGENDRE FUNCTION EVALUATON\n");
-    dumpMat(sys, mat, numchgs, terms);
-  }
+  template <class O>
+  static double **run(O order, ssystem *sys, double x, double y, double z, charge **chgs, int numchgs)
+  {
+    double **mat;
+    const int terms = multerms(order());
+    const double *f = factorials();
+    double *coef = sys->mm.tleg;
+
+    mat = sys->heap.mat(numchgs, terms, AL2P);
+
+    /* r^n Pn^m(cosTh)/(n+m)! (cos, sin)(m*phi) */
+    for(int n = 0; n <= order(); n++) {
+      for(int m = 0; m <= n; m++) coef[CINDEX(n, m)] = 1.0/f[n+m];
+    }
+    harmonics<O, false, true>(order, chgs, numchgs, x, y, z, coef, sys->mm.batch, mat);
 
-  /* add the r^n factors to the left (cos(m*phi)) half of the matrix */
-  for(j = 0, k = kold = 1; j < cterms; j++) { /* loop on columns of matrix */
-    for(i = 0; i < numchgs; i++) mat[i][j] *= sys->mm.Irn[i]; /* multiply by r^n */
-    k -= 1;
-    if(k == 0) {                /* so that n changes as appropriate */
-      kold = k = kold + 1;
-      for(i = 0; i < numchgs; i++) sys->mm.Irn[i] *= sys->mm.Ir[i]; /* r^n -> r^n+1 */
+    /* flux density rows (--numdpt=0) get the normal derivative instead */
+    for(int j = 0; j < numchgs; j++) {
+      if(is_flux_row(sys, chgs[j])) {
+        normal_harmonics<O, false>(order, chgs[j], x, y, z, chgs[j]->Z, coef, sys->mm.nscratch, mat[j]);
+      }
     }
-  }
 
-  if (sys->dall2p) {
-    sys->msg(
-            "    AFTER ADDITION OF R^N FACTORS\n");
-    dumpMat(sys, mat, numchgs, terms);
-  }
+    if (sys->dall2p) {
+      sys->msg("\nL2P MATRIX BUILD:\n    AFTER SINGLE PASS EVALUATION\n");
+      dumpMat(sys, mat, numchgs, terms);
+    }
 
-  /* add the factorial fraction factors to the left (cos(m*phi)) part of mat */
-  for(n = 0; n <= order; n++) {
-    for(m = 0; m <= n; m++) {
-      for(i = 0; i < numchgs; i++) mat[i][CINDEX(n, m)] /= fact(sys, n+m);
+    if (sys->disl2p) {
+      dispL2P(sys, mat, x, y, z, chgs, numchgs, order());
     }
-  }
 
-  if (sys->dall2p) {
-    sys->msg(
-            "    AFTER ADDITION OF FACTORIAL FRACTION FACTORS\n");
-    dumpMat(sys, mat, numchgs, terms);
+    return(mat);
   }
+};
 
-  /* copy left half of matrix to right half for sin(m*phi) terms */
-  for(i = 0; i < numchgs; i++) { /* loop on rows of matrix */
-    for(n = 1; n <= order; n++) { 
-      for(m = 1; m <= n; m++) { /* copy a row */
-        mat[i][SINDEX(n, m, cterms)] = mat[i][CINDEX(n, m)];
-      }
-    }
-  }
+}
 
-  if (sys->dall2p) {
-    sys->msg(
-            "    AFTER COPYING SINE (RIGHT) HALF\n");
-    dumpMat(sys, mat, numchgs, terms);
-  }
+/* 
+  Used for all but no local downward pass. 
+*/
+double **mulMulti2Local(ssystem *sys, double x, double y, double z, double xp, double yp, double zp, int order)
+/* double x, y, z, xp, yp, zp: multipole and local cube centers */
+{
+  return order_dispatch<m2l_kernel>::call(order, sys, x, y, z, xp, yp, zp);
+}
 
-  /* add factors of cos(m*phi) and sin(m*phi) to left and right halves resp. */
-  for(m = 1; m <= order; m++) { /* lp on m in Mn^m (no m=0 since cos(0)=1) */
-    for(n = m; n <= order; n++) { /* loop over cols with same m */
-      for(i = 0; i < numchgs; i++) { /* add factors to a column */
-        mat[i][CINDEX(n, m)] *= cos(sys->mm.Mphi[i]);
-        mat[i][SINDEX(n, m, cterms)] *= sin(sys->mm.Mphi[i]);
-      }
-    }
-    for(i = 0; i < numchgs; i++) sys->mm.Mphi[i] += sys->mm.phi[i]; /* (m-1)*phi->m*phi */
-  }
+/* 
+  Used only for true (Greengard) downward pass - similar to Multi2Local
+*/
+double **mulLocal2Local(ssystem *sys, double x, double y, double z, double xc, double yc, double zc, int order)
+/* double x, y, z, xc, yc, zc: parent and child cube centers */
+{
+  return order_dispatch<l2l_kernel>::call(order, sys, x, y, z, xc, yc, zc);
+}
 
-  if (sys->disl2p) {
-    dispL2P(sys, mat, x, y, z, chgs, numchgs, order);
-  }
+/*
+  sets up xformation for distant cube charges to local expansion
+  form almost identical to mulQ2Multi - follows NB12 pg 32 w/m,n replacing k,j
+  OPTIMIZATIONS INVOLVING is_dummy HAVE NOT BEEN COMPLETELY IMPLEMENTED
+*/
+double **mulQ2Local(ssystem *sys, charge **chgs, int numchgs, int *is_dummy, double x, double y, double z, int order)
+{
+  return order_dispatch<q2l_kernel>::call(order, sys, chgs, numchgs, is_dummy, x, y, z);
+}
 
-  return(mat);
+/*
+  builds local expansion evaluation matrix; not used for fake dwnwd pass
+  follows NB10 equation marked circle(2A) except roles of j,k and n,m switched
+  very similar to mulMulti2P()
+*/
+double **mulLocal2P(ssystem *sys, double x, double y, double z, charge **chgs, int numchgs, int order)
+{
+  return order_dispatch<l2p_kernel>::call(order, sys, x, y, z, chgs, numchgs);
 }
@@ -9,15 +9,35 @@
 #include "blkDirect.h"
 #include "resusage.h"
 #include "counters.h"
+#include "parallel.h"
 
 #include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+/* This near picks up only the hamming distance one cubes. */    
+#define HNEAR(nbr, nj, nk, nl) \
+((ABS((nbr)->j - (nj)) + ABS((nbr)->k - (nk)) + ABS((nbr)->l - (nl))) <= 1)
+
+/* This near picks up all 27 neighboring cubes. */
+#define NEAR(nbr, nj, nk, nl) \
+((ABS((nbr)->j - (nj)) <= 1) && \
+ (ABS((nbr)->k - (nk)) <= 1) && \
+ (ABS((nbr)->l - (nl)) <= 1))
+
+/* This near picks only the diagonal, for testing. */
+#define DNEAR(nbr, nj, nk, nl) \
+(((nbr)->j == (nj)) && \
+ ((nbr)->k == (nk)) && \
+ ((nbr)->l == (nl)) )
 
 /*
 MulMatDirect creates the matrices for the piece of the problem that is done
 directly exactly.
 */
-void mulMatDirect(ssystem *sys, double **trimat, double **sqrmat, int **real_index, int up_size, int eval_size)
-  /* double *trimat, *sqrmat: flattened triangular, square matrices */
+void mulMatDirect(ssystem *sys, blk_matrix **blkmat, int **real_index, int up_size, int eval_size)
+  /* blk_matrix *blkmat: out-of-core full matrix (DIRSOL/EXPGCR only) */
   /* int *real_index: for map btwn condensed/expanded vectors */
 {
   cube *nextc, *nextnbr;
@@ -38,6 +58,9 @@ void mulMatDirect(ssystem *sys, double **trimat, double **sqrmat, int **real_ind
       temp = sys->heap.alloc<int *>(nummats, AMSC);
       nextc->directnumeles = sys->heap.alloc<int>(nummats, AMSC);
       nextc->directmats = sys->heap.alloc<double**>(nummats, AMSC);
+      nextc->directrank = sys->heap.alloc<int>(nummats, AMSC);
+      nextc->directu = sys->heap.alloc<double**>(nummats, AMSC);
+      nextc->directv = sys->heap.alloc<double**>(nummats, AMSC);
       nextc->precondmats = sys->heap.alloc<double**>(nummats, AMSC);
     }
 
@@ -51,6 +74,7 @@ void mulMatDirect(ssystem *sys, double **trimat, double **sqrmat, int **real_ind
   for(nextc=sys->directlist; nextc != NULL; nextc = nextc->dnext) {
     nextc->directq[0] = nextc->upvects[0];
     nextc->directnumeles[0] = nextc->upnumeles[0];
+    nextc->directrank[0] = -1;
 
     starttimer;
     if (sys->dirsol || sys->expgcr) {
@@ -58,8 +82,14 @@ void mulMatDirect(ssystem *sys, double **trimat, double **sqrmat, int **real_ind
         if(eval_size < MAXSIZ) {
           sys->error("mulMatDirect: non-block direct methods not supported");
         }
-        else blkQ2Pfull(sys, sys->directlist, up_size, eval_size,
-                        trimat, sqrmat, real_index, sys->is_dummy);
+        else {
+          blkQ2Pfull(sys, sys->directlist, up_size, eval_size,
+                     blkmat, real_index, sys->is_dummy);
+          /* P is multiplied in every iteration - avoid rereading it */
+          if(sys->expgcr) {
+            (*blkmat)->make_resident(size_t(sys->mem_limit * 1024.0 * 1024.0));
+          }
+        }
       }
       else nextc->directmats[0]
           = Q2PDiag(sys, nextc->chgs, nextc->upnumeles[0], nextc->nbr_is_dummy[0],
@@ -68,9 +98,6 @@ void mulMatDirect(ssystem *sys, double **trimat, double **sqrmat, int **real_ind
       nextc->directmats[0]
           = Q2PDiag(sys, nextc->chgs, nextc->upnumeles[0], nextc->nbr_is_dummy[0],
                     TRUE);
-      nextc->precondmats[0]
-          = Q2PDiag(sys, nextc->chgs, nextc->upnumeles[0], nextc->nbr_is_dummy[0],
-                    FALSE);
     }
 
     stoptimer;
@@ -87,11 +114,12 @@ void mulMatDirect(ssystem *sys, double **trimat, double **sqrmat, int **real_ind
     if (sys->dirsol) {
       /* transform A into LU */
       if(eval_size > MAXSIZ) {
-        blkLUdecomp(sys, *sqrmat, *trimat, up_size);
+        blkLUdecomp(sys, *blkmat);
       }
       else if(nextc == sys->directlist) {
         starttimer;
-        nextc->directlu = ludecomp(sys, nextc->directmats[0], eval_size, TRUE);
+        nextc->directlu = ludecomp(sys, nextc->directmats[0], eval_size, TRUE,
+                                   &nextc->directpiv);
         stoptimer;
         counters.lutime += dtime;
       }
@@ -104,18 +132,28 @@ void mulMatDirect(ssystem *sys, double **trimat, double **sqrmat, int **real_ind
       nextc->directq[nummats] = nextnbr->upvects[0];
       nextc->nbr_is_dummy[nummats] = nextnbr->nbr_is_dummy[0];
       nextc->directnumeles[nummats] = nextnbr->upnumeles[0];
-      nextc->directmats[nummats] = Q2P(sys,
-                                       nextnbr->chgs,
-                                       nextnbr->upnumeles[0], 
-                                       nextnbr->nbr_is_dummy[0],
-                                       nextc->chgs, nextc->upnumeles[0],
-                                       TRUE);
-      nextc->precondmats[nummats++] = Q2P(sys,
-                                          nextnbr->chgs,
-                                          nextnbr->upnumeles[0], 
-                                          nextnbr->nbr_is_dummy[0],
-                                          nextc->chgs, nextc->upnumeles[0],
-                                          FALSE);
+      nextc->directrank[nummats] = -1;
+      /* the interactions with the second shell are smooth enough for a
+         low-rank form - the overlapped preconditioner does not use them */
+      if(sys->q2pcomp && !NEAR(nextnbr, nextc->j, nextc->k, nextc->l)) {
+        nextc->directrank[nummats] = Q2Plowrank(sys,
+                                                nextnbr->chgs,
+                                                nextnbr->upnumeles[0],
+                                                nextnbr->nbr_is_dummy[0],
+                                                nextc->chgs, nextc->upnumeles[0],
+                                                ACATOL * sys->iter_tol,
+                                                &nextc->directu[nummats],
+                                                &nextc->directv[nummats]);
+      }
+      if(nextc->directrank[nummats] < 0) {
+        nextc->directmats[nummats] = Q2P(sys,
+                                         nextnbr->chgs,
+                                         nextnbr->upnumeles[0], 
+                                         nextnbr->nbr_is_dummy[0],
+                                         nextc->chgs, nextc->upnumeles[0],
+                                         TRUE);
+      }
+      nummats++;
       if (sys->dmtcnt) {
         sys->mm.Q2Pcnt[nextc->level][nextnbr->level]++;
       }
@@ -123,314 +161,368 @@ void mulMatDirect(ssystem *sys, double **trimat, double **sqrmat, int **real_ind
     stoptimer;
     counters.dirtime += dtime;
   }
+
+  if(sys->dirsol || sys->expgcr
+     || (sys->precond != OL && sys->precond != SPAI)) return;
+
+  /* The raw blocks of the overlapped and SPAI preconditioners in a second
+     pass, so the direct blocks mulDirect() streams through every iteration
+     stay contiguous (in the mapped file with --mem-limit) */
+  starttimer;
+  for(nextc=sys->directlist; nextc != NULL; nextc = nextc->dnext) {
+    nextc->precondmats[0]
+        = Q2PDiag(sys, nextc->chgs, nextc->upnumeles[0], nextc->nbr_is_dummy[0],
+                  FALSE);
+    for(i = 0; i < nextc->numnbrs; i++) {
+      nextnbr = nextc->nbrs[i];
+      if(NEAR(nextnbr, nextc->j, nextc->k, nextc->l)) {
+        nextc->precondmats[i+1] = Q2P(sys,
+                                      nextnbr->chgs,
+                                      nextnbr->upnumeles[0], 
+                                      nextnbr->nbr_is_dummy[0],
+                                      nextc->chgs, nextc->upnumeles[0],
+                                      FALSE);
+      }
+    }
+  }
+  stoptimer;
+  counters.dirtime += dtime;
+}
+
+
+/*
+  gets matrix i of nc's direct matrices in dense form - a compressed
+  block (see mulMatDirect()) is expanded into buf/rows, which are
+  reused by the next call
+*/
+static double **dense_directmat(cube *nc, int i, std::vector<double> &buf, std::vector<double *> &rows)
+{
+  if(nc->directrank[i] < 0) return nc->directmats[i];
+
+  int nrows = nc->directnumeles[0], ncols = nc->directnumeles[i];
+  int rank = nc->directrank[i];
+  double **u = nc->directu[i], **v = nc->directv[i];
+
+  buf.resize(size_t(nrows) * size_t(ncols));
+  rows.resize(nrows);
+  for(int r = 0; r < nrows; r++) {
+    rows[r] = buf.data() + size_t(r) * size_t(ncols);
+    for(int j = 0; j < ncols; j++) {
+      double s = 0.0;
+      for(int l = 0; l < rank; l++) s += u[r][l] * v[j][l];
+      rows[r][j] = s;
+    }
+  }
+  return rows.data();
+}
+
+/*
+  slot of cube to in the direct matrices of cube from (0 for from itself,
+  -1 if to is not among from's neighbors)
+*/
+static int direct_slot(cube *from, cube *to)
+{
+  if(from == to) return 0;
+  for(int m = 0; m < from->numnbrs; m++) {
+    if(from->nbrs[m] == to) return m + 1;
+  }
+  return -1;
 }
 
+/*
+  collects the cubes near to c (NEAR()), c first and then in the order of
+  c's neighbor list, and the offsets of their panels in the near-field
+  matrix - returns the size of that matrix
+*/
+static int near_cubes(cube *c, std::vector<cube *> &near, std::vector<int> &offset)
+{
+  near.assign(1, c);
+  for(int m = 0; m < c->numnbrs; m++) {
+    if(NEAR(c->nbrs[m], c->j, c->k, c->l)) near.push_back(c->nbrs[m]);
+  }
+  int n = 0;
+  offset.clear();
+  for(size_t e = 0; e < near.size(); e++) {
+    offset.push_back(n);
+    n += near[e]->directnumeles[0];
+  }
+  return n;
+}
+
+/*
+  fills in the near-field matrix Pn(J, J) of the cubes J from near_cubes()
+  - rows must be n x n and zero
+  - the rows of dielectric panels are flux density rows, dummy panels get
+    unit rows and columns so they drop out of any solve
+  - buf/rows are scratch space for dense_directmat()
+  - returns the number of dummy rows built with calcp() (see
+    find_flux_density_row())
+*/
+static int near_field_matrix(ssystem *sys, const std::vector<cube *> &near, const std::vector<int> &offset,
+                              double **mat, std::vector<double> &buf, std::vector<double *> &rows)
+{
+  int calcp_rows = 0;
+
+  for(size_t d = 0; d < near.size(); d++) {
+    cube *dc = near[d];
+    int dsize = dc->directnumeles[0];
+    int *d_dummy = dc->nbr_is_dummy[0];
+    for(size_t e = 0; e < near.size(); e++) {
+      int slot = direct_slot(dc, near[e]);
+      if(slot < 0) continue;            /* not in the near field of dc */
+      int esize = near[e]->directnumeles[0];
+      double **dmat = dense_directmat(dc, slot, buf, rows);
+      for(int r = 0; r < dsize; r++) {
+        if(d_dummy[r]) continue;        /* dummy rows copied only in divided diff */
+        if(dc->chgs[r]->surf->type != DIELEC) {
+          for(int k = 0; k < esize; k++) mat[offset[d] + r][offset[e] + k] = dmat[r][k];
+        }
+        else {
+          calcp_rows += find_flux_density_row(sys, mat, dmat, r, esize, dsize, offset[d], offset[e],
+                                              dc->chgs, near[e]->chgs, d_dummy, near[e]->nbr_is_dummy[0]);
+        }
+      }
+    }
+  }
+
+  int n = offset.back() + near.back()->directnumeles[0];
+  for(size_t e = 0; e < near.size(); e++) {
+    int *e_dummy = near[e]->nbr_is_dummy[0];
+    for(int k = near[e]->directnumeles[0] - 1; k >= 0; k--) {
+      if(!e_dummy[k]) continue;
+      int col = offset[e] + k;
+      for(int r = 0; r < n; r++) mat[r][col] = mat[col][r] = 0.0;
+      mat[col][col] = 1.0;
+    }
+  }
+
+  return calcp_rows;
+}
 
 /*
-MulMatPrecond creates the preconditioner matrix
+  BdmulMatPrecond creates the block diagonal preconditioner: for each
+  parent of lowest level cubes the LU factors of the near-field matrix
+  of its kids, set up like the one of olmulMatPrecond() (flux density
+  rows for dielectric panels, unit rows and columns for dummies)
+  - the kids' panels are numbered consecutively (see indexkid()), so the
+    block acts on a contiguous piece of the charge vector
 */
 void bdmulMatPrecond(ssystem *sys)
 {
-  cube *nc, *kid, *kidnbr;
-  double **mat, **nbrmat;
-  int i, j, k, l, kidi;
-  int kidsize, nbrsize, size, row, col, first;
+  cube *nc, *kid;
+  int i, size;
+  std::vector<cube *> kids;
+  std::vector<int> offset;
+  std::vector<double> buf;
+  std::vector<double *> rows;
+  int calcp_rows = 0;
 
   for(nc=sys->precondlist; nc != NULL; nc = nc->pnext) {
 
     /* find total number of charges in cube to dimension P. */
+    kids.clear();
+    offset.clear();
     for(size=0, i=0; i < nc->numkids; i++) {
       kid = nc->kids[i];
       if(kid != NULL) {
         assert(kid->level == sys->depth);
+        kids.push_back(kid);
+        offset.push_back(size);
         size += kid->directnumeles[0];  /* Equals number of charges. */
       }
     }
+    if(kids.empty()) continue;
 
-    /* allocate and zero a preconditioner matrix. */
-    mat = sys->heap.alloc<double *>(size, AMSC);
-    for(i = 0; i < size; i++) {
-      mat[i] = sys->heap.alloc<double>(size, AMSC);
-    }
-    for(i = 0; i < size; i++) {
-      for(j = 0; j < size; j++) {
-        mat[i][j] = 0.0;
-      }
-    }
+    nc->prevectq = kids.front()->directq[0];
+    nc->prevectp = kids.front()->eval;
 
-    /* Chase through the kids to place in potential coeffs. */
-    for(first = TRUE, row=0, kidi=0; kidi < nc->numkids; kidi++) {
-      kid = nc->kids[kidi];
-      if(kid != NULL) {
-        /* Exploit the hierarchical charge numbering to get precond vector. */
-        if(first == TRUE) {
-          first = FALSE;
-          nc->prevectq = kid->directq[0];
-          nc->prevectp = kid->eval;
-        }
-        /* Get the diagonal block of P^{-1}. */
-        kidsize = kid->directnumeles[0];
-        for(k = kidsize - 1; k >= 0; k--) {
-          for(l = kidsize - 1; l >= 0; l--) {
-            mat[row + k][row + l] = kid->directmats[0][k][l];
-          }
-        }
-        /* Get the off-diagonals of P^{-1}. */
-        for(col = 0, i = 0; i < nc->numkids; i++) {
-          kidnbr = nc->kids[i];
-          if(kidnbr != NULL) {
-            if(kidnbr != kid) {
-              /* Chase thru list of nbrs to get matrix associated with this 
-                 kidnbr.  Note, this is because the kid list and nbr matrix
-                 list are in different orders, could be fixed. */
-              for(j = kid->numnbrs-1; j >= 0; j--) {
-                if(kidnbr == kid->nbrs[j]) {
-                  nbrmat = kid->directmats[j+1];
-                  nbrsize = kidnbr->directnumeles[0];
-                  for(k = kidsize - 1; k >= 0; k--) {
-                    for(l = nbrsize - 1; l >= 0; l--) {
-                      mat[row + k][col + l] = nbrmat[k][l];
-                    }
-                  }
-                  break;
-                }
-              }
-            }
-            col += kidnbr->directnumeles[0];
-          }
-        }
-        assert(col == size);
-        row += kidsize;
-      }
-    }    
-    assert(row == size);
+    double **mat = sys->heap.mat(size, size);
+    calcp_rows += near_field_matrix(sys, kids, offset, mat, buf, rows);
 
-    nc->precond = ludecomp(sys, mat, size, FALSE);
+    nc->precond = ludecomp(sys, mat, size, FALSE, &nc->prepivots);
     nc->presize = size;
   }
+
+  if(calcp_rows > 0) {
+    sys->info("\nbdmulMatPrecond: built %d dummy rows with calcp()\n", calcp_rows);
+  }
 }
-      
 
-/* This near picks up only the hamming distance one cubes. */    
-#define HNEAR(nbr, nj, nk, nl) \
-((ABS((nbr)->j - (nj)) + ABS((nbr)->k - (nk)) + ABS((nbr)->l - (nl))) <= 1)
+/*
+  runs f(c, near, offset, n, mat, x, pivots) for every cube c of the direct
+  list, in parallel over the cubes: near/offset/n are the near cubes J from
+  near_cubes(), mat holds Pn(J, J) from near_field_matrix(), x is zeroed
+  n x nsize scratch space, nsize being the number of panels of c, and
+  pivots has room for n pivots
+  - the cubes are done serially when sys->dpcomp or sys->dpddif is set,
+    so the dumps come out in order
+  - the dummy rows built with calcp() are counted on the threads and
+    reported once when all are done
+*/
+template <class F>
+static void for_near_fields(ssystem *sys, F f)
+{
+  std::vector<cube *> cubes;
+  long long work = 0;
 
-/* This near picks up all 27 neighboring cubes. */
-#define NEAR(nbr, nj, nk, nl) \
-((ABS((nbr)->j - (nj)) <= 1) && \
- (ABS((nbr)->k - (nk)) <= 1) && \
- (ABS((nbr)->l - (nl)) <= 1))
+  for(cube *nc = sys->directlist; nc != NULL; nc = nc->dnext) {
+    long long n = nc->directnumeles[0], size = n;
+    for(int i = 0; i < nc->numnbrs; i++) {
+      if(NEAR(nc->nbrs[i], nc->j, nc->k, nc->l)) size += nc->nbrs[i]->directnumeles[0];
+    }
+    work += size * size * (size / 3 + n);
+    cubes.push_back(nc);
+  }
+  if(cubes.empty()) return;
 
-/* This near picks only the diagonal, for testing. */
-#define DNEAR(nbr, nj, nk, nl) \
-(((nbr)->j == (nj)) && \
- ((nbr)->k == (nk)) && \
- ((nbr)->l == (nl)) )
-        
+  if (sys->dpcomp || sys->dpddif) {
+    work = 0;
+  }
+
+  std::atomic<int> calcp_rows(0);
+
+  parallel_rows(0, int(cubes.size()), work / (long long) cubes.size(),
+                [sys, &cubes, &f, &calcp_rows] (int from, int to) {
+
+    std::vector<cube *> near;
+    std::vector<int> offset, pivots;
+    std::vector<double> a, x;
+    std::vector<double *> arows, xrows;
+    std::vector<double> exp_buf;        /* expanded compressed direct matrix */
+    std::vector<double *> exp_rows;
+
+    for(int ci = from; ci < to; ci++) {
+
+      cube *c = cubes[ci];
+      int nsize = c->directnumeles[0];
+      int n = near_cubes(c, near, offset);
+
+      a.assign(size_t(n) * n, 0.0);
+      arows.resize(n);
+      for(int r = 0; r < n; r++) arows[r] = a.data() + size_t(r) * n;
+      x.assign(size_t(n) * nsize, 0.0);
+      xrows.resize(n);
+      for(int r = 0; r < n; r++) xrows[r] = x.data() + size_t(r) * nsize;
+      pivots.resize(MAX(n, 1));
+
+      calcp_rows += near_field_matrix(sys, near, offset, arows.data(), exp_buf, exp_rows);
+
+      if (sys->dpcomp) {
+        sys->msg("Near-field matrix\n");
+        dumpMat(sys, arows.data(), n, n);
+      }
+
+      f(c, near, offset, n, arows.data(), xrows.data(), pivots.data());
+
+    }
+
+  });
+
+  if(calcp_rows > 0) {
+    sys->info("\nnear-field setup: built %d dummy rows with calcp()\n", int(calcp_rows));
+  }
+}
+
+/*
+  OlmulMatPrecond creates the overlapped preconditioner: for each cube c
+  the rows of c of the inverse of the near-field matrix Pn(J, J), J being
+  c and its near neighbors. The rows are found from the LU factors of
+  Pn(J, J)^T with the rows of the identity for c's panels as right hand
+  sides, so the inverse is never formed. The cubes are set up in parallel.
+*/
 void olmulMatPrecond(ssystem *sys)
 {
-  cube *nc, *nnbr, *nnnbr;
-  double **mat, **nmat;
-  int i, j, k, l, m;
-  int maxsize, nsize, nnsize, nnnsize;
-  int nj, nk, nl, offset, noffset;
-  int *nc_dummy, *nnbr_dummy, *nnnbr_dummy;
-  static Heap local_heap;
-  static int *is_dummy;         /* local dummy flag vector, stays around */
-  static int big_mat_size = 0;  /* size of previous mat */
-  charge **nnnbr_pc, **nnbr_pc, **nc_pc;
-
-/* Figure out the max number of elements in any set of near cubes. */
-  for(maxsize=0, nc=sys->directlist; nc != NULL; nc = nc->dnext) {
-    nsize = nc->directnumeles[0];
-    nj = nc->j;
-    nk = nc->k;
-    nl = nc->l;
-    for(i=0; i < nc->numnbrs; i++) {
-      nnbr = nc->nbrs[i];
-      if(NEAR(nnbr, nj, nk, nl)) nsize += nnbr->directnumeles[0];
-    }
-    maxsize = MAX(nsize, maxsize);
-  }
-
-  /* Allocate a matrix big enough for any set of 7. */
-  if (sys->jacdbg) {
-    sys->msg("max direct size =%d\n", maxsize);
-  }
-  mat = sys->heap.alloc<double*>(maxsize, AMSC);
-  for(i=0; i < maxsize; i++) {
-    mat[i] = sys->heap.alloc<double>(maxsize, AMSC);
-  }
-
-  /* Now go fill-in a matrix. */
-  for(maxsize=0, nc=sys->directlist; nc != NULL; nc = nc->dnext) {
-    nsize = nc->directnumeles[0];
-    nc_dummy = nc->nbr_is_dummy[0];
-    nc_pc = nc->chgs;
-    if (sys->chkdum) {
-      chkDummyList(sys, nc_pc, nc_dummy, nsize);
-    }
-    nj = nc->j;
-    nk = nc->k;
-    nl = nc->l;
-    for(i = nsize - 1; i >= 0; i--) {
-      if(nc_dummy[i]) continue; /* dummy rows copied only in divided diff */
-      if(nc_pc[i]->surf->type != DIELEC) {
-        for(j = nsize - 1; j >= 0; j--) {
-          mat[i][j] = nc->directmats[0][i][j];
-        }
-      }
-      else {
-        if (sys->dpcomp) {
-          sys->msg("Source mat, nc to nc\n");
-          dumpMat(sys, nc->directmats[0], nsize, nsize);
-        }
-        find_flux_density_row(sys, mat, nc->directmats[0], i, nsize, nsize, 0, 0,
-                              nc_pc, nc_pc, nc_dummy, nc_dummy);
-      } 
-    }
-    offset = nsize;
-    for(k=0; k < nc->numnbrs; k++) { /* loop on neighbors of nc */
-      nnbr = nc->nbrs[k];
-      if(NEAR(nnbr, nj, nk, nl)) {
-        nnsize = nc->directnumeles[k+1];
-        nmat = nc->directmats[k+1];
-        assert(nc->directnumeles[k+1] == nnbr->directnumeles[0]);
-        nnbr_dummy = nnbr->nbr_is_dummy[0];
-        nnbr_pc = nnbr->chgs;
-        if (sys->chkdum) {
-          chkDummyList(sys, nnbr_pc, nnbr_dummy, nnsize);
-        }
-        for(i = nsize - 1; i >= 0; i--) {
-          if(nc_dummy[i]) continue;
-          if(nc_pc[i]->surf->type != DIELEC) {
-            for(j = nnsize - 1; j >= 0; j--) {
-              mat[i][offset + j] = nmat[i][j];
-            }
-          }
-          else {
-            if (sys->dpcomp) {
-              sys->msg("Source mat, nnbr to nc\n");
-              dumpMat(sys, nmat, nsize, nnsize);
-            }
-            find_flux_density_row(sys, mat, nmat, i, nnsize, nsize, 0, offset,
-                                  nc_pc, nnbr_pc, nc_dummy, nnbr_dummy);
-          }
-        }
-        /* Get the row of the big matrix associated with this nnbr. */
-        for(noffset = 0, l = -1; l < nc->numnbrs; l++) { /* lp on nc's nbrs */
-          if(l < 0) nnnbr = nc;
-          else nnnbr = nc->nbrs[l];
-          if(NEAR(nnnbr, nj, nk, nl)) {  /* Note, near to nc!! */
-            if(nnbr == nnnbr) m = -1;
-            else { /* Find this nnnbr's position in nnbr's list */
-              for(m=0; m < nnbr->numnbrs; m++) {
-                if(nnbr->nbrs[m] == nnnbr) break;
-              }
-              assert(m < nnbr->numnbrs);
-            }
-            nnnsize = nnbr->directnumeles[m+1];
-            nmat = nnbr->directmats[m+1];
-            assert(nnbr->directnumeles[m+1] == nnnbr->directnumeles[0]);
-            nnnbr_pc = nnnbr->chgs; /* panels in nnnbr */
-            nnnbr_dummy = nnnbr->nbr_is_dummy[0];
-            if (sys->chkdum) {
-              chkDummyList(sys, nnnbr_pc, nnnbr_dummy, nnnsize);
-            }
-            for(i = nnsize - 1; i >= 0; i--) { /* loop on panels in nnbr */
-              if(nnbr_dummy[i]) continue;
-              if(nnbr_pc[i]->surf->type != DIELEC) {
-                for(j = nnnsize - 1; j >= 0; j--) {
-                  mat[offset + i][noffset+j] = nmat[i][j];
-                }
-              }
-              else {
-                if (sys->dpcomp) {
-                  sys->msg("Source mat, nnnbr to nnbr\n");
-                  dumpMat(sys, nmat, nnsize, nnnsize);
-                }
-                find_flux_density_row(sys, mat, nmat, i, nnnsize, nnsize, offset,
-                                      noffset, nnbr_pc, nnnbr_pc, nnbr_dummy,
-                                      nnnbr_dummy);
-              }
-            }
-            noffset += nnnsize;
-          }
-        }
-        offset += nnsize;
-      }
+  cube *nc;
+
+  if (sys->chkdum) {
+    for(nc = sys->directlist; nc != NULL; nc = nc->dnext) {
+      chkDummyList(sys, nc->chgs, nc->nbr_is_dummy[0], nc->directnumeles[0]);
     }
+  }
+
+  for_near_fields(sys, [] (cube *c, const std::vector<cube *> &near, const std::vector<int> &offset,
+                           int n, double **mat, double **x, int *pivots) {
 
-    /* set up the local is_dummy vector for the rows/cols of mat */
-    /* THIS COULD BE AVOIDED BY USING CUBE is_dummy's INSIDE invert() */
-    if(big_mat_size < offset) { /* allocate only if larger array needed */
-      is_dummy = local_heap.alloc<int>(offset, AMSC);
+    int nsize = c->directnumeles[0];
+
+    /* transpose in place */
+    for(int r = 0; r < n; r++) {
+      for(int k = r + 1; k < n; k++) std::swap(mat[r][k], mat[k][r]);
     }
-    /* dump sections of the dummy vector in order cubes appear in nbr lst */
-    /* (use fragment of Jacob's loop above) */
-    nnnsize = noffset = nc->directnumeles[0];
-    nc_dummy = nc->nbr_is_dummy[0];
-    for(i = nnnsize - 1; i >= 0; i--) {
-      is_dummy[i] = nc_dummy[i];
+
+    for(int r = 0; r < nsize; r++) {
+      if(!c->nbr_is_dummy[0][r]) x[r][r] = 1.0;
     }
-    for(l = 0; l < nc->numnbrs; l++) {
-      nnnbr = nc->nbrs[l];
-      if(NEAR(nnnbr, nj, nk, nl)) {
-        nnnsize = nnnbr->directnumeles[0];
-        nc_dummy = nnnbr->nbr_is_dummy[0];
-        for(i = nnnsize - 1; i >= 0; i--) {
-          is_dummy[i + noffset] = nc_dummy[i];
-        }
-        noffset += nnnsize;
+
+    /* a singular near field leaves c without preconditioner */
+    if(!lu_factor(mat, n, pivots, FALSE)) return;
+    lu_solve(mat, x, n, nsize, pivots, FALSE);
+
+    /* x[k][r] is entry (r, k) of c's rows of the inverse */
+    for(size_t e = 0; e < near.size(); e++) {
+      double **pmat = c->precondmats[direct_slot(c, near[e])];
+      int esize = near[e]->directnumeles[0];
+      for(int r = 0; r < nsize; r++) {
+        for(int k = 0; k < esize; k++) pmat[r][k] = x[offset[e] + k][r];
       }
     }
 
-    /* The big Matrix is filled in, invert it and get the preconditioner. */
-    if (sys->dpcomp) {
-      sys->msg("Before compression\n");
-      dumpMat(sys, mat, offset, offset);
-    }
-    nnnsize = compressMat(sys, mat, offset, is_dummy, BOTH);
-    if (sys->dpcomp) {
-      sys->msg("After compression\n");
-      dumpMat(sys, mat, nnnsize, nnnsize);
-    }
-    invert(mat, nnnsize, NULL);
-    expandMat(mat, offset, nnnsize, is_dummy, BOTH);
-    if (sys->dpcomp) {
-      sys->msg("After expansion\n");
-      dumpMat(sys, mat, offset, offset);
+  });
+
+  for(nc = sys->directlist; nc != NULL; nc = nc->dnext) {
+    for(int k = 0; k < nc->numnbrs; k++) {
+      if(!NEAR(nc->nbrs[k], nc->j, nc->k, nc->l)) nc->precondmats[k+1] = NULL;
     }
+  }
+}
 
-    /* Copy out the preconditioner to the saved matrices. */
-    for(i = nsize - 1; i >= 0; i--) {
-      for(j = nsize - 1; j >= 0; j--) {
-        nc->precondmats[0][i][j] = mat[i][j];
-      }
+/*
+  SpaimulMatPrecond creates a sparse approximate inverse M of P with the
+  pattern of the overlapped preconditioner: M(i, j) is nonzero only if
+  the cubes of panels i and j are near (NEAR()). mulPrecond() applies it
+  just like the OL preconditioner. The block column M(J, c) of cube c
+  minimizes the Frobenius norm of the residual
+
+    Pn(J, J) M(J, c) - I(J, c)
+
+  with J the cubes near to c and Pn the near-field part of P held in the
+  direct matrices. Taking the residual rows from J only makes the system
+  square: M(J, c) are c's columns of the inverse of Pn(J, J) - the OL
+  preconditioner takes c's rows instead.
+  (Adding the rows of the outer neighbors to the residual as in a full
+  SPAI makes the iterations converge slower for the smooth kernel.)
+*/
+void spaimulMatPrecond(ssystem *sys)
+{
+  for_near_fields(sys, [] (cube *c, const std::vector<cube *> &near, const std::vector<int> &offset,
+                           int n, double **mat, double **x, int *pivots) {
+
+    int nsize = c->directnumeles[0];
+
+    for(int r = 0; r < nsize; r++) {
+      if(!c->nbr_is_dummy[0][r]) x[r][r] = 1.0;
     }
-    offset = nsize;
-    for(k=0; k < nc->numnbrs; k++) {
-      nnbr = nc->nbrs[k];
-      if(NEAR(nnbr, nj, nk, nl)) {
-        nnsize = nc->directnumeles[k+1];
-        nmat = nc->precondmats[k+1];
-        for(i = nsize - 1; i >= 0; i--) {
-          for(j = nnsize - 1; j >= 0; j--) {
-            nmat[i][j] = mat[i][offset + j];
-          }
-        }
-        offset += nnsize;
+
+    if(!lu_factor(mat, n, pivots, FALSE)) return;
+    lu_solve(mat, x, n, nsize, pivots, FALSE);
+
+    /* scatter the column block into the precondmats of the near cubes */
+    for(size_t e = 0; e < near.size(); e++) {
+      double **pmat = near[e]->precondmats[direct_slot(near[e], c)];
+      int esize = near[e]->directnumeles[0];
+      for(int k = 0; k < esize; k++) {
+        for(int r = 0; r < nsize; r++) pmat[k][r] = x[offset[e] + k][r];
       }
-      else nc->precondmats[k+1] = NULL;
     }
-  }
+
+  });
 }
 
 /*
   finds a row of flux density coeffs from three potential coeff rows
   - to_mat[eval_row][] is the destination row; from_mat[eval_row][]
     initially contains the potential coefficients for evals at the 
-    center of eval_panels[eval_row] (unless NUMDPT == 2, is garbage then)
+    center of eval_panels[eval_row] (unless sys->numdpt == 2, is garbage then)
   - the eval panels are scaned until eval_panels[eval_row]'s
     dummies are found and the corresponding two rows are identified
   - the divided differences built with entries in the same columns in
@@ -438,23 +530,43 @@ void olmulMatPrecond(ssystem *sys)
     to_mat[eval_row][j] = a1*from_mat[eval_row][j]
               + a2*from_mat[pos_dum_row][j] + a3*from_mat[neg_dum_row][j]
   - if a dummy panel is not found in the panel list, its row is generated
-    using explicit calcp() calls (shouldn't happen much)
-  - global flags used here
-    NUMDPT = number of divided diff points, 2 or 3
+    using explicit calcp() calls (shouldn't happen much) - the number of
+    rows built this way is returned, so the caller can report them (this
+    runs on worker threads, see for_near_fields())
+  - flags used here
+    sys->numdpt = number of divided diff points, 2 or 3 (0: from_mat[eval_row][]
+      holds the normal derivatives, see calcpn())
     SKIPDQ = ON=>don't do cancellation-prone add-subtract of identical
       influence of DIELEC/BOTH panels' charges on dummy panel pot. evals
 */
-void find_flux_density_row(ssystem *sys, double **to_mat, double **from_mat, int eval_row, int n_chg, int n_eval, int row_offset,
+int find_flux_density_row(ssystem *sys, double **to_mat, double **from_mat, int eval_row, int n_chg, int n_eval, int row_offset,
                       int col_offset, charge **eval_panels, charge **chg_panels, int *eval_is_dummy, 
                       int *chg_is_dummy)
 {
-  int dindex, j;
+  int dindex, j, calcp_rows = 0;
   double factor;
   charge *dp;
   Surface *surf = eval_panels[eval_row]->surf;
 
+  /* analytic normal derivatives (no dummies): scale the row and set the
+     entry of the panel itself, as compute_electric_fields() does */
+  if (sys->numdpt == 0) {
+    for(j = n_chg - 1; j >= 0; j--) {
+      if(chg_panels[j] == eval_panels[eval_row]) {
+        to_mat[row_offset + eval_row][col_offset + j]
+            = -(2*M_PI*(surf->inner_perm + surf->outer_perm)
+                /eval_panels[eval_row]->area);
+      }
+      else {
+        to_mat[row_offset + eval_row][col_offset + j]
+            = (surf->outer_perm - surf->inner_perm)*from_mat[eval_row][j];
+      }
+    }
+    return 0;
+  }
+
   /* do divided difference w/ three rows to get dielectric row */
-  if (NUMDPT == 3) {
+  if (sys->numdpt == 3) {
     /* - dielectric panel row first */
     factor = -(surf->outer_perm + surf->inner_perm)/
         (eval_panels[eval_row]->pos_dummy->area);
@@ -482,7 +594,7 @@ void find_flux_density_row(ssystem *sys, double **to_mat, double **from_mat, int
     }
   }
   if(dindex != -1) { /* dummy row found */
-    if (NUMDPT == 3) {
+    if (sys->numdpt == 3) {
       factor = surf->outer_perm/eval_panels[dindex]->area;
     } else {
       /* this is the only factor required for two dummy rows in two point case */
@@ -501,7 +613,7 @@ void find_flux_density_row(ssystem *sys, double **to_mat, double **from_mat, int
         }
       }
       if(!chg_is_dummy[j]) {
-        if (NUMDPT == 3) {
+        if (sys->numdpt == 3) {
           to_mat[row_offset + eval_row][col_offset + j]
               += from_mat[dindex][j]*factor;
         } else {                      /* make sure to overwrite possible garbage */
@@ -515,7 +627,7 @@ void find_flux_density_row(ssystem *sys, double **to_mat, double **from_mat, int
     }
   }
   else {                /* dummy row out of cube => build it w/calcp */
-    if (NUMDPT == 3) {
+    if (sys->numdpt == 3) {
       factor = surf->outer_perm/dp->area;
     } else {
       /* this is the only factor required for two dummy rows in two point case */
@@ -525,9 +637,8 @@ void find_flux_density_row(ssystem *sys, double **to_mat, double **from_mat, int
     }
     if (sys->dpddif) {
       sys->msg("\nPos dummy calcp row, factor = %g\n", factor);
-    } else {
-      sys->info("\nolmulMatPrecond: building pos. dummy row\n");
     }
+    calcp_rows++;
     for(j = n_chg - 1; j >= 0; j--) {
       if (SKIPQD == ON) {
         if(chg_panels[j]->index == eval_panels[eval_row]->index) {
@@ -536,7 +647,7 @@ void find_flux_density_row(ssystem *sys, double **to_mat, double **from_mat, int
         }
       }
       if(!chg_is_dummy[j]) {
-        if (NUMDPT == 3) {
+        if (sys->numdpt == 3) {
           to_mat[row_offset + eval_row][col_offset + j]
               += calcp(sys, chg_panels[j], dp->x, dp->y, dp->z, NULL)*factor;
         } else {
@@ -568,7 +679,7 @@ void find_flux_density_row(ssystem *sys, double **to_mat, double **from_mat, int
     }
   }
   if(dindex != -1) { /* dummy row found */
-    if (NUMDPT == 3) {
+    if (sys->numdpt == 3) {
       factor = surf->inner_perm/eval_panels[dindex]->area;
     }
     if (sys->dpddif) {
@@ -590,9 +701,8 @@ void find_flux_density_row(ssystem *sys, double **to_mat, double **from_mat, int
     factor = surf->inner_perm/dp->area;
     if (sys->dpddif) {
       sys->msg("\nNeg dummy calcp row, factor = %g\n", factor);
-    } else {
-      sys->info("olmulMatPrecond: building neg. dummy row\n");
     }
+    calcp_rows++;
     for(j = n_chg - 1; j >= 0; j--) {
       if (SKIPQD == ON) {
         if(chg_panels[j]->index == eval_panels[eval_row]->index) continue;
@@ -613,7 +723,7 @@ void find_flux_density_row(ssystem *sys, double **to_mat, double **from_mat, int
       }
     }
   }
-  if (NUMDPT == 2) {
+  if (sys->numdpt == 2) {
     /* - do row entry due to panel contribution
        - entry only necessary if eval panel is in chg panel list */
     /*   search for the eval panel in the charge panel list */
@@ -645,6 +755,8 @@ void find_flux_density_row(ssystem *sys, double **to_mat, double **from_mat, int
     }
     sys->msg("\n\n");
   }
+
+  return calcp_rows;
 }
 
 
@@ -670,8 +782,7 @@ void mulMatUp(ssystem *sys)
 
   /* Handle the lowest level cubes first (set up Q2M's). */
   for(nextc=sys->multilist[sys->depth]; nextc != NULL; nextc = nextc->mnext) {
-    nextc->multisize = numterms;
-    nextc->multi = sys->heap.alloc<double>(numterms, AMSC);
+    nextc->multisize = numterms;  /* multi is a slice of multiblock */
     nextc->upmats = sys->heap.alloc<double **>(1, AMSC);
     nextc->upmats[0] = mulQ2Multi(sys,
                                   nextc->chgs, nextc->nbr_is_dummy[0],
@@ -737,10 +848,7 @@ void mulMatUp(ssystem *sys)
       }
 
       /* Save space for upvector sizes, upvect ptrs, and upmats. */
-      nextc->multisize = numterms;
-      if(numterms > 0) {
-        nextc->multi = sys->heap.alloc<double>(numterms, AMSC);
-      }
+      nextc->multisize = numterms;  /* multi is a slice of multiblock */
       if(nextc->upnumvects) {
         nextc->upnumeles = sys->heap.alloc<int>(nextc->upnumvects, AMSC);
         nextc->upvects = sys->heap.alloc<double*>(nextc->upnumvects, AMSC);
@@ -849,9 +957,9 @@ void mulMatEval(ssystem *sys)
     /* allocate space for evaluation pass vectors; check nc's ancestors */
     /* First count the number of transformations to do. */
     for(na = nc, ttlvects = 0; na->level > 1; na = na->parent) { 
-      if(na->loc_exact == FALSE && DNTYPE != NOLOCL) {
+      if(na->loc_exact == FALSE && sys->dntype != NOLOCL) {
         ttlvects++;  /* allow for na to na local expansion (L2P) */
-        if(DNTYPE == GRENGD) break; /* Only one local expansion if shifting. */
+        if(sys->dntype == GRENGD) break; /* Only one local expansion if shifting. */
       }
       else {
         ttlvects += na->interSize; /* room for Q2P and M2P xformations */
@@ -871,7 +979,7 @@ void mulMatEval(ssystem *sys)
     
     /* set up exp/charge vectors and L2P, Q2P and/or M2P matrices as req'd */
     for(j=0, na = nc, ttlvects = 0; na->level > 1; na = na->parent) { 
-      if(na->loc_exact == FALSE && DNTYPE != NOLOCL) {  
+      if(na->loc_exact == FALSE && sys->dntype != NOLOCL) {  
         /* build matrices for local expansion evaluation */
         nc->evalmats[j] = mulLocal2P(sys, na->x, na->y, na->z, nc->chgs,
                                      nc->upnumeles[0], sys->order);
@@ -888,7 +996,7 @@ void mulMatEval(ssystem *sys)
           disExtrasimpcube(sys, na);
         }
 
-        if(DNTYPE == GRENGD) break; /* Only one local expansion if shifting. */
+        if(sys->dntype == GRENGD) break; /* Only one local expansion if shifting. */
       }
       else { /* build matrices for ancestor's (or cube's if 1st time) ilist */
         for(i=0; i < na->interSize; i++) {
@@ -952,19 +1060,20 @@ void mulMatDown(ssystem *sys)
   cube *nc, *parent, *ni;
   int depth;
 
-  assert(DNTYPE != NOLOCL);     /* use mulMatEval() alone if NOLOCL */
+  assert(sys->dntype != NOLOCL);     /* use mulMatEval() alone if NOLOCL */
 
   for(depth = 2; depth <= sys->depth; depth++) { /* no locals before level 2 */
     for(nc=sys->locallist[depth]; nc != NULL; nc = nc->lnext) {
 
       /* Allocate for interaction list, include one for parent if needed */
-      if((depth <= 2) || (DNTYPE == NOSHFT)) vects = nc->interSize;
+      if((depth <= 2) || (sys->dntype == NOSHFT)) vects = nc->interSize;
       else vects = nc->interSize + 1;
       nc->downnumvects = vects;
       if(vects > 0) {
         nc->downvects = sys->heap.alloc<double*>(vects, AMSC);
         nc->downnumeles = sys->heap.alloc<int>(vects, AMSC);
         nc->downmats = sys->heap.alloc<double**>(vects, AMSC);
+        nc->downxyz = sys->heap.alloc<double*>(vects, AMSC);
       }
 
       parent = nc->parent;
@@ -974,7 +1083,7 @@ void mulMatDown(ssystem *sys)
         sys->mm.localcnt[nc->level]++;
       }
 
-      if((depth <= 2) || (DNTYPE == NOSHFT)) i = 0; /* No parent local. */
+      if((depth <= 2) || (sys->dntype == NOSHFT)) i = 0; /* No parent local. */
       else { /* Create the mapping matrix for the parent to kid. */
         i = 1;
 
@@ -1003,8 +1112,16 @@ void mulMatDown(ssystem *sys)
         }
         else {
           nc->downvects[i] = ni->multi;
-          nc->downmats[i] = mulMulti2Local(sys, ni->x, ni->y, ni->z, nc->x,
-                                           nc->y, nc->z, sys->order);
+          if(sys->mm.rot) {     /* M2L by rotation: keep the translation only */
+            nc->downxyz[i] = sys->heap.alloc<double>(3, AM2L);
+            nc->downxyz[i][0] = nc->x - ni->x;
+            nc->downxyz[i][1] = nc->y - ni->y;
+            nc->downxyz[i][2] = nc->z - ni->z;
+          }
+          else {
+            nc->downmats[i] = mulMulti2Local(sys, ni->x, ni->y, ni->z, nc->x,
+                                             nc->y, nc->z, sys->order);
+          }
           nc->downnumeles[i] = ni->multisize;
           if (sys->dmtcnt) {
             sys->mm.M2Lcnt[ni->level][nc->level]++;
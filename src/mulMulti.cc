@@ -4,36 +4,13 @@
 #include "mulLocal.h"
 #include "mulDisplay.h"
 #include "mulStruct.h"
+#include "expansion.h"
+#include "calcp.h"
+#include "rotation.h"
 #include <cmath>
 
 void evalFactFac(double **array, int order);
 
-/*
-   Used various places.  Returns number of coefficients in the multipole 
-   expansion. 
-*/
-int multerms(int order)
-{
-  return(costerms(order) + sinterms(order));
-}
-
-/*
-  returns number of cos(m*phi)-weighted terms in the real (not cmpx) multi exp
-*/
-int costerms(int order)
-{
-  return(((order + 1) * (order + 2)) / 2);
-}
-
-/*
-  returns number of sin(m*phi)-weighted terms in the real (not cmpx) multi exp
-*/
-int sinterms(int order)
-{
-  return((((order + 1) * (order + 2)) / 2) - (order+1));
-}
-
-
 /*
   takes two sets of cartesian absolute coordinates; finds rel. spherical coor.
 */
@@ -90,6 +67,21 @@ double fact(ssystem *sys, int x)
   }
 }
 
+/*
+  returns the table of x! for x = 0..MAXFACT (see expansion.h)
+*/
+const double *factorials()
+{
+  static struct factorial_table {
+    double f[MAXFACT+1];
+    factorial_table() {
+      f[0] = 1.0;
+      for(int x = 1; x <= MAXFACT; x++) f[x] = f[x-1] * x;
+    }
+  } table;
+  return table.f;
+}
+
 /*
   produces factorial factor array for mulMulti2P
 */
@@ -118,15 +110,11 @@ void mulMultiAlloc(ssystem *sys, int maxchgs, int order, int depth)
   int x;
 
   if(maxchgs > 0) {
-    sys->mm.Rho = sys->heap.alloc<double>(maxchgs, AMSC); /* rho array */
-    sys->mm.Rhon = sys->heap.alloc<double>(maxchgs, AMSC); /* rho^n array */
-    sys->mm.Beta = sys->heap.alloc<double>(maxchgs, AMSC); /* beta array */
-    sys->mm.Betam = sys->heap.alloc<double>(maxchgs, AMSC); /* beta*m array */
-    sys->mm.Irn = sys->heap.alloc<double>(maxchgs, AMSC); /* (1/r)^n+1 vector */
-    sys->mm.Ir = sys->heap.alloc<double>(maxchgs, AMSC); /* 1/r vector */
-    sys->mm.Mphi = sys->heap.alloc<double>(maxchgs, AMSC); /* m*phi vector */
-    sys->mm.phi = sys->heap.alloc<double>(maxchgs, AMSC); /* phi vector */
+    /* per-charge scratch rows for the Q2M, Q2L, M2P and L2P builds */
+    sys->mm.batch = sys->heap.mat(NBATCH, maxchgs, AMSC);
   }
+  sys->mm.nscratch = sys->heap.alloc<double>(normal_scratch(order), AMSC);
+                /* normal derivative rows of M2P and L2P (see is_flux_row()) */
   sys->mm.tleg = sys->heap.alloc<double>(costerms(2*order), AMSC);
                 /* temp legendre storage (2*order needed for local exp) */
   sys->mm.factFac = sys->heap.mat(order+1, order+1, AMSC);
@@ -170,6 +158,12 @@ void mulMultiAlloc(ssystem *sys, int maxchgs, int order, int depth)
   sys->mm.sinmkB = sys->heap.alloc<double>(2*order+1, AMSC);
   sys->mm.cosmkB = sys->heap.alloc<double>(2*order+1, AMSC);
   sys->mm.cosmkB[0] = 1.0;              /* look up arrays used for local exp */
+  sys->mm.rot = 0;
+  if(sys->dntype != NOLOCL && m2l_rotated(sys->m2ltyp, order)) {
+    /* rotation and z translation coefficients for M2L by rotation */
+    sys->mm.rot = sys->heap.create<m2l_rotation>(AM2L);
+    sys->mm.rot->init(order);
+  }
   /* generate array of sqrt((n+m)!(n-m)!)'s for L2L
   evalSqrtFac(sqrtFac, factFac, order); */
 }
@@ -181,343 +175,224 @@ void mulMultiAlloc(ssystem *sys, int maxchgs, int order, int depth)
 */
 void evalLegendre(double cosA, double *vector, int order)
 {
-  int x;
-  int m;                        /* as in Pn^m, both <= order */
-  double sinMA;                 /* becomes sin^m(alpha) in higher order P's */
-  double fact;                  /* factorial factor */
+  legendre(cosA, vector, any_order(order));
+}
 
-  sinMA = -sqrt(1-cosA*cosA);
+namespace {
 
-  /* do evaluations of first four functions separately w/o recursions */
-  vector[CINDEX(0, 0)] = 1.0;   /* P0^0 */
-  if(order > 0) {
-    vector[CINDEX(1, 0)] = cosA;        /* P1^0 */
-    vector[CINDEX(1, 1)] = sinMA;       /* P1^1 = -sin(alpha) */
-  }
-  if(order > 1) vector[CINDEX(2, 1)] = 3*sinMA*cosA; /* P2^1 = -3sin()cos() */
-
-  /* generate remaining evaluations by recursion on lower triangular array */
-  fact = 1.0;
-  for(m = 0; m < order+1; m++) {
-    if(m != 0 && m != 1) {      /* set up first two evaluations in row */
-      fact *= (2*m - 1); /* (2(m-1)-1)!! -> (2m-1)!! */
-      /* use recursion on m */
-      if(vector[CINDEX(1, 1)] == 0.0) {
-        vector[CINDEX(m, m)] = 0.0;
-        if(m != order) vector[CINDEX(m+1, m)] = 0.0;    /* if not last row */
-      }
-      else {
-        cosA = vector[CINDEX(1,0)]/vector[CINDEX(1,1)]; /* cosA= -cot(theta) */
-        sinMA *= vector[CINDEX(1,1)]; /*(-sin(alpha))^(m-1)->(-sin(alpha))^m*/
-        vector[CINDEX(m, m)] = fact * sinMA;
-        if(m != order) {                /* do if not on last row */
-          vector[CINDEX(m+1, m)] = vector[CINDEX(1, 0)]*(2*m+1)
-              *vector[CINDEX(m, m)];
-        }
-      }
-    }
-    for(x = 2; x < order-m+1; x++) { /* generate row of evals recursively */
-      vector[CINDEX(x+m, m)] = 
-          ((2*(x+m)-1)*vector[CINDEX(1, 0)]*vector[CINDEX(x+m-1, m)]
-           - (x + 2*m - 1)*vector[CINDEX(x+m-2, m)])/x;
-    }
-  }
-}
-    
-  
-/* 
-  Returns a matrix which gives a cube's multipole expansion when *'d by chg vec
-  OPTIMIZATIONS USING is_dummy HAVE NOT BEEN COMPLETELY IMPLEMENTED
+/*
+  builds the Q2M matrix for a given order type (see mulQ2Multi())
 */
-double **mulQ2Multi(ssystem *sys, charge **chgs, int *is_dummy, int numchgs, double x, double y, double z, int order)
+struct q2m_kernel
 {
-  double **mat;
-  double cosA;                  /* cosine of elevation coordinate */
-  int i, j, k, kold, n, m;
-  int cterms = costerms(order), terms = multerms(order);
-
-  /* Allocate the matrix. */
-  mat = sys->heap.alloc<double*>(terms, AQ2M);
-  for(i=0; i < terms; i++) 
-    mat[i] = sys->heap.alloc<double>(numchgs, AQ2M);
-
-  /* get Legendre function evaluations, one set for each charge */
-  /*  also get charge coordinates, set up for subsequent evals */
-  for(j = 0; j < numchgs; j++) { /* for each charge */
-
-    /* get cosA for eval; save rho, beta in rho^n and cos/sin(m*beta) arrays */
-    xyz2sphere(chgs[j]->x, chgs[j]->y, chgs[j]->z,
-               x, y, z, &(sys->mm.Rho[j]), &cosA, &(sys->mm.Beta[j]));
-    sys->mm.Rhon[j] = sys->mm.Rho[j]; /* init powers of rho_i's */
-    sys->mm.Betam[j] = sys->mm.Beta[j];         /* init multiples of beta */
-    evalLegendre(cosA, sys->mm.tleg, order);    /* write moments to temporary array */
-
-    /* write a column of the matrix with each set of legendre evaluations */
-    for(i = 0; i < cterms; i++) mat[i][j] = sys->mm.tleg[i]; /* copy for cos terms */
-  }
-
-  if (sys->dalq2m) {
-    sys->msg(
-            "\nQ2M MATRIX BUILD:\n    AFTER LEGENDRE FUNCTION EVALUATON\n");
-    dumpMat(sys, mat, terms, numchgs);
-  }
-
-  /* some of this can be avoided using is_dummy to skip unused columns */
-  /* add the rho^n factors to the cos matrix entries. */
-  for(i = 1, k = kold = 2; i < cterms; i++) { /* loop on rows of matrix */
-    for(j = 0; j < numchgs; j++) mat[i][j] *= sys->mm.Rhon[j]; /* mul in factor */
-    k -= 1;
-    if(k == 0) {                /* so that effective n varys appropriately */
-      kold = k = kold + 1;
-      for(j = 0; j < numchgs; j++) sys->mm.Rhon[j] *= sys->mm.Rho[j];   /* r^n-1 -> r^n */
+  template <class O>
+  static double **run(O order, ssystem *sys, charge **chgs, int *is_dummy, int numchgs, double x, double y, double z)
+  {
+    double **mat;
+    const int terms = multerms(order());
+    double *coef = sys->mm.tleg;
+
+    mat = sys->heap.mat(terms, numchgs, AQ2M);
+
+    /* Mn^m = (2 for m > 0) rho^n Pn^m(cosA) (cos, sin)(m*beta) */
+    for(int n = 0; n <= order(); n++) {
+      for(int m = 0; m <= n; m++) coef[CINDEX(n, m)] = (m == 0 ? 1.0 : 2.0);
     }
-  }
-
-  if (sys->dalq2m) {
-    sys->msg("    AFTER ADDITION OF RHO^N FACTORS\n");
-    dumpMat(sys, mat, terms, numchgs);
-  }
+    harmonics<O, false, false>(order, chgs, numchgs, x, y, z, coef, sys->mm.batch, mat);
 
-  /* copy result to lower (sine) part of matrix */
-  for(n = 1; n <= order; n++) { /* loop on rows of matrix */
-    for(m = 1; m <= n; m++) {
-      for(j = 0; j < numchgs; j++) { /* copy a row */
-        mat[SINDEX(n, m, cterms)][j] = mat[CINDEX(n, m)][j];
-      }
+    if (sys->dalq2m) {
+      sys->msg("\nQ2M MATRIX BUILD:\n    AFTER SINGLE PASS EVALUATION\n");
+      dumpMat(sys, mat, terms, numchgs);
     }
-  }
 
-  if (sys->dalq2m) {
-    sys->msg("    AFTER COPYING SINE (LOWER) HALF\n");
-    dumpMat(sys, mat, terms, numchgs);
-  }
-
-  /* add factors of cos(m*beta) and sin(m*beta) to matrix entries */
-  for(m = 1; m <= order; m++) { /* lp on m in Mn^m (no m=0 since cos(0)=1) */
-    for(n = m; n <= order; n++) { /* loop over rows with same m */
-      for(j = 0; j < numchgs; j++) { /* add factors to a row */
-        mat[CINDEX(n, m)][j] *= (2.0*cos(sys->mm.Betam[j]));   /* note factors of 2 */
-        mat[SINDEX(n, m, cterms)][j] *= (2.0*sin(sys->mm.Betam[j]));
+    /* THIS IS NOT VERY GOOD: zero out columns corresponding to dummy panels */
+    for(int j = 0; j < numchgs; j++) {
+      if(is_dummy[j]) {
+        for(int i = 0; i < terms; i++) {
+          mat[i][j] = 0.0;
+        }
       }
     }
-    for(j = 0; j < numchgs; j++) sys->mm.Betam[j] += sys->mm.Beta[j]; /* (m-1)*beta->m*beta */
-  }
 
-  /* THIS IS NOT VERY GOOD: zero out columns corresponding to dummy panels */
-  for(j = 0; j < numchgs; j++) {
-    if(is_dummy[j]) {
-      for(i = 0; i < terms; i++) {
-        mat[i][j] = 0.0;
-      }
+    if (sys->disq2m) {
+      dispQ2M(sys, mat, chgs, numchgs, x, y, z, order());
     }
-  }
 
-  if (sys->disq2m) {
-    dispQ2M(sys, mat, chgs, numchgs, x, y, z, order);
+    return(mat);
   }
+};
 
-  return(mat);
-}
-
-double **mulMulti2Multi(ssystem *sys, double x, double y, double z, double xp, double yp, double zp, int order)
-/* double x, y, z, xp, yp, zp: cube center, parent cube center */
+/*
+  builds the M2M matrix for a given order type (see mulMulti2Multi())
+*/
+struct m2m_kernel
 {
-  double **mat, rho, rhoPwr, cosA, beta, mBeta, temp1, temp2; 
-  int r, j, k, m, n, c;
-  int cterms = costerms(order), sterms = sinterms(order);
-  int terms = cterms + sterms;
-
-  /* Allocate the matrix (terms x terms ) */
-  mat = sys->heap.alloc<double*>(terms, AM2M);
-  for(r=0; r < terms; r++)
-    mat[r] = sys->heap.alloc<double>(terms, AM2M);
-  for(r = 0; r < terms; r++)
-      for(c = 0; c < terms; c++) mat[r][c] = 0.0;
-
-  /* get relative distance in spherical coordinates */
-  xyz2sphere(x, y, z, xp, yp, zp, &rho, &cosA, &beta);
-
-  /* get the requisite Legendre function evaluations */
-  evalLegendre(cosA, sys->mm.tleg, order);
-
-  /* for each new moment (Nj^k) stuff the appropriate matrix entries */
-  /* done completely brute force, one term at a time; uses exp in nb 12, p29 */
-  for(j = 0; j <= order; j++) {
-    for(k = 0; k <= j; k++) {
-      for(n = 0, rhoPwr = 1.0; n <= j; n++, rhoPwr *= rho) {
-        for(m = 0, mBeta = 0.0; m <= n; m++, mBeta += beta) {
-
-          if(k == 0) {          /* figure terms for Nj^0, ie k = 0 */
-            if(m <= j-n) {      /* if O moments are nonzero */
-              temp1 = fact(sys, j)*rhoPwr*iPwr(sys, 2*m)*sys->mm.tleg[CINDEX(n, m)];
-              temp1 /= (fact(sys, j-n+m)*fact(sys, n+m));
-              mat[CINDEX(j, k)][CINDEX(j-n, m)] += temp1*cos(mBeta);
-              if(m != 0) {              /* if sin term is non-zero */
-                mat[CINDEX(j, k)][SINDEX(j-n, m, cterms)] += temp1*sin(mBeta);
+  template <class O>
+  static double **run(O order, ssystem *sys, double x, double y, double z, double xp, double yp, double zp)
+  {
+    double **mat, rho, rhoPwr, cosA, beta, mBeta, temp1, temp2;
+    const int cterms = costerms(order()), terms = multerms(order());
+    const double *f = factorials();
+    double *tleg = sys->mm.tleg, *cosmB = sys->mm.cosmkB, *sinmB = sys->mm.sinmkB;
+
+    /* Allocate the matrix (terms x terms ) */
+    mat = sys->heap.mat(terms, terms, AM2M);
+
+    /* get relative distance in spherical coordinates */
+    xyz2sphere(x, y, z, xp, yp, zp, &rho, &cosA, &beta);
+
+    /* get the requisite Legendre function evaluations */
+    legendre(cosA, tleg, order);
+
+    /* cos(m*beta) and sin(m*beta) */
+    mBeta = 0.0;
+    for(int m = 0; m <= order(); m++, mBeta += beta) {
+      cosmB[m] = cos(mBeta);
+      sinmB[m] = sin(mBeta);
+    }
+
+    /* for each new moment (Nj^k) stuff the appropriate matrix entries */
+    /* done completely brute force, one term at a time; uses exp in nb 12, p29 */
+    for(int j = 0; j <= order(); j++) {
+      for(int k = 0; k <= j; k++) {
+        double *crow = mat[CINDEX(j, k)];
+        double *srow = mat[SINDEX(j, k, cterms)];
+        rhoPwr = 1.0;
+        for(int n = 0; n <= j; n++, rhoPwr *= rho) {
+          for(int m = 0; m <= n; m++) {
+
+            if(k == 0) {        /* figure terms for Nj^0, ie k = 0 */
+              if(m <= j-n) {    /* if O moments are nonzero */
+                temp1 = f[j]*rhoPwr*ipower(2*m)*tleg[CINDEX(n, m)];
+                temp1 /= (f[j-n+m]*f[n+m]);
+                crow[CINDEX(j-n, m)] += temp1*cosmB[m];
+                if(m != 0) {            /* if sin term is non-zero */
+                  crow[SINDEX(j-n, m, cterms)] += temp1*sinmB[m];
+                }
               }
             }
-          }
-          else {                /* figure terms for Nj^k, k != 0 */
-            temp1 = fact(sys, j+k)*rhoPwr*sys->mm.tleg[CINDEX(n, m)]/fact(sys, n+m);
-            temp2 = temp1*iPwr(sys, 2*m)/fact(sys, j-n+k+m);
-            temp1 = temp1*iPwr(sys, k-m-abs(k-m))/fact(sys, j-n+abs(k-m));
-
-            /* write the cos(kPhi) coeff, bar(N)j^k */
-            if(m != 0) {
-              if(k-m < 0 && abs(k-m) <= j-n) {  /* use conjugates here */
-                mat[CINDEX(j, k)][CINDEX(j-n, m-k)] += temp1*cos(mBeta);
-                mat[CINDEX(j, k)][SINDEX(j-n, m-k,cterms)] += temp1*sin(mBeta);
-              }
-              else if(k-m == 0) {       /* double to compensate for 2Re sub. */
-                mat[CINDEX(j, k)][CINDEX(j-n, k-m)] += 2*temp1*cos(mBeta);
-                /* sin term is always zero */
-              }
-              else if(k-m > 0 && k-m <= j-n) {
-                mat[CINDEX(j, k)][CINDEX(j-n, k-m)] += temp1*cos(mBeta);
-                mat[CINDEX(j, k)][SINDEX(j-n, k-m,cterms)] -= temp1*sin(mBeta);
-              }
-              if(k+m <= j-n) {
-                mat[CINDEX(j, k)][CINDEX(j-n, k+m)] += temp2*cos(mBeta);
-                mat[CINDEX(j, k)][SINDEX(j-n, k+m,cterms)] += temp2*sin(mBeta);
-              }
-            }                   /* do if m = 0 and O moments not zero */
-            else if(k <= j-n) mat[CINDEX(j, k)][CINDEX(j-n, k)] += temp2;
-
-            /* write the sin(kPhi) coeff, dblbar(N)j^k, if it is non-zero */
-            if(m != 0) {
-              if(k-m < 0 && abs(k-m) <= j-n) {  /* use conjugates here */
-                mat[SINDEX(j, k,cterms)][CINDEX(j-n, m-k)] += temp1*sin(mBeta);
-                mat[SINDEX(j, k, cterms)][SINDEX(j-n, m-k, cterms)] 
-                    -= temp1*cos(mBeta);
-              }
-              else if(k-m == 0) {/* double to compensate for 2Re sub */
-                mat[SINDEX(j, k, cterms)][CINDEX(j-n, k-m)] 
-                    += 2*temp1*sin(mBeta);
-                /* sine term is always zero */
-              }
-              else if(k-m > 0 && k-m <= j-n) {
-                mat[SINDEX(j, k,cterms)][CINDEX(j-n, k-m)] += temp1*sin(mBeta);
-                mat[SINDEX(j, k, cterms)][SINDEX(j-n, k-m, cterms)] 
-                    += temp1*cos(mBeta);
-              }
-              if(k+m <= j-n) {
-                mat[SINDEX(j, k,cterms)][CINDEX(j-n, k+m)] -= temp2*sin(mBeta);
-                mat[SINDEX(j, k, cterms)][SINDEX(j-n, k+m, cterms)] 
-                    += temp2*cos(mBeta);
-              }
-            }                   /* do if m = 0 and moments not zero */
-            else if(k <= j-n) mat[SINDEX(j, k,cterms)][SINDEX(j-n, k, cterms)] 
-                += temp2;
+            else {              /* figure terms for Nj^k, k != 0 */
+              temp1 = f[j+k]*rhoPwr*tleg[CINDEX(n, m)]/f[n+m];
+              temp2 = temp1*ipower(2*m)/f[j-n+k+m];
+              temp1 = temp1*ipower(k-m-abs(k-m))/f[j-n+abs(k-m)];
+
+              /* write the cos(kPhi) coeff, bar(N)j^k */
+              if(m != 0) {
+                if(k-m < 0 && abs(k-m) <= j-n) {        /* use conjugates here */
+                  crow[CINDEX(j-n, m-k)] += temp1*cosmB[m];
+                  crow[SINDEX(j-n, m-k,cterms)] += temp1*sinmB[m];
+                }
+                else if(k-m == 0) {     /* double to compensate for 2Re sub. */
+                  crow[CINDEX(j-n, k-m)] += 2*temp1*cosmB[m];
+                  /* sin term is always zero */
+                }
+                else if(k-m > 0 && k-m <= j-n) {
+                  crow[CINDEX(j-n, k-m)] += temp1*cosmB[m];
+                  crow[SINDEX(j-n, k-m,cterms)] -= temp1*sinmB[m];
+                }
+                if(k+m <= j-n) {
+                  crow[CINDEX(j-n, k+m)] += temp2*cosmB[m];
+                  crow[SINDEX(j-n, k+m,cterms)] += temp2*sinmB[m];
+                }
+              }                 /* do if m = 0 and O moments not zero */
+              else if(k <= j-n) crow[CINDEX(j-n, k)] += temp2;
+
+              /* write the sin(kPhi) coeff, dblbar(N)j^k, if it is non-zero */
+              if(m != 0) {
+                if(k-m < 0 && abs(k-m) <= j-n) {        /* use conjugates here */
+                  srow[CINDEX(j-n, m-k)] += temp1*sinmB[m];
+                  srow[SINDEX(j-n, m-k, cterms)] -= temp1*cosmB[m];
+                }
+                else if(k-m == 0) {/* double to compensate for 2Re sub */
+                  srow[CINDEX(j-n, k-m)] += 2*temp1*sinmB[m];
+                  /* sine term is always zero */
+                }
+                else if(k-m > 0 && k-m <= j-n) {
+                  srow[CINDEX(j-n, k-m)] += temp1*sinmB[m];
+                  srow[SINDEX(j-n, k-m, cterms)] += temp1*cosmB[m];
+                }
+                if(k+m <= j-n) {
+                  srow[CINDEX(j-n, k+m)] -= temp2*sinmB[m];
+                  srow[SINDEX(j-n, k+m, cterms)] += temp2*cosmB[m];
+                }
+              }                 /* do if m = 0 and moments not zero */
+              else if(k <= j-n) srow[SINDEX(j-n, k, cterms)] += temp2;
+            }
           }
         }
       }
     }
-  }
-  if (sys->dism2m) {
-    dispM2M(sys, mat, x, y, z, xp, yp, zp, order);
-  }
-  return(mat);
-}
-
-/* 
-  builds multipole evaluation matrix; used only for fake downward pass 
-*/
-double **mulMulti2P(ssystem *sys, double x, double y, double z, charge **chgs, int numchgs, int order)
-/* double x, y, z: multipole expansion origin */
-{
-  double **mat;
-  double cosTh;                 /* cosine of elevation coordinate */
-  int i, j, k, m, n, kold;
-  int cterms = costerms(order), sterms = sinterms(order);
-  int terms = cterms + sterms;
-
-  mat = sys->heap.mat(numchgs, terms, AM2P);
-
-  /* get Legendre function evaluations, one set for each charge */
-  /*   also get charge coordinates to set up rest of matrix */
-  for(i = 0; i < numchgs; i++) { /* for each charge, do a legendre eval set */
-    xyz2sphere(chgs[i]->x, chgs[i]->y, chgs[i]->z,
-               x, y, z, &(sys->mm.Ir[i]), &cosTh, &(sys->mm.phi[i]));
-
-    sys->mm.Irn[i] = sys->mm.Ir[i]; /* initialize (1/r)^n+1 vec. */
-    sys->mm.Mphi[i] = sys->mm.phi[i];           /* initialize m*phi vector */
-
-    evalLegendre(cosTh, mat[i], order); /* wr moms to 1st (cos) half of row */
-
-  }
 
-  if (sys->dalm2p) {
-    sys->msg(
-            "\nM2P MATRIX BUILD:\n    AFTER LEGENDRE FUNCTION EVALUATON\n");
-    dumpMat(sys, mat, numchgs, terms);
-  }
-
-  /* add the (1/r)^n+1 factors to the left (cos(m*phi)) half of the matrix */
-  for(j = 0, k = kold = 1; j < cterms; j++) { /* loop on columns of matrix */
-    for(i = 0; i < numchgs; i++) mat[i][j] /= sys->mm.Irn[i]; /* divide by r^n+1 */
-    k -= 1;
-    if(k == 0) {                /* so that n changes as appropriate */
-      kold = k = kold + 1;
-      for(i = 0; i < numchgs; i++) sys->mm.Irn[i] *= sys->mm.Ir[i]; /* r^n -> r^n+1 */
+    if (sys->dism2m) {
+      dispM2M(sys, mat, x, y, z, xp, yp, zp, order());
     }
+    return(mat);
   }
+};
 
-  if (sys->dalm2p) {
-    sys->msg(
-            "    AFTER ADDITION OF (1/R)^N+1 FACTORS\n");
-    dumpMat(sys, mat, numchgs, terms);
-  }
-
-  /* add the factorial fraction factors to the left (cos(m*phi)) part of mat */
-  /*  note that (n-m)!/(n+m)! = 1/(n-m+1)...(n+m) since m \leq n */
-  for(n = 1; n <= order; n++) {
-    for(m = 1; m <= n; m++) {
-      for(i = 0; i < numchgs; i++) mat[i][CINDEX(n, m)] /= sys->mm.factFac[n][m];
+/*
+  builds the M2P matrix for a given order type (see mulMulti2P())
+*/
+struct m2p_kernel
+{
+  template <class O>
+  static double **run(O order, ssystem *sys, double x, double y, double z, charge **chgs, int numchgs)
+  {
+    double **mat;
+    const int terms = multerms(order());
+    double *coef = sys->mm.tleg;
+
+    mat = sys->heap.mat(numchgs, terms, AM2P);
+
+    /* (n-m)!/(n+m)! Pn^m(cosTh)/r^n+1 (cos, sin)(m*phi) */
+    /*  note that (n-m)!/(n+m)! = 1/(n-m+1)...(n+m) since m \leq n */
+    for(int n = 0; n <= order(); n++) {
+      for(int m = 0; m <= n; m++) coef[CINDEX(n, m)] = 1.0/sys->mm.factFac[n][m];
     }
-  }
-
-  if (sys->dalm2p) {
-    sys->msg(
-            "    AFTER ADDITION OF FACTORIAL FRACTION FACTORS\n");
-    dumpMat(sys, mat, numchgs, terms);
-  }
+    harmonics<O, true, true>(order, chgs, numchgs, x, y, z, coef, sys->mm.batch, mat);
 
-  /* copy left half of matrix to right half for sin(m*phi) terms */
-  for(i = 0; i < numchgs; i++) { /* loop on rows of matrix */
-    for(n = 1; n <= order; n++) { 
-      for(m = 1; m <= n; m++) { /* copy a row */
-        mat[i][SINDEX(n, m, cterms)] = mat[i][CINDEX(n, m)];
+    /* flux density rows (--numdpt=0) get the normal derivative instead */
+    for(int j = 0; j < numchgs; j++) {
+      if(is_flux_row(sys, chgs[j])) {
+        normal_harmonics<O, true>(order, chgs[j], x, y, z, chgs[j]->Z, coef, sys->mm.nscratch, mat[j]);
       }
     }
-  }
 
-  if (sys->dalm2p) {
-    sys->msg(
-            "    AFTER COPYING SINE (RIGHT) HALF\n");
-    dumpMat(sys, mat, numchgs, terms);
-  }
+    if (sys->dalm2p) {
+      sys->msg("\nM2P MATRIX BUILD:\n    AFTER SINGLE PASS EVALUATION\n");
+      dumpMat(sys, mat, numchgs, terms);
+    }
 
-  /* add factors of cos(m*phi) and sin(m*phi) to left and right halves resp. */
-  for(m = 1; m <= order; m++) { /* lp on m in Mn^m (no m=0 since cos(0)=1) */
-    for(n = m; n <= order; n++) { /* loop over cols with same m */
-      for(i = 0; i < numchgs; i++) { /* add factors to a column */
-        mat[i][CINDEX(n, m)] *= cos(sys->mm.Mphi[i]);
-        mat[i][SINDEX(n, m, cterms)] *= sin(sys->mm.Mphi[i]);
-      }
+    if (sys->dism2p) {
+      dispM2P(sys, mat, x, y, z, chgs, numchgs, order());
     }
-    for(i = 0; i < numchgs; i++) sys->mm.Mphi[i] += sys->mm.phi[i]; /* (m-1)*phi->m*phi */
-  }
 
-  if (sys->dism2p) {
-    dispM2P(sys, mat, x, y, z, chgs, numchgs, order);
+    return(mat);
   }
+};
 
-  return(mat);
 }
 
+/* 
+  Returns a matrix which gives a cube's multipole expansion when *'d by chg vec
+  OPTIMIZATIONS USING is_dummy HAVE NOT BEEN COMPLETELY IMPLEMENTED
+*/
+double **mulQ2Multi(ssystem *sys, charge **chgs, int *is_dummy, int numchgs, double x, double y, double z, int order)
+{
+  return order_dispatch<q2m_kernel>::call(order, sys, chgs, is_dummy, numchgs, x, y, z);
+}
 
+double **mulMulti2Multi(ssystem *sys, double x, double y, double z, double xp, double yp, double zp, int order)
+/* double x, y, z, xp, yp, zp: cube center, parent cube center */
+{
+  return order_dispatch<m2m_kernel>::call(order, sys, x, y, z, xp, yp, zp);
+}
 
-
-
-
-
+/* 
+  builds multipole evaluation matrix; used only for fake downward pass 
+*/
+double **mulMulti2P(ssystem *sys, double x, double y, double z, charge **chgs, int numchgs, int order)
+/* double x, y, z: multipole expansion origin */
+{
+  return order_dispatch<m2p_kernel>::call(order, sys, x, y, z, chgs, numchgs);
+}
@@ -13,9 +13,30 @@ double **mulMulti2P(ssystem *sys, double x, double y, double z, charge **chgs, i
 double **mulQ2Multi(ssystem *sys, charge **chgs, int *is_dummy, int numchgs, double x, double y, double z, int order);
 double **mulMulti2Multi(ssystem *sys, double x, double y, double z, double xp, double yp, double zp, int order);
 
-int multerms(int order);
-int costerms(int order);
-int sinterms(int order);
+/*
+  returns number of cos(m*phi)-weighted terms in the real (not cmpx) multi exp
+*/
+constexpr int costerms(int order)
+{
+  return(((order + 1) * (order + 2)) / 2);
+}
+
+/*
+  returns number of sin(m*phi)-weighted terms in the real (not cmpx) multi exp
+*/
+constexpr int sinterms(int order)
+{
+  return((((order + 1) * (order + 2)) / 2) - (order+1));
+}
+
+/*
+   Used various places.  Returns number of coefficients in the multipole 
+   expansion. 
+*/
+constexpr int multerms(int order)
+{
+  return(costerms(order) + sinterms(order));
+}
 
 double iPwr(ssystem *sys, int e);
 double fact(ssystem *sys, int x);
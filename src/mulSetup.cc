@@ -9,11 +9,14 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cassert>
+#include <vector>
+#include <algorithm>
 
-cube *cstack[1024];             /* Stack used in several routines. */
+cube *cstack[4096];             /* Stack used in several routines. */
 
 static void getAllInter(ssystem *sys);
 static void set_vector_masks(ssystem *sys);
+static void set_panel_table(ssystem *sys, int size);
 static int placeq(int flag, ssystem *sys, charge *charges);
 static void setMaxq(ssystem *sys);
 static void indexkid(ssystem *sys, cube *dad, int *pqindex, int *pcindex);
@@ -42,21 +45,18 @@ void mulInit(ssystem *sys, charge *charges)
   indexkid(sys, sys->cubes[0][0][0][0], &qindex, &cindex); 
                                 /* Index chgs and cubes. */
 
-#if ADAPT == ON
-  setExact(sys, multerms(sys->order)); /* Note cubes to be done exactly and
-                                           determine the number of nonempty
-                                           kids for each cube. */
-#else
-  setExact(sys, 0);             /* Note cubes to be done exactly and
-                                           determine the number of nonempty
-                                           kids for each cube. */
-#endif
+  setExact(sys, sys->adapt ? multerms(sys->order) : 0);
+                                /* Note cubes to be done exactly and
+                                   determine the number of nonempty
+                                   kids for each cube. */
 
   getnbrs(sys);                 /* Get all the nearest neighbors. At bot level
                                    add as nearest nbrs cubes in exact block. */
   linkcubes(sys);               /* Make linked-lists of direct, multis, and
                                    locals to do at each level. */
   set_vector_masks(sys);        /* set up sys->is_dummy and sys->is_dielec */
+  set_panel_table(sys, qindex - 1);
+                                /* per-panel arrays by index (sys->ptab) */
   setMaxq(sys);                 /* Calculates the max # chgs in cubes treated
                                    exactly, and over lowest level cubes. */
   getAllInter(sys);             /* Get the interaction lists at all levels. */
@@ -597,12 +597,12 @@ being exact.
           
             /* Stack up the nearest nbrs plus nbrs in exact cube. */
             numnbrs = 0;
-            for(m = MIN((j-NNBRS), es * (j/es));
-                m < MAX((j+NNBRS+1), es * (1 + (j / es))); m++) {
-              for(n = MIN((k-NNBRS), es * (k/es));
-                  n < MAX((k+NNBRS+1), es * (1 + (k/es))); n++) {
-                for(p = MIN((l-NNBRS), es * (l/es));
-                    p < MAX((l+NNBRS+1), es * (1+(l/es))); p++) {
+            for(m = MIN((j-sys->nnbrs), es * (j/es));
+                m < MAX((j+sys->nnbrs+1), es * (1 + (j / es))); m++) {
+              for(n = MIN((k-sys->nnbrs), es * (k/es));
+                  n < MAX((k+sys->nnbrs+1), es * (1 + (k/es))); n++) {
+                for(p = MIN((l-sys->nnbrs), es * (l/es));
+                    p < MAX((l+sys->nnbrs+1), es * (1+(l/es))); p++) {
                   if( (m >= 0) && (n >= 0) && (p >= 0)
                      && (m < side) && (n < side) && (p < side)
                      && ((m != j) || (n != k) || (p != l))
@@ -637,6 +637,45 @@ static int cntDwnwdChg(cube *cp, int depth)
   return(cnt);
 }
 
+/*
+  Morton (z-order) key of the cube at j, k, l: the bits of the three
+  indices interleaved, so cubes close in space are close in the key
+*/
+static unsigned long long morton_key(int j, int k, int l)
+{
+  unsigned long long key = 0;
+  for(int b = 0; b < 21; b++) {
+    key |= (unsigned long long) ((j >> b) & 1) << (3 * b + 2);
+    key |= (unsigned long long) ((k >> b) & 1) << (3 * b + 1);
+    key |= (unsigned long long) ((l >> b) & 1) << (3 * b);
+  }
+  return key;
+}
+
+/*
+  links the cubes of one level into a list in Morton order and gives them
+  consecutive slices of one (cubes x numterms) block as expansion vectors
+  - pnext is the offset of the cube's next pointer (mnext or lnext),
+    pvec the one of its vector pointer (multi or local)
+*/
+static void link_level(ssystem *sys, std::vector<std::pair<unsigned long long, cube *> > &cl,
+                       cube **head, cube *cube::*pnext, double *cube::*pvec,
+                       int numterms, double **block, int *count)
+{
+  std::sort(cl.begin(), cl.end());
+
+  *count = int(cl.size());
+  *block = cl.empty() ? NULL : sys->heap.alloc<double>(cl.size() * numterms, AMSC);
+
+  for(size_t n = 0; n < cl.size(); n++) {
+    cube *nc = cl[n].second;
+    nc->*pvec = *block + n * numterms;
+    *head = nc;
+    head = &(nc->*pnext);
+  }
+  *head = NULL;
+}
+
 /* 
 Set up the links between cubes requiring multi work on each level, one
 for the cubes requiring local expansion work, one for the cubes requiring
@@ -645,18 +684,27 @@ Note, upnumvects and exact must be set!!!
 */
 static void linkcubes(ssystem *sys)
 {
-  cube *nc, **plnc, **pdnc, **pmnc, *****cubes = sys->cubes;
+  cube *nc, **pdnc, **ppnc, *****cubes = sys->cubes;
   int i, j, k, l;
   int dindex, side, depth=sys->depth, numterms=multerms(sys->order);
+  std::vector<std::pair<unsigned long long, cube *> > ml, ll;
 
   /* Allocate the vector of heads of cubelists. */
   sys->multilist = sys->heap.alloc<cube*>(sys->depth+1, AMSC);
   sys->locallist = sys->heap.alloc<cube*>(sys->depth+1, AMSC);
 
+  /* and the per level expansion storage */
+  sys->multiblock = sys->heap.alloc<double*>(sys->depth+1, AMSC);
+  sys->localblock = sys->heap.alloc<double*>(sys->depth+1, AMSC);
+  sys->multicount = sys->heap.alloc<int>(sys->depth+1, AMSC);
+  sys->localcount = sys->heap.alloc<int>(sys->depth+1, AMSC);
+
   pdnc = &(sys->directlist);
+  ppnc = &(sys->precondlist);
+  *ppnc = NULL;
   for(dindex = 1, i=0, side = 1; i <= sys->depth; i++, side *= 2) {
-    pmnc = &(sys->multilist[i]);
-    plnc = &(sys->locallist[i]);
+    ml.clear();
+    ll.clear();
     for(j=0; j < side; j++) {
       for(k=0; k < side; k++) {
         for(l=0; l < side; l++) {
@@ -665,9 +713,7 @@ static void linkcubes(ssystem *sys)
             /* Do the multi expansion if the cube is not treated exactly. */
             if(i > 1) {         /* no multis over the root cube and its kids */
               if(nc->mul_exact == FALSE) { /* exact -> mul_exact 1Apr91 */
-                nc->multi = sys->heap.alloc<double>(numterms, AMSC);
-                *pmnc = nc;
-                pmnc = &(nc->mnext);
+                ml.push_back(std::make_pair(morton_key(j, k, l), nc));
               }
             }
             
@@ -675,9 +721,7 @@ static void linkcubes(ssystem *sys)
              not exact and not the root (lev 0) nor one of its kids (lev 1). */
             if(i > 1) {         /* no locals with level 0 or 1 */
               if(nc->loc_exact == FALSE) { /* exact -> loc_exact 1Apr91 */
-                *plnc = nc;
-                plnc = &(nc->lnext);
-                nc->local = sys->heap.alloc<double>(numterms, AMSC);
+                ll.push_back(std::make_pair(morton_key(j, k, l), nc));
               }
             }
 
@@ -687,10 +731,24 @@ static void linkcubes(ssystem *sys)
               pdnc = &(nc->dnext);
               nc->dindex = dindex++;
             }
+
+            /* Add to block diagonal preconditioner list if the parent of
+               bot level cubes (see bdmulMatPrecond()). */
+            if(i == depth - 1) {
+              *ppnc = nc;
+              ppnc = &(nc->pnext);
+            }
           }
         }
       }
     }
+
+    /* the expansion lists of a level are in Morton order, with the 
+       vectors contiguous (see mulPassTables()) */
+    link_level(sys, ml, &(sys->multilist[i]), &cube::mnext, &cube::multi,
+               numterms, &(sys->multiblock[i]), &(sys->multicount[i]));
+    link_level(sys, ll, &(sys->locallist[i]), &cube::lnext, &cube::local,
+               numterms, &(sys->localblock[i]), &(sys->localcount[i]));
   }
 }
 
@@ -911,7 +969,51 @@ static void set_vector_masks(ssystem *sys)
 
 }
 
+/*
+  fills sys->ptab from the charges of the lowest level cubes, which hold
+  the panels in index order - the dummy panels get their own entries and
+  are linked to their panels by index
+*/
+static void set_panel_table(ssystem *sys, int size)
+{
+  panel_table &t = sys->ptab;
+  charge *pq;
+  cube *cp;
+  int i, k;
+
+  t.size = size;
+  t.panel = sys->heap.alloc<charge *>(size + 1, AMSC);
+  t.type = sys->heap.alloc<int>(size + 1, AMSC);
+  t.cond = sys->heap.alloc<int>(size + 1, AMSC);
+  t.area = sys->heap.alloc<double>(size + 1, AMSC);
+  t.outer_perm = sys->heap.alloc<double>(size + 1, AMSC);
+  t.inner_perm = sys->heap.alloc<double>(size + 1, AMSC);
+  t.pos_dummy = sys->heap.alloc<int>(size + 1, AMSC);
+  t.neg_dummy = sys->heap.alloc<int>(size + 1, AMSC);
+
+  t.num_dielec = 0;
+  for(cp = sys->directlist; cp != NULL; cp = cp->dnext) {
+    for(i = 0; i < cp->upnumeles[0]; i++) {
+      pq = cp->chgs[i];
+      k = pq->index;
+      t.panel[k] = pq;
+      t.cond[k] = pq->cond;
+      t.area[k] = pq->area;
+      if(pq->dummy) {
+        t.type[k] = -1;
+        continue;
+      }
+      t.type[k] = pq->surf->type;
+      t.outer_perm[k] = pq->surf->outer_perm;
+      t.inner_perm[k] = pq->surf->inner_perm;
+      if(pq->pos_dummy) t.pos_dummy[k] = pq->pos_dummy->index;
+      if(pq->neg_dummy) t.neg_dummy[k] = pq->neg_dummy->index;
+      if(pq->surf->type == DIELEC) t.num_dielec++;
+    }
+  }
 
-
-
-
+  t.dielec = sys->heap.alloc<int>(MAX(t.num_dielec, 1), AMSC);
+  for(i = 0, k = 1; k <= size; k++) {
+    if(t.type[k] == DIELEC) t.dielec[i++] = k;
+  }
+}
@@ -6,6 +6,7 @@
 #include <cstdarg>
 #include <cstring>
 #include <stdexcept>
+#include <algorithm>
 
 // -----------------------------------------------------------------------
 
@@ -14,7 +15,7 @@ Name::Name()
 { }
 
 void
-Name::add_alias(const ssystem *sys, const char *alias)
+Name::add_alias(ssystem *sys, const char *alias)
 {
   Name **al = &alias_list;
   while (*al) {
@@ -23,6 +24,8 @@ Name::add_alias(const ssystem *sys, const char *alias)
 
   *al = sys->heap.alloc<Name>(1, AMSC);
   (*al)->name = sys->heap.strdup(alias);
+
+  sys->index_conductor_alias(this, alias);
 }
 
 const char *
@@ -104,7 +107,21 @@ ssystem::ssystem() :
   line_file(0),
   dirsol(false),
   expgcr(false),
+  autotune(0.0),
+  estimate(false),
+  mem_limit(0.0),
+  hsolve(false),
+  q2pcomp(false),
+  twolevel(false),
+  precond(PRECOND),
+  itrtyp(ITRTYP),
+  dntype(DNTYPE),
+  nnbrs(NNBRS),
+  numdpt(NUMDPT),
+  adapt(ADAPT == ON),
+  m2ltyp(M2LTYP),
   timdat(false),
+  trace_file(0),
   mksdat(true),
   dumpps(DUMPPS_OFF),
   capvew(true),
@@ -170,11 +187,16 @@ ssystem::ssystem() :
   cubes(0),
   multilist(0),
   locallist(0),
+  multiblock(0),
+  localblock(0),
+  multicount(0),
+  localcount(0),
   directlist(0),
   precondlist(0),
   revprecondlist(0),
   is_dummy(0),
-  is_dielec(0)
+  is_dielec(0),
+  cond_prefix_valid(false)
 {
   /* initialize defaults, etc */
   axes = heap.alloc<double **>(10);
@@ -331,26 +353,37 @@ ssystem::ssystem() :
  *
  *  Any unique leading part of the name%group_name string may be specified
  *
- *  The return value
+ *  The names (last aliases) are looked up in a sorted index, so the
+ *  candidates for a prefix are a contiguous range.
  */
 int
-ssystem::get_unique_cond_num(const char *name, size_t nlen) const
+ssystem::get_unique_cond_num(const char *name, size_t nlen)
 {
-  int cond = NOTFND;
-
-  //  fish through name list for name - check first nlen chars for match
-  int i = 1;
-  for (const Name *cur_name = this->cond_names; cur_name; cur_name = cur_name->next, ++i) {
-    const char *cur_alias = cur_name->last_alias();
-    if (!strncmp(cur_alias, name, nlen)) {
-      if (cond != NOTFND) {
-        return NOTUNI;
-      }
-      cond = i;
+  if (! cond_prefix_valid) {
+    cond_prefix_index.clear();
+    cond_prefix_index.reserve(cond_list.size());
+    for (size_t i = 0; i < cond_list.size(); ++i) {
+      cond_prefix_index.push_back(std::make_pair(std::string(cond_list[i]->last_alias()), int(i + 1)));
     }
+    std::sort(cond_prefix_index.begin(), cond_prefix_index.end());
+    cond_prefix_valid = true;
+  }
+
+  std::string prefix(name, nlen);
+  auto i = std::lower_bound(cond_prefix_index.begin(), cond_prefix_index.end(), std::make_pair(prefix, 0));
+
+  //  no name starts with the prefix
+  if (i == cond_prefix_index.end() || i->first.compare(0, nlen, prefix) != 0) {
+    return NOTFND;
+  }
+
+  //  more than one does
+  auto j = i + 1;
+  if (j != cond_prefix_index.end() && j->first.compare(0, nlen, prefix) == 0) {
+    return NOTUNI;
   }
 
-  return cond;
+  return i->second;
 }
 
 /**
@@ -368,7 +401,7 @@ ssystem::get_unique_cond_num(const char *name, size_t nlen) const
  *  list entries.
  */
 std::set<int>
-ssystem::get_conductor_number_set(const char *names) const
+ssystem::get_conductor_number_set(const char *names)
 {
   std::set<int> result;
 
@@ -420,15 +453,10 @@ ssystem::get_conductor_number_set(const char *names) const
 int
 ssystem::get_conductor_number(const char *name)
 {
-  int i = 1;
-  Name *prev_name = 0;
-
   //  check to see if name is present
-  for (Name *cur_name = cond_names; cur_name; cur_name = cur_name->next, ++i) {
-    if (cur_name->match(name)) {
-      return i;   //  return conductor number
-    }
-    prev_name = cur_name;
+  auto n = cond_index.find(name);
+  if (n != cond_index.end()) {
+    return n->second;   //  return conductor number
   }
 
   //  create a new item
@@ -437,12 +465,15 @@ ssystem::get_conductor_number(const char *name)
   new_name->next = 0;
 
   //  add the new name to the list
-  if (!prev_name) {
+  if (cond_list.empty()) {
     cond_names = new_name;
   } else {
-    prev_name->next = new_name;
+    cond_list.back()->next = new_name;
   }
 
+  int i = int(cond_list.size()) + 1;
+  index_conductor(new_name, i);
+
   num_cond = i;
   return i;
 }
@@ -450,11 +481,10 @@ ssystem::get_conductor_number(const char *name)
 bool ssystem::rename_conductor(const char *old_name, const char *new_name)
 {
   //  check to see if name is present
-  for (Name *cur_name = cond_names; cur_name; cur_name = cur_name->next) {
-    if (cur_name->match(old_name)) {
-      cur_name->add_alias(this, new_name);
-      return true;
-    }
+  auto n = cond_index.find(old_name);
+  if (n != cond_index.end()) {
+    cond_list[n->second - 1]->add_alias(this, new_name);
+    return true;
   }
 
   warn("rename_conductor: Unknown conductor '%s'\n", old_name);
@@ -463,35 +493,26 @@ bool ssystem::rename_conductor(const char *old_name, const char *new_name)
 
 int ssystem::number_of(const Name *nn) const
 {
-  int i = 1;
-  for (const Name *n = cond_names; n; n = n->next, ++i) {
-    if (n == nn) {
-      return i;
-    }
-  }
-  return NOTFND;
+  auto n = cond_numbers.find(nn);
+  return n != cond_numbers.end() ? n->second : NOTFND;
 }
 
 Name *ssystem::conductor_name(int i)
 {
-  Name *n;
-  for (n = cond_names; i > 1 && n; n = n->next, --i)
-    ;
-  if (!n) {
+  if (i < 1 || i > int(cond_list.size())) {
     warn("conductor_name: Conductor no. %d not defined\n", i);
+    return 0;
   }
-  return n;
+  return cond_list[i - 1];
 }
 
 const Name *ssystem::conductor_name(int i) const
 {
-  const Name *n;
-  for (n = cond_names; i > 1 && n; n = n->next, --i)
-    ;
-  if (!n) {
+  if (i < 1 || i > int(cond_list.size())) {
     warn("conductor_name: Conductor no. %d not defined\n", i);
+    return 0;
   }
-  return n;
+  return cond_list[i - 1];
 }
 
 const char *ssystem::conductor_name_str(int i) const
@@ -501,13 +522,74 @@ const char *ssystem::conductor_name_str(int i) const
 }
 
 /**
- *  @brief Will force a re-read on the next build_charge_list call
+ *  @brief Enters a conductor's name and aliases into the name index
  */
-void ssystem::reset_read()
+void ssystem::index_conductor(Name *cond, int i)
+{
+  cond_list.push_back(cond);
+  cond_numbers[cond] = i;
+  index_conductor_alias(cond, cond->name);
+  for (const Name *a = cond->alias_list; a; a = a->next) {
+    index_conductor_alias(cond, a->name);
+  }
+}
+
+/**
+ *  @brief Registers a new alias of a conductor (called by Name::add_alias)
+ *
+ *  Names which are not conductors of this system are ignored. As with a
+ *  walk through the list, a name shared by several conductors gives the
+ *  lowest number.
+ */
+void ssystem::index_conductor_alias(const Name *cond, const char *alias)
+{
+  auto n = cond_numbers.find(cond);
+  if (n == cond_numbers.end()) {
+    return;
+  }
+
+  auto r = cond_index.insert(std::make_pair(std::string(alias), n->second));
+  if (! r.second && n->second < r.first->second) {
+    r.first->second = n->second;
+  }
+
+  cond_prefix_valid = false;
+}
+
+/**
+ *  @brief Rebuilds the name index after cond_names has been edited directly
+ */
+void ssystem::update_conductor_index()
+{
+  cond_list.clear();
+  cond_numbers.clear();
+  cond_index.clear();
+  cond_prefix_valid = false;
+
+  int i = 1;
+  for (Name *n = cond_names; n; n = n->next, ++i) {
+    index_conductor(n, i);
+  }
+}
+
+/**
+ *  @brief Forgets all conductors
+ */
+void ssystem::clear_conductors()
 {
   num_cond = 0;
   cond_names = NULL;
+  update_conductor_index();
+}
+
+/**
+ *  @brief Will force a re-read on the next build_charge_list call
+ */
+void ssystem::reset_read()
+{
+  clear_conductors();
   panels = NULL;
+  setup.valid = false;
 }
 
 void ssystem::flush()
@@ -559,15 +641,52 @@ void ssystem::error(const char *fmt, ...) const
 
 // ---------------------------------------------------------------------------------
 
+solve_setup::solve_setup()
+  : valid(false), panels(0), order(0), req_depth(0), depth(0),
+    dirsol(false), expgcr(false), hsolve(false), q2pcomp(false),
+    precond(NONE), dntype(0), nnbrs(0), numdpt(0), adapt(false), m2ltyp(0), autotune(0.0), iter_tol(0.0),
+    blkmat(0), hmat(0), coarse(0), real_index(0),
+    up_size(0), eval_size(0),
+    inittime(0.0), dirtime(0.0), multime(0.0),
+    mark_panels(0)
+{
+}
+
+bool solve_setup::matches(const ssystem *sys, const charge *chglist) const
+{
+  //  sys->depth is either still the requested depth or has been replaced
+  //  by the one computed in the previous setup
+  return valid && panels == chglist && order == sys->order
+         && (sys->depth == req_depth || sys->depth == depth)
+         && dirsol == sys->dirsol && expgcr == sys->expgcr && hsolve == sys->hsolve
+         && q2pcomp == sys->q2pcomp && precond == sys->precond
+         && dntype == sys->dntype && nnbrs == sys->nnbrs && numdpt == sys->numdpt
+         && adapt == sys->adapt && m2ltyp == sys->m2ltyp
+         && autotune == sys->autotune
+         && (! (hsolve || q2pcomp) || iter_tol == sys->iter_tol);
+}
+
+// -----------------------------------------------------------------------
+
+panel_table::panel_table()
+  : size(0), panel(0), type(0), cond(0), area(0), outer_perm(0), inner_perm(0),
+    pos_dummy(0), neg_dummy(0), num_dielec(0), dielec(0)
+{
+  //  .. nothing yet ..
+}
+
+pass_table::pass_table()
+  : num_ops(0), ops(0)
+{
+}
+
 multi_mats::multi_mats()
   : localcnt(0), multicnt(0), evalcnt(0),
     Q2Mcnt(0), Q2Lcnt(0), Q2Pcnt(0), L2Lcnt(0),
     M2Mcnt(0), M2Lcnt(0), M2Pcnt(0), L2Pcnt(0), Q2PDcnt(0),
-    Irn(0), Mphi(0),
-    Ir(0), phi(0),
-    Rho(0), Rhon(0),
-    Beta(0), Betam(0),
+    batch(0), nscratch(0),
     tleg(0), factFac(0),
-    sinmkB(0), cosmkB(0), facFrA(0)
+    sinmkB(0), cosmkB(0), facFrA(0),
+    rot(0)
 {
 }
@@ -6,12 +6,20 @@
 #include "heap.h"
 #include "vector.h"
 #include "matrix.h"
+#include "trace.h"
 
 #include <cstdio>
 #include <set>
+#include <string>
+#include <vector>
+#include <unordered_map>
 
 struct SurfaceData;
 struct ssystem;
+class blk_matrix;
+class h_matrix;
+class coarse_space;
+class m2l_rotation;
 
 /* used to build linked list of conductor names */
 struct Name {
@@ -19,7 +27,7 @@ struct Name {
   char *name;
   Name *next;
   Name *alias_list;
-  void add_alias(const ssystem *sys, const char *alias);
+  void add_alias(ssystem *sys, const char *alias);
   const char *last_alias() const;
   bool match(const char *n) const;
 };
@@ -113,6 +121,8 @@ struct cube {
   double *local;        /* Vector of local field coefs */
   double ***downmats;   /* Matrices for multi to chg, or multi to local
                            or local to local.  Downnumele x localsize. */
+  double **downxyz;     /* downmats[i] == NULL => M2L by rotation, local
+                           center rel. to the multi center (else NULL) */
 
   struct cube **interList;      /* explicit interaction list 
                                    - for fake dwnwd passes and eval pass */
@@ -139,9 +149,14 @@ struct cube {
                                    directnumeles[0] = numchgs in cube. */
   double **directq;             /* Vecs of chg vecs, directq[0] this cube's. */
   double ***directmats;         /* Potential Coeffs in cube and neighbors. */
+  int *directrank;              /* rank of a compressed nbr block, -1 if dense */
+  double ***directu, ***directv; /* compressed nbr blocks are directu directv^T
+                                   (directmats entry is NULL then) */
   double ***precondmats;        /* Precond Coeffs in cube and neighbors. */
   double **directlu;            /* Decomposed cube potential Coefficients. */
+  int *directpiv;               /* Row interchanges of directlu. */
   double **precond;             /* Preconditioner. */
+  int *prepivots;               /* Row interchanges of precond. */
   double *prevectq;             /* The charge vector for the preconditioner. */
   double *prevectp;             /* The potential vector for preconditioner. */
   int presize;                  /* Size of the preconditioner. */
@@ -164,14 +179,96 @@ struct multi_mats
   int **Q2Mcnt, **Q2Lcnt, **Q2Pcnt, **L2Lcnt; //  counts of xformation mats
   int **M2Mcnt, **M2Lcnt, **M2Pcnt, **L2Pcnt, **Q2PDcnt;
 
-  double *Irn, *Mphi;           //  (1/r)^n+1, m*phi vect's
-  double *Ir, *phi;             //  1/r and phi arrays, used to update above
-  double *Rho, *Rhon;           //  rho and rho^n array
-  double *Beta, *Betam;         //  beta and beta*m array
+  double **batch;               //  per-charge scratch rows (see harmonics())
+  double *nscratch;             //  scratch for normal_harmonics()
   double *tleg;                 //  Temporary Legendre storage.
   double **factFac;             //  factorial factor array: (n-m+1)...(n+m)
 
   double *sinmkB, *cosmkB, **facFrA;
+
+  m2l_rotation *rot;            //  rotation-based M2L (0 if dense M2L matrices are used)
+};
+
+//  the per-panel data used in the per-column and per-iteration loops, as
+//  contiguous arrays indexed by the panel index (1 .. size, the order of the
+//  charges in the lowest level cubes, see indexkid()) - set up by mulInit()
+//  so these loops are array scans instead of walks along the charge list
+//  - the panel geometry (centroid, axes, moments) used by calcp() in the
+//  matrix setup stays in the charge structs: a copy here did not make
+//  mulMatDirect() measurably faster (see BM_mulMatDirect in microbench)
+struct panel_table
+{
+  panel_table();
+
+  int size;                     //  number of panels incl. dummy panels
+  charge **panel;               //  the charge struct of each index
+  int *type;                    //  surface type (CONDTR, DIELEC or BOTH), -1 for dummies
+  int *cond;                    //  conductor number (0 for dielectric panels)
+  double *area;                 //  panel area (divided difference step for dummies)
+  double *outer_perm;           //  relative permittivity on the normal side
+  double *inner_perm;           //  relative permittivity on the other side
+  int *pos_dummy, *neg_dummy;   //  indices of the dummy panels (0 if none)
+  int num_dielec;               //  number of DIELEC panels
+  int *dielec;                  //  indices of the DIELEC panels, ascending
+};
+
+//  one matrix-vector product of an upward, downward or evaluation pass:
+//  dst += mat * src with mat being rows x cols - the passes walk arrays of
+//  these (see mulPassTables()) instead of the cube lists
+struct pass_op
+{
+  double *dst;                  //  multi, local or eval vector of the cube
+  double *src;                  //  kid's multi or charges, interaction vector
+                                //    (0 => zero the rows entries of dst)
+  double **mat;                 //  the matrix (0 => M2L by rotation)
+  const double *xyz;            //  translation of the rotation M2L (mat == 0)
+  const int *skip;              //  rows skipped for numdpt 2 (is_dielec) or 0
+  int rows, cols;
+};
+
+struct pass_table
+{
+  pass_table();
+
+  int num_ops;
+  pass_op *ops;                 //  in execution order (by level for up/down)
+};
+
+//  results of the solver setup in fastcap_solve() which are kept so that a
+//  following solve with the same panels, order and depth can skip the setup
+struct solve_setup
+{
+  solve_setup();
+
+  bool matches(const ssystem *sys, const charge *chglist) const;
+
+  bool valid;                   //  true => setup below is complete
+  const charge *panels;         //  panel list the setup was made for
+  int order;                    //  expansion order used
+  int req_depth;                //  depth requested (-1 for automatic)
+  int depth;                    //  depth actually used
+  bool dirsol, expgcr, hsolve;  //  solver kind used
+  bool q2pcomp;                 //  second-shell Q2P blocks compressed
+  int precond;                  //  preconditioner type set up
+  int dntype, nnbrs, numdpt;    //  multipole configuration used
+  bool adapt;
+  int m2ltyp;
+  double autotune;              //  autotune target error used (0 for none)
+  double iter_tol;              //  iteration tolerance used (sets the low-rank accuracy)
+
+  blk_matrix *blkmat;           //  out-of-core full matrix (DIRSOL/EXPGCR only)
+  h_matrix *hmat;               //  factored H-matrix (hsolve only)
+  coarse_space *coarse;         //  two-level preconditioner coarse space (built on first use)
+  int *real_index;
+  int up_size;                  //  number of real panels
+  int eval_size;                //  number of real and dummy panels
+
+  double inittime;              //  setup times, reported by fastcap_solve()
+  double dirtime;
+  double multime;
+
+  Heap::Mark heap_mark;         //  heap state before the setup was made
+  const charge *mark_panels;    //  panel list at the time of heap_mark
 };
 
 enum dumpps_mode {
@@ -242,9 +339,30 @@ struct ssystem
 
   bool dirsol;                  //  solve Pq=psi by Gaussian elim.
   bool expgcr;                  //  do explicit full P*q products
+  double autotune;              //  target error for picking order and depth
+                                //  automatically (0 for off, see autotune.h)
+  bool estimate;                //  stop after mulInit() and print the predicted
+                                //  memory and run time (see estimate.h)
+  double mem_limit;             //  memory budget in megabytes (0 for none) - near-field
+                                //  matrices go to a memory-mapped file beyond that
+  bool hsolve;                  //  solve Pq=psi with the H-matrix direct solver
+                                //  (see hmatrix.h) unless dirsol or expgcr is set
+  bool q2pcomp;                 //  store the second-shell near-field (Q2P) blocks in
+                                //  low-rank form (see mulMatDirect())
+  bool twolevel;                //  add a coarse-grid correction to the preconditioner
+                                //  (see coarse.h)
+  int precond;                  //  preconditioner type (NONE, OL or SPAI, see mulGlobal.h)
+  int itrtyp;                   //  iterative method (GCR or GMRES)
+  int dntype;                   //  type of downward/eval pass (NOLOCL, NOSHFT or GRENGD)
+  int nnbrs;                    //  distance (in cubes) to consider a nearest neighbor
+  int numdpt;                   //  number of evaluation points per dielectric panel (2 or 3),
+                                //  0 for analytic normal fields (no dummy panels)
+  bool adapt;                   //  use the adaptive algorithm (cubes done exactly)
+  int m2ltyp;                   //  M2L translations (M2LDNS, M2LROT or M2LAUT, see mulGlobal.h)
 
   //  configuration options
   bool timdat;                  //  print timing data
+  const char *trace_file;       //  Chrome trace JSON output file (0 for none)
   bool mksdat;                  //  dump symmetrized, MKS units cap mat
   dumpps_mode dumpps;           //  ON=> dump ps file w/mulMatDirect calcp's
                                 //  ALL=> dump adaptive alg calcp's as well
@@ -319,26 +437,39 @@ struct ssystem
   charge *panels;               //  linked list of charge panels in problem
   cube *****cubes;              //  The array of cube pointers.
   cube **multilist;             //  Array of ptrs to first cube in linked list
-                                //    of cubes to do multi at each level.
+                                //    of cubes to do multi at each level
+                                //    (Morton order, see linkcubes()).
   cube **locallist;             //  Array of ptrs to first cube in linked list
                                 //    of cubes to do local at each level.
+  double **multiblock;          //  per level: the multi vectors of the cubes
+                                //    in multilist, one (cubes x terms) block
+  double **localblock;          //  per level: the same for the local vectors
+  int *multicount, *localcount; //  per level: number of cubes in the blocks
   cube *directlist;             //  head of linked lst of low lev cubes w/chg
   cube *precondlist;            //  head of linked lst of precond blks.
   cube *revprecondlist;         //  reversed linked lst of precond blks.
   int *is_dummy;                //  is_dummy[i] = TRUE => panel i is a dummy
   int *is_dielec;               //  is_dielec[i] = TRUE => panel i on dielec
+  panel_table ptab;             //  per-panel arrays by panel index
+  pass_table uppass, downpass, evalpass; //  FMM pass descriptors
 
   multi_mats mm;
+  solve_setup setup;            //  reusable setup of the last solve
 
   mutable Heap heap;            //  allocation heap
 
-  std::set<int> get_conductor_number_set(const char *names) const;
+  Tracer trace;                 //  solver timeline recorder (see trace_file)
+
+  std::set<int> get_conductor_number_set(const char *names);
   int get_conductor_number(const char *name);
   bool rename_conductor(const char *old_name, const char *new_name);
   int number_of(const Name *) const;
   Name *conductor_name(int i);
   const Name *conductor_name(int i) const;
   const char *conductor_name_str(int i) const;
+  void index_conductor_alias(const Name *cond, const char *alias);
+  void update_conductor_index();
+  void clear_conductors();
 
   void reset_read();
 
@@ -353,7 +484,16 @@ struct ssystem
   void flush();
 
 private:
-  int get_unique_cond_num(const char *name, size_t nlen) const;
+  int get_unique_cond_num(const char *name, size_t nlen);
+  void index_conductor(Name *cond, int i);
+
+  //  conductor name index, kept in sync with cond_names by the methods
+  //  above (update_conductor_index() after editing the list directly)
+  std::vector<Name *> cond_list;                            //  by number - 1
+  std::unordered_map<const Name *, int> cond_numbers;       //  Name -> number
+  std::unordered_map<std::string, int> cond_index;          //  name or alias -> lowest number
+  std::vector<std::pair<std::string, int> > cond_prefix_index; //  last aliases, sorted
+  bool cond_prefix_valid;                                   //  false => rebuild cond_prefix_index
 };
 
 #endif
@@ -0,0 +1,43 @@
+
+#if !defined(parallel_H)
+#define parallel_H
+
+#include <thread>
+#include <vector>
+
+/* smallest number of multiply-adds worth distributing over threads */
+#define MINPARWORK 1000000
+
+/**
+ *  @brief Runs f(from, to) on slices of [from, to) in parallel
+ *
+ *  The range is split over the hardware threads if the work (multiply-adds
+ *  per item times items) is worth it. Otherwise f(from, to) is called
+ *  directly. The slices must be independent of each other.
+ */
+template <class F>
+void parallel_rows(int from, int to, long long work_per_row, F f)
+{
+  int rows = to - from;
+  int nthreads = int(std::thread::hardware_concurrency());
+
+  if (nthreads <= 1 || rows < 2 || rows * work_per_row < MINPARWORK) {
+    f(from, to);
+    return;
+  }
+
+  nthreads = nthreads < rows ? nthreads : rows;
+  int chunk = (rows + nthreads - 1) / nthreads;
+
+  std::vector<std::thread> threads;
+  for (int r = from + chunk; r < to; r += chunk) {
+    threads.push_back(std::thread(f, r, r + chunk < to ? r + chunk : to));
+  }
+  f(from, from + chunk < to ? from + chunk : to);
+
+  for (auto t = threads.begin(); t != threads.end(); ++t) {
+    t->join();
+  }
+}
+
+#endif
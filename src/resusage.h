@@ -44,11 +44,14 @@ dtime = (timestuff.tms_utime)-utime; \
 dtime /= HZ
 #endif /* FIVE */
 
-#else                           /* default - no timers */
+#else                           /* default - wall clock (C++11 chrono) */
 
-#define starttimer              /*  */
-#define stoptimer               /*  */
-const double dtime = 0.0;
+#include <chrono>
+static double dtime = 0.0;
+static std::chrono::steady_clock::time_point stime;
+#define starttimer stime = std::chrono::steady_clock::now()
+#define stoptimer dtime = std::chrono::duration<double>( \
+std::chrono::steady_clock::now() - stime).count()
 
 #endif /* NOTOTHER */
 
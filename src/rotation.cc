@@ -0,0 +1,275 @@
+
+#include "mulGlobal.h"
+#include "mulMulti.h"
+#include "rotation.h"
+#include "expansion.h"
+
+#include <cmath>
+
+namespace {
+
+/*
+  Gauss-Legendre nodes and weights on [-1, 1] for n points
+*/
+void gauss_legendre(int n, std::vector<double> &x, std::vector<double> &w)
+{
+  x.resize(n);
+  w.resize(n);
+
+  for(int i = 0; i < (n + 1) / 2; i++) {
+
+    /* Newton iteration on Pn from the Chebyshev node estimate */
+    double t = cos(M_PI * (i + 0.75) / (n + 0.5));
+    double dp = 1.0;
+    for(int iter = 0; iter < 100; iter++) {
+      double p0 = 1.0, p1 = t;
+      for(int k = 2; k <= n; k++) {
+        double p2 = ((2*k - 1) * t * p1 - (k - 1) * p0) / k;
+        p0 = p1;
+        p1 = p2;
+      }
+      dp = n * (t * p1 - p0) / (t * t - 1.0);
+      double dt = p1 / dp;
+      t -= dt;
+      if(fabs(dt) < 1e-15) break;
+    }
+
+    x[i] = t;
+    x[n - 1 - i] = -t;
+    w[i] = w[n - 1 - i] = 2.0 / ((1.0 - t * t) * dp * dp);
+
+  }
+}
+
+}
+
+m2l_rotation::m2l_rotation()
+  : m_order(-1)
+{
+  //  .. nothing yet ..
+}
+
+/*
+  J applied four times, the z translation for cos and sin terms and the
+  scaling of the input and output terms
+*/
+long long m2l_rotation::ops(int order)
+{
+  long long p = order;
+  return 4 * (p + 1) * (2*p + 1) * (2*p + 3) / 3 + (p + 1) * (p + 2) * (2*p + 3) / 3 + 2 * (p + 1) * (p + 1);
+}
+
+/*
+  the J blocks and the z translation coefficients
+*/
+long long m2l_rotation::stored(int order)
+{
+  long long p = order;
+  return (p + 1) * (2*p + 1) * (2*p + 3) / 3 + (p + 1) * (p + 2) * (2*p + 3) / 6;
+}
+
+/*
+  The vectors worked on hold the scaled harmonics blocked by degree: entry
+  n*n + r is the cos term of (n, r) for r <= n and the sin term of (n, r-n)
+  for r > n. m_index maps these entries to the expansion terms.
+*/
+void m2l_rotation::init(int order)
+{
+  const int terms = multerms(order);
+  const int ct = costerms(order);
+  const double *f = factorials();
+
+  m_order = order;
+
+  m_index.resize(terms);
+  m_mscale.resize(terms);
+  m_lscale.resize(terms);
+  for(int n = 0; n <= order; n++) {
+    m_index[n*n] = CINDEX(n, 0);
+    m_mscale[n*n] = 1.0;
+    m_lscale[n*n] = f[n];
+    for(int m = 1; m <= n; m++) {
+      m_index[n*n + m] = CINDEX(n, m);
+      m_index[n*n + n + m] = SINDEX(n, m, ct);
+      m_mscale[n*n + m] = m_mscale[n*n + n + m] = sqrt(0.5 * f[n-m] / f[n+m]);
+      m_lscale[n*n + m] = m_lscale[n*n + n + m] = sqrt(2.0 * f[n+m] * f[n-m]);
+    }
+  }
+
+  /* J = rotation by 90 degree about x, J[i][j] = (2n+1)/4pi int Bi(Qu) Bj(u)
+     with Q u = (ux, -uz, uy). The products are polynomials of degree 2n, so
+     order+1 Gauss points in cos(theta) and 2 order+1 points in phi are exact */
+  m_j.assign((order + 1) * (2*order + 1) * (2*order + 3) / 3, 0.0);
+
+  std::vector<double> gx, gw;
+  gauss_legendre(order + 1, gx, gw);
+  const int nphi = 2*order + 1;
+
+  std::vector<double> bu(terms), bq(terms), leg(costerms(order));
+
+  auto harmonics = [&leg, order, f] (double ct, double phi, double *b) {
+    legendre(ct, leg.data(), any_order(order));
+    for(int n = 0; n <= order; n++) {
+      b[n*n] = leg[CINDEX(n, 0)];
+      for(int m = 1; m <= n; m++) {
+        double s = sqrt(2.0 * f[n-m] / f[n+m]) * leg[CINDEX(n, m)];
+        b[n*n + m] = s * cos(m * phi);
+        b[n*n + n + m] = s * sin(m * phi);
+      }
+    }
+  };
+
+  for(size_t k = 0; k < gx.size(); k++) {
+    for(int l = 0; l < nphi; l++) {
+
+      double phi = 2.0 * M_PI * l / nphi;
+      double st = sqrt(1.0 - gx[k] * gx[k]);
+      double ux = st * cos(phi), uy = st * sin(phi), uz = gx[k];
+      harmonics(uz, phi, bu.data());
+      harmonics(uy, atan2(-uz, ux), bq.data());
+
+      double wt = gw[k] / (2.0 * nphi);    /* 2pi/nphi / 4pi */
+      for(int n = 0; n <= order; n++) {
+        int s = 2*n + 1;
+        double *j = m_j.data() + n * (2*n - 1) * (2*n + 1) / 3;
+        for(int r = 0; r < s; r++) {
+          for(int c = 0; c < s; c++) {
+            j[r*s + c] += s * wt * bq[n*n + r] * bu[n*n + c];
+          }
+        }
+      }
+
+    }
+  }
+
+  /* z translation with the local expansion at z = 1 relative to the
+     multipole expansion: bj^m = sum_n (-1)^(j+m) (j+n)!
+     / sqrt((n-m)! (n+m)! (j-m)! (j+m)!) an^m */
+  m_xoff.resize(order + 1);
+  m_xlat.clear();
+  for(int m = 0; m <= order; m++) {
+    m_xoff[m] = int(m_xlat.size());
+    for(int j = m; j <= order; j++) {
+      for(int n = m; n <= order; n++) {
+        double t = f[j+n] / sqrt(f[n-m] * f[n+m] * f[j-m] * f[j+m]);
+        m_xlat.push_back((j + m) % 2 == 0 ? t : -t);
+      }
+    }
+  }
+
+  m_a.resize(terms);
+  m_b.resize(terms);
+  m_t.resize(2*order + 1);
+  m_cos.resize(order + 1);
+  m_sin.resize(order + 1);
+  m_pow.resize(2*order + 2);
+}
+
+/*
+  rotation about z by the angle with cos c and sin s: B(Rz u) = W B(u)
+*/
+void m2l_rotation::rotate_z(double *v, double c, double s) const
+{
+  double *cm = m_cos.data(), *sm = m_sin.data();
+
+  cm[0] = 1.0;
+  sm[0] = 0.0;
+  for(int m = 1; m <= m_order; m++) {
+    cm[m] = cm[m-1] * c - sm[m-1] * s;
+    sm[m] = sm[m-1] * c + cm[m-1] * s;
+  }
+
+  for(int n = 1; n <= m_order; n++) {
+    double *vc = v + n*n, *vs = v + n*n + n;
+    for(int m = 1; m <= n; m++) {
+      double a = vc[m], b = vs[m];
+      vc[m] = cm[m] * a - sm[m] * b;
+      vs[m] = sm[m] * a + cm[m] * b;
+    }
+  }
+}
+
+/*
+  v = J v or J^T v
+*/
+void m2l_rotation::apply_j(double *v, bool transposed) const
+{
+  double *t = m_t.data();
+
+  for(int n = 1; n <= m_order; n++) {
+
+    int s = 2*n + 1;
+    const double *j = m_j.data() + n * (2*n - 1) * (2*n + 1) / 3;
+    double *vn = v + n*n;
+
+    if(transposed) {
+      for(int c = 0; c < s; c++) t[c] = 0.0;
+      for(int r = 0; r < s; r++) {
+        double vr = vn[r];
+        for(int c = 0; c < s; c++) t[c] += j[r*s + c] * vr;
+      }
+    }
+    else {
+      for(int r = 0; r < s; r++) {
+        double sum = 0.0;
+        for(int c = 0; c < s; c++) sum += j[r*s + c] * vn[c];
+        t[r] = sum;
+      }
+    }
+
+    for(int r = 0; r < s; r++) vn[r] = t[r];
+
+  }
+}
+
+void m2l_rotation::apply(const double *multi, double *local, double x, double y, double z) const
+{
+  const int order = m_order;
+  const int terms = multerms(order);
+  double *a = m_a.data(), *b = m_b.data(), *ipow = m_pow.data();
+
+  double rxy = sqrt(x*x + y*y);
+  double rho = sqrt(rxy*rxy + z*z);
+  double cp = 1.0, sp = 0.0;
+  if(rxy > 0.0) {
+    cp = x / rxy;
+    sp = y / rxy;
+  }
+  double cth = z / rho, sth = rxy / rho;
+
+  for(int i = 0; i < terms; i++) a[i] = m_mscale[i] * multi[m_index[i]];
+
+  /* rotate the translation vector onto z: Ry(-theta) Rz(-phi) */
+  rotate_z(a, cp, -sp);
+  apply_j(a, false);
+  rotate_z(a, cth, -sth);
+  apply_j(a, true);
+
+  /* translate by rho along z: the unit distance coefficients times rho^-(j+n+1) */
+  ipow[0] = 1.0;
+  for(int k = 1; k <= 2*order + 1; k++) ipow[k] = ipow[k-1] / rho;
+  for(int n = 1; n <= order; n++) {
+    for(int r = 0; r <= 2*n; r++) a[n*n + r] *= ipow[n];
+  }
+
+  for(int m = 0; m <= order; m++) {
+    const double *t = m_xlat.data() + m_xoff[m];
+    for(int j = m; j <= order; j++, t += order - m + 1) {
+      double sc = 0.0, ss = 0.0;
+      for(int n = m; n <= order; n++) {
+        sc += t[n-m] * a[n*n + m];
+        ss += t[n-m] * a[n*n + n + m];
+      }
+      b[j*j + m] = sc * ipow[j+1];
+      if(m > 0) b[j*j + j + m] = ss * ipow[j+1];
+    }
+  }
+
+  /* rotate back: Rz(phi) Ry(theta) */
+  apply_j(b, false);
+  rotate_z(b, cth, sth);
+  apply_j(b, true);
+  rotate_z(b, cp, sp);
+
+  for(int i = 0; i < terms; i++) local[m_index[i]] += m_lscale[i] * b[i];
+}
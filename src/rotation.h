@@ -0,0 +1,86 @@
+
+#if !defined(rotation_H)
+#define rotation_H
+
+#include "mulGlobal.h"
+
+#include <vector>
+
+/**
+ *  @brief Multipole to local translations by rotation to the z axis
+ *
+ *  The dense M2L matrix of mulMulti2Local() has terms x terms entries,
+ *  so building, storing and applying it costs O(p^4) for order p. This
+ *  engine applies the translation in three steps instead:
+ *
+ *    - the multipole expansion is rotated so that the translation vector
+ *      points along the z axis,
+ *    - it is translated along the z axis, which does not mix different m,
+ *    - the local expansion obtained is rotated back.
+ *
+ *  Each step costs O(p^3) and nothing is stored per translation but the
+ *  translation vector (see mulMatDown()).
+ *
+ *  The rotations work on the real spherical harmonics scaled to a norm of
+ *  4 pi/(2n+1), for which the rotation matrices are orthogonal and block
+ *  diagonal in n. A rotation about z only mixes the cos and sin terms of
+ *  the same (n, m). A rotation about y by theta is done as J^T Rz(theta) J
+ *  where J is the constant rotation by 90 degree about x which takes y to
+ *  z. J is computed once by quadrature of the spherical harmonics.
+ */
+class m2l_rotation
+{
+public:
+  m2l_rotation();
+
+  /**
+   *  @brief Sets up the rotation and translation coefficients for the given order
+   */
+  void init(int order);
+
+  /**
+   *  @brief Adds the M2L translation of "multi" to "local"
+   *
+   *  (x, y, z) is the center of the local expansion relative to the center
+   *  of the multipole expansion. Both expansions are in the layout of
+   *  mulMulti2Local() (see CINDEX and SINDEX).
+   */
+  void apply(const double *multi, double *local, double x, double y, double z) const;
+
+  //  multiply-adds per apply()
+  long long ops() const { return ops(m_order); }
+
+  //  multiply-adds per apply() for the given order
+  static long long ops(int order);
+
+  //  doubles stored by init() for the given order
+  static long long stored(int order);
+
+  //  expansion order set up
+  int order() const { return m_order; }
+
+private:
+  int m_order;
+  std::vector<int> m_index;             //  expansion term per (n, r), see apply()
+  std::vector<double> m_mscale;         //  multipole term to scaled harmonics
+  std::vector<double> m_lscale;         //  scaled harmonics to local term
+  std::vector<double> m_j;              //  J blocks, (2n+1) x (2n+1) from offset n(2n-1)(2n+1)/3
+  std::vector<double> m_xlat;           //  z translation for unit distance by (m, j, n)
+  std::vector<int> m_xoff;              //  offset of m in m_xlat
+  mutable std::vector<double> m_a, m_b, m_t, m_cos, m_sin, m_pow;
+
+  void rotate_z(double *v, double c, double s) const;
+  void apply_j(double *v, bool transposed) const;
+};
+
+/**
+ *  @brief Returns true if M2L translations of the given order use m2l_rotation
+ *
+ *  "m2ltyp" is M2LDNS, M2LROT or M2LAUT (see mulGlobal.h).
+ */
+inline bool m2l_rotated(int m2ltyp, int order)
+{
+  return m2ltyp == M2LROT || (m2ltyp == M2LAUT && order >= ROTORD);
+}
+
+#endif
@@ -0,0 +1,97 @@
+
+#include "trace.h"
+
+#include <cstdio>
+
+Tracer::Tracer()
+  : m_enabled(false), m_column(-1), m_iteration(-1)
+{
+  //  .. nothing yet ..
+}
+
+void Tracer::start()
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+  m_events.clear();
+  m_tids.clear();
+  m_tids[std::this_thread::get_id()] = 0;
+  m_column = m_iteration = -1;
+  m_t0 = std::chrono::steady_clock::now();
+  m_enabled = true;
+}
+
+void Tracer::stop()
+{
+  m_enabled = false;
+  m_column = m_iteration = -1;
+}
+
+double Tracer::now() const
+{
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_t0).count();
+}
+
+void Tracer::add(const char *name, const char *cat, double ts, double dur, int column, int iteration)
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+
+  std::map<std::thread::id, int>::const_iterator t = m_tids.find(std::this_thread::get_id());
+  int tid;
+  if (t == m_tids.end()) {
+    tid = int(m_tids.size());
+    m_tids[std::this_thread::get_id()] = tid;
+  } else {
+    tid = t->second;
+  }
+
+  Event ev;
+  ev.name = name;
+  ev.cat = cat;
+  ev.ts = ts;
+  ev.dur = dur;
+  ev.tid = tid;
+  ev.column = column;
+  ev.iteration = iteration;
+  m_events.push_back(ev);
+}
+
+bool Tracer::write(const char *filename) const
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+
+  FILE *fp = fopen(filename, "w");
+  if (!fp) {
+    return false;
+  }
+
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+  const char *sep = "\n";
+
+  //  name the threads
+  for (std::map<std::thread::id, int>::const_iterator t = m_tids.begin(); t != m_tids.end(); ++t) {
+    fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", sep, t->second);
+    if (t->second == 0) {
+      fprintf(fp, "\"main\"}}");
+    } else {
+      fprintf(fp, "\"worker %d\"}}", t->second);
+    }
+    sep = ",\n";
+  }
+
+  for (std::vector<Event>::const_iterator e = m_events.begin(); e != m_events.end(); ++e) {
+    fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d",
+            sep, e->name, e->cat, e->ts, e->dur, e->tid);
+    if (e->column >= 0 || e->iteration >= 0) {
+      fprintf(fp, ",\"args\":{\"column\":%d,\"iteration\":%d}", e->column, e->iteration);
+    }
+    fprintf(fp, "}");
+    sep = ",\n";
+  }
+
+  fprintf(fp, "\n]}\n");
+
+  bool ok = (ferror(fp) == 0);
+  ok = (fclose(fp) == 0) && ok;
+  return ok;
+}
@@ -0,0 +1,145 @@
+
+#if !defined(trace_H)
+#define trace_H
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+/**
+ *  @brief A recorder for solver timeline events
+ *
+ *  The recorder collects "complete" events (start time plus duration)
+ *  and writes them in the Chrome trace event JSON format which can be
+ *  viewed with chrome://tracing or https://ui.perfetto.dev.
+ *
+ *  Recording is disabled unless "start" is called. Events can be
+ *  recorded from any thread - each thread is given a small integer id,
+ *  the thread that called "start" gets id 0.
+ *
+ *  Events carry the conductor column and iteration number that are
+ *  current when the event begins (-1 if not inside the iterative solve).
+ */
+class Tracer
+{
+public:
+  Tracer();
+
+  /**
+   *  @brief Enables recording and clears previous events
+   */
+  void start();
+
+  /**
+   *  @brief Disables recording
+   */
+  void stop();
+
+  /**
+   *  @brief Returns true, if events are recorded
+   */
+  bool enabled() const
+  {
+    return m_enabled;
+  }
+
+  /**
+   *  @brief Sets the conductor column that is attached to the events
+   */
+  void set_column(int column)
+  {
+    m_column = column;
+  }
+
+  /**
+   *  @brief Sets the iteration number that is attached to the events
+   */
+  void set_iteration(int iteration)
+  {
+    m_iteration = iteration;
+  }
+
+  int column() const
+  {
+    return m_column;
+  }
+
+  int iteration() const
+  {
+    return m_iteration;
+  }
+
+  /**
+   *  @brief Gets the time in microseconds since "start"
+   */
+  double now() const;
+
+  /**
+   *  @brief Records an event
+   *
+   *  "name" and "cat" are not copied and must be static strings.
+   */
+  void add(const char *name, const char *cat, double ts, double dur, int column, int iteration);
+
+  /**
+   *  @brief Writes the events recorded so far to the given file
+   *
+   *  Returns false, if the file cannot be written.
+   */
+  bool write(const char *filename) const;
+
+private:
+  struct Event
+  {
+    const char *name, *cat;
+    double ts, dur;
+    int tid;
+    int column, iteration;
+  };
+
+  bool m_enabled;
+  int m_column, m_iteration;
+  std::chrono::steady_clock::time_point m_t0;
+  std::vector<Event> m_events;
+  std::map<std::thread::id, int> m_tids;
+  mutable std::mutex m_lock;
+
+  Tracer(const Tracer &);
+  Tracer &operator=(const Tracer &);
+};
+
+/**
+ *  @brief Records one span on the given tracer for the lifetime of the object
+ */
+class TraceSpan
+{
+public:
+  TraceSpan(Tracer &tracer, const char *name, const char *cat = "solve")
+    : mp_tracer(tracer.enabled() ? &tracer : 0), mp_name(name), mp_cat(cat),
+      m_column(tracer.column()), m_iteration(tracer.iteration()), m_ts(0.0)
+  {
+    if (mp_tracer) {
+      m_ts = mp_tracer->now();
+    }
+  }
+
+  ~TraceSpan()
+  {
+    if (mp_tracer) {
+      mp_tracer->add(mp_name, mp_cat, m_ts, mp_tracer->now() - m_ts, m_column, m_iteration);
+    }
+  }
+
+private:
+  Tracer *mp_tracer;
+  const char *mp_name, *mp_cat;
+  int m_column, m_iteration;
+  double m_ts;
+
+  TraceSpan(const TraceSpan &);
+  TraceSpan &operator=(const TraceSpan &);
+};
+
+#endif
@@ -0,0 +1,73 @@
+
+#include <gtest/gtest.h>
+
+#include "mulStruct.h"
+#include "mulGlobal.h"
+#include "calcp.h"
+
+#include <cmath>
+
+namespace {
+
+//  a tilted, slightly irregular quad panel
+void make_panel(ssystem *sys, Surface *surf, charge *panel)
+{
+  const double c[4][3] = {
+    { 0.0, 0.0, 0.0 }, { 1.0, 0.1, 0.2 }, { 1.1, 0.9, 0.3 }, { -0.1, 1.0, 0.1 }
+  };
+
+  surf->type = CONDTR;
+  panel->shape = 4;
+  panel->surf = surf;
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      panel->corner[i][j] = c[i][j];
+    }
+  }
+  initcalcp(sys, panel);
+}
+
+}
+
+TEST(calcp, normal_derivative)
+{
+  ssystem sys;
+  Surface surf;
+  charge panel = charge();
+  make_panel(&sys, &surf, &panel);
+
+  const double n[3] = { 0.48, -0.6, 0.64 };
+  const double h = 1e-5;
+
+  //  near (exact terms), medium and far (second moments) evaluation points
+  const double pts[][3] = {
+    { 0.6, 0.4, 0.5 }, { 1.5, -0.3, 0.1 }, { -0.4, 1.4, -0.7 }, { 2.5, 2.0, 1.5 }, { 8.0, -5.0, 6.0 }
+  };
+
+  for (auto p : pts) {
+    double x = p[0], y = p[1], z = p[2];
+    double fd = (calcp(&sys, &panel, x + h * n[0], y + h * n[1], z + h * n[2], NULL)
+                 - calcp(&sys, &panel, x - h * n[0], y - h * n[1], z - h * n[2], NULL)) / (2.0 * h);
+    double dn = calcpn(&sys, &panel, x, y, z, n);
+    EXPECT_NEAR(dn, fd, 1e-6 * (1.0 + std::abs(fd))) << "at " << x << "," << y << "," << z;
+  }
+
+  //  the principal value on the panel itself: no normal component
+  EXPECT_NEAR(calcpn(&sys, &panel, panel.x, panel.y, panel.z, panel.Z), 0.0, 1e-12);
+}
+
+TEST(calcp, flux_rows)
+{
+  ssystem sys;
+  Surface surf;
+  charge panel = charge();
+  make_panel(&sys, &surf, &panel);
+
+  //  only dielectric panels give flux density rows and only with --numdpt=0
+  sys.numdpt = 0;
+  EXPECT_FALSE(is_flux_row(&sys, &panel));
+  surf.type = DIELEC;
+  EXPECT_TRUE(is_flux_row(&sys, &panel));
+  sys.numdpt = 2;
+  EXPECT_FALSE(is_flux_row(&sys, &panel));
+}
@@ -0,0 +1,230 @@
+
+#include <gtest/gtest.h>
+
+#include "mulStruct.h"
+#include "mulGlobal.h"
+#include "direct.h"
+#include "blkDirect.h"
+#include "aca.h"
+
+#include <vector>
+#include <cmath>
+
+namespace {
+
+//  a matrix which needs pivoting: zero diagonal, larger entries off the diagonal
+double element(int i, int j, int size)
+{
+  if (i == j) {
+    return 0.0;
+  }
+  return std::sin(0.7 * i + 1.3 * j) + ((i + 1) % size == j ? double(size) : 0.0);
+}
+
+double max_residual(double **a, const std::vector<double> &x, const std::vector<double> &b, int size)
+{
+  double r = 0.0;
+  for (int i = 0; i < size; ++i) {
+    double s = -b[i];
+    for (int j = 0; j < size; ++j) {
+      s += a[i][j] * x[j];
+    }
+    r = std::max(r, std::abs(s));
+  }
+  return r;
+}
+
+TEST(direct, ludecomp)
+{
+  //  spans several blocks and ends with a partial one
+  const int size = 150;
+
+  ssystem sys;
+  double **a = sys.heap.mat(size, size);
+  for (int i = 0; i < size; ++i) {
+    for (int j = 0; j < size; ++j) {
+      a[i][j] = element(i, j, size);
+    }
+  }
+
+  int *pivots = 0;
+  double **lu = ludecomp(&sys, a, size, TRUE, &pivots);
+  EXPECT_NE(lu, a);
+
+  std::vector<double> b(size), x(size);
+  for (int i = 0; i < size; ++i) {
+    b[i] = 1.0 + i % 7;
+  }
+
+  solve(lu, x.data(), b.data(), size, pivots);
+  EXPECT_LT(max_residual(a, x, b, size), 1e-10);
+
+  //  several right hand sides at once give the same solutions
+  const int nrhs = 3;
+  double **xm = sys.heap.mat(size, nrhs);
+  for (int i = 0; i < size; ++i) {
+    for (int c = 0; c < nrhs; ++c) {
+      xm[i][c] = b[i] * (c + 1);
+    }
+  }
+
+  solveMulti(lu, xm, size, nrhs, pivots);
+  for (int i = 0; i < size; ++i) {
+    for (int c = 0; c < nrhs; ++c) {
+      EXPECT_NEAR(xm[i][c], x[i] * (c + 1), 1e-10);
+    }
+  }
+}
+
+TEST(direct, ludecomp_singular)
+{
+  ssystem sys;
+  double **a = sys.heap.mat(2, 2);
+  a[0][0] = 1.0;
+  a[0][1] = 2.0;
+  a[1][0] = 2.0;
+  a[1][1] = 4.0;
+
+  int *pivots = 0;
+  EXPECT_THROW(ludecomp(&sys, a, 2, FALSE, &pivots), std::runtime_error);
+}
+
+TEST(direct, lu_factor_serial)
+{
+  //  the serial kernels used inside parallel sections give the same result
+  const int size = 150, nrhs = 3;
+
+  ssystem sys;
+  double **a = sys.heap.mat(size, size);
+  double **lu = sys.heap.mat(size, size);
+  for (int i = 0; i < size; ++i) {
+    for (int j = 0; j < size; ++j) {
+      a[i][j] = lu[i][j] = element(i, j, size);
+    }
+  }
+
+  std::vector<int> pivots(size);
+  EXPECT_EQ(lu_factor(lu, size, pivots.data(), FALSE), TRUE);
+
+  double **xm = sys.heap.mat(size, nrhs);
+  std::vector<double> b(size), x(size);
+  for (int i = 0; i < size; ++i) {
+    b[i] = 1.0 + i % 7;
+    for (int c = 0; c < nrhs; ++c) {
+      xm[i][c] = b[i] * (c + 1);
+    }
+  }
+
+  lu_solve(lu, xm, size, nrhs, pivots.data(), FALSE);
+  for (int c = 0; c < nrhs; ++c) {
+    for (int i = 0; i < size; ++i) {
+      x[i] = xm[i][c] / (c + 1);
+    }
+    EXPECT_LT(max_residual(a, x, b, size), 1e-10);
+  }
+
+  double *s[2] = { sys.heap.alloc<double>(2), sys.heap.alloc<double>(2) };
+  s[0][0] = 1.0;
+  s[0][1] = 2.0;
+  s[1][0] = 2.0;
+  s[1][1] = 4.0;
+  EXPECT_EQ(lu_factor(s, 2, pivots.data(), FALSE), FALSE);
+}
+
+TEST(direct, aca)
+{
+  //  interactions of two separated point clusters on a line are smooth
+  const int nrows = 60, ncols = 40;
+  auto entry = [] (int i, int j) {
+    double xi = 0.01 * i, yj = 2.0 + 0.01 * j;
+    return 1.0 / (yj - xi);
+  };
+
+  ssystem sys;
+  double **u = 0, **v = 0;
+  int rank = aca(sys.heap, AMSC, nrows, ncols, 1e-8, ncols, entry, &u, &v);
+  EXPECT_GT(rank, 0);
+  EXPECT_LT(rank, 12);
+
+  double err = 0.0;
+  for (int i = 0; i < nrows; ++i) {
+    for (int j = 0; j < ncols; ++j) {
+      double s = 0.0;
+      for (int l = 0; l < rank; ++l) {
+        s += u[i][l] * v[j][l];
+      }
+      err = std::max(err, std::abs(s - entry(i, j)));
+    }
+  }
+  EXPECT_LT(err, 1e-8);
+
+  //  a full rank block is not compressed below its size
+  auto diag = [] (int i, int j) { return i == j ? 1.0 + i : 0.0; };
+  EXPECT_EQ(aca(sys.heap, AMSC, 10, 10, 1e-8, 5, diag, &u, &v), -1);
+}
+
+TEST(direct, blk_matrix)
+{
+  //  does not divide by the tile size, so the last panel is padded
+  const int size = 70, tile = 16;
+
+  ssystem sys;
+  double **a = sys.heap.mat(size, size);
+  for (int i = 0; i < size; ++i) {
+    for (int j = 0; j < size; ++j) {
+      a[i][j] = element(i, j, size);
+    }
+  }
+
+  blk_matrix *mat = sys.heap.create<blk_matrix>(AMSC);
+  mat->init(&sys, size, tile);
+  EXPECT_EQ(mat->panels(), 5);
+  EXPECT_EQ(mat->padded_size(), 80);
+
+  std::vector<double> panel(mat->panel_size());
+  for (int k = 0; k < mat->panels(); ++k) {
+    for (int i = 0; i < mat->padded_size(); ++i) {
+      for (int c = 0; c < tile; ++c) {
+        int j = k * tile + c;
+        double v = (i < size && j < size) ? a[i][j] : (i == j ? 1.0 : 0.0);
+        panel[size_t(i) * tile + c] = v;
+      }
+    }
+    mat->write_panel(k, panel.data());
+  }
+
+  std::vector<double> b(size), x(size);
+  for (int i = 0; i < size; ++i) {
+    b[i] = 1.0 + i % 5;
+  }
+
+  //  the product with the unfactored matrix
+  std::vector<double> p(size, 0.0);
+  blkAqprod(&sys, p.data(), b.data(), mat);
+  for (int i = 0; i < size; ++i) {
+    double s = 0.0;
+    for (int j = 0; j < size; ++j) {
+      s += a[i][j] * b[j];
+    }
+    EXPECT_NEAR(p[i], s, 1e-10);
+  }
+
+  blkLUdecomp(&sys, mat);
+
+  const int nrhs = 2;
+  double **xm = sys.heap.mat(size, nrhs);
+  for (int i = 0; i < size; ++i) {
+    xm[i][0] = b[i];
+    xm[i][1] = -b[i];
+  }
+
+  blkSolve(&sys, xm, nrhs, mat);
+
+  for (int i = 0; i < size; ++i) {
+    x[i] = xm[i][0];
+    EXPECT_NEAR(xm[i][1], -xm[i][0], 1e-10);
+  }
+  EXPECT_LT(max_residual(a, x, b, size), 1e-10);
+}
+
+}
@@ -0,0 +1,133 @@
+
+#include <gtest/gtest.h>
+
+#include "mulStruct.h"
+#include "mulGlobal.h"
+#include "mulSetup.h"
+#include "mulMulti.h"
+#include "mulMats.h"
+#include "estimate.h"
+#include "input.h"
+#include "quickif.h"
+
+namespace {
+
+//  a 1m cube made from n x n uniform quads per face
+charge *make_cube(ssystem *sys, int n)
+{
+  SurfaceData *data = sys->heap.create<SurfaceData>(AMSC);
+  data->name = sys->heap.strdup("C");
+
+  quadl *last = 0;
+  double h = 1.0 / n;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    for (int side = 0; side < 2; ++side) {
+      for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+
+          double p[4][3];
+          double u[] = { double(i), double(i + 1), double(i + 1), double(i) };
+          double v[] = { double(j), double(j), double(j + 1), double(j + 1) };
+          for (int c = 0; c < 4; ++c) {
+            p[c][axis] = side;
+            p[c][(axis + 1) % 3] = u[c] * h;
+            p[c][(axis + 2) % 3] = v[c] * h;
+          }
+
+          quadl *q = sys->heap.alloc<quadl>(1, AMSC);
+          q->p1 = Vector3d(p[0][0], p[0][1], p[0][2]);
+          q->p2 = Vector3d(p[1][0], p[1][1], p[1][2]);
+          q->p3 = Vector3d(p[2][0], p[2][1], p[2][2]);
+          q->p4 = Vector3d(p[3][0], p[3][1], p[3][2]);
+          if (last) {
+            last->next = q;
+          } else {
+            data->quads = q;
+          }
+          last = q;
+
+        }
+      }
+    }
+  }
+
+  Surface *surf = sys->heap.create<Surface>(AMSC);
+  surf->type = CONDTR;
+  surf->surf_data = data;
+  surf->end_of_chain = TRUE;
+  surf->group_name = sys->heap.strdup("GROUP1");
+  sys->surf_list = surf;
+
+  return build_charge_list(sys);
+}
+
+//  sets up the system like setup_solver() does and compares the Q2P/Q2PD
+//  memory with the estimate
+void check_direct_memory(int precond, bool q2pcomp)
+{
+  ssystem sys;
+  sys.precond = precond;
+  sys.q2pcomp = q2pcomp;
+  sys.depth = 3;
+
+  charge *chglist = make_cube(&sys, 12);
+  mulInit(&sys, chglist);
+
+  int up_size = 0;
+  for (charge *c = chglist; c; c = c->next) {
+    ++up_size;
+  }
+
+  resource_estimate est;
+  estimate_resources(&sys, up_size, up_size, est);
+
+  mulMultiAlloc(&sys, MAX(sys.max_eval_pnt, sys.max_panel), sys.order, sys.depth);
+
+  size_t q2p = sys.heap.memory(AQ2P), q2pd = sys.heap.memory(AQ2PD);
+
+  blk_matrix *blkmat = 0;
+  int *real_index = 0;
+  mulMatDirect(&sys, &blkmat, &real_index, up_size, up_size);
+  if (precond == OL) {
+    olmulMatPrecond(&sys);
+  } else if (precond == SPAI) {
+    spaimulMatPrecond(&sys);
+  }
+  mulMatUp(&sys);
+  mulMatDown(&sys);
+  mulMatEval(&sys);
+
+  q2p = sys.heap.memory(AQ2P) - q2p;
+  q2pd = sys.heap.memory(AQ2PD) - q2pd;
+
+  EXPECT_EQ(est.memory[AQ2PD], q2pd);
+  if (q2pcomp) {
+    //  the low-rank second shell blocks are estimated dense
+    EXPECT_GE(est.memory[AQ2P], q2p);
+  } else {
+    EXPECT_EQ(est.memory[AQ2P], q2p);
+  }
+}
+
+TEST(estimate, direct_no_precond)
+{
+  check_direct_memory(NONE, false);
+}
+
+TEST(estimate, direct_ol)
+{
+  check_direct_memory(OL, false);
+}
+
+TEST(estimate, direct_spai)
+{
+  check_direct_memory(SPAI, false);
+}
+
+TEST(estimate, direct_compressed)
+{
+  check_direct_memory(NONE, true);
+}
+
+}
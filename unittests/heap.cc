@@ -51,7 +51,96 @@ TEST(heap, mat)
       EXPECT_EQ(mat[i][j], 0.0);
     }
   }
+
+  //  rows are contiguous
+  EXPECT_EQ(mat[1], mat[0] + 3);
+  EXPECT_EQ(mat[2], mat[0] + 6);
 }
 
+TEST(heap, mapped)
+{
+  Heap heap;
+
+  EXPECT_EQ(heap.map_to_file(AQ2P), true);
+
+  double **mat = heap.mat(100, 1000, AQ2P);
+  char *str = heap.strdup("ABC");
+
+  EXPECT_EQ(heap.memory(AQ2P), sizeof(double) * 100000 + sizeof(double *) * 100);
+  EXPECT_EQ(heap.memory(AMSC), size_t(4));
+  EXPECT_GE(heap.mapped_memory(), heap.memory(AQ2P));
+
+  //  mapped memory is zeroed and writable
+  for (int i = 0; i < 100; ++i) {
+    for (int j = 0; j < 1000; ++j) {
+      EXPECT_EQ(mat[i][j], 0.0);
+      mat[i][j] = i * 1000 + j;
+    }
+  }
+  EXPECT_EQ(mat[99][999], 99999.0);
+  EXPECT_EQ(std::string(str), "ABC");
+
+  //  allocations larger than a chunk
+  double *big = heap.alloc<double>(10 * 1024 * 1024, AQ2P);
+  big[10 * 1024 * 1024 - 1] = 1.0;
+  EXPECT_EQ(big[0], 0.0);
+  EXPECT_EQ(mat[99][999], 99999.0);
 }
 
+TEST(heap, release)
+{
+  Heap heap;
+
+  EXPECT_EQ(heap.map_to_file(AQ2P), true);
+
+  double *keep = heap.alloc<double>(100, AQ2P);
+  keep[99] = 1.0;
+  char *str = heap.strdup("ABC");
+
+  Heap::Mark m = heap.mark();
+  size_t mapped = heap.mapped_memory();
+
+  for (int n = 0; n < 3; ++n) {
+
+    double **mat = heap.mat(1000, 1000, AQ2P);
+    EXPECT_EQ(mat[999][999], 0.0);
+    EXPECT_EQ(mat[0][0], 0.0);
+    mat[0][0] = mat[999][999] = 1.0;
+    heap.alloc<int>(1000, AMSC)[999] = 1;
+    heap.create<std::string>()->assign("XYZ");
+
+    EXPECT_GT(heap.memory(AQ2P), sizeof(double) * 100);
+    EXPECT_EQ(heap.memory(AMSC), size_t(4) + sizeof(int) * 1000 + sizeof(std::string));
+
+    //  everything after the mark is gone, released memory reads as zero again
+    heap.release(m);
+    EXPECT_EQ(heap.memory(AQ2P), sizeof(double) * 100);
+    EXPECT_EQ(heap.memory(AMSC), size_t(4));
+    EXPECT_EQ(heap.mapped_memory(), mapped);
+
+  }
+
+  EXPECT_EQ(keep[99], 1.0);
+  EXPECT_EQ(std::string(str), "ABC");
+}
+
+TEST(heap, release_mapping)
+{
+  Heap heap;
+
+  Heap::Mark m = heap.mark();
+
+  EXPECT_EQ(heap.map_to_file(AQ2PD), true);
+  heap.alloc<double>(100, AQ2PD);
+  EXPECT_EQ(heap.mapped_memory(), sizeof(double) * 100);
+
+  //  the mapping made after the mark is dropped too
+  heap.release(m);
+  EXPECT_EQ(heap.mapped_memory(), size_t(0));
+
+  heap.alloc<double>(100, AQ2PD)[99] = 1.0;
+  EXPECT_EQ(heap.memory(AQ2PD), sizeof(double) * 100);
+  EXPECT_EQ(heap.mapped_memory(), size_t(0));
+}
+
+}
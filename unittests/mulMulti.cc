@@ -0,0 +1,153 @@
+
+#include <gtest/gtest.h>
+
+#include "mulStruct.h"
+#include "mulGlobal.h"
+#include "mulMulti.h"
+#include "mulLocal.h"
+
+#include <vector>
+#include <cmath>
+
+namespace {
+
+//  the potential of the charges at (x, y, z) through Q2M, M2M, M2L, L2L and L2P
+//  with the given expansion order
+std::vector<double> expansion_potentials(int order, std::vector<charge *> &src, std::vector<charge *> &dest, const std::vector<double> &q)
+{
+  ssystem sys;
+  sys.order = order;
+  mulMultiAlloc(&sys, int(std::max(src.size(), dest.size())), order, 0);
+
+  int terms = multerms(order);
+  std::vector<int> is_dummy(src.size(), FALSE);
+
+  //  cubes of side 1: the source cube at 0.5 with its parent at 1, the
+  //  destination cube at 4.5 with its parent at 5
+  double **q2m = mulQ2Multi(&sys, src.data(), is_dummy.data(), int(src.size()), 0.5, 0.5, 0.5, order);
+  double **m2m = mulMulti2Multi(&sys, 0.5, 0.5, 0.5, 1.0, 1.0, 1.0, order);
+  double **m2l = mulMulti2Local(&sys, 1.0, 1.0, 1.0, 5.0, 1.0, 1.0, order);
+  double **l2l = mulLocal2Local(&sys, 5.0, 1.0, 1.0, 4.5, 0.5, 0.5, order);
+  double **l2p = mulLocal2P(&sys, 4.5, 0.5, 0.5, dest.data(), int(dest.size()), order);
+
+  auto mul = [terms] (double **m, const std::vector<double> &v, int rows) {
+    std::vector<double> r(rows, 0.0);
+    for (int i = 0; i < rows; ++i) {
+      for (size_t j = 0; j < v.size(); ++j) {
+        r[i] += m[i][j] * v[j];
+      }
+    }
+    return r;
+  };
+
+  std::vector<double> multi = mul(m2m, mul(q2m, q, terms), terms);
+  std::vector<double> local = mul(l2l, mul(m2l, multi, terms), terms);
+  return mul(l2p, local, int(dest.size()));
+}
+
+}
+
+TEST(mulMulti, expansion_accuracy)
+{
+  std::vector<charge> src_chgs(5), dest_chgs(4);
+  std::vector<charge *> src, dest;
+  std::vector<double> q;
+
+  for (size_t i = 0; i < src_chgs.size(); ++i) {
+    src_chgs[i].x = 0.5 + 0.3 * std::sin(1.1 * i);
+    src_chgs[i].y = 0.5 + 0.3 * std::cos(1.7 * i);
+    src_chgs[i].z = 0.5 + 0.2 * std::sin(2.3 * i + 0.5);
+    src.push_back(&src_chgs[i]);
+    q.push_back(1.0 + 0.5 * std::cos(0.9 * i));
+  }
+
+  for (size_t i = 0; i < dest_chgs.size(); ++i) {
+    dest_chgs[i].x = 4.5 + 0.3 * std::cos(1.3 * i);
+    dest_chgs[i].y = 0.5 + 0.3 * std::sin(0.7 * i + 0.2);
+    dest_chgs[i].z = 0.5 - 0.2 * std::cos(2.1 * i);
+    dest.push_back(&dest_chgs[i]);
+  }
+
+  std::vector<double> exact;
+  for (size_t i = 0; i < dest.size(); ++i) {
+    double p = 0.0;
+    for (size_t j = 0; j < src.size(); ++j) {
+      double dx = dest[i]->x - src[j]->x, dy = dest[i]->y - src[j]->y, dz = dest[i]->z - src[j]->z;
+      p += q[j] / sqrt(dx * dx + dy * dy + dz * dz);
+    }
+    exact.push_back(p);
+  }
+
+  //  covers the compile-time orders and the run-time fallback beyond MAXORDER
+  double last_error = 1.0;
+  for (int order = 1; order <= MAXORDER + 2; ++order) {
+
+    std::vector<double> p = expansion_potentials(order, src, dest, q);
+
+    double error = 0.0;
+    for (size_t i = 0; i < dest.size(); ++i) {
+      error = std::max(error, std::abs(p[i] - exact[i]) / exact[i]);
+    }
+
+    EXPECT_LT(error, 0.1 * std::pow(0.5, order)) << "order " << order;
+    //  (the error must drop with the order until it hits rounding)
+    EXPECT_TRUE(error < last_error || error < 1e-12) << "order " << order;
+    last_error = error;
+
+  }
+}
+
+TEST(mulMulti, normal_derivative_rows)
+{
+  //  the normal derivative rows of M2P and L2P match finite differences
+  //  of the plain rows along the panel normal
+  charge chg = charge();
+  chg.x = 1.3;
+  chg.y = -0.7;
+  chg.z = 0.9;
+  const double n[3] = { 0.36, 0.48, -0.8 };
+  for (int i = 0; i < 3; ++i) {
+    chg.Z[i] = n[i];
+  }
+
+  const double h = 1e-5;
+  const double xc = 0.2, yc = 0.1, zc = -0.3;
+
+  for (int order = 1; order <= 6; ++order) {
+
+    ssystem sys;
+    sys.order = order;
+    mulMultiAlloc(&sys, 1, order, 0);
+    int terms = multerms(order);
+
+    charge cp = chg, cm = chg;
+    cp.x += h * n[0]; cp.y += h * n[1]; cp.z += h * n[2];
+    cm.x -= h * n[0]; cm.y -= h * n[1]; cm.z -= h * n[2];
+    charge *pchg = &chg, *pcp = &cp, *pcm = &cm;
+
+    for (int local = 0; local < 2; ++local) {
+
+      auto row = [&sys, local, order, xc, yc, zc] (charge **c) {
+        return local ? mulLocal2P(&sys, xc, yc, zc, c, 1, order)[0]
+                     : mulMulti2P(&sys, xc, yc, zc, c, 1, order)[0];
+      };
+
+      double *rp = row(&pcp), *rm = row(&pcm);
+
+      //  with --numdpt=0, the rows of dielectric panels are the normal derivatives
+      Surface surf;
+      surf.type = DIELEC;
+      chg.surf = &surf;
+      sys.numdpt = 0;
+      double *rn = row(&pchg);
+      sys.numdpt = NUMDPT;
+      chg.surf = 0;
+
+      for (int i = 0; i < terms; ++i) {
+        double fd = (rp[i] - rm[i]) / (2.0 * h);
+        EXPECT_NEAR(rn[i], fd, 1e-6 * (1.0 + std::abs(fd))) << "order " << order << ", term " << i << (local ? " (L2P)" : " (M2P)");
+      }
+
+    }
+  }
+}
@@ -137,5 +137,56 @@ TEST(ssystem, conductor_name_lists)
   }
 }
 
+TEST(ssystem, conductor_name_index)
+{
+  ssystem sys;
+
+  //  many names with common prefixes
+  for (int i = 1; i <= 1000; ++i) {
+    std::ostringstream os;
+    os << "NET" << i << "%GROUP1";
+    EXPECT_EQ(sys.get_conductor_number(os.str().c_str()), i);
+  }
+  EXPECT_EQ(sys.num_cond, 1000);
+  EXPECT_EQ(sys.get_conductor_number("NET517%GROUP1"), 517);
+  EXPECT_EQ(std::string(sys.conductor_name_str(517)), "NET517%GROUP1");
+  EXPECT_EQ(sys.number_of(sys.conductor_name(517)), 517);
+
+  EXPECT_EQ(set2s(sys.get_conductor_number_set("NET999")), "999");
+  EXPECT_EQ(set2s(sys.get_conductor_number_set("NET1%,NET10%")), "1,10");
+  try {
+    sys.get_conductor_number_set("NET99");
+    EXPECT_EQ(true, false);
+  } catch (std::runtime_error &ex) {
+    EXPECT_EQ(std::string(ex.what()), "Cannot find unique conductor name starting with 'NET99'");
+  }
+
+  //  renaming updates both the name and the prefix index
+  EXPECT_EQ(sys.rename_conductor("NET42%GROUP1", "VDD"), true);
+  EXPECT_EQ(sys.get_conductor_number("VDD"), 42);
+  EXPECT_EQ(sys.get_conductor_number("NET42%GROUP1"), 42);
+  EXPECT_EQ(set2s(sys.get_conductor_number_set("VD")), "42");
+  try {
+    sys.get_conductor_number_set("NET42%");
+    EXPECT_EQ(true, false);
+  } catch (std::runtime_error &ex) {
+    EXPECT_EQ(std::string(ex.what()), "Cannot find conductor name starting with 'NET42%'");
+  }
+
+  //  a name shared by two conductors gives the first one
+  sys.conductor_name(7)->add_alias(&sys, "VDD");
+  EXPECT_EQ(sys.get_conductor_number("VDD"), 7);
+
+  //  edits of the list itself need a reindex
+  sys.conductor_name(3)->name = sys.heap.strdup("GND");
+  sys.update_conductor_index();
+  EXPECT_EQ(sys.get_conductor_number("GND"), 3);
+  EXPECT_EQ(sys.num_cond, 1000);
+
+  sys.clear_conductors();
+  EXPECT_EQ(sys.conductor_name(1) == 0, true);
+  EXPECT_EQ(sys.get_conductor_number("GND"), 1);
+}
+
 }
 
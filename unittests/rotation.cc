@@ -0,0 +1,68 @@
+
+#include <gtest/gtest.h>
+
+#include "mulStruct.h"
+#include "mulGlobal.h"
+#include "mulMulti.h"
+#include "mulLocal.h"
+#include "rotation.h"
+
+#include <vector>
+#include <cmath>
+
+TEST(rotation, same_as_dense_m2l)
+{
+  //  translations along the axes, in the xy plane and in general directions
+  double xyz[][3] = {
+    { 0.0, 0.0, 3.0 }, { 0.0, 0.0, -2.0 }, { 2.0, 0.0, 0.0 }, { 0.0, -2.5, 0.0 },
+    { 2.0, -1.0, 0.0 }, { 2.0, -1.0, 0.5 }, { -1.5, 2.0, -2.5 }, { 0.5, 0.5, 3.0 }
+  };
+
+  for (int order = 1; order <= MAXORDER; ++order) {
+
+    ssystem sys;
+    sys.order = order;
+    mulMultiAlloc(&sys, 0, order, 0);
+
+    m2l_rotation rot;
+    rot.init(order);
+    EXPECT_EQ(rot.order(), order);
+
+    int terms = multerms(order);
+    std::vector<double> multi(terms);
+    for (int i = 0; i < terms; ++i) {
+      multi[i] = std::sin(1.3 * i + 0.2);
+    }
+
+    for (size_t t = 0; t < sizeof(xyz) / sizeof(xyz[0]); ++t) {
+
+      const double *d = xyz[t];
+      double **mat = mulMulti2Local(&sys, 0.0, 0.0, 0.0, d[0], d[1], d[2], order);
+
+      std::vector<double> dense(terms, 0.0), rotated(terms, 0.0);
+      for (int i = 0; i < terms; ++i) {
+        for (int j = 0; j < terms; ++j) {
+          dense[i] += mat[i][j] * multi[j];
+        }
+      }
+      rot.apply(multi.data(), rotated.data(), d[0], d[1], d[2]);
+
+      double norm = 0.0, error = 0.0;
+      for (int i = 0; i < terms; ++i) {
+        norm = std::max(norm, std::abs(dense[i]));
+        error = std::max(error, std::abs(rotated[i] - dense[i]));
+      }
+      EXPECT_LT(error, 1e-10 * norm) << "order " << order << ", translation " << t;
+
+    }
+
+  }
+}
+
+TEST(rotation, auto_type)
+{
+  EXPECT_FALSE(m2l_rotated(M2LDNS, MAXORDER));
+  EXPECT_TRUE(m2l_rotated(M2LROT, 1));
+  EXPECT_FALSE(m2l_rotated(M2LAUT, ROTORD - 1));
+  EXPECT_TRUE(m2l_rotated(M2LAUT, ROTORD));
+}